@@ -83,28 +83,37 @@ public struct Activity {
         }
     }
 
-    /// Executes a function `body` within the context of the activity.
-    public func execute<Return>(_ body: () throws -> Return) rethrows -> Return {
-        func impl(execute work: () throws -> Return, recover: (Error) throws -> Return) rethrows -> Return {
-            var result: Return!
-            var error: Error?
-
-            os_activity_apply(reference) {
-                do {
-                    result = try work()
-                } catch let e {
-                    error = e
-                }
-            }
-
-            if let e = error {
-                return try recover(e)
-            } else {
-                return result!
-            }
+    /// The activity in effect on the current thread between `enter()` and
+    /// `leave()`.
+    ///
+    /// Entering and leaving doesn't allocate. Scopes must be left in the
+    /// reverse order they were entered, on the thread that entered them.
+    public struct Scope {
+
+        fileprivate var state = os_activity_scope_state_s()
+
+        fileprivate init() {}
+
+        /// Restores the activity that was in effect before `enter()`.
+        public mutating func leave() {
+            os_activity_scope_leave(&state)
         }
 
-        return try impl(execute: body, recover: { throw $0 })
+    }
+
+    /// Makes the activity current on this thread until the returned scope is
+    /// left.
+    public func enter() -> Scope {
+        var scope = Scope()
+        os_activity_scope_enter(reference, &scope.state)
+        return scope
+    }
+
+    /// Executes a function `body` within the context of the activity.
+    public func execute<Return>(_ body: () throws -> Return) rethrows -> Return {
+        var scope = enter()
+        defer { scope.leave() }
+        return try body()
     }
 
     /// Executes a named group of code `body` under a `label`.
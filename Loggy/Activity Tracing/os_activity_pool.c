@@ -0,0 +1,357 @@
+//
+//  os_activity_pool.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_activity_pool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE   4096
+
+// MARK: - Tasks
+
+void loggy_os_activity_task_init(loggy_os_activity_task_t task, void *context, void (*fn)(void *context)) {
+    task->at_fn = fn;
+    task->at_context = context;
+    task->at_activity = 0;
+    task->at_parent = 0;
+#if LOGGY_HAS_OS_ACTIVITY
+    // With an activity present, this makes one with the same ID rather
+    // than a new one.
+    if (os_activity_get_identifier(OS_ACTIVITY_CURRENT, NULL)) {
+        task->at_activity = (uint64_t)(uintptr_t)os_activity_create("Task", OS_ACTIVITY_CURRENT, OS_ACTIVITY_FLAG_IF_NONE_PRESENT);
+    }
+#else
+    task->at_activity = os_activity_get_identifier(OS_ACTIVITY_CURRENT, &task->at_parent);
+#endif
+}
+
+void loggy_os_activity_task_run(const loggy_os_activity_task_s *task) {
+    struct os_activity_scope_state_s state;
+#if LOGGY_HAS_OS_ACTIVITY
+    os_activity_t activity = (os_activity_t)(uintptr_t)task->at_activity;
+    if (!activity) {
+        task->at_fn(task->at_context);
+        return;
+    }
+
+    os_activity_scope_enter(activity, &state);
+    task->at_fn(task->at_context);
+    os_activity_scope_leave(&state);
+    os_release(activity);
+#else
+    loggy_os_activity_scope_enter_id(task->at_activity, task->at_parent, &state);
+    task->at_fn(task->at_context);
+    os_activity_scope_leave(&state);
+#endif
+}
+
+// MARK: - Deques
+
+// A fixed-size Chase-Lev deque. The owner pushes and pops at the bottom;
+// thieves take from the top. Tasks are copied word by word with relaxed
+// atomics, and a steal only counts if its CAS on `wd_top` succeeds.
+typedef struct {
+    int64_t wd_top __attribute__((aligned(64)));
+    int64_t wd_bottom __attribute__((aligned(64)));
+    loggy_os_activity_task_s wd_tasks[LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE];
+} pool_deque_s, *pool_deque_t;
+
+static inline void task_store(loggy_os_activity_task_s *slot, const loggy_os_activity_task_s *task) {
+    __atomic_store_n(&slot->at_fn, task->at_fn, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->at_context, task->at_context, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->at_activity, task->at_activity, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->at_parent, task->at_parent, __ATOMIC_RELAXED);
+}
+
+static inline void task_load(loggy_os_activity_task_s *task, loggy_os_activity_task_s *slot) {
+    task->at_fn = __atomic_load_n(&slot->at_fn, __ATOMIC_RELAXED);
+    task->at_context = __atomic_load_n(&slot->at_context, __ATOMIC_RELAXED);
+    task->at_activity = __atomic_load_n(&slot->at_activity, __ATOMIC_RELAXED);
+    task->at_parent = __atomic_load_n(&slot->at_parent, __ATOMIC_RELAXED);
+}
+
+static bool deque_push(pool_deque_t deque, const loggy_os_activity_task_s *task) {
+    int64_t bottom = __atomic_load_n(&deque->wd_bottom, __ATOMIC_RELAXED);
+    int64_t top = __atomic_load_n(&deque->wd_top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE) {
+        return false;
+    }
+
+    task_store(&deque->wd_tasks[bottom & (LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE - 1)], task);
+    __atomic_store_n(&deque->wd_bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool deque_pop(pool_deque_t deque, loggy_os_activity_task_s *task) {
+    int64_t bottom = __atomic_load_n(&deque->wd_bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->wd_bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t top = __atomic_load_n(&deque->wd_top, __ATOMIC_RELAXED);
+
+    if (top > bottom) {
+        __atomic_store_n(&deque->wd_bottom, bottom + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    task_load(task, &deque->wd_tasks[bottom & (LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE - 1)]);
+    if (top < bottom) {
+        return true;
+    }
+
+    // The last task; race thieves for it.
+    bool won = __atomic_compare_exchange_n(&deque->wd_top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->wd_bottom, bottom + 1, __ATOMIC_RELAXED);
+    return won;
+}
+
+static bool deque_steal(pool_deque_t deque, loggy_os_activity_task_s *task) {
+    int64_t top = __atomic_load_n(&deque->wd_top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t bottom = __atomic_load_n(&deque->wd_bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return false;
+    }
+
+    task_load(task, &deque->wd_tasks[top & (LOGGY_OS_ACTIVITY_POOL_DEQUE_SIZE - 1)]);
+    return __atomic_compare_exchange_n(&deque->wd_top, &top, top + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+static bool deque_empty(pool_deque_t deque) {
+    return __atomic_load_n(&deque->wd_top, __ATOMIC_ACQUIRE) >= __atomic_load_n(&deque->wd_bottom, __ATOMIC_ACQUIRE);
+}
+
+// MARK: - Pool
+
+typedef struct {
+    pool_deque_s pw_deque;
+    loggy_os_activity_pool_t pw_pool;
+    pthread_t pw_thread;
+    size_t pw_index;
+} pool_worker_s, *pool_worker_t;
+
+struct loggy_os_activity_pool_s {
+    pthread_mutex_t pp_lock;
+    pthread_cond_t pp_work;
+    pthread_cond_t pp_idle;
+
+    // Work submitted from outside the pool. Guarded by `pp_lock`.
+    loggy_os_activity_task_s *pp_queue;
+    size_t pp_queue_head;
+    size_t pp_queue_cnt;
+    size_t pp_queue_cap;
+
+    uint64_t pp_pending;
+    uint32_t pp_sleepers;
+    bool pp_stopping;
+
+    size_t pp_width;
+    pool_worker_t pp_workers;
+};
+
+static __thread pool_worker_t pool_current_worker;
+
+static bool pool_queue_push(loggy_os_activity_pool_t pool, const loggy_os_activity_task_s *task) {
+    if (pool->pp_queue_cnt == pool->pp_queue_cap) {
+        size_t cap = pool->pp_queue_cap ? pool->pp_queue_cap * 2 : 64;
+        loggy_os_activity_task_s *queue = malloc(cap * sizeof(loggy_os_activity_task_s));
+        if (!queue) {
+            return false;
+        }
+
+        for (size_t i = 0; i < pool->pp_queue_cnt; i++) {
+            queue[i] = pool->pp_queue[(pool->pp_queue_head + i) % pool->pp_queue_cap];
+        }
+        free(pool->pp_queue);
+        pool->pp_queue = queue;
+        pool->pp_queue_head = 0;
+        pool->pp_queue_cap = cap;
+    }
+
+    pool->pp_queue[(pool->pp_queue_head + pool->pp_queue_cnt) % pool->pp_queue_cap] = *task;
+    pool->pp_queue_cnt += 1;
+    return true;
+}
+
+static bool pool_queue_pop(loggy_os_activity_pool_t pool, loggy_os_activity_task_s *task) {
+    if (!pool->pp_queue_cnt) {
+        return false;
+    }
+
+    *task = pool->pp_queue[pool->pp_queue_head];
+    pool->pp_queue_head = (pool->pp_queue_head + 1) % pool->pp_queue_cap;
+    pool->pp_queue_cnt -= 1;
+    return true;
+}
+
+static bool pool_find(pool_worker_t worker, loggy_os_activity_task_s *task) {
+    loggy_os_activity_pool_t pool = worker->pw_pool;
+    if (deque_pop(&worker->pw_deque, task)) {
+        return true;
+    }
+
+    for (size_t i = 1; i < pool->pp_width; i++) {
+        pool_worker_t victim = &pool->pp_workers[(worker->pw_index + i) % pool->pp_width];
+        if (deque_steal(&victim->pw_deque, task)) {
+            return true;
+        }
+    }
+
+    pthread_mutex_lock(&pool->pp_lock);
+    bool found = pool_queue_pop(pool, task);
+    pthread_mutex_unlock(&pool->pp_lock);
+    return found;
+}
+
+static bool pool_has_work(loggy_os_activity_pool_t pool) {
+    if (pool->pp_queue_cnt) {
+        return true;
+    }
+
+    for (size_t i = 0; i < pool->pp_width; i++) {
+        if (!deque_empty(&pool->pp_workers[i].pw_deque)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pool_finished(loggy_os_activity_pool_t pool) {
+    if (__atomic_sub_fetch(&pool->pp_pending, 1, __ATOMIC_ACQ_REL) == 0) {
+        pthread_mutex_lock(&pool->pp_lock);
+        pthread_cond_broadcast(&pool->pp_idle);
+        pthread_mutex_unlock(&pool->pp_lock);
+    }
+}
+
+static void *pool_worker_main(void *context) {
+    pool_worker_t worker = context;
+    loggy_os_activity_pool_t pool = worker->pw_pool;
+    pool_current_worker = worker;
+
+    for (;;) {
+        loggy_os_activity_task_s task;
+        if (pool_find(worker, &task)) {
+            loggy_os_activity_task_run(&task);
+            pool_finished(pool);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->pp_lock);
+        __atomic_add_fetch(&pool->pp_sleepers, 1, __ATOMIC_SEQ_CST);
+        // Rechecked after announcing ourselves, so a submitter either sees
+        // the sleeper or we see its work.
+        while (!pool->pp_stopping && !pool_has_work(pool)) {
+            pthread_cond_wait(&pool->pp_work, &pool->pp_lock);
+        }
+        __atomic_sub_fetch(&pool->pp_sleepers, 1, __ATOMIC_SEQ_CST);
+        bool stopping = pool->pp_stopping && !pool_has_work(pool);
+        pthread_mutex_unlock(&pool->pp_lock);
+
+        if (stopping) {
+            return NULL;
+        }
+    }
+}
+
+// Stops and joins the first `started` workers.
+static void pool_stop(loggy_os_activity_pool_t pool, size_t started) {
+    pthread_mutex_lock(&pool->pp_lock);
+    pool->pp_stopping = true;
+    pthread_cond_broadcast(&pool->pp_work);
+    pthread_mutex_unlock(&pool->pp_lock);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(pool->pp_workers[i].pw_thread, NULL);
+    }
+}
+
+static void pool_free(loggy_os_activity_pool_t pool) {
+    pthread_cond_destroy(&pool->pp_idle);
+    pthread_cond_destroy(&pool->pp_work);
+    pthread_mutex_destroy(&pool->pp_lock);
+    free(pool->pp_queue);
+    free(pool->pp_workers);
+    free(pool);
+}
+
+loggy_os_activity_pool_t loggy_os_activity_pool_create(size_t width) {
+    if (!width) {
+        return NULL;
+    }
+
+    loggy_os_activity_pool_t pool = calloc(1, sizeof(struct loggy_os_activity_pool_s));
+    pool_worker_t workers = NULL;
+    if (!pool || posix_memalign((void **)&workers, 64, width * sizeof(pool_worker_s)) != 0) {
+        free(pool);
+        return NULL;
+    }
+
+    memset(workers, 0, width * sizeof(pool_worker_s));
+    pthread_mutex_init(&pool->pp_lock, NULL);
+    pthread_cond_init(&pool->pp_work, NULL);
+    pthread_cond_init(&pool->pp_idle, NULL);
+    pool->pp_workers = workers;
+
+    // Workers steal across the whole width, so it's set before any start
+    // and never changes after.
+    pool->pp_width = width;
+    for (size_t i = 0; i < width; i++) {
+        workers[i].pw_pool = pool;
+        workers[i].pw_index = i;
+    }
+
+    for (size_t i = 0; i < width; i++) {
+        if (pthread_create(&workers[i].pw_thread, NULL, pool_worker_main, &workers[i]) != 0) {
+            pool_stop(pool, i);
+            pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void loggy_os_activity_pool_async(loggy_os_activity_pool_t pool, void *context, void (*fn)(void *context)) {
+    loggy_os_activity_task_s task;
+    loggy_os_activity_task_init(&task, context, fn);
+    __atomic_add_fetch(&pool->pp_pending, 1, __ATOMIC_RELAXED);
+
+    pool_worker_t worker = pool_current_worker;
+    if (worker && worker->pw_pool == pool && deque_push(&worker->pw_deque, &task)) {
+        if (__atomic_load_n(&pool->pp_sleepers, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&pool->pp_lock);
+            pthread_cond_signal(&pool->pp_work);
+            pthread_mutex_unlock(&pool->pp_lock);
+        }
+        return;
+    }
+
+    pthread_mutex_lock(&pool->pp_lock);
+    bool queued = pool_queue_push(pool, &task);
+    pthread_cond_signal(&pool->pp_work);
+    pthread_mutex_unlock(&pool->pp_lock);
+
+    // Out of memory; run it here rather than lose it.
+    if (!queued) {
+        loggy_os_activity_task_run(&task);
+        pool_finished(pool);
+    }
+}
+
+void loggy_os_activity_pool_wait(loggy_os_activity_pool_t pool) {
+    pthread_mutex_lock(&pool->pp_lock);
+    while (__atomic_load_n(&pool->pp_pending, __ATOMIC_ACQUIRE)) {
+        pthread_cond_wait(&pool->pp_idle, &pool->pp_lock);
+    }
+    pthread_mutex_unlock(&pool->pp_lock);
+}
+
+void loggy_os_activity_pool_destroy(loggy_os_activity_pool_t pool) {
+    loggy_os_activity_pool_wait(pool);
+    pool_stop(pool, pool->pp_width);
+    pool_free(pool);
+}
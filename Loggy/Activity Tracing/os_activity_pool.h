@@ -0,0 +1,64 @@
+//
+//  os_activity_pool.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_activity_pool_h__
+#define __loggy_os_activity_pool_h__
+
+#include "os_activity_shims.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// A unit of work that carries the activity it was submitted under.
+///
+/// Use with any executor: `loggy_os_activity_task_init` where work is
+/// submitted, `loggy_os_activity_task_run` where it runs. On Linux, the
+/// activity costs two words per task, copied; on Darwin, see below.
+typedef struct {
+    void (*at_fn)(void *_Nullable context);
+    void *_Nullable at_context;
+    uint64_t at_activity;
+    uint64_t at_parent;
+} loggy_os_activity_task_s, *loggy_os_activity_task_t;
+
+/// Captures the current activity along with `fn`.
+///
+/// On Linux, that's the activity's ID and its parent's. Darwin has no public
+/// way to re-enter an activity by its ID, so there the task holds an
+/// activity sharing the current one's ID, which running it releases: while
+/// an activity is current, each task allocates one and frees it.
+OS_EXPORT
+void loggy_os_activity_task_init(loggy_os_activity_task_t task, void *_Nullable context, void (*fn)(void *_Nullable context));
+
+/// Runs the task with its captured activity current, then restores the
+/// previous one. Run each task exactly once.
+OS_EXPORT
+void loggy_os_activity_task_run(const loggy_os_activity_task_s *task);
+
+/// A fixed set of worker threads. Each worker keeps a deque of the work it
+/// submits, which other workers steal from when idle; work submitted from
+/// elsewhere goes through a shared queue.
+typedef struct loggy_os_activity_pool_s *loggy_os_activity_pool_t;
+
+/// Starts `width` workers. Returns `NULL` if they couldn't be started.
+OS_EXPORT
+loggy_os_activity_pool_t _Nullable loggy_os_activity_pool_create(size_t width);
+
+/// Runs `fn` on the pool under the current activity.
+OS_EXPORT
+void loggy_os_activity_pool_async(loggy_os_activity_pool_t pool, void *_Nullable context, void (*fn)(void *_Nullable context));
+
+/// Waits until all work submitted so far, and any it submits, has run.
+OS_EXPORT
+void loggy_os_activity_pool_wait(loggy_os_activity_pool_t pool);
+
+/// Waits for outstanding work, then stops the workers and frees the pool.
+OS_EXPORT
+void loggy_os_activity_pool_destroy(loggy_os_activity_pool_t pool);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_activity_pool_h__ */
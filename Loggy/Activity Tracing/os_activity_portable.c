@@ -0,0 +1,102 @@
+//
+//  os_activity_portable.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_activity_shims.h"
+
+#if !LOGGY_HAS_OS_ACTIVITY
+
+#include <stdlib.h>
+
+struct loggy_os_activity_s _os_activity_none;
+struct loggy_os_activity_s _os_activity_current;
+
+static uint64_t activity_next_id;
+static __thread os_activity_id_t activity_current_id;
+static __thread os_activity_id_t activity_current_parent;
+
+os_activity_id_t loggy_os_activity_current_id(void) {
+    return activity_current_id;
+}
+
+os_activity_t _os_activity_create(void *dso, const char *description, os_activity_t parent, os_activity_flag_t flags) {
+    (void)dso;
+    os_activity_t activity = calloc(1, sizeof(struct loggy_os_activity_s));
+    if (!activity) {
+        return OS_ACTIVITY_NONE;
+    }
+
+    os_activity_id_t parent_id = parent == OS_ACTIVITY_CURRENT ? activity_current_id : parent->ac_id;
+    if ((flags & OS_ACTIVITY_FLAG_IF_NONE_PRESENT) && activity_current_id) {
+        activity->ac_id = activity_current_id;
+        activity->ac_parent = activity_current_parent;
+    } else {
+        activity->ac_id = __atomic_add_fetch(&activity_next_id, 1, __ATOMIC_RELAXED);
+        activity->ac_parent = (flags & OS_ACTIVITY_FLAG_DETACHED) ? 0 : parent_id;
+    }
+
+    activity->ac_description = description;
+    activity->ac_refcount = 1;
+    return activity;
+}
+
+// The static activities aren't counted.
+os_activity_t loggy_os_activity_retain(os_activity_t activity) {
+    if (activity != OS_ACTIVITY_NONE && activity != OS_ACTIVITY_CURRENT) {
+        __atomic_fetch_add(&activity->ac_refcount, 1, __ATOMIC_RELAXED);
+    }
+    return activity;
+}
+
+void loggy_os_activity_release(os_activity_t activity) {
+    if (activity == OS_ACTIVITY_NONE || activity == OS_ACTIVITY_CURRENT) {
+        return;
+    }
+    if (__atomic_sub_fetch(&activity->ac_refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(activity);
+    }
+}
+
+void _os_activity_label_useraction(void *dso, const char *name) {
+    (void)dso;
+    (void)name;
+}
+
+void loggy_os_activity_scope_enter_id(os_activity_id_t activity_id, os_activity_id_t parent_id, os_activity_scope_state_t state) {
+    state->opaque[0] = activity_current_id;
+    state->opaque[1] = activity_current_parent;
+    activity_current_id = activity_id;
+    activity_current_parent = parent_id;
+}
+
+void os_activity_scope_enter(os_activity_t activity, os_activity_scope_state_t state) {
+    if (activity == OS_ACTIVITY_CURRENT) {
+        loggy_os_activity_scope_enter_id(activity_current_id, activity_current_parent, state);
+    } else {
+        loggy_os_activity_scope_enter_id(activity->ac_id, activity->ac_parent, state);
+    }
+}
+
+void os_activity_scope_leave(os_activity_scope_state_t state) {
+    activity_current_id = state->opaque[0];
+    activity_current_parent = state->opaque[1];
+}
+
+os_activity_id_t os_activity_get_identifier(os_activity_t activity, os_activity_id_t *parent_id) {
+    if (activity == OS_ACTIVITY_CURRENT) {
+        if (parent_id) {
+            *parent_id = activity_current_parent;
+        }
+        return activity_current_id;
+    }
+
+    if (parent_id) {
+        *parent_id = activity->ac_parent;
+    }
+    return activity->ac_id;
+}
+
+#endif
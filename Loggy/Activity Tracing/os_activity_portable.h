@@ -0,0 +1,82 @@
+//
+//  os_activity_portable.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_activity_portable_h__
+#define __loggy_os_activity_portable_h__
+
+// Stand-ins for the parts of <os/activity.h> the shims rely on, for
+// platforms (i.e., Linux) without activity tracing. The activity stack is
+// per thread, and scopes chain through their state, so entering and leaving
+// never allocates.
+
+#include "os_log_portable.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+typedef uint64_t os_activity_id_t;
+
+OS_ENUM(os_activity_flag, uint32_t,
+    OS_ACTIVITY_FLAG_DEFAULT = 0,
+    OS_ACTIVITY_FLAG_DETACHED = 0x1,
+    OS_ACTIVITY_FLAG_IF_NONE_PRESENT = 0x2,
+);
+
+/// An activity. Unlike Darwin, activities are plain structs owned by Loggy.
+typedef struct loggy_os_activity_s {
+    os_activity_id_t ac_id;
+    os_activity_id_t ac_parent;
+    const char *_Nullable ac_description;
+    uint32_t ac_refcount;
+} *os_activity_t;
+
+OS_EXPORT struct loggy_os_activity_s _os_activity_none;
+OS_EXPORT struct loggy_os_activity_s _os_activity_current;
+
+#define OS_ACTIVITY_NONE    (&_os_activity_none)
+#define OS_ACTIVITY_CURRENT (&_os_activity_current)
+
+typedef struct os_activity_scope_state_s {
+    uint64_t opaque[2];
+} *os_activity_scope_state_t;
+
+/// Creates an activity, which the caller owns a reference to. As on Darwin,
+/// `description` must be a constant string; it isn't copied.
+OS_EXPORT
+os_activity_t _os_activity_create(void *dso, const char *_Nullable description, os_activity_t parent, os_activity_flag_t flags);
+
+/// Takes another reference to `activity`, like `os_retain` on Darwin.
+OS_EXPORT
+os_activity_t loggy_os_activity_retain(os_activity_t activity);
+
+/// Drops a reference to `activity`, like `os_release` on Darwin, freeing it
+/// with the last one. Scopes entered with it don't hold a reference.
+OS_EXPORT
+void loggy_os_activity_release(os_activity_t activity);
+
+/// Does nothing; there is no UI to label.
+OS_EXPORT
+void _os_activity_label_useraction(void *dso, const char *_Nullable name);
+
+/// Makes `activity` current on this thread until the matching
+/// `os_activity_scope_leave`. Scopes must be left in reverse order.
+OS_EXPORT
+void os_activity_scope_enter(os_activity_t activity, os_activity_scope_state_t state);
+
+OS_EXPORT
+void os_activity_scope_leave(os_activity_scope_state_t state);
+
+/// Like `os_activity_scope_enter`, for an activity known only by its ID,
+/// such as one captured on another thread.
+OS_EXPORT
+void loggy_os_activity_scope_enter_id(os_activity_id_t activity_id, os_activity_id_t parent_id, os_activity_scope_state_t state);
+
+OS_EXPORT
+os_activity_id_t os_activity_get_identifier(os_activity_t activity, os_activity_id_t *_Nullable parent_id);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_activity_portable_h__ */
@@ -13,7 +13,13 @@
 #ifndef __loggy_os_activity_shims_h__
 #define __loggy_os_activity_shims_h__
 
+#if __has_include(<os/activity.h>)
+#define LOGGY_HAS_OS_ACTIVITY 1
 #import <os/activity.h>
+#else
+#define LOGGY_HAS_OS_ACTIVITY 0
+#include "os_activity_portable.h"
+#endif
 
 OS_ASSUME_NONNULL_BEGIN
 
@@ -37,6 +43,12 @@ void loggy_os_activity_label_useraction(const void *dso, const uint8_t *_Nullabl
     _os_activity_label_useraction((void *)dso, (const char *)name);
 }
 
+#if !LOGGY_HAS_OS_ACTIVITY
+/// The activity current on this thread, as stamped on log records.
+OS_EXPORT
+os_activity_id_t loggy_os_activity_current_id(void);
+#endif
+
 OS_ASSUME_NONNULL_END
 
 #endif /* __loggy_os_activity_shims_h__ */
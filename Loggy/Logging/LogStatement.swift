@@ -39,8 +39,12 @@ public struct LogStatement {
         case float(Float)
         case double(Double)
         case string(String)
+        case data(Data)
+        case bytes(UnsafeRawBufferPointer)
         case object(Unmanaged<AnyObject>)
-        case multiple([Variant])
+        /// The segments of an interpolation, exactly as the compiler passed
+        /// them. A `.string` at an even position is literal text.
+        case interpolation([LogStatement])
     }
 
     let variant: Variant
@@ -66,18 +70,9 @@ extension LogStatement: _ExpressibleByStringInterpolation {
         if let variant = statements.first?.variant, statements.dropFirst().isEmpty {
             self.variant = variant
         } else {
-            var segments = [Variant]()
-            for (i, substring) in statements.enumerated() {
-                switch substring.variant {
-                case .string(let value) where i % 2 == 0:
-                    segments.append(.literal(value))
-                case .multiple(let others):
-                    segments.append(contentsOf: others)
-                case let other:
-                    segments.append(other)
-                }
-            }
-            self.variant = .multiple(segments)
+            // Keep the compiler's array rather than flattening it into a new
+            // one; nested statements are walked in place.
+            self.variant = .interpolation(statements)
         }
     }
 
@@ -207,6 +202,31 @@ extension LogStatement: _ExpressibleByStringInterpolation {
         variant = .string(expression)
     }
 
+    /// Creates a log statement for printing the contents of the given
+    /// `expression` as hex.
+    ///
+    /// The bytes are copied into the log message as-is, and only formatted
+    /// when the message is read.
+    ///
+    /// Do not call this initializer directly. It is used by the compiler when
+    /// interpreting string interpolations.
+    public init(stringInterpolationSegment expression: Data) {
+        variant = .data(expression)
+    }
+
+    /// Creates a log statement for printing the contents of the given
+    /// `expression` as hex.
+    ///
+    /// The bytes are copied into the log message as-is, and only formatted
+    /// when the message is read. They need only remain valid while the log
+    /// method is running.
+    ///
+    /// Do not call this initializer directly. It is used by the compiler when
+    /// interpreting string interpolations.
+    public init(stringInterpolationSegment expression: UnsafeRawBufferPointer) {
+        variant = .bytes(expression)
+    }
+
     /// Creates a log statement for printing the contents of the given
     /// `expression`.
     ///
@@ -284,65 +304,116 @@ extension LogStatement {
 
 }
 
+extension LogStatement.Variant {
+
+    /// Calls `body` with each segment in order, descending into nested
+    /// interpolations without copying them. `body` never sees
+    /// `.interpolation`.
+    func forEachSegment(_ body: (LogStatement.Variant) throws -> Void) rethrows {
+        guard case .interpolation(let statements) = self else {
+            return try body(self)
+        }
+
+        for (i, statement) in statements.enumerated() {
+            switch statement.variant {
+            case .string(let value) where i % 2 == 0:
+                try body(.literal(value))
+            case let other:
+                try other.forEachSegment(body)
+            }
+        }
+    }
+
+}
+
+private extension Array where Element == UInt8 {
+
+    mutating func appendDecimal(_ value: UInt64, negative: Bool = false) {
+        if negative {
+            append(UInt8(ascii: "-"))
+        }
+
+        let start = endIndex
+        var value = value
+        repeat {
+            append(UInt8(ascii: "0") + UInt8(truncatingIfNeeded: value % 10))
+            value /= 10
+        } while value != 0
+        self[start...].reverse()
+    }
+
+    mutating func appendDecimal(_ value: Int64) {
+        appendDecimal(value.magnitude, negative: value < 0)
+    }
+
+    mutating func appendDecimal(_ value: Double, precision: Int32) {
+        // Enough for any `%.*g` up to `DBL_DIG`.
+        let room = 32
+        let start = endIndex
+        append(contentsOf: repeatElement(0, count: room))
+        let length = withUnsafeMutableBufferPointer { (buffer) -> Int in
+            let out = UnsafeMutableRawPointer(buffer.baseAddress! + start).assumingMemoryBound(to: CChar.self)
+            return loggy_os_log_render_double(value, precision, out, room)
+        }
+        removeLast(room - length)
+    }
+
+    mutating func appendHex(_ bytes: UnsafeRawBufferPointer) {
+        let digits: StaticString = "0123456789abcdef"
+        reserveCapacity(count + bytes.count * 2)
+        for byte in bytes {
+            append(digits.utf8Start[Int(byte >> 4)])
+            append(digits.utf8Start[Int(byte & 0xf)])
+        }
+    }
+
+}
+
 private extension LogStatement.Variant {
 
-    func write(formatTo format: inout String, argumentsTo arguments: inout [CVarArg]) {
+    /// Writes the statement as UTF-8 the way `String(format:)` would have,
+    /// without building a format or boxing arguments.
+    func render(into buffer: inout [UInt8]) {
         switch self {
-        case .literal(let value):
-            format.append(value.replacingOccurrences(of: "%", with: "%%"))
-        case .bool(false):
-            format.append("%@")
-            arguments.append("false")
-        case .bool(true):
-            format.append("%@")
-            arguments.append("true")
+        case .literal(let value), .string(let value):
+            buffer.append(contentsOf: value.utf8)
+        case .bool(let value):
+            buffer.append(contentsOf: (value ? "true" : "false").utf8)
         case .int8(let value):
-            format.append("%hhd")
-            arguments.append(value)
+            buffer.appendDecimal(Int64(value))
         case .uint8(let value):
-            format.append("%hhu")
-            arguments.append(value)
+            buffer.appendDecimal(UInt64(value))
         case .int16(let value):
-            format.append("%hd")
-            arguments.append(value)
+            buffer.appendDecimal(Int64(value))
         case .uint16(let value):
-            format.append("%hu")
-            arguments.append(value)
+            buffer.appendDecimal(UInt64(value))
         case .int32(let value):
-            format.append("%d")
-            arguments.append(value)
+            buffer.appendDecimal(Int64(value))
         case .uint32(let value):
-            format.append("%u")
-            arguments.append(value)
+            buffer.appendDecimal(UInt64(value))
         case .int64(let value):
-            format.append("%lld")
-            arguments.append(value)
+            buffer.appendDecimal(value)
         case .uint64(let value):
-            format.append("%llu")
-            arguments.append(value)
+            buffer.appendDecimal(value)
         case .int(let value):
-            format.append("%zd")
-            arguments.append(value)
+            buffer.appendDecimal(Int64(value))
         case .uint(let value):
-            format.append("%zu")
-            arguments.append(value)
+            buffer.appendDecimal(UInt64(value))
         case .float(let value):
-            format.append("%.*g")
-            arguments.append(FLT_DIG)
-            arguments.append(value)
+            buffer.appendDecimal(Double(value), precision: FLT_DIG)
         case .double(let value):
-            format.append("%.*g")
-            arguments.append(DBL_DIG)
-            arguments.append(value)
-        case .string(let string):
-            format.append("%@")
-            arguments.append(string)
+            buffer.appendDecimal(value, precision: DBL_DIG)
+        case .data(let data):
+            data.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) in
+                buffer.appendHex(UnsafeRawBufferPointer(start: bytes, count: data.count))
+            }
+        case .bytes(let bytes):
+            buffer.appendHex(bytes)
         case .object(let object):
-            format.append("%@")
-            arguments.append(OpaquePointer(object.toOpaque()))
-        case .multiple(let others):
-            for other in others {
-                other.write(formatTo: &format, argumentsTo: &arguments)
+            buffer.append(contentsOf: String(describing: object.takeUnretainedValue()).utf8)
+        case .interpolation:
+            forEachSegment { (other) in
+                other.render(into: &buffer)
             }
         }
     }
@@ -352,10 +423,10 @@ private extension LogStatement.Variant {
 extension LogStatement: CustomStringConvertible {
 
     public var description: String {
-        var format = ""
-        var arguments = [CVarArg]()
-        variant.write(formatTo: &format, argumentsTo: &arguments)
-        return String(format: format, arguments: arguments)
+        var buffer = [UInt8]()
+        buffer.reserveCapacity(128)
+        variant.render(into: &buffer)
+        return String(decoding: buffer, as: UTF8.self)
     }
 
 }
@@ -10,28 +10,26 @@ import Foundation
 
 private extension Bundle {
 
-    static let cache = NSCache<NSValue, Bundle>()
-
-    static func containing(_ dso: UnsafeRawPointer) -> Bundle {
-        let cacheKey = NSValue(pointer: dso)
-        if let bundle = cache.object(forKey: cacheKey) {
-            return bundle
+    static func subsystem(containing dso: UnsafeRawPointer) -> String {
+        if let subsystem = loggy_os_log_image_subsystem(dso) {
+            return String(cString: subsystem)
         }
 
-        var info = Dl_info()
-        guard dladdr(dso, &info) != 0 else { return .main }
+        guard let path = loggy_os_log_image_path(dso) else { return main.bundleIdentifier ?? "" }
 
-        var url = URL(fileURLWithFileSystemRepresentation: info.dli_fname, isDirectory: false, relativeTo: nil)
+        var url = URL(fileURLWithFileSystemRepresentation: path, isDirectory: false, relativeTo: nil)
+        var bundle = main
 
         for _ in 0 ..< 3 {
             url.deleteLastPathComponent()
 
-            guard let bundle = Bundle(url: url) else { continue }
-            cache.setObject(bundle, forKey: cacheKey)
-            return bundle
+            guard let found = Bundle(url: url) else { continue }
+            bundle = found
+            break
         }
 
-        return .main
+        let subsystem = bundle.bundleIdentifier ?? ""
+        return loggy_os_log_image_set_subsystem(dso, subsystem).map { String(cString: $0) } ?? subsystem
     }
 
 }
@@ -43,8 +41,19 @@ extension OSLog {
     /// In standard `OSLog` parlance, the log's `subsystem` is synthesized from
     /// the calling code's bundle identifier, and `name` is the `category`.
     public convenience init(named name: String, containingBinary dso: UnsafeRawPointer = #dsohandle) {
-        let subsystem = Bundle.containing(dso).bundleIdentifier ?? ""
+        let subsystem = Bundle.subsystem(containing: dso)
         self.init(subsystem: subsystem, category: name)
     }
 
+    /// Returns the shared app-specific log named `name`.
+    ///
+    /// Like `init(named:containingBinary:)`, but repeated calls for the same
+    /// name from the same module return the same handle instead of
+    /// creating a new one each time. Prefer this when creating logs in
+    /// short-lived objects.
+    public static func named(_ name: String, containingBinary dso: UnsafeRawPointer = #dsohandle) -> OSLog {
+        let subsystem = Bundle.subsystem(containing: dso)
+        return loggy_os_log_intern(subsystem, name)
+    }
+
 }
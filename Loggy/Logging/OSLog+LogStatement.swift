@@ -8,83 +8,208 @@
 
 import Foundation
 
+private extension LogStatement.Variant {
+
+    func appendFormat(to format: inout String) {
+        switch self {
+        case .literal(let string):
+            format.append(string.replacingOccurrences(of: "%", with: "%%"))
+        case .bool:
+            format.append("%{bool}d")
+        case .int8:
+            format.append("%hhd")
+        case .uint8:
+            format.append("%hhu")
+        case .int16:
+            format.append("%hd")
+        case .uint16:
+            format.append("%hu")
+        case .int32:
+            format.append("%d")
+        case .uint32:
+            format.append("%u")
+        case .int64:
+            format.append("%lld")
+        case .uint64:
+            format.append("%llu")
+        case .int:
+            format.append("%zd")
+        case .uint:
+            format.append("%zu")
+        case .float, .double:
+            format.append("%.*g")
+        case .string:
+            format.append("%s")
+        case .data, .bytes:
+            format.append("%.*P")
+        case .object:
+            format.append("%@")
+        case .interpolation:
+            forEachSegment { (other) in
+                other.appendFormat(to: &format)
+            }
+        }
+    }
+
+    /// Mixes the kind of each segment, and the text of any literal, into
+    /// `shape`. With the return address, this identifies the format a call
+    /// site produces without building it.
+    func combineShape(into shape: inout UInt64) {
+        let tag: UInt64
+        switch self {
+        case .literal(let string):
+            // The text itself, not just its length: one call site can pass
+            // different literals, as in `ready ? "idle \(n)" : "busy \(n)"`.
+            var length = UInt64(0)
+            for byte in string.utf8 {
+                shape = (shape ^ UInt64(byte)) &* 0x100000001b3
+                length += 1
+            }
+            tag = 1 | length << 8
+        case .bool:
+            tag = 2
+        case .int8:
+            tag = 3
+        case .uint8:
+            tag = 4
+        case .int16:
+            tag = 5
+        case .uint16:
+            tag = 6
+        case .int32:
+            tag = 7
+        case .uint32:
+            tag = 8
+        case .int64:
+            tag = 9
+        case .uint64:
+            tag = 10
+        case .int:
+            tag = 11
+        case .uint:
+            tag = 12
+        case .float:
+            tag = 13
+        case .double:
+            tag = 14
+        case .string:
+            tag = 15
+        case .data, .bytes:
+            tag = 16
+        case .object:
+            tag = 17
+        case .interpolation:
+            forEachSegment { (other) in
+                other.combineShape(into: &shape)
+            }
+            return
+        }
+
+        // FNV-1a
+        shape = (shape ^ tag) &* 0x100000001b3
+    }
+
+}
+
 extension LogStatementEncoder {
 
-    mutating func append(_ statement: LogStatement.Variant, appendingToFormat format: inout String) {
+    mutating func append(_ statement: LogStatement.Variant) {
         switch statement {
-        case .literal(let string):
-            format.append(string)
+        case .literal:
+            break
         case .bool(let value):
-            format.append("%{bool}d")
             append(Int32(value ? 1 : 0))
         case .int8(let value):
-            format.append("%hhd")
             append(Int32(value))
         case .uint8(let value):
-            format.append("%hhu")
             append(Int32(value))
         case .int16(let value):
-            format.append("%hd")
             append(Int32(value))
         case .uint16(let value):
-            format.append("%hu")
             append(Int32(value))
         case .int32(let value):
-            format.append("%d")
             append(value)
         case .uint32(let value):
-            format.append("%u")
             append(Int32(bitPattern: value))
         case .int64(let value):
-            format.append("%lld")
             append(value)
         case .uint64(let value):
-            format.append("%llu")
             append(Int64(bitPattern: value))
         case .int(let value):
-            format.append("%zd")
             append(value)
         case .uint(let value):
-            format.append("%zu")
             append(Int(bitPattern: value))
         case .float(let value):
-            format.append("%.*g")
             append(Double(value), precision: FLT_DIG)
         case .double(let value):
-            format.append("%.*g")
             append(value, precision: DBL_DIG)
         case .string(let value):
-            format.append("%@")
-            let object = Unmanaged.passRetained(value as NSString).autorelease()
-            append(object.toOpaque())
+            append(value)
+        case .data(let value):
+            value.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) in
+                append(bytes: bytes, count: value.count)
+            }
+        case .bytes(let buffer):
+            append(bytes: buffer.baseAddress, count: buffer.count)
         case .object(let object):
-            format.append("%@")
             append(object.toOpaque())
-        case .multiple(let others):
-            for other in others {
-                append(other, appendingToFormat: &format)
+        case .interpolation:
+            statement.forEachSegment { (other) in
+                append(other)
             }
         }
     }
 
-    mutating func send(format: String, to log: OSLog, at type: OSLogType, fromAddress ra: UnsafeRawPointer, containingBinary dso: UnsafeRawPointer) {
-        format.withCString { (formatPtr) in
-            __send(format: formatPtr, to: log, at: type, fromAddress: ra, containingBinary: dso)
+    /// Copies the UTF-8 of `string`, up to `maximumStringLength` bytes, into
+    /// the message itself, cutting it short on a scalar boundary if need be.
+    mutating func append(_ string: String) {
+        let utf8 = string.utf8
+        let length = Swift.min(utf8.count, LogStatementEncoder.maximumStringLength)
+
+        withUnsafeMutablePointer(to: &self) { (encoder) in
+            guard let buffer = __loggy_os_log_encoder_add_string(encoder, length) else { return }
+
+            var iterator = utf8.makeIterator()
+            var count = 0
+            var boundary = 0
+            while count < length, let byte = iterator.next() {
+                if byte & 0xC0 != 0x80 {
+                    boundary = count
+                }
+                buffer[count] = byte
+                count += 1
+            }
+
+            // Don't leave half a scalar behind when cutting the string short.
+            if let next = iterator.next(), next & 0xC0 == 0x80 {
+                count = boundary
+            }
+
+            (buffer + count).initialize(repeating: 0, count: length - count)
         }
     }
 
-    #if swift(>=4.1.50)
+    /// Encodes the arguments of `statement`, then calls `body` with its format.
+    ///
+    /// A call site produces only a few distinct formats, so each is built
+    /// the first time it's seen and interned by its shape; after that, only
+    /// the arguments are encoded.
+    mutating func encode(_ statement: LogStatement, callSite ra: UnsafeRawPointer, then body: (inout LogStatementEncoder, UnsafePointer<CChar>) -> Void) {
+        append(statement.variant)
 
-    @available(macOS 10.14, iOS 12.0, watchOS 5.0, tvOS 12.0, *)
-    mutating func send(format: String, to log: OSLog, for type: OSSignpostType, name: StaticString, id: OSSignpostID, fromAddress ra: UnsafeRawPointer, containingBinary dso: UnsafeRawPointer) {
-        format.withCString { (formatPtr) in
-            name.withUTF8Buffer { (nameBuffer) in
-                __send(format: formatPtr, to: log, for: type, name: nameBuffer.baseAddress, id: id.rawValue, fromAddress: ra, containingBinary: dso)
-            }
+        var shape: UInt64 = 0xcbf29ce484222325
+        statement.variant.combineShape(into: &shape)
+
+        if let format = LogStatementEncoder.cachedFormat(callSite: ra, shape: shape) {
+            return body(&self, format)
         }
-    }
 
-    #endif
+        var format = ""
+        statement.variant.appendFormat(to: &format)
+        format.withCString { (transient) in
+            body(&self, LogStatementEncoder.cacheFormat(transient, callSite: ra, shape: shape) ?? transient)
+        }
+    }
 
 }
 
@@ -94,19 +219,24 @@ extension OSLog {
     @discardableResult
     func show(_ type: OSLogType, makingStatementUsing makeStatement: () -> LogStatement, containingBinary dso: UnsafeRawPointer) -> LogStatement? {
         // If the log does not want the message, do not produce the log statement.
-        guard isEnabled(type: type) else { return nil }
+        guard LogStatementEncoder.isEnabled(self, type: type) else { return nil }
 
         // The instrumentation performed by os_log should not include this
         // function or any it calls in the course of building the log buffer.
         let retaddr = LogStatementEncoder.currentReturnAddress
 
+        // A call site over its rate limit is dropped before anything is built.
+        guard LogStatementEncoder.admit(callSite: retaddr, log: self, type: type, containingBinary: dso) else { return nil }
+
+        var encoder = LogStatementEncoder()
+
         // Now we're ready to build up the string literal.
         let statement = makeStatement()
 
-        var format = ""
-        var encoder = LogStatementEncoder()
-        encoder.append(statement.variant, appendingToFormat: &format)
-        encoder.send(format: format, to: self, at: type, fromAddress: retaddr, containingBinary: dso)
+        encoder.makeGrowable()
+        encoder.encode(statement, callSite: retaddr) { (encoder, format) in
+            encoder.__send(format: format, to: self, at: type, fromAddress: retaddr, containingBinary: dso)
+        }
 
         return statement
     }
@@ -276,7 +406,16 @@ extension OSLog {
     /// - https://developer.apple.com/videos/play/wwdc2018/405/
     @available(macOS 10.14, iOS 12.0, watchOS 5.0, tvOS 12.0, *)
     public func signpost(_ type: OSSignpostType, named name: StaticString, id signpostID: OSSignpostID = .exclusive, _ statement: @autoclosure() -> LogStatement = LogStatement(), containingBinary dso: UnsafeRawPointer = #dsohandle) {
-        guard signpostsEnabled, signpostID != .invalid, signpostID != .null else { return }
+        guard signpostID != .invalid, signpostID != .null else { return }
+
+        // Aggregated in process whether or not Instruments is recording. The
+        // pending intervals are keyed by the name's address, so a name that's
+        // a single scalar rather than a pointer to a literal isn't counted.
+        if name.hasPointerRepresentation {
+            loggy_os_signpost_stats_record(self, UnsafeRawPointer(name.utf8Start).assumingMemoryBound(to: CChar.self), signpostID.rawValue, loggy_os_signpost_phase_t(type.rawValue))
+        }
+
+        guard signpostsEnabled else { return }
 
         // The instrumentation performed by os_signpost should not include this
         // function or any it calls in the course of building the log buffer.
@@ -285,10 +424,13 @@ extension OSLog {
         // Now we're ready to build up the string literal.
         let statement = statement()
 
-        var format = ""
         var encoder = LogStatementEncoder()
-        encoder.append(statement.variant, appendingToFormat: &format)
-        encoder.send(format: format, to: self, for: type, name: name, id: signpostID, fromAddress: retaddr, containingBinary: dso)
+        encoder.makeGrowable()
+        encoder.encode(statement, callSite: retaddr) { (encoder, format) in
+            name.withUTF8Buffer { (nameBuffer) in
+                encoder.__send(format: format, to: self, for: type, name: nameBuffer.baseAddress, id: signpostID.rawValue, fromAddress: retaddr, containingBinary: dso)
+            }
+        }
     }
 
     /// Marks a point of interest for debugging performance in Instruments.
@@ -311,6 +453,20 @@ extension OSLog {
 
 }
 
+@available(macOS 10.14, iOS 12.0, watchOS 5.0, tvOS 12.0, *)
+extension OSSignpostID {
+
+    /// Makes an ID that is unique within the process, for concurrent
+    /// intervals not tied to an object.
+    ///
+    /// Unlike `init(log:)`, this doesn't call into the OS; each thread hands
+    /// out IDs from a block reserved for it.
+    public static func makeUnique() -> OSSignpostID {
+        return OSSignpostID(loggy_os_signpost_id_make())
+    }
+
+}
+
 #endif
 
 // MARK: - Conveniences
@@ -0,0 +1,301 @@
+//
+//  os_log_async.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_async.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define LOGGY_OS_LOG_ASYNC_RING_SIZE    (64 * 1024)
+#define LOGGY_OS_LOG_ASYNC_INTERVAL     1000000
+#define LOGGY_OS_LOG_ASYNC_LEVELS       5
+
+// One per sending thread. Only that thread appends and only the drain thread
+// reads, so the ring's writer CAS is never contended. `ar_sending` is set
+// while the thread is appending, so that a stop can wait for it.
+typedef struct async_ring_s {
+    struct async_ring_s *ar_next;
+    bool ar_closed;
+    bool ar_sending;
+    loggy_os_log_ring_s ar_ring;
+    uint64_t ar_storage[];
+} async_ring_s, *async_ring_t;
+
+static struct {
+    loggy_os_log_sink_s as_sink;
+    const loggy_os_log_sink_s *as_downstream;
+    loggy_os_log_async_config_s as_config;
+    async_ring_t as_rings;
+    pthread_t as_thread;
+    bool as_running;
+    bool as_stopping;
+    uint64_t as_dropped[LOGGY_OS_LOG_ASYNC_LEVELS];
+} async_state;
+
+static pthread_key_t async_ring_key;
+static pthread_once_t async_ring_once = PTHREAD_ONCE_INIT;
+static __thread async_ring_t async_ring_current;
+
+static size_t async_level(os_log_type_t type) {
+    switch (type) {
+    case OS_LOG_TYPE_DEBUG:
+        return 0;
+    case OS_LOG_TYPE_INFO:
+        return 1;
+    case OS_LOG_TYPE_ERROR:
+        return 3;
+    case OS_LOG_TYPE_FAULT:
+        return 4;
+    default:
+        return 2;
+    }
+}
+
+// MARK: - Rings
+
+// The thread is gone; the drain thread frees the ring once it's empty.
+static void async_ring_close(void *value) {
+    async_ring_t ar = value;
+    async_ring_current = NULL;
+    __atomic_store_n(&ar->ar_closed, true, __ATOMIC_RELEASE);
+}
+
+static void async_ring_init(void) {
+    pthread_key_create(&async_ring_key, async_ring_close);
+}
+
+// The key is only there to close the ring when the thread exits; lookups
+// go through `async_ring_current`.
+static async_ring_t _Nullable async_ring_get(void) {
+    async_ring_t ar = async_ring_current;
+    if (ar) {
+        return ar;
+    }
+
+    pthread_once(&async_ring_once, async_ring_init);
+    size_t size = async_state.as_config.la_ring_size;
+    if (!(ar = malloc(sizeof(async_ring_s) + size))) {
+        return NULL;
+    }
+
+    ar->ar_closed = false;
+    ar->ar_sending = false;
+    loggy_os_log_ring_init(&ar->ar_ring, ar->ar_storage, size);
+    ar->ar_ring.lrb_single_writer = true;
+
+    // Sequentially consistent so that a stop that misses this ring is sure
+    // to be seen by its first send; see `async_sink_send`.
+    ar->ar_next = __atomic_load_n(&async_state.as_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&async_state.as_rings, &ar->ar_next, ar, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {}
+
+    pthread_setspecific(async_ring_key, ar);
+    async_ring_current = ar;
+    return ar;
+}
+
+// Threads only ever push at the head, and only the drain thread unlinks, so
+// `ar` is always reachable from the head. Returns the link now holding the
+// ring that followed `ar`.
+static async_ring_t *async_ring_unlink(async_ring_t *link, async_ring_t ar) {
+    if (link == &async_state.as_rings) {
+        async_ring_t head = ar;
+        if (__atomic_compare_exchange_n(link, &head, ar->ar_next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return link;
+        }
+
+        for (link = &head->ar_next; *link != ar; link = &(*link)->ar_next) {}
+    }
+
+    *link = ar->ar_next;
+    return link;
+}
+
+// MARK: - Sending
+
+// A send that found the drain stopped or stopping, through a sink it loaded
+// before the stop. It waits for the stop's final drain, so that the thread's
+// earlier messages go first, then delivers directly.
+static void async_send_stopped(const loggy_os_log_record_s *record) {
+    while (__atomic_load_n(&async_state.as_stopping, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    const loggy_os_log_sink_s *downstream = async_state.as_downstream;
+    downstream->ls_send(downstream, record);
+}
+
+static bool async_append(async_ring_t ar, const loggy_os_log_record_s *record) {
+    if (loggy_os_log_ring_try_append(&ar->ar_ring, record)) {
+        return true;
+    }
+
+    if ((async_state.as_config.la_block_types & LOGGY_OS_LOG_ASYNC_BLOCK(record->lr_type))
+        && loggy_os_log_ring_entry_size(record) <= ar->ar_ring.lrb_mask + 1) {
+        while (__atomic_load_n(&async_state.as_running, __ATOMIC_RELAXED)) {
+            sched_yield();
+            if (loggy_os_log_ring_try_append(&ar->ar_ring, record)) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void async_sink_send(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    (void)sink;
+
+    async_ring_t ar = async_ring_get();
+    if (!ar) {
+        __atomic_fetch_add(&async_state.as_dropped[async_level(record->lr_type)], 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    // Marked before checking for a stop, and the stop checks the mark after
+    // announcing itself, so either the stop waits for this append or this
+    // send sees the stop.
+    __atomic_store_n(&ar->ar_sending, true, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&async_state.as_running, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&ar->ar_sending, false, __ATOMIC_RELEASE);
+        async_send_stopped(record);
+        return;
+    }
+
+    bool appended = async_append(ar, record);
+    __atomic_store_n(&ar->ar_sending, false, __ATOMIC_RELEASE);
+    if (!appended) {
+        __atomic_fetch_add(&async_state.as_dropped[async_level(record->lr_type)], 1, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t loggy_os_log_async_dropped(os_log_type_t type) {
+    return __atomic_load_n(&async_state.as_dropped[async_level(type)], __ATOMIC_RELAXED);
+}
+
+// MARK: - Draining
+
+static void async_deliver(void *context, const loggy_os_log_entry_s *entry) {
+    const loggy_os_log_sink_s *downstream = context;
+    loggy_os_log_record_s record = {
+        .lr_time = entry->le_time,
+        .lr_activity = entry->le_activity,
+        .lr_log = entry->le_log,
+        .lr_format = entry->le_format,
+        .lr_pc = entry->le_pc,
+        .lr_dso = entry->le_dso,
+        .lr_buf = entry->le_data,
+        .lr_len = entry->le_len,
+        .lr_truncated = entry->le_truncated,
+        .lr_type = entry->le_type,
+    };
+    downstream->ls_send(downstream, &record);
+}
+
+static size_t async_drain(void) {
+    size_t count = 0;
+    async_ring_t *link = &async_state.as_rings;
+    async_ring_t ar = __atomic_load_n(link, __ATOMIC_ACQUIRE);
+
+    while (ar) {
+        // Checked first: once closed, nothing more is appended, so the drain
+        // below empties the ring for good.
+        bool closed = __atomic_load_n(&ar->ar_closed, __ATOMIC_ACQUIRE);
+        count += loggy_os_log_ring_drain(&ar->ar_ring, async_deliver, (void *)async_state.as_downstream);
+
+        async_ring_t next = ar->ar_next;
+        if (closed) {
+            link = async_ring_unlink(link, ar);
+            free(ar);
+        } else {
+            link = &ar->ar_next;
+        }
+        ar = next;
+    }
+
+    return count;
+}
+
+static void *async_drain_main(void *unused) {
+    (void)unused;
+    uint64_t interval = async_state.as_config.la_interval;
+    struct timespec idle = {
+        .tv_sec = (time_t)(interval / 1000000000),
+        .tv_nsec = (long)(interval % 1000000000),
+    };
+
+    while (__atomic_load_n(&async_state.as_running, __ATOMIC_ACQUIRE)) {
+        if (!async_drain()) {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    return NULL;
+}
+
+bool loggy_os_log_async_start(const loggy_os_log_sink_s *sink, const loggy_os_log_async_config_s *config) {
+    if (__atomic_load_n(&async_state.as_running, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    loggy_os_log_async_config_s resolved = config ? *config : (loggy_os_log_async_config_s){ 0 };
+    if (!resolved.la_ring_size) {
+        resolved.la_ring_size = LOGGY_OS_LOG_ASYNC_RING_SIZE;
+    }
+    if (!resolved.la_interval) {
+        resolved.la_interval = LOGGY_OS_LOG_ASYNC_INTERVAL;
+    }
+    if (resolved.la_ring_size < 4096 || (resolved.la_ring_size & (resolved.la_ring_size - 1)) != 0) {
+        return false;
+    }
+
+    async_state.as_downstream = sink;
+    async_state.as_config = resolved;
+    async_state.as_sink = (loggy_os_log_sink_s){
+        .ls_send = async_sink_send,
+        .ls_flags = sink->ls_flags & LOGGY_OS_LOG_SINK_FLAG_OVERSIZE,
+    };
+
+    __atomic_store_n(&async_state.as_running, true, __ATOMIC_RELEASE);
+    if (pthread_create(&async_state.as_thread, NULL, async_drain_main, NULL) != 0) {
+        __atomic_store_n(&async_state.as_running, false, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    loggy_os_log_set_sink(&async_state.as_sink);
+    return true;
+}
+
+void loggy_os_log_async_stop(void) {
+    if (__atomic_exchange_n(&async_state.as_stopping, true, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (!__atomic_exchange_n(&async_state.as_running, false, __ATOMIC_SEQ_CST)) {
+        __atomic_store_n(&async_state.as_stopping, false, __ATOMIC_RELEASE);
+        return;
+    }
+
+    pthread_join(async_state.as_thread, NULL);
+    loggy_os_log_set_sink(async_state.as_downstream);
+
+    // Sends still holding the old sink either started appending before the
+    // flag flipped, and are waited out here, or will see it and deliver
+    // directly once this is done.
+    for (async_ring_t ar = __atomic_load_n(&async_state.as_rings, __ATOMIC_SEQ_CST); ar; ar = ar->ar_next) {
+        while (__atomic_load_n(&ar->ar_sending, __ATOMIC_SEQ_CST)) {
+            sched_yield();
+        }
+    }
+
+    async_drain();
+    __atomic_store_n(&async_state.as_stopping, false, __ATOMIC_RELEASE);
+}
+
+#endif
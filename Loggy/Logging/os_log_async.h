@@ -0,0 +1,56 @@
+//
+//  os_log_async.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_async_h__
+#define __loggy_os_log_async_h__
+
+#include "os_log_sink.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// The bit for messages of `type` in `la_block_types`.
+#define LOGGY_OS_LOG_ASYNC_BLOCK(type) (1u << (type))
+
+/// Tuning for asynchronous delivery. Zeroed fields take the defaults.
+typedef struct {
+    /// Bytes in each thread's ring; a power of two of at least 4KiB.
+    /// Defaults to 64KiB.
+    size_t      la_ring_size;
+    /// Nanoseconds the drain thread sleeps when every ring is empty.
+    /// Defaults to 1ms.
+    uint64_t    la_interval;
+    /// Types whose senders wait for room in a full ring rather than
+    /// dropping the message, built with `LOGGY_OS_LOG_ASYNC_BLOCK`.
+    uint32_t    la_block_types;
+} loggy_os_log_async_config_s;
+
+/// Interposes asynchronous delivery in front of `sink`, then installs it.
+///
+/// Each sending thread copies its messages into a ring of its own, and a
+/// background thread drains them to `sink` in order per thread. `sink` is
+/// only ever called from that thread. Returns false if already started, the
+/// configuration is unsuitable, or the thread couldn't be created.
+OS_EXPORT
+bool loggy_os_log_async_start(const loggy_os_log_sink_s *sink, const loggy_os_log_async_config_s *_Nullable config);
+
+/// Stops the drain thread, delivers what's left, and reinstalls the sink
+/// given to `loggy_os_log_async_start`. Messages racing with the stop are
+/// delivered before it returns, or directly to the sink after.
+OS_EXPORT
+void loggy_os_log_async_stop(void);
+
+/// The number of messages of `type` dropped because a ring was full.
+OS_EXPORT
+uint64_t loggy_os_log_async_dropped(os_log_type_t type);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_async_h__ */
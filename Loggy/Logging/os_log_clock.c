@@ -0,0 +1,226 @@
+//
+//  os_log_clock.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_clock.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include "os_log_sink.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define LOGGY_OS_LOG_CLOCK_HAS_TSC 1
+#else
+#define LOGGY_OS_LOG_CLOCK_HAS_TSC 0
+#endif
+
+#define LOGGY_OS_LOG_CLOCK_SAMPLES 5
+
+static bool clock_ticks;
+
+// Switching to ticks is refused while anything that stores times alongside
+// a calibration is open, since it would mix units.
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t clock_pins;
+
+// The first calibration, which later ones measure the frequency against,
+// and the latest, guarded by a sequence count that's odd while it changes.
+static loggy_os_log_clock_calibration_s clock_base;
+static loggy_os_log_clock_calibration_s clock_latest;
+static uint32_t clock_sequence;
+
+static inline uint64_t clock_read(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t loggy_os_log_timestamp(void) {
+#if LOGGY_OS_LOG_CLOCK_HAS_TSC
+    if (__atomic_load_n(&clock_ticks, __ATOMIC_RELAXED)) {
+        return __rdtsc();
+    }
+#endif
+    return clock_read(CLOCK_MONOTONIC);
+}
+
+bool loggy_os_log_clock_ticks(void) {
+    return __atomic_load_n(&clock_ticks, __ATOMIC_ACQUIRE);
+}
+
+void loggy_os_log_clock_pin(void) {
+    pthread_mutex_lock(&clock_lock);
+    clock_pins += 1;
+    pthread_mutex_unlock(&clock_lock);
+}
+
+void loggy_os_log_clock_unpin(void) {
+    pthread_mutex_lock(&clock_lock);
+    clock_pins -= 1;
+    pthread_mutex_unlock(&clock_lock);
+}
+
+#if LOGGY_OS_LOG_CLOCK_HAS_TSC
+
+// Brackets each clock read with the counter and keeps the tightest pair.
+static void clock_sample(loggy_os_log_clock_calibration_t sample) {
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < LOGGY_OS_LOG_CLOCK_SAMPLES; i++) {
+        uint64_t before = __rdtsc();
+        uint64_t monotonic = clock_read(CLOCK_MONOTONIC);
+        uint64_t realtime = clock_read(CLOCK_REALTIME);
+        uint64_t after = __rdtsc();
+        if (after - before < best) {
+            best = after - before;
+            sample->cc_ticks = before + (after - before) / 2;
+            sample->cc_monotonic = monotonic;
+            sample->cc_realtime = realtime;
+        }
+    }
+}
+
+// Only one thread publishes at a time. The fence keeps the fields' stores
+// from being seen before the count goes odd.
+static void clock_publish(const loggy_os_log_clock_calibration_s *calibration) {
+    __atomic_fetch_add(&clock_sequence, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&clock_latest.cc_ticks, calibration->cc_ticks, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock_latest.cc_monotonic, calibration->cc_monotonic, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock_latest.cc_realtime, calibration->cc_realtime, __ATOMIC_RELAXED);
+    __atomic_store_n(&clock_latest.cc_frequency, calibration->cc_frequency, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&clock_sequence, 1, __ATOMIC_RELEASE);
+}
+
+// The counter has to tick at a constant rate through frequency changes and
+// sleep, and agree across cores. CPUID promises the former; the kernel
+// only picks it as its clock source if it checked the latter.
+static bool clock_tsc_usable(void) {
+    unsigned eax, ebx, ecx, edx;
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))) {
+        return false;
+    }
+
+    char source[32] = "";
+    FILE *file = fopen("/sys/devices/system/clocksource/clocksource0/current_clocksource", "re");
+    if (file) {
+        if (!fgets(source, sizeof(source), file)) {
+            source[0] = 0;
+        }
+        fclose(file);
+        return strncmp(source, "tsc", 3) == 0;
+    }
+    return true;
+}
+
+bool loggy_os_log_clock_use_ticks(void) {
+    pthread_mutex_lock(&clock_lock);
+
+    bool ok = clock_ticks;
+    if (!ok && !clock_pins && clock_tsc_usable()) {
+        // Measure the frequency over a short interval to start; later
+        // calibrations measure it against this one over a longer one.
+        loggy_os_log_clock_calibration_s start, end;
+        clock_sample(&start);
+        struct timespec delay = { .tv_nsec = 10 * 1000 * 1000 };
+        nanosleep(&delay, NULL);
+        clock_sample(&end);
+
+        if (end.cc_monotonic > start.cc_monotonic && end.cc_ticks > start.cc_ticks) {
+            start.cc_frequency = (uint64_t)((unsigned __int128)(end.cc_ticks - start.cc_ticks) * 1000000000u / (end.cc_monotonic - start.cc_monotonic));
+            end.cc_frequency = start.cc_frequency;
+            clock_base = start;
+            clock_publish(&end);
+            __atomic_store_n(&clock_ticks, true, __ATOMIC_RELEASE);
+            ok = true;
+        }
+    }
+
+    pthread_mutex_unlock(&clock_lock);
+    return ok;
+}
+
+#else
+
+bool loggy_os_log_clock_use_ticks(void) {
+    return false;
+}
+
+#endif
+
+static void clock_latest_read(loggy_os_log_clock_calibration_t calibration) {
+    uint32_t sequence;
+    do {
+        while ((sequence = __atomic_load_n(&clock_sequence, __ATOMIC_ACQUIRE)) & 1) {
+        }
+        calibration->cc_ticks = __atomic_load_n(&clock_latest.cc_ticks, __ATOMIC_RELAXED);
+        calibration->cc_monotonic = __atomic_load_n(&clock_latest.cc_monotonic, __ATOMIC_RELAXED);
+        calibration->cc_realtime = __atomic_load_n(&clock_latest.cc_realtime, __ATOMIC_RELAXED);
+        calibration->cc_frequency = __atomic_load_n(&clock_latest.cc_frequency, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&clock_sequence, __ATOMIC_RELAXED) != sequence);
+}
+
+void loggy_os_log_clock_calibration(loggy_os_log_clock_calibration_t calibration) {
+    if (!loggy_os_log_clock_ticks()) {
+        uint64_t monotonic = clock_read(CLOCK_MONOTONIC);
+        *calibration = (loggy_os_log_clock_calibration_s){
+            .cc_ticks = monotonic,
+            .cc_monotonic = monotonic,
+            .cc_realtime = clock_read(CLOCK_REALTIME),
+        };
+        return;
+    }
+
+    clock_latest_read(calibration);
+
+#if LOGGY_OS_LOG_CLOCK_HAS_TSC
+    if (clock_read(CLOCK_MONOTONIC) - calibration->cc_monotonic < LOGGY_OS_LOG_CLOCK_CALIBRATION_INTERVAL * 1000000000ull) {
+        return;
+    }
+
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    if (pthread_mutex_trylock(&lock) != 0) {
+        return;
+    }
+
+    loggy_os_log_clock_calibration_s sample;
+    clock_sample(&sample);
+    sample.cc_frequency = (uint64_t)((unsigned __int128)(sample.cc_ticks - clock_base.cc_ticks) * 1000000000u / (sample.cc_monotonic - clock_base.cc_monotonic));
+    clock_publish(&sample);
+    pthread_mutex_unlock(&lock);
+    *calibration = sample;
+#endif
+}
+
+uint64_t loggy_os_log_clock_convert(const loggy_os_log_clock_calibration_s *calibration, uint64_t time) {
+    if (!calibration->cc_frequency) {
+        return time;
+    }
+
+    // Times from just before the calibration come out slightly behind it.
+    if (time >= calibration->cc_ticks) {
+        return calibration->cc_monotonic + (uint64_t)((unsigned __int128)(time - calibration->cc_ticks) * 1000000000u / calibration->cc_frequency);
+    }
+    uint64_t behind = (uint64_t)((unsigned __int128)(calibration->cc_ticks - time) * 1000000000u / calibration->cc_frequency);
+    return behind < calibration->cc_monotonic ? calibration->cc_monotonic - behind : 0;
+}
+
+uint64_t loggy_os_log_clock_nanoseconds(uint64_t time) {
+    if (!loggy_os_log_clock_ticks()) {
+        return time;
+    }
+    loggy_os_log_clock_calibration_s calibration;
+    clock_latest_read(&calibration);
+    return loggy_os_log_clock_convert(&calibration, time);
+}
+
+#endif
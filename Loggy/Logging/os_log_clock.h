@@ -0,0 +1,75 @@
+//
+//  os_log_clock.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_clock_h__
+#define __loggy_os_log_clock_h__
+
+#include "os_log_shims.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// Seconds between calibrations of the tick counter.
+#ifndef LOGGY_OS_LOG_CLOCK_CALIBRATION_INTERVAL
+#define LOGGY_OS_LOG_CLOCK_CALIBRATION_INTERVAL 1
+#endif
+
+/// A sample of the tick counter taken alongside `CLOCK_MONOTONIC` and
+/// `CLOCK_REALTIME`. Readers of stored ticks convert them with the nearest
+/// calibration. A frequency of zero means times are already nanoseconds.
+typedef struct {
+    uint64_t        cc_ticks;
+    uint64_t        cc_monotonic;
+    uint64_t        cc_realtime;
+    uint64_t        cc_frequency;
+} loggy_os_log_clock_calibration_s, *loggy_os_log_clock_calibration_t;
+
+/// Switches `loggy_os_log_timestamp` to reading the CPU's time-stamp counter
+/// rather than calling `clock_gettime`, if the counter is invariant and the
+/// kernel trusts it as a clock source. Times in records are then ticks.
+/// Returns false, leaving times in nanoseconds, if not, or if the units are
+/// pinned.
+///
+/// Enable before logging starts; records already buffered keep their units.
+OS_EXPORT
+bool loggy_os_log_clock_use_ticks(void);
+
+/// Whether times in records are ticks.
+OS_EXPORT
+bool loggy_os_log_clock_ticks(void);
+
+/// Keeps `loggy_os_log_clock_use_ticks` from changing the units of times
+/// until a matching `loggy_os_log_clock_unpin`. Segment writers and flight
+/// recorders hold a pin while open, since they store times alongside
+/// calibrations taken in one unit.
+OS_EXPORT
+void loggy_os_log_clock_pin(void);
+
+OS_EXPORT
+void loggy_os_log_clock_unpin(void);
+
+/// The current calibration, recalibrating first if the last one is older
+/// than `LOGGY_OS_LOG_CLOCK_CALIBRATION_INTERVAL`. Recalibrating takes a few
+/// microseconds; keep it off the logging path.
+OS_EXPORT
+void loggy_os_log_clock_calibration(loggy_os_log_clock_calibration_t calibration);
+
+/// Converts a time from `calibration`'s clock to monotonic nanoseconds.
+OS_EXPORT
+uint64_t loggy_os_log_clock_convert(const loggy_os_log_clock_calibration_s *calibration, uint64_t time);
+
+/// Converts a record's time to monotonic nanoseconds with the latest
+/// calibration.
+OS_EXPORT
+uint64_t loggy_os_log_clock_nanoseconds(uint64_t time);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_clock_h__ */
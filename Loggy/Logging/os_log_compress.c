@@ -0,0 +1,172 @@
+//
+//  os_log_compress.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_compress.h"
+#include <string.h>
+
+#define LOGGY_OS_LOG_COMPRESS_HASH_BITS     12
+#define LOGGY_OS_LOG_COMPRESS_MIN_MATCH     4
+#define LOGGY_OS_LOG_COMPRESS_MAX_OFFSET    65535
+// The format requires the last literals to be left unmatched.
+#define LOGGY_OS_LOG_COMPRESS_LAST_LITERALS 5
+#define LOGGY_OS_LOG_COMPRESS_MF_LIMIT      12
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t hash32(uint32_t v) {
+    return (v * 2654435761u) >> (32 - LOGGY_OS_LOG_COMPRESS_HASH_BITS);
+}
+
+// Writes the remainder of a length that didn't fit in its token nibble.
+static inline uint8_t *put_length(uint8_t *op, size_t len) {
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, size_t literal_len, size_t offset, size_t match_len) {
+    uint8_t *token = op++;
+    *token = (uint8_t)((literal_len < 15 ? literal_len : 15) << 4);
+    if (literal_len >= 15) {
+        op = put_length(op, literal_len - 15);
+    }
+    memcpy(op, literals, literal_len);
+    op += literal_len;
+
+    if (match_len) {
+        *op++ = (uint8_t)offset;
+        *op++ = (uint8_t)(offset >> 8);
+        match_len -= LOGGY_OS_LOG_COMPRESS_MIN_MATCH;
+        *token |= (uint8_t)(match_len < 15 ? match_len : 15);
+        if (match_len >= 15) {
+            op = put_length(op, match_len - 15);
+        }
+    }
+    return op;
+}
+
+size_t loggy_os_log_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t size) {
+    if (size < LOGGY_OS_LOG_COMPRESS_BOUND(len)) {
+        return 0;
+    }
+
+    uint32_t table[1 << LOGGY_OS_LOG_COMPRESS_HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t *ip = src, *anchor = src;
+    const uint8_t *match_limit = len > LOGGY_OS_LOG_COMPRESS_MF_LIMIT ? src + len - LOGGY_OS_LOG_COMPRESS_MF_LIMIT : src;
+    const uint8_t *end = src + len;
+    uint8_t *op = dst;
+
+    while (ip < match_limit) {
+        uint32_t h = hash32(read32(ip));
+        const uint8_t *candidate = src + table[h];
+        table[h] = (uint32_t)(ip - src);
+
+        if (candidate >= ip || ip - candidate > LOGGY_OS_LOG_COMPRESS_MAX_OFFSET || read32(candidate) != read32(ip)) {
+            // Skip ahead faster the longer nothing has matched.
+            ip += 1 + ((size_t)(ip - anchor) >> 6);
+            continue;
+        }
+
+        while (ip > anchor && candidate > src && ip[-1] == candidate[-1]) {
+            ip -= 1;
+            candidate -= 1;
+        }
+
+        const uint8_t *match_end = ip + LOGGY_OS_LOG_COMPRESS_MIN_MATCH;
+        const uint8_t *scan_limit = end - LOGGY_OS_LOG_COMPRESS_LAST_LITERALS;
+        const uint8_t *ref = candidate + LOGGY_OS_LOG_COMPRESS_MIN_MATCH;
+        while (match_end < scan_limit && *match_end == *ref) {
+            match_end += 1;
+            ref += 1;
+        }
+
+        op = put_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - candidate), (size_t)(match_end - ip));
+        ip = anchor = match_end;
+        if (ip < match_limit) {
+            table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+        }
+    }
+
+    op = put_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    return (size_t)(op - dst);
+}
+
+// Reads the remainder of a length whose token nibble was 15.
+static inline bool get_length(const uint8_t **ip, const uint8_t *end, size_t *len) {
+    uint8_t byte;
+    do {
+        if (*ip >= end) {
+            return false;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool loggy_os_log_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size) {
+    const uint8_t *ip = src, *end = src + len;
+    uint8_t *op = dst, *out_end = dst + size;
+
+    while (ip < end) {
+        uint8_t token = *ip++;
+
+        size_t literal_len = token >> 4;
+        if (literal_len == 15 && !get_length(&ip, end, &literal_len)) {
+            return false;
+        }
+        if (literal_len > (size_t)(end - ip) || literal_len > (size_t)(out_end - op)) {
+            return false;
+        }
+        memcpy(op, ip, literal_len);
+        ip += literal_len;
+        op += literal_len;
+
+        // The last sequence is literals only.
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return false;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+
+        size_t match_len = token & 0xf;
+        if (match_len == 15 && !get_length(&ip, end, &match_len)) {
+            return false;
+        }
+        match_len += LOGGY_OS_LOG_COMPRESS_MIN_MATCH;
+
+        if (offset == 0 || offset > (size_t)(op - dst) || match_len > (size_t)(out_end - op)) {
+            return false;
+        }
+
+        // Matches may overlap what they're copying, so go byte by byte
+        // unless they're far enough apart.
+        const uint8_t *ref = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, ref, match_len);
+            op += match_len;
+        } else {
+            for (size_t i = 0; i < match_len; i++) {
+                *op++ = *ref++;
+            }
+        }
+    }
+
+    return op == out_end;
+}
@@ -0,0 +1,35 @@
+//
+//  os_log_compress.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_compress_h__
+#define __loggy_os_log_compress_h__
+
+#include "os_log_shims.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+// A byte-oriented LZ77 codec in the LZ4 block format: runs of literals and
+// back-references within 64KiB, with no entropy coding. Encoded messages
+// repeat their headers, descriptors, and string arguments, which is what
+// it's good at, and it decompresses at memory speed.
+
+/// The most `loggy_os_log_compress` may write for `len` bytes of input.
+#define LOGGY_OS_LOG_COMPRESS_BOUND(len) ((len) + (len) / 255 + 16)
+
+/// Compresses `len` bytes of `src` into `dst`, which has room for `size`
+/// bytes. Returns the compressed length, or 0 if it didn't fit.
+OS_EXPORT
+size_t loggy_os_log_compress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+
+/// Decompresses `len` bytes of `src` into `dst`, which must be exactly
+/// `size` bytes, the original length. Returns false if the input is corrupt.
+OS_EXPORT
+bool loggy_os_log_decompress(const uint8_t *src, size_t len, uint8_t *dst, size_t size);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_log_compress_h__ */
@@ -0,0 +1,194 @@
+//
+//  os_log_enabled.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+#include <pthread.h>
+
+uint64_t _loggy_os_log_generation = 1;
+
+void loggy_os_log_config_changed(void) {
+    __atomic_fetch_add(&_loggy_os_log_generation, 1, __ATOMIC_RELAXED);
+}
+
+#if LOGGY_HAS_OS_LOG
+
+#include <dispatch/dispatch.h>
+#include <notify.h>
+
+_loggy_os_log_enabled_cache_s _loggy_os_log_enabled_cache[LOGGY_OS_LOG_ENABLED_CACHE_SIZE];
+
+static pthread_once_t enabled_watch_once = PTHREAD_ONCE_INIT;
+
+// Posted when `log config` or a profile changes logging preferences.
+static void enabled_watch_init(void) {
+    _loggy_os_log_enabled_cache_add(OS_LOG_DEFAULT);
+
+    int token;
+    notify_register_dispatch("com.apple.system.logging.prefschanged", &token, dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^(int unused) {
+        (void)unused;
+        loggy_os_log_config_changed();
+    });
+}
+
+static uint8_t enabled_mask(os_log_t h) {
+    static const os_log_type_t types[] = { OS_LOG_TYPE_DEFAULT, OS_LOG_TYPE_INFO, OS_LOG_TYPE_DEBUG, OS_LOG_TYPE_ERROR, OS_LOG_TYPE_FAULT };
+    uint8_t mask = 0;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (os_log_type_enabled(h, types[i])) {
+            mask |= LOGGY_OS_LOG_TYPE_BIT(types[i]);
+        }
+    }
+    return mask;
+}
+
+// The slot holding `key`, claiming an empty one for it if `add`; `NULL` if
+// it has none.
+static _loggy_os_log_enabled_cache_s *_Nullable enabled_cache_slot(const void *key, bool add) {
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ull) >> 51);
+    for (size_t i = 0; i < LOGGY_OS_LOG_ENABLED_CACHE_SIZE; i++) {
+        _loggy_os_log_enabled_cache_s *entry = &_loggy_os_log_enabled_cache[(slot + i) & (LOGGY_OS_LOG_ENABLED_CACHE_SIZE - 1)];
+        const void *owner = __atomic_load_n(&entry->ec_log, __ATOMIC_RELAXED);
+        if (!owner && add && __atomic_compare_exchange_n(&entry->ec_log, &owner, key, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return entry;
+        }
+        if (owner == key) {
+            return entry;
+        }
+        if (!owner) {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// A new slot's state is zero, a generation that never matches, so the
+// first check of the handle fills it in.
+void _loggy_os_log_enabled_cache_add(os_log_t h) {
+    (void)enabled_cache_slot(LOGGY_OS_LOG_HANDLE_KEY(h), true);
+}
+
+void _loggy_os_log_truncations_add(os_log_t h, uint64_t count) {
+    pthread_once(&enabled_watch_once, enabled_watch_init);
+    _loggy_os_log_enabled_cache_s *entry = enabled_cache_slot(LOGGY_OS_LOG_HANDLE_KEY(h), false);
+    if (entry) {
+        __atomic_fetch_add(&entry->ec_truncated, count, __ATOMIC_RELAXED);
+    }
+}
+
+uint64_t loggy_os_log_truncations(os_log_t h) {
+    pthread_once(&enabled_watch_once, enabled_watch_init);
+    _loggy_os_log_enabled_cache_s *entry = enabled_cache_slot(LOGGY_OS_LOG_HANDLE_KEY(h), false);
+    return entry ? __atomic_load_n(&entry->ec_truncated, __ATOMIC_RELAXED) : 0;
+}
+
+bool _loggy_os_log_enabled_refresh(os_log_t h, os_log_type_t type) {
+    pthread_once(&enabled_watch_once, enabled_watch_init);
+
+    _loggy_os_log_enabled_cache_s *entry = enabled_cache_slot(LOGGY_OS_LOG_HANDLE_KEY(h), false);
+    if (!entry) {
+        // Not a handle that lives for good; ask every time.
+        return os_log_type_enabled(h, type);
+    }
+
+    // Read first, so a change during the refresh invalidates it again.
+    uint64_t generation = __atomic_load_n(&_loggy_os_log_generation, __ATOMIC_RELAXED);
+    uint8_t mask = enabled_mask(h);
+    __atomic_store_n(&entry->ec_state, generation << 8 | mask, __ATOMIC_RELAXED);
+    return (mask & LOGGY_OS_LOG_TYPE_BIT(type)) != 0;
+}
+
+#else
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct enabled_rule_s {
+    struct enabled_rule_s *er_next;
+    char *_Nullable er_subsystem;
+    char *_Nullable er_category;
+    uint8_t er_mask;
+} enabled_rule_s, *enabled_rule_t;
+
+static pthread_mutex_t enabled_rules_lock = PTHREAD_MUTEX_INITIALIZER;
+static enabled_rule_t enabled_rules;
+static uint8_t enabled_default = (uint8_t)~LOGGY_OS_LOG_TYPE_BIT(OS_LOG_TYPE_DEBUG);
+
+static bool rule_field_equal(const char *_Nullable a, const char *_Nullable b) {
+    return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+void loggy_os_log_configure(const char *subsystem, const char *category, uint8_t mask) {
+    pthread_mutex_lock(&enabled_rules_lock);
+
+    if (!subsystem) {
+        enabled_default = mask;
+    } else {
+        enabled_rule_t rule = enabled_rules;
+        while (rule && !(rule_field_equal(rule->er_subsystem, subsystem) && rule_field_equal(rule->er_category, category))) {
+            rule = rule->er_next;
+        }
+
+        if (!rule && (rule = calloc(1, sizeof(enabled_rule_s)))) {
+            rule->er_subsystem = strdup(subsystem);
+            rule->er_category = category ? strdup(category) : NULL;
+            rule->er_next = enabled_rules;
+            enabled_rules = rule;
+        }
+
+        if (rule) {
+            rule->er_mask = mask;
+        }
+    }
+
+    loggy_os_log_config_changed();
+    pthread_mutex_unlock(&enabled_rules_lock);
+}
+
+static uint8_t enabled_mask(os_log_t h) {
+    pthread_mutex_lock(&enabled_rules_lock);
+
+    uint8_t mask = enabled_default;
+    int best = 0;
+    for (enabled_rule_t rule = enabled_rules; rule; rule = rule->er_next) {
+        if (strcmp(rule->er_subsystem, h->subsystem) != 0) {
+            continue;
+        }
+
+        if (!rule->er_category && best < 1) {
+            mask = rule->er_mask;
+            best = 1;
+        } else if (rule->er_category && strcmp(rule->er_category, h->category) == 0) {
+            mask = rule->er_mask;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&enabled_rules_lock);
+    return mask;
+}
+
+bool _loggy_os_log_enabled_refresh(os_log_t h, os_log_type_t type) {
+    // Read first, so a change during the refresh invalidates it again.
+    uint64_t generation = __atomic_load_n(&_loggy_os_log_generation, __ATOMIC_RELAXED);
+    uint8_t mask = enabled_mask(h);
+    __atomic_store_n(&h->enabled, generation << 8 | mask, __ATOMIC_RELAXED);
+    return (mask & LOGGY_OS_LOG_TYPE_BIT(type)) != 0;
+}
+
+bool os_log_type_enabled(os_log_t log, os_log_type_t type) {
+    return loggy_os_log_type_enabled(log, type);
+}
+
+void _loggy_os_log_truncations_add(os_log_t h, uint64_t count) {
+    __atomic_fetch_add(&h->truncated, count, __ATOMIC_RELAXED);
+}
+
+uint64_t loggy_os_log_truncations(os_log_t h) {
+    return __atomic_load_n(&h->truncated, __ATOMIC_RELAXED);
+}
+
+#endif
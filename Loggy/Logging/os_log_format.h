@@ -0,0 +1,116 @@
+//===----------------------------------------------------------------------===//
+//
+// This source file is part of the Swift.org open source project
+//
+// Copyright (c) 2014 - 2018 Apple Inc. and the Swift project authors
+// Licensed under Apache License v2.0 with Runtime Library Exception
+//
+// See https://swift.org/LICENSE.txt for license information
+// See https://swift.org/CONTRIBUTORS.txt for the list of Swift project authors
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef __loggy_os_log_format_h__
+#define __loggy_os_log_format_h__
+
+#include "os_log_shims.h"
+#include <string.h>
+
+OS_ASSUME_NONNULL_BEGIN
+
+// The layout of an encoded message: a header, then one command per argument,
+// each a descriptor followed by `cmd_size` bytes of data.
+
+OS_ENUM(os_log_fmt_hdr_flags, uint8_t,
+    OSLF_HDR_FLAG_HAS_PRIVATE    = 0x01,
+    OSLF_HDR_FLAG_HAS_NON_SCALAR = 0x02,
+);
+
+typedef struct os_log_fmt_hdr_s {
+    os_log_fmt_hdr_flags_t hdr_flags;
+    uint8_t hdr_cmd_cnt;
+} os_log_fmt_hdr_s, *os_log_fmt_hdr_t;
+
+OS_ENUM(os_log_fmt_cmd_flags, uint8_t,
+    OSLF_CMD_FLAG_PRIVATE = 0x1,
+    OSLF_CMD_FLAG_PUBLIC = 0x2,
+    // Loggy-specific: the data is the argument itself rather than a pointer.
+    OSLF_CMD_FLAG_LOGGY_INLINE = 0x8,
+);
+
+OS_ENUM(os_log_fmt_cmd_type, uint8_t,
+    OSLF_CMD_TYPE_SCALAR      = 0,
+    OSLF_CMD_TYPE_COUNT       = 1,
+    OSLF_CMD_TYPE_STRING      = 2,
+    OSLF_CMD_TYPE_DATA        = 3,
+    OSLF_CMD_TYPE_OBJECT      = 4,
+    OSLF_CMD_TYPE_WIDE_STRING = 5,
+    OSLF_CMD_TYPE_ERRNO       = 6,
+);
+
+typedef struct {
+    os_log_fmt_cmd_flags_t cmd_flags : 4;
+    os_log_fmt_cmd_type_t cmd_type : 4;
+    uint8_t cmd_size;
+} os_log_fmt_cmd_s, *os_log_fmt_cmd_t;
+
+/// Reads the command at `*cursor` and advances past it. Returns false at the
+/// end of the buffer, or if what remains is malformed.
+OS_INLINE OS_ALWAYS_INLINE
+bool loggy_os_log_fmt_next(const uint8_t *_Nonnull *_Nonnull cursor, const uint8_t *end, os_log_fmt_cmd_s *cmd, const uint8_t *_Nullable *_Nonnull data) {
+    if ((size_t)(end - *cursor) < sizeof(os_log_fmt_cmd_s)) {
+        return false;
+    }
+
+    memcpy(cmd, *cursor, sizeof(os_log_fmt_cmd_s));
+    if ((size_t)(end - *cursor) - sizeof(os_log_fmt_cmd_s) < cmd->cmd_size) {
+        return false;
+    }
+
+    *data = *cursor + sizeof(os_log_fmt_cmd_s);
+    *cursor += sizeof(os_log_fmt_cmd_s) + cmd->cmd_size;
+    return true;
+}
+
+/// The value of a scalar command's data, zero-extended.
+OS_INLINE OS_ALWAYS_INLINE
+uint64_t loggy_os_log_fmt_read_unsigned(const uint8_t *data, size_t size) {
+    switch (size) {
+    case 1: { uint8_t v; memcpy(&v, data, 1); return v; }
+    case 2: { uint16_t v; memcpy(&v, data, 2); return v; }
+    case 4: { uint32_t v; memcpy(&v, data, 4); return v; }
+    case 8: { uint64_t v; memcpy(&v, data, 8); return v; }
+    default: return 0;
+    }
+}
+
+/// The value of a scalar command's data, sign-extended.
+OS_INLINE OS_ALWAYS_INLINE
+int64_t loggy_os_log_fmt_read_signed(const uint8_t *data, size_t size) {
+    switch (size) {
+    case 1: { int8_t v; memcpy(&v, data, 1); return v; }
+    case 2: { int16_t v; memcpy(&v, data, 2); return v; }
+    case 4: { int32_t v; memcpy(&v, data, 4); return v; }
+    case 8: { int64_t v; memcpy(&v, data, 8); return v; }
+    default: return 0;
+    }
+}
+
+/// The value of a floating-point command's data.
+OS_INLINE OS_ALWAYS_INLINE
+double loggy_os_log_fmt_read_double(const uint8_t *data, size_t size) {
+    if (size == sizeof(float)) {
+        float v;
+        memcpy(&v, data, sizeof(v));
+        return v;
+    } else if (size == sizeof(double)) {
+        double v;
+        memcpy(&v, data, sizeof(v));
+        return v;
+    }
+    return 0;
+}
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_log_format_h__ */
@@ -0,0 +1,75 @@
+//
+//  os_log_format_cache.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGGY_OS_LOG_FORMAT_CACHE_SIZE  4096
+#define LOGGY_OS_LOG_FORMAT_CACHE_PROBE 16
+
+// Entries are immutable once published, and never freed, so a reader that
+// sees the pointer can use the format for the life of the process.
+typedef struct {
+    const void *fce_ra;
+    uint64_t fce_shape;
+    char fce_format[];
+} format_cache_entry_s, *format_cache_entry_t;
+
+static format_cache_entry_t format_cache[LOGGY_OS_LOG_FORMAT_CACHE_SIZE];
+
+static inline size_t format_cache_slot(const void *ra, uint64_t shape) {
+    uint64_t key = ((uint64_t)(uintptr_t)ra ^ shape) * 0x9e3779b97f4a7c15ull;
+    return (size_t)(key >> 52) & (LOGGY_OS_LOG_FORMAT_CACHE_SIZE - 1);
+}
+
+const char *loggy_os_log_format_lookup(const void *ra, uint64_t shape) {
+    size_t slot = format_cache_slot(ra, shape);
+    for (size_t i = 0; i < LOGGY_OS_LOG_FORMAT_CACHE_PROBE; i++) {
+        format_cache_entry_t entry = __atomic_load_n(&format_cache[(slot + i) & (LOGGY_OS_LOG_FORMAT_CACHE_SIZE - 1)], __ATOMIC_ACQUIRE);
+        if (!entry) {
+            return NULL;
+        }
+
+        if (entry->fce_ra == ra && entry->fce_shape == shape) {
+            return entry->fce_format;
+        }
+    }
+    return NULL;
+}
+
+const char *loggy_os_log_format_intern(const void *ra, uint64_t shape, const char *fmt) {
+    size_t len = strlen(fmt);
+    format_cache_entry_t mine = malloc(sizeof(format_cache_entry_s) + len + 1);
+    if (!mine) {
+        return NULL;
+    }
+
+    mine->fce_ra = ra;
+    mine->fce_shape = shape;
+    memcpy(mine->fce_format, fmt, len + 1);
+
+    size_t slot = format_cache_slot(ra, shape);
+    for (size_t i = 0; i < LOGGY_OS_LOG_FORMAT_CACHE_PROBE; i++) {
+        format_cache_entry_t *ptr = &format_cache[(slot + i) & (LOGGY_OS_LOG_FORMAT_CACHE_SIZE - 1)];
+        format_cache_entry_t entry = NULL;
+        if (__atomic_compare_exchange_n(ptr, &entry, mine, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+            return mine->fce_format;
+        }
+
+        // Another thread got to this slot first; it may have been racing to
+        // intern the same call site.
+        if (entry->fce_ra == ra && entry->fce_shape == shape) {
+            free(mine);
+            return entry->fce_format;
+        }
+    }
+
+    // Too many collisions; let the caller use its own copy.
+    free(mine);
+    return NULL;
+}
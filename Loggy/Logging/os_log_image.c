@@ -0,0 +1,471 @@
+//
+//  os_log_image.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#if !defined(__APPLE__)
+#define _GNU_SOURCE
+#endif
+
+#include "os_log_image.h"
+#include <pthread.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__APPLE__)
+#include <dlfcn.h>
+#include <mach-o/dyld.h>
+#include <mach-o/loader.h>
+#else
+#include <link.h>
+#include <unistd.h>
+#endif
+
+// Images are never freed, so a reader holding one can use it indefinitely.
+typedef struct {
+    uintptr_t im_start;
+    uintptr_t im_end;
+    uintptr_t im_bias;
+    const char *im_path;
+    const char *im_build_id;
+    const char *_Nullable im_subsystem;
+} image_s, *image_t;
+
+// Tables are immutable once published. Adding images publishes a new table;
+// the old one is kept, since a reader may still be searching it.
+typedef struct {
+    size_t it_count;
+    image_t it_images[];
+} image_table_s, *image_table_t;
+
+static image_table_t image_table;
+static pthread_mutex_t image_table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t image_table_once = PTHREAD_ONCE_INIT;
+
+static image_t _Nullable image_find(image_table_t _Nullable table, uintptr_t address) {
+    if (!table) {
+        return NULL;
+    }
+
+    size_t lo = 0, hi = table->it_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (table->it_images[mid]->im_start <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0) {
+        return NULL;
+    }
+
+    image_t image = table->it_images[lo - 1];
+    return address < image->im_end ? image : NULL;
+}
+
+static image_t _Nullable image_create(uintptr_t start, uintptr_t end, uintptr_t bias, const char *path, const uint8_t *_Nullable build_id, size_t build_id_len) {
+    image_t image = calloc(1, sizeof(image_s));
+    char *hex = malloc(build_id_len * 2 + 1);
+    if (!image || !hex) {
+        free(image);
+        free(hex);
+        return NULL;
+    }
+
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < build_id_len; i++) {
+        hex[i * 2] = digits[build_id[i] >> 4];
+        hex[i * 2 + 1] = digits[build_id[i] & 0xf];
+    }
+    hex[build_id_len * 2] = 0;
+
+    image->im_start = start;
+    image->im_end = end;
+    image->im_bias = bias;
+    image->im_path = strdup(path);
+    image->im_build_id = hex;
+    return image;
+}
+
+static int image_compare(const void *lhs, const void *rhs) {
+    uintptr_t a = (*(const image_t *)lhs)->im_start, b = (*(const image_t *)rhs)->im_start;
+    return a < b ? -1 : a > b;
+}
+
+// Publishes `images`, which must be sorted, as the table. Call with the lock
+// held.
+static bool image_table_publish(image_t *images, size_t count) {
+    image_table_t table = malloc(sizeof(image_table_s) + count * sizeof(image_t));
+    if (!table) {
+        return false;
+    }
+
+    memcpy(table->it_images, images, count * sizeof(image_t));
+    table->it_count = count;
+    __atomic_store_n(&image_table, table, __ATOMIC_RELEASE);
+    return true;
+}
+
+#if defined(__APPLE__)
+
+// Takes ownership of `added`, sorted or not. An image already in the table
+// at the same address is replaced.
+static void image_table_add(image_t *added, size_t count) {
+    qsort(added, count, sizeof(image_t), image_compare);
+
+    pthread_mutex_lock(&image_table_lock);
+
+    image_table_t old = image_table;
+    size_t old_count = old ? old->it_count : 0;
+    image_t *merged = malloc((old_count + count) * sizeof(image_t));
+    if (!merged) {
+        pthread_mutex_unlock(&image_table_lock);
+        return;
+    }
+
+    size_t i = 0, j = 0, n = 0;
+    while (i < old_count || j < count) {
+        if (j == count || (i < old_count && old->it_images[i]->im_start < added[j]->im_start)) {
+            merged[n++] = old->it_images[i++];
+        } else {
+            if (i < old_count && old->it_images[i]->im_start == added[j]->im_start) {
+                i++;
+            }
+            merged[n++] = added[j++];
+        }
+    }
+
+    image_table_publish(merged, n);
+    pthread_mutex_unlock(&image_table_lock);
+    free(merged);
+}
+
+static image_t _Nullable image_from_header(const struct mach_header *mh, intptr_t slide) {
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    const uint8_t *uuid = NULL;
+    const uint8_t *cursor = (const uint8_t *)mh + (mh->magic == MH_MAGIC_64 ? sizeof(struct mach_header_64) : sizeof(struct mach_header));
+
+    for (uint32_t i = 0; i < mh->ncmds; i++) {
+        const struct load_command *lc = (const struct load_command *)cursor;
+        uintptr_t lo = 0, hi = 0;
+        if (lc->cmd == LC_SEGMENT_64) {
+            const struct segment_command_64 *seg = (const struct segment_command_64 *)lc;
+            lo = (uintptr_t)seg->vmaddr;
+            hi = lo + (uintptr_t)seg->vmsize;
+        } else if (lc->cmd == LC_SEGMENT) {
+            const struct segment_command *seg = (const struct segment_command *)lc;
+            lo = seg->vmaddr;
+            hi = lo + seg->vmsize;
+        } else if (lc->cmd == LC_UUID) {
+            uuid = ((const struct uuid_command *)lc)->uuid;
+        }
+
+        // Skip __PAGEZERO, which maps nothing.
+        if (hi > lo && lo + (uintptr_t)slide != 0 && strcmp(((const struct segment_command *)lc)->segname, SEG_PAGEZERO) != 0) {
+            start = lo + (uintptr_t)slide < start ? lo + (uintptr_t)slide : start;
+            end = hi + (uintptr_t)slide > end ? hi + (uintptr_t)slide : end;
+        }
+        cursor += lc->cmdsize;
+    }
+
+    Dl_info info;
+    if (start >= end || !dladdr(mh, &info) || !info.dli_fname) {
+        return NULL;
+    }
+
+    return image_create(start, end, (uintptr_t)slide, info.dli_fname, uuid, uuid ? 16 : 0);
+}
+
+static void image_added(const struct mach_header *mh, intptr_t slide) {
+    image_t existing = image_find(__atomic_load_n(&image_table, __ATOMIC_ACQUIRE), (uintptr_t)mh);
+    Dl_info info;
+    if (existing && dladdr(mh, &info) && info.dli_fname && existing->im_bias == (uintptr_t)slide && strcmp(existing->im_path, info.dli_fname) == 0) {
+        return;
+    }
+
+    image_t image = image_from_header(mh, slide);
+    if (image) {
+        image_table_add(&image, 1);
+    }
+}
+
+// Unloaded images leave the table, so their addresses can be reused.
+static void image_removed(const struct mach_header *mh, intptr_t slide) {
+    (void)slide;
+    pthread_mutex_lock(&image_table_lock);
+
+    image_table_t old = image_table;
+    image_t image = image_find(old, (uintptr_t)mh);
+    image_t *kept = old ? malloc(old->it_count * sizeof(image_t)) : NULL;
+    if (image && kept) {
+        size_t n = 0;
+        for (size_t i = 0; i < old->it_count; i++) {
+            if (old->it_images[i] != image) {
+                kept[n++] = old->it_images[i];
+            }
+        }
+        image_table_publish(kept, n);
+    }
+
+    pthread_mutex_unlock(&image_table_lock);
+    free(kept);
+}
+
+static void image_table_init(void) {
+    uint32_t count = _dyld_image_count();
+    image_t *images = calloc(count, sizeof(image_t));
+    size_t n = 0;
+    for (uint32_t i = 0; images && i < count; i++) {
+        const struct mach_header *mh = _dyld_get_image_header(i);
+        image_t image = mh ? image_from_header(mh, _dyld_get_image_vmaddr_slide(i)) : NULL;
+        if (image) {
+            images[n++] = image;
+        }
+    }
+    image_table_add(images, n);
+    free(images);
+
+    // Called back for every image already loaded too; those are skipped.
+    _dyld_register_func_for_add_image(image_added);
+    _dyld_register_func_for_remove_image(image_removed);
+}
+
+// dyld tells us about every change, so the table is always current and a
+// miss is an address in no image.
+static bool image_table_refresh(void) {
+    return false;
+}
+
+#else
+
+typedef struct {
+    image_table_t _Nullable is_table;
+    image_t *is_images;
+    size_t is_count;
+    size_t is_capacity;
+    uint64_t is_generation;
+} image_scan_s;
+
+// The loader's count of images added and removed, as of the table. Zero if
+// the loader doesn't keep one, in which case every lookup rescans.
+static uint64_t image_table_generation;
+static bool image_table_refreshing;
+
+static void image_destroy(image_t image) {
+    free((void *)image->im_path);
+    free((void *)image->im_build_id);
+    free(image);
+}
+
+// Whether `image` is still what's loaded at its address, as opposed to an
+// image unloaded since whose range has been reused.
+static bool image_same(image_t image, uintptr_t start, uintptr_t end, uintptr_t bias, const char *path) {
+    return image->im_start == start && image->im_end == end && image->im_bias == bias && strcmp(image->im_path, path) == 0;
+}
+
+// Finds the GNU build ID among the image's notes, which are mapped.
+static const uint8_t *_Nullable image_build_id(const struct dl_phdr_info *info, size_t *len) {
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_NOTE) {
+            continue;
+        }
+
+        size_t align = phdr->p_align == 8 ? 8 : 4;
+        const uint8_t *note = (const uint8_t *)(info->dlpi_addr + phdr->p_vaddr);
+        const uint8_t *end = note + phdr->p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nhdr = (const ElfW(Nhdr) *)note;
+            const uint8_t *name = note + sizeof(ElfW(Nhdr));
+            const uint8_t *desc = name + ((nhdr->n_namesz + align - 1) & ~(align - 1));
+            if (desc + nhdr->n_descsz > end) {
+                break;
+            }
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                *len = nhdr->n_descsz;
+                return desc;
+            }
+            note = desc + ((nhdr->n_descsz + align - 1) & ~(align - 1));
+        }
+    }
+    return NULL;
+}
+
+static uint64_t image_generation_of(const struct dl_phdr_info *info, size_t size) {
+    if (size < offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs)) {
+        return 0;
+    }
+    return (uint64_t)info->dlpi_adds + (uint64_t)info->dlpi_subs;
+}
+
+static int image_generation_one(struct dl_phdr_info *info, size_t size, void *context) {
+    *(uint64_t *)context = image_generation_of(info, size);
+    return 1;
+}
+
+// Collects every loaded image, reusing the table's entry for one that's
+// unchanged so that its subsystem and any readers' pointers carry over.
+static int image_scan_one(struct dl_phdr_info *info, size_t size, void *context) {
+    image_scan_s *scan = context;
+    scan->is_generation = image_generation_of(info, size);
+
+    uintptr_t start = UINTPTR_MAX, end = 0;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) {
+            continue;
+        }
+
+        uintptr_t lo = info->dlpi_addr + phdr->p_vaddr, hi = lo + phdr->p_memsz;
+        start = lo < start ? lo : start;
+        end = hi > end ? hi : end;
+    }
+
+    if (start >= end) {
+        return 0;
+    }
+
+    if (scan->is_count == scan->is_capacity) {
+        size_t capacity = scan->is_capacity ? scan->is_capacity * 2 : 64;
+        image_t *images = realloc(scan->is_images, capacity * sizeof(image_t));
+        if (!images) {
+            return 1;
+        }
+        scan->is_images = images;
+        scan->is_capacity = capacity;
+    }
+
+    // The main executable has no name.
+    const char *path = info->dlpi_name;
+    char exe[4096];
+    if (!path || !path[0]) {
+        ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        exe[len > 0 ? len : 0] = 0;
+        path = exe;
+    }
+
+    image_t image = image_find(scan->is_table, start);
+    if (!image || !image_same(image, start, end, info->dlpi_addr, path)) {
+        size_t build_id_len = 0;
+        const uint8_t *build_id = image_build_id(info, &build_id_len);
+        image = image_create(start, end, info->dlpi_addr, path, build_id, build_id_len);
+    }
+    if (image) {
+        scan->is_images[scan->is_count++] = image;
+    }
+    return 0;
+}
+
+// There's no notification for `dlopen` on Linux, so a lookup that misses
+// checks whether the loader's generation has moved since the table was
+// built, which costs one callback from `dl_iterate_phdr` under the loader's
+// lock. If it hasn't, the table is current and the miss is an address in no
+// image. If it has, the table is rebuilt from scratch: unloaded images drop
+// out, and one loaded where another used to be replaces it. Returns whether
+// the table may have changed.
+//
+// Only one thread refreshes at a time; one that misses meanwhile reports
+// the miss rather than waiting, since it may be running a constructor
+// inside `dlopen` and so hold the loader's lock that the refresh needs.
+static bool image_table_refresh(void) {
+    if (__atomic_exchange_n(&image_table_refreshing, true, __ATOMIC_ACQUIRE)) {
+        return false;
+    }
+
+    uint64_t generation = 0;
+    dl_iterate_phdr(image_generation_one, &generation);
+    if (generation && generation == __atomic_load_n(&image_table_generation, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&image_table_refreshing, false, __ATOMIC_RELEASE);
+        return false;
+    }
+
+    image_scan_s scan = { .is_table = __atomic_load_n(&image_table, __ATOMIC_ACQUIRE) };
+    dl_iterate_phdr(image_scan_one, &scan);
+    qsort(scan.is_images, scan.is_count, sizeof(image_t), image_compare);
+
+    pthread_mutex_lock(&image_table_lock);
+    bool published = false;
+    if (image_table == scan.is_table && image_table_publish(scan.is_images, scan.is_count)) {
+        __atomic_store_n(&image_table_generation, scan.is_generation, __ATOMIC_RELEASE);
+        published = true;
+    }
+    pthread_mutex_unlock(&image_table_lock);
+
+    // The table couldn't be published; drop whatever this scan created.
+    for (size_t i = 0; !published && i < scan.is_count; i++) {
+        if (image_find(scan.is_table, scan.is_images[i]->im_start) != scan.is_images[i]) {
+            image_destroy(scan.is_images[i]);
+        }
+    }
+    free(scan.is_images);
+    __atomic_store_n(&image_table_refreshing, false, __ATOMIC_RELEASE);
+    return published;
+}
+
+static void image_table_init(void) {
+    (void)image_table_refresh();
+}
+
+#endif
+
+// Hits never leave the binary search. On Linux, an image unloaded since the
+// table was built can still be found at its old range until a miss prompts
+// a rescan.
+static image_t _Nullable image_lookup(const void *address) {
+    pthread_once(&image_table_once, image_table_init);
+    image_t image = image_find(__atomic_load_n(&image_table, __ATOMIC_ACQUIRE), (uintptr_t)address);
+    if (!image && image_table_refresh()) {
+        image = image_find(__atomic_load_n(&image_table, __ATOMIC_ACQUIRE), (uintptr_t)address);
+    }
+    return image;
+}
+
+bool loggy_os_log_image_info(const void *address, loggy_os_log_image_info_t info) {
+    image_t image = image_lookup(address);
+    if (!image) {
+        return false;
+    }
+
+    *info = (loggy_os_log_image_info_s){
+        .ii_path = image->im_path,
+        .ii_build_id = image->im_build_id,
+        .ii_start = image->im_start,
+        .ii_end = image->im_end,
+        .ii_bias = image->im_bias,
+    };
+    return true;
+}
+
+const char *loggy_os_log_image_path(const void *address) {
+    image_t image = image_lookup(address);
+    return image ? image->im_path : NULL;
+}
+
+const char *loggy_os_log_image_subsystem(const void *address) {
+    image_t image = image_lookup(address);
+    return image ? __atomic_load_n(&image->im_subsystem, __ATOMIC_ACQUIRE) : NULL;
+}
+
+const char *loggy_os_log_image_set_subsystem(const void *address, const char *subsystem) {
+    image_t image = image_lookup(address);
+    if (!image) {
+        return NULL;
+    }
+
+    const char *existing = NULL;
+    char *copy = strdup(subsystem);
+    if (!copy) {
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&image->im_subsystem, &existing, copy, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(copy);
+        return existing;
+    }
+    return copy;
+}
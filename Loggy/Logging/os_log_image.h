@@ -0,0 +1,56 @@
+//
+//  os_log_image.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_image_h__
+#define __loggy_os_log_image_h__
+
+#include "os_log_shims.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// What identifies a loaded image to a symbolicator.
+typedef struct loggy_os_log_image_info_s {
+    const char     *ii_path;
+    /// The image's GNU build ID or Mach-O UUID in hex, or empty if it has
+    /// none.
+    const char     *ii_build_id;
+    uintptr_t       ii_start;
+    uintptr_t       ii_end;
+    /// The difference between where the image was loaded and the addresses
+    /// it was linked at, which its debug info uses.
+    uintptr_t       ii_bias;
+} loggy_os_log_image_info_s, *loggy_os_log_image_info_t;
+
+/// Describes the loaded image containing `address`. Returns false if it
+/// isn't in one. The strings live as long as the process.
+OS_EXPORT
+bool loggy_os_log_image_info(const void *address, loggy_os_log_image_info_t info);
+
+/// The path of the loaded image containing `address`, or `NULL` if it isn't
+/// in one.
+///
+/// Images are enumerated once, on first use, into a sorted table of address
+/// ranges; lookups are a binary search without locks or allocation. Images
+/// loaded later are added as they appear on Darwin; on Linux, an address the
+/// table misses makes it check the loader for changes and rescan.
+OS_EXPORT
+const char *_Nullable loggy_os_log_image_path(const void *address);
+
+/// The subsystem recorded for the image containing `address`, or `NULL` if
+/// none has been yet.
+OS_EXPORT
+const char *_Nullable loggy_os_log_image_subsystem(const void *address);
+
+/// Records a copy of `subsystem` for the image containing `address`. The
+/// first one recorded wins and is returned; `NULL` if `address` isn't in an
+/// image.
+OS_EXPORT
+const char *_Nullable loggy_os_log_image_set_subsystem(const void *address, const char *subsystem);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_log_image_h__ */
@@ -0,0 +1,112 @@
+//
+//  os_log_intern.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LOGGY_OS_LOG_INTERN_SIZE 4096
+
+// Entries are handed out of one array and never reused, so the slots only
+// ever go from empty to full and lookups need no more than acquire loads.
+typedef struct {
+    uint64_t in_hash;
+    const char *in_subsystem;
+    const char *in_category;
+    os_log_t in_log;
+} intern_entry_s, *intern_entry_t;
+
+static intern_entry_t intern_slots[LOGGY_OS_LOG_INTERN_SIZE];
+static intern_entry_s intern_entries[LOGGY_OS_LOG_INTERN_SIZE];
+static uint32_t intern_entry_cnt;
+
+#if !LOGGY_HAS_OS_LOG
+// Interned handles sit side by side, so their cached enabled masks share
+// cache lines rather than being scattered across the heap.
+static struct loggy_os_log_s intern_logs[LOGGY_OS_LOG_INTERN_SIZE];
+#endif
+
+static uint64_t intern_hash(const char *subsystem, const char *category) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *p = subsystem; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 0x100000001b3ull;
+    }
+    hash *= 0x100000001b3ull;
+    for (const char *p = category; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static bool intern_matches(intern_entry_t entry, uint64_t hash, const char *subsystem, const char *category) {
+    return entry->in_hash == hash && strcmp(entry->in_subsystem, subsystem) == 0 && strcmp(entry->in_category, category) == 0;
+}
+
+static intern_entry_t _Nullable intern_entry_create(uint64_t hash, const char *subsystem, const char *category) {
+    // Stops counting once full, so the count can't wrap around and hand out
+    // entries already in use.
+    uint32_t index = __atomic_load_n(&intern_entry_cnt, __ATOMIC_RELAXED);
+    do {
+        if (index >= LOGGY_OS_LOG_INTERN_SIZE) {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&intern_entry_cnt, &index, index + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    char *copied_subsystem = strdup(subsystem);
+    char *copied_category = strdup(category);
+    if (!copied_subsystem || !copied_category) {
+        free(copied_subsystem);
+        free(copied_category);
+        return NULL;
+    }
+
+    intern_entry_t entry = &intern_entries[index];
+    entry->in_hash = hash;
+    entry->in_subsystem = copied_subsystem;
+    entry->in_category = copied_category;
+
+#if LOGGY_HAS_OS_LOG
+    entry->in_log = os_log_create(subsystem, category);
+    _loggy_os_log_enabled_cache_add(entry->in_log);
+#else
+    entry->in_log = &intern_logs[index];
+    entry->in_log->subsystem = entry->in_subsystem;
+    entry->in_log->category = entry->in_category;
+#endif
+    return entry;
+}
+
+os_log_t loggy_os_log_intern(const char *subsystem, const char *category) {
+    uint64_t hash = intern_hash(subsystem, category);
+    size_t slot = (size_t)(hash >> 52) & (LOGGY_OS_LOG_INTERN_SIZE - 1);
+    intern_entry_t mine = NULL;
+
+    for (size_t i = 0; i < LOGGY_OS_LOG_INTERN_SIZE; i++) {
+        intern_entry_t *ptr = &intern_slots[(slot + i) & (LOGGY_OS_LOG_INTERN_SIZE - 1)];
+        intern_entry_t entry = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+
+        if (!entry) {
+            if (!mine && !(mine = intern_entry_create(hash, subsystem, category))) {
+                break;
+            }
+
+            if (__atomic_compare_exchange_n(ptr, &entry, mine, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+                return mine->in_log;
+            }
+        }
+
+        // Another thread may have been racing to intern the same name. Its
+        // entry wins; ours stays allocated but unreachable.
+        if (intern_matches(entry, hash, subsystem, category)) {
+            return entry->in_log;
+        }
+    }
+
+    // Out of room. Making a handle each time would leak one per call, so
+    // messages go to the default log instead.
+    return mine ? mine->in_log : OS_LOG_DEFAULT;
+}
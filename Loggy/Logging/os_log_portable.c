@@ -0,0 +1,31 @@
+//
+//  os_log_portable.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <stdlib.h>
+#include <string.h>
+
+struct loggy_os_log_s _os_log_default = {
+    .subsystem = "",
+    .category = "",
+};
+
+os_log_t os_log_create(const char *subsystem, const char *category) {
+    os_log_t log = calloc(1, sizeof(struct loggy_os_log_s));
+    if (!log) {
+        return OS_LOG_DEFAULT;
+    }
+
+    log->subsystem = strdup(subsystem);
+    log->category = strdup(category);
+    return log;
+}
+
+#endif
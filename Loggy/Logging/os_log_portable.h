@@ -0,0 +1,123 @@
+//
+//  os_log_portable.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_portable_h__
+#define __loggy_os_log_portable_h__
+
+// Stand-ins for the parts of <os/base.h> and <os/log.h> the shims rely on,
+// for platforms (i.e., Linux) that have no unified logging.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if !defined(__clang__)
+#define _Nullable
+#define _Nonnull
+#endif
+
+#ifndef __has_attribute
+#define __has_attribute(x) 0
+#endif
+
+#ifndef OS_ASSUME_NONNULL_BEGIN
+#if defined(__clang__)
+#define OS_ASSUME_NONNULL_BEGIN _Pragma("clang assume_nonnull begin")
+#define OS_ASSUME_NONNULL_END   _Pragma("clang assume_nonnull end")
+#else
+#define OS_ASSUME_NONNULL_BEGIN
+#define OS_ASSUME_NONNULL_END
+#endif
+#endif
+
+#ifndef OS_INLINE
+#define OS_INLINE static __inline__
+#endif
+
+#ifndef OS_ALWAYS_INLINE
+#define OS_ALWAYS_INLINE __attribute__((__always_inline__))
+#endif
+
+#ifndef OS_NOINLINE
+#define OS_NOINLINE __attribute__((__noinline__))
+#endif
+
+#ifndef OS_EXPORT
+#define OS_EXPORT extern __attribute__((__visibility__("default")))
+#endif
+
+#ifndef OS_SWIFT_NAME
+#if __has_attribute(swift_name)
+#define OS_SWIFT_NAME(_name) __attribute__((__swift_name__(#_name)))
+#else
+#define OS_SWIFT_NAME(_name)
+#endif
+#endif
+
+#ifndef OS_REFINED_FOR_SWIFT
+#if __has_attribute(swift_private)
+#define OS_REFINED_FOR_SWIFT __attribute__((__swift_private__))
+#else
+#define OS_REFINED_FOR_SWIFT
+#endif
+#endif
+
+#ifndef OS_ENUM
+#if defined(__clang__)
+#define OS_ENUM(_name, _type, ...) \
+    typedef enum : _type { __VA_ARGS__ } _name##_t
+#else
+#define OS_ENUM(_name, _type, ...) \
+    enum { __VA_ARGS__ }; typedef _type _name##_t
+#endif
+#endif
+
+#ifndef API_AVAILABLE
+#define API_AVAILABLE(...)
+#endif
+
+OS_ASSUME_NONNULL_BEGIN
+
+OS_ENUM(os_log_type, uint8_t,
+    OS_LOG_TYPE_DEFAULT = 0x00,
+    OS_LOG_TYPE_INFO    = 0x01,
+    OS_LOG_TYPE_DEBUG   = 0x02,
+    OS_LOG_TYPE_ERROR   = 0x10,
+    OS_LOG_TYPE_FAULT   = 0x11,
+);
+
+/// A log handle. Unlike Darwin, handles are plain structs owned by Loggy.
+typedef struct loggy_os_log_s {
+    const char *subsystem;
+    const char *category;
+    uint64_t enabled;
+    uint64_t truncated;
+} *os_log_t;
+
+OS_EXPORT struct loggy_os_log_s _os_log_default;
+
+#define OS_LOG_DEFAULT (&_os_log_default)
+
+/// Creates a log handle for `subsystem` and `category`. The strings are
+/// copied. Handles are never destroyed.
+OS_EXPORT
+os_log_t os_log_create(const char *subsystem, const char *category);
+
+/// Whether messages of `type` sent to `log` are kept, per the rules given to
+/// `loggy_os_log_configure`.
+OS_EXPORT
+bool os_log_type_enabled(os_log_t log, os_log_type_t type);
+
+/// Sets the types enabled for logs in `subsystem`, or only its `category` if
+/// given, as a mask of `LOGGY_OS_LOG_TYPE_BIT`s. The most specific rule wins.
+/// With no `subsystem`, sets the default, which is everything but debug.
+OS_EXPORT
+void loggy_os_log_configure(const char *_Nullable subsystem, const char *_Nullable category, uint8_t mask);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_log_portable_h__ */
@@ -0,0 +1,951 @@
+//
+//  os_log_query.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_query.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include "os_log_format.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define LOGGY_OS_LOG_QUERY_BATCH_BLOCKS 4
+
+typedef enum {
+    PREDICATE_AND,
+    PREDICATE_OR,
+    PREDICATE_NOT,
+    PREDICATE_COMPARE,
+} predicate_kind_t;
+
+typedef enum {
+    FIELD_TYPE,
+    FIELD_SUBSYSTEM,
+    FIELD_CATEGORY,
+    FIELD_FORMAT,
+    FIELD_ACTIVITY,
+    FIELD_TIME,
+    FIELD_ARG,
+    FIELD_INT,
+    FIELD_DOUBLE,
+    FIELD_STRING,
+} predicate_field_t;
+
+typedef enum {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_CONTAINS,
+    OP_BEGINSWITH,
+    OP_ENDSWITH,
+} predicate_op_t;
+
+typedef enum {
+    VALUE_NONE,
+    VALUE_INTEGER,
+    VALUE_FLOAT,
+    VALUE_STRING,
+} value_kind_t;
+
+// A value read from a record or written in a predicate. Integers keep their
+// bits with a sign flag, so signed and unsigned compare correctly.
+typedef struct {
+    value_kind_t    v_kind;
+    bool            v_negative;
+    uint64_t        v_bits;
+    double          v_float;
+    const char     *v_string;
+    size_t          v_len;
+} value_s, *value_t;
+
+typedef struct {
+    predicate_kind_t pn_kind;
+    uint32_t        pn_lhs;
+    uint32_t        pn_rhs;
+    predicate_field_t pn_field;
+    uint32_t        pn_arg;
+    predicate_op_t  pn_op;
+    value_s         pn_value;
+} predicate_node_s, *predicate_node_t;
+
+struct loggy_os_log_predicate_s {
+    predicate_node_s *p_nodes;
+    uint32_t        p_count;
+    uint32_t        p_capacity;
+    uint32_t        p_root;
+    char           *p_strings;
+};
+
+// MARK: - Parsing
+
+typedef struct {
+    const char     *ps_cursor;
+    loggy_os_log_predicate_t ps_predicate;
+    char           *ps_strings;
+    char           *_Nullable ps_error;
+    size_t          ps_error_size;
+    bool            ps_failed;
+} predicate_parser_s, *predicate_parser_t;
+
+__attribute__((__format__(__printf__, 2, 3)))
+static bool parse_fail(predicate_parser_t parser, const char *fmt, ...) {
+    if (!parser->ps_failed && parser->ps_error && parser->ps_error_size) {
+        va_list ap;
+        va_start(ap, fmt);
+        vsnprintf(parser->ps_error, parser->ps_error_size, fmt, ap);
+        va_end(ap);
+    }
+    parser->ps_failed = true;
+    return false;
+}
+
+static void parse_space(predicate_parser_t parser) {
+    while (isspace((unsigned char)*parser->ps_cursor)) {
+        parser->ps_cursor += 1;
+    }
+}
+
+// Consumes `token` if it's next. Words must match whole and ignore case.
+static bool parse_accept(predicate_parser_t parser, const char *token) {
+    parse_space(parser);
+    size_t len = strlen(token);
+    if (isalpha((unsigned char)token[0])) {
+        if (strncasecmp(parser->ps_cursor, token, len) != 0 || isalnum((unsigned char)parser->ps_cursor[len]) || parser->ps_cursor[len] == '_') {
+            return false;
+        }
+    } else if (strncmp(parser->ps_cursor, token, len) != 0) {
+        return false;
+    }
+    parser->ps_cursor += len;
+    return true;
+}
+
+static bool parse_node(predicate_parser_t parser, predicate_node_s node, uint32_t *index) {
+    loggy_os_log_predicate_t predicate = parser->ps_predicate;
+    if (predicate->p_count == predicate->p_capacity) {
+        uint32_t capacity = predicate->p_capacity ? predicate->p_capacity * 2 : 16;
+        predicate_node_s *nodes = realloc(predicate->p_nodes, capacity * sizeof(predicate_node_s));
+        if (!nodes) {
+            return parse_fail(parser, "out of memory");
+        }
+        predicate->p_nodes = nodes;
+        predicate->p_capacity = capacity;
+    }
+    *index = predicate->p_count++;
+    predicate->p_nodes[*index] = node;
+    return true;
+}
+
+static bool parse_field(predicate_parser_t parser, predicate_node_t node) {
+    static const struct { const char *name; predicate_field_t field; bool indexed; } fields[] = {
+        { "type", FIELD_TYPE, false },
+        { "subsystem", FIELD_SUBSYSTEM, false },
+        { "category", FIELD_CATEGORY, false },
+        { "format", FIELD_FORMAT, false },
+        { "activity", FIELD_ACTIVITY, false },
+        { "time", FIELD_TIME, false },
+        { "arg", FIELD_ARG, true },
+        { "int", FIELD_INT, true },
+        { "double", FIELD_DOUBLE, true },
+        { "string", FIELD_STRING, true },
+    };
+
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (!parse_accept(parser, fields[i].name)) {
+            continue;
+        }
+
+        node->pn_field = fields[i].field;
+        if (!fields[i].indexed) {
+            return true;
+        }
+
+        char *end;
+        if (!parse_accept(parser, "[")) {
+            return parse_fail(parser, "expected '[' after '%s'", fields[i].name);
+        }
+        parse_space(parser);
+        unsigned long arg = strtoul(parser->ps_cursor, &end, 10);
+        if (end == parser->ps_cursor || arg > UINT32_MAX) {
+            return parse_fail(parser, "expected an argument number after '%s['", fields[i].name);
+        }
+        parser->ps_cursor = end;
+        if (!parse_accept(parser, "]")) {
+            return parse_fail(parser, "expected ']' after '%s[%lu'", fields[i].name, arg);
+        }
+        node->pn_arg = (uint32_t)arg;
+        return true;
+    }
+
+    return parse_fail(parser, "expected a field at '%.16s'", parser->ps_cursor);
+}
+
+static bool parse_op(predicate_parser_t parser, predicate_node_t node) {
+    // Longer operators first, so `<=` isn't taken for `<`.
+    static const struct { const char *token; predicate_op_t op; } ops[] = {
+        { "==", OP_EQ }, { "!=", OP_NE }, { "<=", OP_LE }, { ">=", OP_GE },
+        { "<", OP_LT }, { ">", OP_GT }, { "=", OP_EQ },
+        { "contains", OP_CONTAINS }, { "beginswith", OP_BEGINSWITH }, { "endswith", OP_ENDSWITH },
+    };
+
+    for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (parse_accept(parser, ops[i].token)) {
+            node->pn_op = ops[i].op;
+            return true;
+        }
+    }
+    return parse_fail(parser, "expected an operator at '%.16s'", parser->ps_cursor);
+}
+
+static bool parse_string(predicate_parser_t parser, value_t value) {
+    char quote = *parser->ps_cursor++;
+    char *out = parser->ps_strings;
+    value->v_kind = VALUE_STRING;
+    value->v_string = out;
+
+    for (;;) {
+        char c = *parser->ps_cursor++;
+        if (!c) {
+            return parse_fail(parser, "unterminated string");
+        } else if (c == quote) {
+            break;
+        } else if (c == '\\' && *parser->ps_cursor) {
+            c = *parser->ps_cursor++;
+        }
+        *out++ = c;
+    }
+
+    value->v_len = (size_t)(out - value->v_string);
+    *out++ = 0;
+    parser->ps_strings = out;
+    return true;
+}
+
+static bool parse_value(predicate_parser_t parser, predicate_node_t node) {
+    static const struct { const char *name; os_log_type_t type; } types[] = {
+        { "default", OS_LOG_TYPE_DEFAULT },
+        { "info", OS_LOG_TYPE_INFO },
+        { "debug", OS_LOG_TYPE_DEBUG },
+        { "error", OS_LOG_TYPE_ERROR },
+        { "fault", OS_LOG_TYPE_FAULT },
+    };
+
+    value_t value = &node->pn_value;
+    parse_space(parser);
+
+    if (node->pn_field == FIELD_TYPE) {
+        if (node->pn_op != OP_EQ && node->pn_op != OP_NE) {
+            return parse_fail(parser, "types only compare with '==' and '!='");
+        }
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (parse_accept(parser, types[i].name)) {
+                *value = (value_s){ .v_kind = VALUE_INTEGER, .v_bits = types[i].type };
+                return true;
+            }
+        }
+        return parse_fail(parser, "expected a type at '%.16s'", parser->ps_cursor);
+    }
+
+    if (*parser->ps_cursor == '"' || *parser->ps_cursor == '\'') {
+        return parse_string(parser, value);
+    }
+
+    const char *start = parser->ps_cursor;
+    bool negative = *start == '-';
+    char *end;
+    errno = 0;
+    uint64_t bits = strtoull(start + negative, &end, 0);
+    if (end != start + negative && !(*end && strchr(".eE", *end)) && errno == 0 && (!negative || bits <= (uint64_t)INT64_MAX + 1)) {
+        *value = (value_s){ .v_kind = VALUE_INTEGER, .v_negative = negative && bits, .v_bits = negative ? (uint64_t)0 - bits : bits };
+        parser->ps_cursor = end;
+        return true;
+    }
+
+    double number = strtod(start, &end);
+    if (end == start) {
+        return parse_fail(parser, "expected a value at '%.16s'", start);
+    }
+    *value = (value_s){ .v_kind = VALUE_FLOAT, .v_float = number };
+    parser->ps_cursor = end;
+    return true;
+}
+
+static bool parse_or(predicate_parser_t parser, uint32_t *index);
+
+static bool parse_unary(predicate_parser_t parser, uint32_t *index) {
+    if (parse_accept(parser, "!") || parse_accept(parser, "not")) {
+        uint32_t child;
+        return parse_unary(parser, &child) && parse_node(parser, (predicate_node_s){ .pn_kind = PREDICATE_NOT, .pn_lhs = child }, index);
+    }
+
+    if (parse_accept(parser, "(")) {
+        if (!parse_or(parser, index)) {
+            return false;
+        }
+        return parse_accept(parser, ")") || parse_fail(parser, "expected ')' at '%.16s'", parser->ps_cursor);
+    }
+
+    predicate_node_s node = { .pn_kind = PREDICATE_COMPARE };
+    if (!parse_field(parser, &node) || !parse_op(parser, &node) || !parse_value(parser, &node)) {
+        return false;
+    }
+
+    bool string_op = node.pn_op >= OP_CONTAINS;
+    if (string_op && node.pn_value.v_kind != VALUE_STRING) {
+        return parse_fail(parser, "'CONTAINS', 'BEGINSWITH', and 'ENDSWITH' take strings");
+    }
+    return parse_node(parser, node, index);
+}
+
+static bool parse_and(predicate_parser_t parser, uint32_t *index) {
+    if (!parse_unary(parser, index)) {
+        return false;
+    }
+    while (parse_accept(parser, "&&") || parse_accept(parser, "and")) {
+        uint32_t rhs;
+        if (!parse_unary(parser, &rhs) || !parse_node(parser, (predicate_node_s){ .pn_kind = PREDICATE_AND, .pn_lhs = *index, .pn_rhs = rhs }, index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_or(predicate_parser_t parser, uint32_t *index) {
+    if (!parse_and(parser, index)) {
+        return false;
+    }
+    while (parse_accept(parser, "||") || parse_accept(parser, "or")) {
+        uint32_t rhs;
+        if (!parse_and(parser, &rhs) || !parse_node(parser, (predicate_node_s){ .pn_kind = PREDICATE_OR, .pn_lhs = *index, .pn_rhs = rhs }, index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+loggy_os_log_predicate_t loggy_os_log_predicate_create(const char *text, char *error, size_t error_size) {
+    loggy_os_log_predicate_t predicate = calloc(1, sizeof(struct loggy_os_log_predicate_s));
+    // Unescaped strings are never longer than the text they came from.
+    char *strings = malloc(strlen(text) + 1);
+    if (!predicate || !strings) {
+        free(predicate);
+        free(strings);
+        return NULL;
+    }
+    predicate->p_strings = strings;
+
+    predicate_parser_s parser = {
+        .ps_cursor = text,
+        .ps_predicate = predicate,
+        .ps_strings = strings,
+        .ps_error = error,
+        .ps_error_size = error_size,
+    };
+    if (parse_or(&parser, &predicate->p_root)) {
+        parse_space(&parser);
+        if (*parser.ps_cursor) {
+            parse_fail(&parser, "unexpected '%.16s'", parser.ps_cursor);
+        }
+    }
+
+    if (parser.ps_failed) {
+        loggy_os_log_predicate_destroy(predicate);
+        return NULL;
+    }
+    return predicate;
+}
+
+void loggy_os_log_predicate_destroy(loggy_os_log_predicate_t predicate) {
+    free(predicate->p_nodes);
+    free(predicate->p_strings);
+    free(predicate);
+}
+
+// MARK: - Evaluation
+
+static inline bool arg_wanted(predicate_field_t field, value_kind_t kind) {
+    switch (field) {
+    case FIELD_INT: return kind == VALUE_INTEGER;
+    case FIELD_DOUBLE: return kind == VALUE_FLOAT;
+    case FIELD_STRING: return kind == VALUE_STRING;
+    default: return true;
+    }
+}
+
+// Finds the `n`th argument of the kind `field` asks for, walking the
+// format's conversions and the buffer's commands in step.
+static bool record_arg(const loggy_os_log_record_s *record, predicate_field_t field, uint32_t n, value_t value) {
+    const uint8_t *cursor = record->lr_buf + sizeof(os_log_fmt_hdr_s);
+    const uint8_t *end = record->lr_buf + record->lr_len;
+    if (record->lr_len < sizeof(os_log_fmt_hdr_s)) {
+        return false;
+    }
+
+    os_log_fmt_cmd_s cmd;
+    const uint8_t *data = NULL;
+    uint32_t seen = 0;
+
+    for (const char *p = record->lr_format; (p = strchr(p, '%'));) {
+        p += 1;
+        if (*p == '%') {
+            p += 1;
+            continue;
+        }
+
+        if (*p == '{') {
+            if (!(p = strchr(p, '}'))) {
+                return false;
+            }
+            p += 1;
+        }
+
+        while (*p && strchr("-+ #0", *p)) {
+            p += 1;
+        }
+
+        // Star widths and precisions are commands of their own.
+        if (*p == '*') {
+            p += 1;
+            if (!loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+                return false;
+            }
+        }
+        while (*p >= '0' && *p <= '9') {
+            p += 1;
+        }
+        if (*p == '.') {
+            p += 1;
+            if (*p == '*') {
+                p += 1;
+                if (!loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+                    return false;
+                }
+            }
+            while (*p >= '0' && *p <= '9') {
+                p += 1;
+            }
+        }
+        while (*p && strchr("hlqLzjt", *p)) {
+            p += 1;
+        }
+
+        char conversion = *p;
+        if (!conversion || !loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+            return false;
+        }
+        p += 1;
+
+        value_s arg = { .v_kind = VALUE_NONE };
+        if (cmd.cmd_type == OSLF_CMD_TYPE_SCALAR && strchr("dic", conversion)) {
+            int64_t v = loggy_os_log_fmt_read_signed(data, cmd.cmd_size);
+            arg = (value_s){ .v_kind = VALUE_INTEGER, .v_negative = v < 0, .v_bits = (uint64_t)v };
+        } else if (cmd.cmd_type == OSLF_CMD_TYPE_SCALAR && strchr("uoxXp", conversion)) {
+            arg = (value_s){ .v_kind = VALUE_INTEGER, .v_bits = loggy_os_log_fmt_read_unsigned(data, cmd.cmd_size) };
+        } else if (cmd.cmd_type == OSLF_CMD_TYPE_SCALAR && strchr("eEfFgGaA", conversion)) {
+            arg = (value_s){ .v_kind = VALUE_FLOAT, .v_float = loggy_os_log_fmt_read_double(data, cmd.cmd_size) };
+        } else if (conversion == 's' && cmd.cmd_type == OSLF_CMD_TYPE_STRING && (cmd.cmd_flags & OSLF_CMD_FLAG_LOGGY_INLINE)) {
+            arg = (value_s){ .v_kind = VALUE_STRING, .v_string = (const char *)data, .v_len = strnlen((const char *)data, cmd.cmd_size) };
+        } else if (conversion == 's') {
+            arg.v_kind = VALUE_STRING;
+        }
+
+        if (arg_wanted(field, arg.v_kind) && seen++ == n) {
+            *value = arg;
+            return arg.v_kind != VALUE_NONE;
+        }
+    }
+    return false;
+}
+
+static bool record_value(const loggy_os_log_record_s *record, const predicate_node_s *node, value_t value) {
+    switch (node->pn_field) {
+    case FIELD_TYPE:
+        *value = (value_s){ .v_kind = VALUE_INTEGER, .v_bits = record->lr_type };
+        return true;
+    case FIELD_ACTIVITY:
+        *value = (value_s){ .v_kind = VALUE_INTEGER, .v_bits = record->lr_activity };
+        return true;
+    case FIELD_TIME:
+        *value = (value_s){ .v_kind = VALUE_INTEGER, .v_bits = record->lr_time };
+        return true;
+    case FIELD_SUBSYSTEM:
+        *value = (value_s){ .v_kind = VALUE_STRING, .v_string = record->lr_log->subsystem, .v_len = strlen(record->lr_log->subsystem) };
+        return true;
+    case FIELD_CATEGORY:
+        *value = (value_s){ .v_kind = VALUE_STRING, .v_string = record->lr_log->category, .v_len = strlen(record->lr_log->category) };
+        return true;
+    case FIELD_FORMAT:
+        *value = (value_s){ .v_kind = VALUE_STRING, .v_string = record->lr_format, .v_len = strlen(record->lr_format) };
+        return true;
+    default:
+        return record_arg(record, node->pn_field, node->pn_arg, value);
+    }
+}
+
+// Orders two values of compatible kinds, like `memcmp`.
+static int value_compare(const value_s *lhs, const value_s *rhs) {
+    if (lhs->v_kind == VALUE_STRING) {
+        size_t len = lhs->v_len < rhs->v_len ? lhs->v_len : rhs->v_len;
+        int order = len ? memcmp(lhs->v_string, rhs->v_string, len) : 0;
+        return order ? order : (lhs->v_len > rhs->v_len) - (lhs->v_len < rhs->v_len);
+    }
+
+    if (lhs->v_kind == VALUE_FLOAT || rhs->v_kind == VALUE_FLOAT) {
+        double l = lhs->v_kind == VALUE_FLOAT ? lhs->v_float : lhs->v_negative ? (double)(int64_t)lhs->v_bits : (double)lhs->v_bits;
+        double r = rhs->v_kind == VALUE_FLOAT ? rhs->v_float : rhs->v_negative ? (double)(int64_t)rhs->v_bits : (double)rhs->v_bits;
+        return (l > r) - (l < r);
+    }
+
+    // Two's complement orders negative numbers correctly as unsigned.
+    if (lhs->v_negative != rhs->v_negative) {
+        return lhs->v_negative ? -1 : 1;
+    }
+    return (lhs->v_bits > rhs->v_bits) - (lhs->v_bits < rhs->v_bits);
+}
+
+static bool value_contains(const value_s *lhs, const value_s *rhs) {
+    if (rhs->v_len > lhs->v_len) {
+        return false;
+    }
+    for (size_t i = 0; i + rhs->v_len <= lhs->v_len; i++) {
+        if (memcmp(lhs->v_string + i, rhs->v_string, rhs->v_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool predicate_compare(const predicate_node_s *node, const loggy_os_log_record_s *record) {
+    value_s value;
+    const value_s *expected = &node->pn_value;
+    if (!record_value(record, node, &value)) {
+        return false;
+    }
+
+    if ((value.v_kind == VALUE_STRING) != (expected->v_kind == VALUE_STRING) || (value.v_kind == VALUE_STRING && !value.v_string)) {
+        return node->pn_op == OP_NE;
+    }
+
+    switch (node->pn_op) {
+    case OP_EQ: return value_compare(&value, expected) == 0;
+    case OP_NE: return value_compare(&value, expected) != 0;
+    case OP_LT: return value_compare(&value, expected) < 0;
+    case OP_LE: return value_compare(&value, expected) <= 0;
+    case OP_GT: return value_compare(&value, expected) > 0;
+    case OP_GE: return value_compare(&value, expected) >= 0;
+    case OP_CONTAINS: return value_contains(&value, expected);
+    case OP_BEGINSWITH: return value.v_len >= expected->v_len && memcmp(value.v_string, expected->v_string, expected->v_len) == 0;
+    case OP_ENDSWITH: return value.v_len >= expected->v_len && memcmp(value.v_string + value.v_len - expected->v_len, expected->v_string, expected->v_len) == 0;
+    }
+    return false;
+}
+
+static bool predicate_evaluate(loggy_os_log_predicate_t predicate, uint32_t index, const loggy_os_log_record_s *record) {
+    const predicate_node_s *node = &predicate->p_nodes[index];
+    switch (node->pn_kind) {
+    case PREDICATE_AND:
+        return predicate_evaluate(predicate, node->pn_lhs, record) && predicate_evaluate(predicate, node->pn_rhs, record);
+    case PREDICATE_OR:
+        return predicate_evaluate(predicate, node->pn_lhs, record) || predicate_evaluate(predicate, node->pn_rhs, record);
+    case PREDICATE_NOT:
+        return !predicate_evaluate(predicate, node->pn_lhs, record);
+    case PREDICATE_COMPARE:
+        return predicate_compare(node, record);
+    }
+    return false;
+}
+
+bool loggy_os_log_predicate_evaluate(loggy_os_log_predicate_t predicate, const loggy_os_log_record_s *record) {
+    return predicate_evaluate(predicate, predicate->p_root, record);
+}
+
+// MARK: - Bounds
+
+// The types a node allows, erring toward more.
+static uint8_t predicate_types(loggy_os_log_predicate_t predicate, uint32_t index) {
+    const predicate_node_s *node = &predicate->p_nodes[index];
+    switch (node->pn_kind) {
+    case PREDICATE_AND:
+        return predicate_types(predicate, node->pn_lhs) & predicate_types(predicate, node->pn_rhs);
+    case PREDICATE_OR:
+        return predicate_types(predicate, node->pn_lhs) | predicate_types(predicate, node->pn_rhs);
+    case PREDICATE_NOT:
+        return UINT8_MAX;
+    case PREDICATE_COMPARE:
+        if (node->pn_field != FIELD_TYPE) {
+            return UINT8_MAX;
+        }
+        uint8_t bit = (uint8_t)LOGGY_OS_LOG_TYPE_BIT(node->pn_value.v_bits);
+        return node->pn_op == OP_EQ ? bit : (uint8_t)~bit;
+    }
+    return UINT8_MAX;
+}
+
+// Narrows the time span and subsystem by the comparisons every match needs.
+static void predicate_required(loggy_os_log_predicate_t predicate, uint32_t index, loggy_os_log_segment_query_s *query) {
+    const predicate_node_s *node = &predicate->p_nodes[index];
+    if (node->pn_kind == PREDICATE_AND) {
+        predicate_required(predicate, node->pn_lhs, query);
+        predicate_required(predicate, node->pn_rhs, query);
+        return;
+    }
+
+    const value_s *value = &node->pn_value;
+    if (node->pn_kind != PREDICATE_COMPARE) {
+        return;
+    }
+
+    if (node->pn_field == FIELD_SUBSYSTEM && node->pn_op == OP_EQ && value->v_kind == VALUE_STRING) {
+        query->sq_subsystem = value->v_string;
+    }
+
+    if (node->pn_field != FIELD_TIME || value->v_kind != VALUE_INTEGER || value->v_negative) {
+        return;
+    }
+
+    uint64_t start = 0, end = UINT64_MAX;
+    switch (node->pn_op) {
+    case OP_EQ: start = value->v_bits; end = value->v_bits + 1; break;
+    case OP_GT: start = value->v_bits + 1; break;
+    case OP_GE: start = value->v_bits; break;
+    case OP_LT: end = value->v_bits; break;
+    case OP_LE: end = value->v_bits + 1; break;
+    default: break;
+    }
+
+    if (start > query->sq_start) {
+        query->sq_start = start;
+    }
+    if (end && end != UINT64_MAX && (!query->sq_end || end < query->sq_end)) {
+        query->sq_end = end;
+    }
+}
+
+void loggy_os_log_predicate_bounds(loggy_os_log_predicate_t predicate, loggy_os_log_segment_query_s *query) {
+    uint8_t types = predicate_types(predicate, predicate->p_root);
+    if (query->sq_types) {
+        types &= query->sq_types;
+    }
+    // No type matching at all is left to evaluation to discover.
+    if (types && types != UINT8_MAX) {
+        query->sq_types = types;
+    }
+    predicate_required(predicate, predicate->p_root, query);
+}
+
+// MARK: - Queries
+
+// A match, with where it was in the segment to order it among records
+// from the same time.
+typedef struct {
+    loggy_os_log_record_s qe_record;
+    uint32_t        qe_block;
+    uint64_t        qe_offset;
+} query_entry_s, *query_entry_t;
+
+// The matches from a run of blocks of one segment, sorted by time.
+typedef struct {
+    query_entry_t   qb_records;
+    size_t          qb_count;
+    size_t          qb_capacity;
+    size_t          qb_next;
+    // The decompressed blocks the records point into.
+    uint8_t       **qb_bufs;
+    size_t         *qb_capacities;
+    size_t          qb_buf_count;
+} query_batch_s, *query_batch_t;
+
+typedef struct query_run_s *query_run_t;
+
+// One segment being scanned. While its current batch is merged, the next
+// is filled on the pool.
+typedef struct {
+    query_run_t     qs_run;
+    loggy_os_log_segment_reader_s qs_reader;
+    loggy_os_log_segment_query_s qs_bounds;
+    // For each block, the earliest time in it or any matching block after
+    // it, from the index; one past the last block is `UINT64_MAX`.
+    uint64_t       *qs_horizons;
+    uint32_t        qs_next_block;
+    query_batch_s   qs_batches[2];
+    query_batch_t   qs_current;
+    query_batch_t   qs_filling;
+    bool            qs_pending;
+    bool            qs_ready;
+    bool            qs_done;
+} query_stream_s, *query_stream_t;
+
+struct query_run_s {
+    loggy_os_log_predicate_t _Nullable qr_predicate;
+    pthread_mutex_t qr_lock;
+    pthread_cond_t  qr_ready;
+};
+
+// Records from the same time keep the order they were written in: blocks
+// in order, and records in order within a block. Their buffers can't be
+// compared, since each block is decompressed into a buffer of its own.
+static int query_record_order(const void *lhs, const void *rhs) {
+    const query_entry_s *l = lhs, *r = rhs;
+    if (l->qe_record.lr_time != r->qe_record.lr_time) {
+        return l->qe_record.lr_time < r->qe_record.lr_time ? -1 : 1;
+    }
+    if (l->qe_block != r->qe_block) {
+        return l->qe_block < r->qe_block ? -1 : 1;
+    }
+    return (l->qe_offset > r->qe_offset) - (l->qe_offset < r->qe_offset);
+}
+
+static bool query_batch_add(query_batch_t batch, const loggy_os_log_record_s *record, uint32_t block, uint64_t offset) {
+    if (batch->qb_count == batch->qb_capacity) {
+        size_t capacity = batch->qb_capacity ? batch->qb_capacity * 2 : 256;
+        query_entry_t records = realloc(batch->qb_records, capacity * sizeof(query_entry_s));
+        if (!records) {
+            return false;
+        }
+        batch->qb_records = records;
+        batch->qb_capacity = capacity;
+    }
+    batch->qb_records[batch->qb_count++] = (query_entry_s){ .qe_record = *record, .qe_block = block, .qe_offset = offset };
+    return true;
+}
+
+static bool query_batch_grow(query_batch_t batch) {
+    size_t count = batch->qb_buf_count ? batch->qb_buf_count * 2 : LOGGY_OS_LOG_QUERY_BATCH_BLOCKS;
+    uint8_t **bufs = realloc(batch->qb_bufs, count * sizeof(uint8_t *));
+    if (!bufs) {
+        return false;
+    }
+    batch->qb_bufs = bufs;
+
+    size_t *capacities = realloc(batch->qb_capacities, count * sizeof(size_t));
+    if (!capacities) {
+        return false;
+    }
+    batch->qb_capacities = capacities;
+
+    for (size_t i = batch->qb_buf_count; i < count; i++) {
+        bufs[i] = NULL;
+        capacities[i] = 0;
+    }
+    batch->qb_buf_count = count;
+    return true;
+}
+
+static bool query_horizons(query_stream_t stream) {
+    loggy_os_log_segment_reader_t reader = &stream->qs_reader;
+    uint32_t blocks = reader->sr_trailer->st_index_count;
+    uint64_t *horizons = malloc(((size_t)blocks + 1) * sizeof(uint64_t));
+    if (!horizons) {
+        return false;
+    }
+
+    horizons[blocks] = UINT64_MAX;
+    for (uint32_t i = blocks; i-- > 0;) {
+        uint64_t time = loggy_os_log_segment_block_matches(reader, i, &stream->qs_bounds) ? loggy_os_log_segment_block_min_time(reader, i) : UINT64_MAX;
+        horizons[i] = time < horizons[i + 1] ? time : horizons[i + 1];
+    }
+    stream->qs_horizons = horizons;
+    return true;
+}
+
+// Scans blocks until some have matched, or the segment runs out.
+//
+// Blocks overlap in time, since a record's time is taken before it's
+// appended. Each batch is sorted on its own, so a batch keeps taking blocks
+// until no later one can hold a record earlier than its latest; then every
+// record in the next batch sorts after every record in this one.
+static void query_fill(void *context) {
+    query_stream_t stream = context;
+    query_run_t run = stream->qs_run;
+    loggy_os_log_segment_reader_t reader = &stream->qs_reader;
+    const loggy_os_log_segment_query_s *bounds = &stream->qs_bounds;
+    query_batch_t batch = stream->qs_filling;
+    uint32_t blocks = reader->sr_trailer->st_index_count;
+    size_t used = 0;
+    uint64_t latest = 0;
+
+    batch->qb_count = 0;
+    batch->qb_next = 0;
+
+    while (stream->qs_next_block < blocks && (used < LOGGY_OS_LOG_QUERY_BATCH_BLOCKS || stream->qs_horizons[stream->qs_next_block] < latest)) {
+        uint32_t i = stream->qs_next_block++;
+        if (!loggy_os_log_segment_block_matches(reader, i, bounds)) {
+            continue;
+        }
+        if (used == batch->qb_buf_count && !query_batch_grow(batch)) {
+            break;
+        }
+
+        const uint8_t *records = loggy_os_log_segment_block_records(reader, i, &batch->qb_bufs[used], &batch->qb_capacities[used]);
+        if (!records) {
+            continue;
+        }
+
+        size_t before = batch->qb_count;
+        loggy_os_log_record_s record;
+        uint64_t offset = 0, start = 0;
+        uint64_t end_time = bounds->sq_end ? bounds->sq_end : UINT64_MAX;
+        for (; loggy_os_log_segment_record_next(reader, i, records, &offset, &record); start = offset) {
+            if (record.lr_time < bounds->sq_start || record.lr_time >= end_time
+                || (run->qr_predicate && !loggy_os_log_predicate_evaluate(run->qr_predicate, &record))) {
+                continue;
+            }
+            if (!query_batch_add(batch, &record, i, start)) {
+                break;
+            }
+            if (record.lr_time > latest) {
+                latest = record.lr_time;
+            }
+        }
+
+        // Only keep the buffer if records point into it.
+        if (batch->qb_count > before) {
+            used += 1;
+        }
+    }
+
+    if (batch->qb_count) {
+        qsort(batch->qb_records, batch->qb_count, sizeof(query_entry_s), query_record_order);
+    }
+
+    pthread_mutex_lock(&run->qr_lock);
+    stream->qs_ready = true;
+    pthread_cond_broadcast(&run->qr_ready);
+    pthread_mutex_unlock(&run->qr_lock);
+}
+
+static void query_schedule(query_stream_t stream, loggy_os_activity_pool_t pool) {
+    stream->qs_ready = false;
+    stream->qs_pending = true;
+    if (pool) {
+        loggy_os_activity_pool_async(pool, stream, query_fill);
+    } else {
+        query_fill(stream);
+    }
+}
+
+// Makes the next filled batch current, refilling the other. Returns false
+// once the segment has no more matches.
+static bool query_advance(query_stream_t stream, loggy_os_activity_pool_t pool) {
+    query_run_t run = stream->qs_run;
+    while (stream->qs_pending) {
+        pthread_mutex_lock(&run->qr_lock);
+        while (!stream->qs_ready) {
+            pthread_cond_wait(&run->qr_ready, &run->qr_lock);
+        }
+        pthread_mutex_unlock(&run->qr_lock);
+
+        query_batch_t filled = stream->qs_filling;
+        stream->qs_filling = stream->qs_current;
+        stream->qs_current = filled;
+        stream->qs_pending = false;
+
+        if (stream->qs_next_block < stream->qs_reader.sr_trailer->st_index_count) {
+            query_schedule(stream, pool);
+        }
+        if (filled->qb_count) {
+            return true;
+        }
+    }
+
+    stream->qs_done = true;
+    return false;
+}
+
+size_t loggy_os_log_query(const char *const *paths, size_t count, loggy_os_log_predicate_t predicate, loggy_os_activity_pool_t pool, void (*handler)(void *context, const loggy_os_log_record_s *record), void *context) {
+    struct query_run_s run = { .qr_predicate = predicate };
+    query_stream_t streams = calloc(count, sizeof(query_stream_s));
+    if (!streams) {
+        return 0;
+    }
+
+    pthread_mutex_init(&run.qr_lock, NULL);
+    pthread_cond_init(&run.qr_ready, NULL);
+
+    size_t open = 0;
+    for (size_t i = 0; i < count; i++) {
+        query_stream_t stream = &streams[open];
+        if (!loggy_os_log_segment_reader_open(&stream->qs_reader, paths[i], NULL)) {
+            continue;
+        }
+        stream->qs_run = &run;
+        stream->qs_current = &stream->qs_batches[0];
+        stream->qs_filling = &stream->qs_batches[1];
+        if (predicate) {
+            loggy_os_log_predicate_bounds(predicate, &stream->qs_bounds);
+        }
+        if (!query_horizons(stream)) {
+            loggy_os_log_segment_reader_close(&stream->qs_reader);
+            continue;
+        }
+        open += 1;
+        query_schedule(stream, pool);
+    }
+
+    for (size_t i = 0; i < open; i++) {
+        query_advance(&streams[i], pool);
+    }
+
+    // Merge by always taking the earliest record at the head of a stream.
+    size_t handled = 0;
+    for (;;) {
+        query_stream_t earliest = NULL;
+        for (size_t i = 0; i < open; i++) {
+            query_stream_t stream = &streams[i];
+            if (stream->qs_done) {
+                continue;
+            }
+            const loggy_os_log_record_s *head = &stream->qs_current->qb_records[stream->qs_current->qb_next].qe_record;
+            if (!earliest || head->lr_time < earliest->qs_current->qb_records[earliest->qs_current->qb_next].qe_record.lr_time) {
+                earliest = stream;
+            }
+        }
+
+        if (!earliest) {
+            break;
+        }
+
+        query_batch_t batch = earliest->qs_current;
+        handler(context, &batch->qb_records[batch->qb_next++].qe_record);
+        handled += 1;
+
+        if (batch->qb_next == batch->qb_count) {
+            query_advance(earliest, pool);
+        }
+    }
+
+    for (size_t i = 0; i < open; i++) {
+        query_stream_t stream = &streams[i];
+        for (size_t b = 0; b < 2; b++) {
+            query_batch_t batch = &stream->qs_batches[b];
+            free(batch->qb_records);
+            for (size_t k = 0; k < batch->qb_buf_count; k++) {
+                free(batch->qb_bufs[k]);
+            }
+            free(batch->qb_bufs);
+            free(batch->qb_capacities);
+        }
+        free(stream->qs_horizons);
+        loggy_os_log_segment_reader_close(&stream->qs_reader);
+    }
+
+    pthread_cond_destroy(&run.qr_ready);
+    pthread_mutex_destroy(&run.qr_lock);
+    free(streams);
+    return handled;
+}
+
+#endif
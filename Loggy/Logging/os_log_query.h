@@ -0,0 +1,75 @@
+//
+//  os_log_query.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_query_h__
+#define __loggy_os_log_query_h__
+
+#include "os_log_segment.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// A compiled filter over log records, in a language modeled on the one
+/// `log show --predicate` takes:
+///
+///     type == error && subsystem == "com.example.app" && int[2] > 500
+///
+/// The fields are:
+///
+/// - `type`: one of `default`, `info`, `debug`, `error`, or `fault`
+/// - `subsystem`, `category`, `format`: strings
+/// - `activity`, `time`: integers; `time` is in `lr_time` nanoseconds
+/// - `arg[N]`: the format's Nth argument, counting from zero
+/// - `int[N]`, `double[N]`, `string[N]`: the Nth argument of that kind, so
+///   `int[2]` is the third integer
+///
+/// Numbers and strings compare with `==`, `!=`, `<`, `<=`, `>`, and `>=`;
+/// strings also take `CONTAINS`, `BEGINSWITH`, and `ENDSWITH`. Comparisons
+/// combine with `&&` or `AND`, `||` or `OR`, `!` or `NOT`, and parentheses.
+///
+/// Arguments are read straight from the encoded commands. The format is only
+/// scanned to see which conversion each command belongs to, never rendered.
+/// Arguments that continued into chunks aren't seen.
+typedef struct loggy_os_log_predicate_s *loggy_os_log_predicate_t;
+
+/// Compiles `text`. Returns `NULL` if it doesn't parse, with the reason in
+/// `error` if given.
+OS_EXPORT
+loggy_os_log_predicate_t _Nullable loggy_os_log_predicate_create(const char *text, char *_Nullable error, size_t error_size);
+
+OS_EXPORT
+void loggy_os_log_predicate_destroy(loggy_os_log_predicate_t predicate);
+
+/// Whether `record` matches. Safe to call from any number of threads.
+OS_EXPORT
+bool loggy_os_log_predicate_evaluate(loggy_os_log_predicate_t predicate, const loggy_os_log_record_s *record);
+
+/// Narrows `query` to the time span, types, and subsystem `predicate`
+/// requires, so the segment index can skip blocks that can't match.
+/// `sq_subsystem` may then point into the predicate.
+OS_EXPORT
+void loggy_os_log_predicate_bounds(loggy_os_log_predicate_t predicate, loggy_os_log_segment_query_s *query);
+
+/// Passes every record in the segments at `paths` that matches `predicate`
+/// to `handler`, merged into time order. Segments that can't be read are
+/// skipped.
+///
+/// Each segment is scanned a few blocks at a time on `pool` if given, ahead
+/// of the merge, so independent segments are decoded and filtered in
+/// parallel. Threads racing to append can leave a segment's records slightly
+/// out of time order; they're sorted within each batch of blocks scanned.
+/// The record's pointers are only valid during the call. Returns the number
+/// of records handled.
+OS_EXPORT
+size_t loggy_os_log_query(const char *const _Nonnull *_Nonnull paths, size_t count, loggy_os_log_predicate_t _Nullable predicate, loggy_os_activity_pool_t _Nullable pool, void (*handler)(void *_Nullable context, const loggy_os_log_record_s *record), void *_Nullable context);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_query_h__ */
@@ -0,0 +1,253 @@
+//
+//  os_log_rate_limit.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+#include <pthread.h>
+#include <time.h>
+
+#define LOGGY_OS_LOG_RATE_LIMIT_SIZE    1024
+#define LOGGY_OS_LOG_RATE_LIMIT_PROBE   8
+#define LOGGY_OS_LOG_RATE_LIMIT_LINE    64
+
+// Ticks are 2^20ns, about a millisecond.
+#define LOGGY_OS_LOG_RATE_LIMIT_TICK_SHIFT  20
+// Tokens are fixed point, so a refill that comes to part of a token isn't
+// lost; a whole token is 1 << FRACTION_BITS.
+#define LOGGY_OS_LOG_RATE_LIMIT_FRACTION_BITS   8
+#define LOGGY_OS_LOG_RATE_LIMIT_TOKEN           (1ull << LOGGY_OS_LOG_RATE_LIMIT_FRACTION_BITS)
+#define LOGGY_OS_LOG_RATE_LIMIT_TOKEN_BITS      (16 + LOGGY_OS_LOG_RATE_LIMIT_FRACTION_BITS)
+
+// The flusher checks at least this often, even when the rate is high.
+#define LOGGY_OS_LOG_RATE_LIMIT_MIN_FLUSH   1000000ull
+#define LOGGY_OS_LOG_RATE_LIMIT_MAX_FLUSH   1000000000ull
+
+// A bucket is packed into one word so it can be updated with a single CAS:
+// the tick it was last refilled, above the tokens left. Zero means a full
+// bucket, so a freshly claimed site needs no further setup. Each site gets a
+// cache line so hot sites on different cores don't contend.
+//
+// The log, type, and image of the last suppressed message are kept so the
+// flusher can report on the site's behalf.
+typedef struct {
+    const void *rl_ra;
+    uint64_t rl_bucket;
+    uint64_t rl_suppressed;
+    os_log_t _Nullable rl_log;
+    const void *_Nullable rl_dso;
+    os_log_type_t rl_type;
+} __attribute__((aligned(LOGGY_OS_LOG_RATE_LIMIT_LINE))) rate_limit_site_s, *rate_limit_site_t;
+
+static rate_limit_site_s rate_limit_sites[LOGGY_OS_LOG_RATE_LIMIT_SIZE];
+static uint32_t rate_limit_rate;
+static uint32_t rate_limit_burst;
+static uint64_t rate_limit_pending;
+static pthread_once_t rate_limit_flusher_once = PTHREAD_ONCE_INIT;
+
+static void rate_limit_flusher_init(void);
+
+void loggy_os_log_rate_limit(uint32_t rate, uint32_t burst) {
+    if (burst == 0) {
+        burst = 1;
+    } else if (burst >= (1u << 16)) {
+        burst = (1u << 16) - 1;
+    }
+    __atomic_store_n(&rate_limit_burst, burst, __ATOMIC_RELAXED);
+    __atomic_store_n(&rate_limit_rate, rate, __ATOMIC_RELEASE);
+    if (rate) {
+        pthread_once(&rate_limit_flusher_once, rate_limit_flusher_init);
+    }
+}
+
+static uint64_t rate_limit_tick(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec) >> LOGGY_OS_LOG_RATE_LIMIT_TICK_SHIFT;
+}
+
+static rate_limit_site_t _Nullable rate_limit_site(const void *ra) {
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)ra * 0x9e3779b97f4a7c15ull) >> 54);
+    for (size_t i = 0; i < LOGGY_OS_LOG_RATE_LIMIT_PROBE; i++) {
+        rate_limit_site_t site = &rate_limit_sites[(slot + i) & (LOGGY_OS_LOG_RATE_LIMIT_SIZE - 1)];
+        const void *owner = __atomic_load_n(&site->rl_ra, __ATOMIC_RELAXED);
+        if (owner == ra) {
+            return site;
+        }
+
+        if (!owner && (__atomic_compare_exchange_n(&site->rl_ra, &owner, ra, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED) || owner == ra)) {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+// Brings `bucket` up to `now`, returning the tokens it holds and setting
+// `last` to its new refill tick.
+//
+// Elapsed time is capped at what fills an empty bucket, which also keeps the
+// arithmetic from overflowing after a long idle. Otherwise `last` only moves
+// forward by the time the credited tokens are worth, rounded up, so the
+// remainder carries into the next refill instead of being dropped.
+static uint64_t rate_limit_refill(uint64_t bucket, uint64_t now, uint64_t rate, uint64_t burst, uint64_t *last) {
+    uint64_t mask = (1ull << LOGGY_OS_LOG_RATE_LIMIT_TOKEN_BITS) - 1;
+    uint64_t full = burst << LOGGY_OS_LOG_RATE_LIMIT_FRACTION_BITS;
+    uint64_t tokens = bucket & mask;
+    *last = bucket >> LOGGY_OS_LOG_RATE_LIMIT_TOKEN_BITS;
+
+    if (!bucket) {
+        *last = now;
+        return full;
+    }
+    if (now <= *last || tokens >= full) {
+        return tokens < full ? tokens : full;
+    }
+
+    uint64_t per_tick = rate << (LOGGY_OS_LOG_RATE_LIMIT_TICK_SHIFT + LOGGY_OS_LOG_RATE_LIMIT_FRACTION_BITS);
+    uint64_t elapsed = now - *last;
+    if (elapsed > (full * 1000000000ull) / per_tick) {
+        *last = now;
+        return full;
+    }
+
+    uint64_t refill = elapsed * per_tick / 1000000000ull;
+    if (!refill) {
+        return tokens;
+    }
+    if (tokens + refill >= full) {
+        *last = now;
+        return full;
+    }
+
+    *last += (refill * 1000000000ull + per_tick - 1) / per_tick;
+    return tokens + refill;
+}
+
+static void rate_limit_report(const void *ra, uint64_t suppressed, os_log_t h, os_log_type_t type, const void *dso) {
+    loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+    loggy_os_log_encoder_add_int64(&encoder, (int64_t)suppressed);
+    loggy_os_log_send(&encoder, "Suppressed %llu messages", h, type, ra, dso);
+}
+
+// Takes the site's count of suppressed messages and, if there were any,
+// reports them.
+static void rate_limit_flush_site(rate_limit_site_t site, const void *ra, os_log_t h, os_log_type_t type, const void *dso) {
+    if (!__atomic_load_n(&site->rl_suppressed, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    uint64_t suppressed = __atomic_exchange_n(&site->rl_suppressed, 0, __ATOMIC_ACQUIRE);
+    if (suppressed) {
+        __atomic_fetch_sub(&rate_limit_pending, 1, __ATOMIC_RELAXED);
+        rate_limit_report(ra, suppressed, h, type, dso);
+    }
+}
+
+// A site keeps the log it was last suppressed under alive, so the flusher
+// can use it. Call sites almost never change logs, so a replaced one is left
+// retained rather than racing the flusher to release it.
+static void rate_limit_suppress(rate_limit_site_t site, os_log_t h, os_log_type_t type, const void *dso) {
+    if (__atomic_load_n(&site->rl_log, __ATOMIC_RELAXED) != h) {
+#if LOGGY_HAS_OS_LOG
+        os_retain(h);
+#endif
+        __atomic_store_n(&site->rl_log, h, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&site->rl_dso, dso, __ATOMIC_RELAXED);
+    __atomic_store_n(&site->rl_type, type, __ATOMIC_RELAXED);
+
+    if (__atomic_fetch_add(&site->rl_suppressed, 1, __ATOMIC_RELEASE) == 0) {
+        __atomic_fetch_add(&rate_limit_pending, 1, __ATOMIC_RELAXED);
+    }
+}
+
+bool loggy_os_log_rate_admit(const void *ra, os_log_t h, os_log_type_t type, const void *dso) {
+    uint64_t rate = __atomic_load_n(&rate_limit_rate, __ATOMIC_ACQUIRE);
+    if (!rate) {
+        return true;
+    }
+
+    // Sites that don't fit in the table aren't limited.
+    rate_limit_site_t site = rate_limit_site(ra);
+    if (!site) {
+        return true;
+    }
+
+    uint64_t burst = __atomic_load_n(&rate_limit_burst, __ATOMIC_RELAXED);
+    uint64_t now = rate_limit_tick();
+    uint64_t bucket = __atomic_load_n(&site->rl_bucket, __ATOMIC_RELAXED);
+    uint64_t next;
+
+    do {
+        uint64_t last;
+        uint64_t tokens = rate_limit_refill(bucket, now, rate, burst, &last);
+        if (tokens < LOGGY_OS_LOG_RATE_LIMIT_TOKEN) {
+            rate_limit_suppress(site, h, type, dso);
+            return false;
+        }
+
+        next = (last << LOGGY_OS_LOG_RATE_LIMIT_TOKEN_BITS) | (tokens - LOGGY_OS_LOG_RATE_LIMIT_TOKEN);
+    } while (!__atomic_compare_exchange_n(&site->rl_bucket, &bucket, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    rate_limit_flush_site(site, ra, h, type, dso);
+    return true;
+}
+
+// Once a suppressing site's bucket holds a token again, its window is over;
+// if it hasn't sent since, report what it suppressed now rather than waiting
+// for a message that may never come.
+static void rate_limit_flush_expired(uint64_t rate, uint64_t burst) {
+    uint64_t now = rate_limit_tick();
+    for (size_t i = 0; i < LOGGY_OS_LOG_RATE_LIMIT_SIZE; i++) {
+        rate_limit_site_t site = &rate_limit_sites[i];
+        if (!__atomic_load_n(&site->rl_suppressed, __ATOMIC_RELAXED)) {
+            continue;
+        }
+
+        uint64_t last;
+        uint64_t bucket = __atomic_load_n(&site->rl_bucket, __ATOMIC_RELAXED);
+        if (rate_limit_refill(bucket, now, rate, burst, &last) < LOGGY_OS_LOG_RATE_LIMIT_TOKEN) {
+            continue;
+        }
+
+        os_log_t h = __atomic_load_n(&site->rl_log, __ATOMIC_RELAXED);
+        if (h) {
+            rate_limit_flush_site(site, site->rl_ra, h, __atomic_load_n(&site->rl_type, __ATOMIC_RELAXED), __atomic_load_n(&site->rl_dso, __ATOMIC_RELAXED));
+        }
+    }
+}
+
+// Wakes about once per token, so a summary goes out close to when the site
+// could have sent again.
+static void *rate_limit_flusher_main(void *unused) {
+    (void)unused;
+    for (;;) {
+        uint64_t rate = __atomic_load_n(&rate_limit_rate, __ATOMIC_ACQUIRE);
+        uint64_t interval = rate ? 1000000000ull / rate : LOGGY_OS_LOG_RATE_LIMIT_MAX_FLUSH;
+        if (interval < LOGGY_OS_LOG_RATE_LIMIT_MIN_FLUSH) {
+            interval = LOGGY_OS_LOG_RATE_LIMIT_MIN_FLUSH;
+        } else if (interval > LOGGY_OS_LOG_RATE_LIMIT_MAX_FLUSH) {
+            interval = LOGGY_OS_LOG_RATE_LIMIT_MAX_FLUSH;
+        }
+
+        struct timespec idle = {
+            .tv_sec = (time_t)(interval / 1000000000),
+            .tv_nsec = (long)(interval % 1000000000),
+        };
+        nanosleep(&idle, NULL);
+
+        if (rate && __atomic_load_n(&rate_limit_pending, __ATOMIC_RELAXED)) {
+            rate_limit_flush_expired(rate, __atomic_load_n(&rate_limit_burst, __ATOMIC_RELAXED));
+        }
+    }
+    return NULL;
+}
+
+static void rate_limit_flusher_init(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, rate_limit_flusher_main, NULL) == 0) {
+        pthread_detach(thread);
+    }
+}
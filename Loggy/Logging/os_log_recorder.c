@@ -0,0 +1,286 @@
+//
+//  os_log_recorder.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_recorder.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOGGY_OS_LOG_RECORDER_HEADER_SIZE   4096
+#define LOGGY_OS_LOG_RECORDER_ALIGN(x)      (((x) + 7) & ~(uint64_t)7)
+
+static void recorder_sink_send(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    loggy_os_log_recorder_append((loggy_os_log_recorder_t)sink->ls_context, record);
+}
+
+bool loggy_os_log_recorder_open(loggy_os_log_recorder_t recorder, const char *path, size_t size) {
+    if (size < 4096 || (size & (size - 1)) != 0) {
+        return false;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+
+    size_t map_size = LOGGY_OS_LOG_RECORDER_HEADER_SIZE + size;
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)map_size) == 0) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // A fresh file reads as zero, which is what unclaimed space must be.
+    loggy_os_log_recorder_header_s *header = map;
+    header->fh_magic = LOGGY_OS_LOG_RECORDER_MAGIC;
+    header->fh_version = LOGGY_OS_LOG_RECORDER_VERSION;
+    header->fh_size = size;
+    // Entries' times are only converted with this, so they can't change
+    // units while it's open.
+    loggy_os_log_clock_pin();
+    loggy_os_log_clock_calibration(&header->fh_calibration);
+
+    *recorder = (loggy_os_log_recorder_s){
+        .lfr_sink = {
+            .ls_send = recorder_sink_send,
+            .ls_context = recorder,
+            .ls_flags = LOGGY_OS_LOG_SINK_FLAG_OVERSIZE,
+        },
+        .lfr_header = header,
+        .lfr_storage = (uint8_t *)map + LOGGY_OS_LOG_RECORDER_HEADER_SIZE,
+        .lfr_mask = size - 1,
+        .lfr_map_size = map_size,
+    };
+    return true;
+}
+
+void loggy_os_log_recorder_close(loggy_os_log_recorder_t recorder) {
+    if (recorder->lfr_header) {
+        munmap(recorder->lfr_header, recorder->lfr_map_size);
+        recorder->lfr_header = NULL;
+        recorder->lfr_storage = NULL;
+        loggy_os_log_clock_unpin();
+    }
+}
+
+static inline loggy_os_log_entry_t recorder_entry(loggy_os_log_recorder_t recorder, uint64_t position) {
+    return (loggy_os_log_entry_t)(recorder->lfr_storage + (position & recorder->lfr_mask));
+}
+
+// Frees the oldest entry. Zeroing its size claims it from any other writer
+// doing the same; the rest is zeroed before the tail moves past it, since
+// no writer can reserve the space until then. Returns false if another
+// writer is freeing it, or if its space was claimed a moment ago and its
+// size isn't stored yet.
+//
+// An entry still being written is freed all the same rather than waited
+// for, so one stalled writer can't stop every other; it finds out when it
+// goes to publish, and drops the message. Only a writer stalled for a whole
+// lap of the ring gets there, and whatever it copies in after is lost to
+// the entries that reuse the space, so sizes are checked before they're
+// trusted.
+static bool recorder_reclaim(loggy_os_log_recorder_t recorder, uint64_t tail) {
+    loggy_os_log_entry_t entry = recorder_entry(recorder, tail);
+    uint32_t size = __atomic_load_n(&entry->le_size, __ATOMIC_ACQUIRE);
+    uint32_t bytes = size & ~LOGGY_OS_LOG_RECORDER_INCOMPLETE;
+    if (bytes == 0 || (bytes & 7) != 0 || bytes > recorder->lfr_mask + 1 - (tail & recorder->lfr_mask)
+        || !__atomic_compare_exchange_n(&entry->le_size, &size, 0, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return __atomic_load_n(&recorder->lfr_header->fh_tail, __ATOMIC_ACQUIRE) != tail;
+    }
+
+    memset(entry, 0, bytes);
+    __atomic_store_n(&recorder->lfr_header->fh_tail, tail + bytes, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool recorder_reserve(loggy_os_log_recorder_t recorder, uint64_t size, uint64_t *position) {
+    loggy_os_log_recorder_header_s *header = recorder->lfr_header;
+    uint64_t capacity = recorder->lfr_mask + 1;
+    uint64_t head = __atomic_load_n(&header->fh_head, __ATOMIC_RELAXED);
+    uint64_t padding;
+
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&header->fh_tail, __ATOMIC_ACQUIRE);
+        uint64_t room = capacity - (head & recorder->lfr_mask);
+        padding = room < size ? room : 0;
+
+        if (head + padding + size - tail > capacity) {
+            if (!recorder_reclaim(recorder, tail)) {
+                return false;
+            }
+            head = __atomic_load_n(&header->fh_head, __ATOMIC_RELAXED);
+            continue;
+        }
+
+        if (__atomic_compare_exchange_n(&header->fh_head, &head, head + padding + size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (padding) {
+        loggy_os_log_entry_t pad = recorder_entry(recorder, head);
+        pad->le_flags = LOGGY_OS_LOG_ENTRY_FLAG_PADDING;
+        __atomic_store_n(&pad->le_size, (uint32_t)padding, __ATOMIC_RELEASE);
+    }
+
+    *position = head + padding;
+    __atomic_store_n(&recorder_entry(recorder, *position)->le_size, (uint32_t)size | LOGGY_OS_LOG_RECORDER_INCOMPLETE, __ATOMIC_RELEASE);
+    return true;
+}
+
+bool loggy_os_log_recorder_append(loggy_os_log_recorder_t recorder, const loggy_os_log_record_s *record) {
+    size_t len = loggy_os_log_record_size(record);
+    size_t format_len = strlen(record->lr_format) + 1;
+    size_t subsystem_len = strlen(record->lr_log->subsystem) + 1;
+    size_t category_len = strlen(record->lr_log->category) + 1;
+    uint64_t size = LOGGY_OS_LOG_RECORDER_ALIGN(sizeof(loggy_os_log_entry_s) + len + format_len + subsystem_len + category_len);
+    uint64_t position;
+
+    if (size > recorder->lfr_mask + 1 || !recorder_reserve(recorder, size, &position)) {
+        return false;
+    }
+
+    loggy_os_log_entry_t entry = recorder_entry(recorder, position);
+    entry->le_type = record->lr_type;
+    entry->le_flags = 0;
+    entry->le_len = (uint32_t)len;
+    entry->le_truncated = record->lr_truncated;
+    entry->le_time = record->lr_time;
+    entry->le_activity = record->lr_activity;
+    entry->le_log = record->lr_log;
+    entry->le_format = record->lr_format;
+    entry->le_pc = record->lr_pc;
+    entry->le_dso = record->lr_dso;
+    loggy_os_log_record_copy(record, entry->le_data);
+
+    uint8_t *strings = entry->le_data + len;
+    memcpy(strings, record->lr_format, format_len);
+    memcpy(strings + format_len, record->lr_log->subsystem, subsystem_len);
+    memcpy(strings + format_len + subsystem_len, record->lr_log->category, category_len);
+
+    // Clearing the mark is what makes the entry valid to the reader. If a
+    // writer short of room gave up on the entry meanwhile, it's gone.
+    uint32_t incomplete = (uint32_t)size | LOGGY_OS_LOG_RECORDER_INCOMPLETE;
+    return __atomic_compare_exchange_n(&entry->le_size, &incomplete, (uint32_t)size, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+// MARK: - Recovery
+
+// Checks that an entry's strings are terminated within its size.
+static bool recorder_entry_strings(const loggy_os_log_entry_s *entry, const char *strings[3]) {
+    const char *cursor = (const char *)entry->le_data + entry->le_len;
+    const char *end = (const char *)entry + entry->le_size;
+    for (size_t i = 0; i < 3; i++) {
+        const char *nul = cursor < end ? memchr(cursor, 0, (size_t)(end - cursor)) : NULL;
+        if (!nul) {
+            return false;
+        }
+        strings[i] = cursor;
+        cursor = nul + 1;
+    }
+    return true;
+}
+
+size_t loggy_os_log_recorder_recover(const char *path, size_t limit, void (*handler)(void *context, const loggy_os_log_record_s *record), void *context) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size > LOGGY_OS_LOG_RECORDER_HEADER_SIZE) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    const loggy_os_log_recorder_header_s *header = map;
+    const uint8_t *storage = (const uint8_t *)map + LOGGY_OS_LOG_RECORDER_HEADER_SIZE;
+    uint64_t size = header->fh_size;
+    if (header->fh_magic != LOGGY_OS_LOG_RECORDER_MAGIC || header->fh_version != LOGGY_OS_LOG_RECORDER_VERSION
+        || (size & (size - 1)) != 0 || LOGGY_OS_LOG_RECORDER_HEADER_SIZE + size > (uint64_t)st.st_size) {
+        munmap(map, (size_t)st.st_size);
+        return 0;
+    }
+
+    // Find the intact entries first, so only the last `limit` are handled.
+    // A writer that died mid-message leaves its entry marked incomplete,
+    // which is skipped. One that died in the moment between reserving space
+    // and marking it leaves a zero size; nothing after it can be trusted.
+    uint64_t head = header->fh_head, tail = header->fh_tail;
+    size_t count = 0, capacity = 0;
+    uint64_t *positions = NULL;
+    for (uint64_t position = tail; position < head && head - tail <= size;) {
+        const loggy_os_log_entry_s *entry = (const loggy_os_log_entry_s *)(storage + (position & (size - 1)));
+        uint32_t entry_size = entry->le_size & ~LOGGY_OS_LOG_RECORDER_INCOMPLETE;
+        bool incomplete = (entry->le_size & LOGGY_OS_LOG_RECORDER_INCOMPLETE) != 0;
+        if (entry_size == 0 || (entry_size & 7) != 0 || entry_size > size - (position & (size - 1))) {
+            break;
+        }
+
+        if (!incomplete && !(entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_PADDING)) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                uint64_t *grown = realloc(positions, capacity * sizeof(uint64_t));
+                if (!grown) {
+                    break;
+                }
+                positions = grown;
+            }
+            positions[count++] = position;
+        }
+        position += entry_size;
+    }
+
+    size_t handled = 0;
+    for (size_t i = count > limit ? count - limit : 0; i < count; i++) {
+        const loggy_os_log_entry_s *entry = (const loggy_os_log_entry_s *)(storage + (positions[i] & (size - 1)));
+        const char *strings[3];
+        if (sizeof(loggy_os_log_entry_s) + entry->le_len > entry->le_size || !recorder_entry_strings(entry, strings)) {
+            continue;
+        }
+
+        struct loggy_os_log_s log = {
+            .subsystem = strings[1],
+            .category = strings[2],
+        };
+        loggy_os_log_record_s record = {
+            .lr_time = loggy_os_log_clock_convert(&header->fh_calibration, entry->le_time),
+            .lr_activity = entry->le_activity,
+            .lr_log = &log,
+            .lr_format = strings[0],
+            .lr_pc = entry->le_pc,
+            .lr_dso = entry->le_dso,
+            .lr_buf = entry->le_data,
+            .lr_len = entry->le_len,
+            .lr_truncated = entry->le_truncated,
+            .lr_type = entry->le_type,
+        };
+        handler(context, &record);
+        handled += 1;
+    }
+
+    free(positions);
+    munmap(map, (size_t)st.st_size);
+    return handled;
+}
+
+#endif
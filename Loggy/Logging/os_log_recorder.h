@@ -0,0 +1,86 @@
+//
+//  os_log_recorder.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_recorder_h__
+#define __loggy_os_log_recorder_h__
+
+#include "os_log_sink.h"
+#include "os_log_clock.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+#define LOGGY_OS_LOG_RECORDER_MAGIC     0x52464c4cu /* "LLFR" */
+#define LOGGY_OS_LOG_RECORDER_VERSION   3
+
+/// Set in an entry's `le_size` from when its space is reserved until its
+/// contents are written. Sizes are multiples of 8, so the bit is free.
+#define LOGGY_OS_LOG_RECORDER_INCOMPLETE    1u
+
+/// The first page of a flight recorder file. Entries follow, laid out as
+/// `loggy_os_log_entry_s`, with the format, subsystem, and category copied
+/// in after the payload since the pointers won't outlive the process. The
+/// calibration taken at open converts their times back to nanoseconds; the
+/// clock's units are pinned while the recorder is open, so it applies to
+/// every entry.
+///
+/// An entry's size is stored, marked incomplete, as soon as it's reserved,
+/// so readers can step over one whose writer stalled or died.
+typedef struct {
+    uint32_t        fh_magic;
+    uint32_t        fh_version;
+    uint64_t        fh_size;
+    loggy_os_log_clock_calibration_s fh_calibration;
+    uint64_t        fh_head __attribute__((aligned(64)));
+    uint64_t        fh_tail __attribute__((aligned(64)));
+} loggy_os_log_recorder_header_s;
+
+/// A ring of recent messages in a shared file mapping. The kernel keeps the
+/// pages when the process dies, so the last messages before a crash can be
+/// read back with `loggy_os_log_recorder_recover`.
+///
+/// Unlike `loggy_os_log_ring_s`, when the recorder is full the oldest
+/// messages are overwritten.
+typedef struct {
+    loggy_os_log_sink_s lfr_sink;
+    loggy_os_log_recorder_header_s *_Nullable lfr_header;
+    uint8_t        *_Nullable lfr_storage;
+    uint64_t        lfr_mask;
+    size_t          lfr_map_size;
+} loggy_os_log_recorder_s, *loggy_os_log_recorder_t;
+
+/// Creates or replaces the file at `path` with room for `size` bytes of
+/// messages, a power of two of at least 4KiB, and maps it. Returns false on
+/// failure.
+///
+/// Install the recorder with `loggy_os_log_set_sink(&recorder->lfr_sink)`.
+OS_EXPORT
+bool loggy_os_log_recorder_open(loggy_os_log_recorder_t recorder, const char *path, size_t size);
+
+/// Appends a copy of `record`, overwriting the oldest messages if need be.
+/// Returns false if the message was dropped.
+OS_EXPORT
+bool loggy_os_log_recorder_append(loggy_os_log_recorder_t recorder, const loggy_os_log_record_s *record);
+
+/// Unmaps the file, which is left in place.
+OS_EXPORT
+void loggy_os_log_recorder_close(loggy_os_log_recorder_t recorder);
+
+/// Reads the file at `path` left by a recorder and passes up to the last
+/// `limit` intact messages to `handler`, oldest first. The record's
+/// pointers are only valid during the call; `lr_pc` and `lr_dso` are
+/// addresses in the process that wrote them. Returns the number of messages
+/// handled.
+OS_EXPORT
+size_t loggy_os_log_recorder_recover(const char *path, size_t limit, void (*handler)(void *_Nullable context, const loggy_os_log_record_s *record), void *_Nullable context);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_recorder_h__ */
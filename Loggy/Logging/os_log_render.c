@@ -0,0 +1,232 @@
+//
+//  os_log_render.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_render.h"
+#include "os_log_format.h"
+#include <stdarg.h>
+#include <stdio.h>
+
+typedef struct {
+    char *out;
+    size_t capacity;
+    size_t len;
+} render_buffer_s, *render_buffer_t;
+
+static void put(render_buffer_t rb, const char *str, size_t len) {
+    if (rb->len < rb->capacity) {
+        size_t room = rb->capacity - rb->len;
+        memcpy(rb->out + rb->len, str, len < room ? len : room);
+    }
+    rb->len += len;
+}
+
+static void put_cstr(render_buffer_t rb, const char *str) {
+    put(rb, str, strlen(str));
+}
+
+static void put_hex(render_buffer_t rb, const uint8_t *data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        char pair[2] = { digits[data[i] >> 4], digits[data[i] & 0xf] };
+        put(rb, pair, 2);
+    }
+}
+
+__attribute__((__format__(__printf__, 2, 3)))
+static void put_format(render_buffer_t rb, const char *fmt, ...) {
+    char tmp[512];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+    va_end(ap);
+    if (len > 0) {
+        put(rb, tmp, (size_t)len < sizeof(tmp) ? (size_t)len : sizeof(tmp) - 1);
+    }
+}
+
+size_t loggy_os_log_render(const char *fmt, const uint8_t *buf, size_t len, char *out, size_t size) {
+    render_buffer_s rb = { .out = out, .capacity = size ? size - 1 : 0 };
+    const uint8_t *cursor = buf + sizeof(os_log_fmt_hdr_s);
+    const uint8_t *end = buf + len;
+    if (len < sizeof(os_log_fmt_hdr_s)) {
+        cursor = end;
+    }
+
+    const char *p = fmt;
+    while (*p) {
+        const char *pct = strchr(p, '%');
+        if (!pct) {
+            put_cstr(&rb, p);
+            break;
+        }
+
+        put(&rb, p, (size_t)(pct - p));
+        p = pct + 1;
+
+        if (*p == '%') {
+            put(&rb, "%", 1);
+            p += 1;
+            continue;
+        }
+
+        // Annotations, like `{public}` or `{bool}`.
+        const char *annotation = NULL;
+        size_t annotation_len = 0;
+        if (*p == '{') {
+            const char *close = strchr(p, '}');
+            if (!close) {
+                break;
+            }
+            annotation = p + 1;
+            annotation_len = (size_t)(close - annotation);
+            p = close + 1;
+        }
+
+        // Flags and width are passed through to `printf`; the argument
+        // sizes come from the buffer, so length modifiers are not.
+        char spec[32] = "%";
+        size_t spec_len = 1;
+        while (*p && strchr("-+ #0", *p) && spec_len < sizeof(spec) - 8) {
+            spec[spec_len++] = *p++;
+        }
+
+        os_log_fmt_cmd_s cmd;
+        const uint8_t *data = NULL;
+        int width = -1, precision = -1;
+
+        if (*p == '*') {
+            p += 1;
+            if (loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+                width = (int)loggy_os_log_fmt_read_signed(data, cmd.cmd_size);
+            }
+        } else {
+            for (width = 0; *p >= '0' && *p <= '9'; p++) {
+                width = width * 10 + (*p - '0');
+            }
+        }
+
+        if (*p == '.') {
+            p += 1;
+            if (*p == '*') {
+                p += 1;
+                if (loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+                    precision = (int)loggy_os_log_fmt_read_signed(data, cmd.cmd_size);
+                }
+            } else {
+                for (precision = 0; *p >= '0' && *p <= '9'; p++) {
+                    precision = precision * 10 + (*p - '0');
+                }
+            }
+        }
+
+        while (*p && strchr("hlqLzjt", *p)) {
+            p += 1;
+        }
+
+        char conversion = *p;
+        if (!conversion) {
+            break;
+        }
+        p += 1;
+
+        if (!loggy_os_log_fmt_next(&cursor, end, &cmd, &data)) {
+            put_cstr(&rb, "<decode: missing data>");
+            continue;
+        }
+
+        if (width > 0) {
+            spec_len += (size_t)snprintf(spec + spec_len, sizeof(spec) - spec_len, "%d", width);
+        }
+        if (precision >= 0 && strchr("eEfFgGaA", conversion)) {
+            spec_len += (size_t)snprintf(spec + spec_len, sizeof(spec) - spec_len, ".%d", precision);
+        }
+
+        switch (conversion) {
+        case 'd':
+        case 'i':
+            if (annotation && annotation_len == 4 && memcmp(annotation, "bool", 4) == 0) {
+                put_cstr(&rb, loggy_os_log_fmt_read_signed(data, cmd.cmd_size) ? "true" : "false");
+            } else if (annotation && annotation_len == 4 && memcmp(annotation, "BOOL", 4) == 0) {
+                put_cstr(&rb, loggy_os_log_fmt_read_signed(data, cmd.cmd_size) ? "YES" : "NO");
+            } else {
+                memcpy(spec + spec_len, "lld", 4);
+                put_format(&rb, spec, (long long)loggy_os_log_fmt_read_signed(data, cmd.cmd_size));
+            }
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = conversion;
+            spec[spec_len] = 0;
+            put_format(&rb, spec, (unsigned long long)loggy_os_log_fmt_read_unsigned(data, cmd.cmd_size));
+            break;
+        case 'c':
+            memcpy(spec + spec_len, "c", 2);
+            put_format(&rb, spec, (int)loggy_os_log_fmt_read_signed(data, cmd.cmd_size));
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec[spec_len++] = conversion;
+            spec[spec_len] = 0;
+            put_format(&rb, spec, loggy_os_log_fmt_read_double(data, cmd.cmd_size));
+            break;
+        case 'p':
+            put_format(&rb, "0x%llx", (unsigned long long)loggy_os_log_fmt_read_unsigned(data, cmd.cmd_size));
+            break;
+        case 's':
+            if (cmd.cmd_type == OSLF_CMD_TYPE_STRING && (cmd.cmd_flags & OSLF_CMD_FLAG_LOGGY_INLINE)) {
+                size_t length = strnlen((const char *)data, cmd.cmd_size);
+                if (precision >= 0 && (size_t)precision < length) {
+                    length = (size_t)precision;
+                }
+                put(&rb, (const char *)data, length);
+            } else {
+                put_cstr(&rb, "<decode: unsupported string>");
+            }
+            break;
+        case 'P':
+            if (cmd.cmd_type == OSLF_CMD_TYPE_DATA && (cmd.cmd_flags & OSLF_CMD_FLAG_LOGGY_INLINE)) {
+                size_t length = cmd.cmd_size;
+                if (precision >= 0 && (size_t)precision < length) {
+                    length = (size_t)precision;
+                }
+                put_hex(&rb, data, length);
+            } else {
+                put_cstr(&rb, "<decode: unsupported data>");
+            }
+            break;
+        case '@':
+            put_format(&rb, "<object 0x%llx>", (unsigned long long)loggy_os_log_fmt_read_unsigned(data, cmd.cmd_size));
+            break;
+        default:
+            put_cstr(&rb, "<decode: unsupported format>");
+            break;
+        }
+    }
+
+    if (size) {
+        out[rb.len < rb.capacity ? rb.len : rb.capacity] = 0;
+    }
+    return rb.len;
+}
+
+size_t loggy_os_log_render_double(double value, int precision, char *out, size_t size) {
+    int len = snprintf(out, size, "%.*g", precision, value);
+    if (len < 0) {
+        return 0;
+    }
+    return (size_t)len < size ? (size_t)len : size - 1;
+}
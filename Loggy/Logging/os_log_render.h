@@ -0,0 +1,32 @@
+//
+//  os_log_render.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_render_h__
+#define __loggy_os_log_render_h__
+
+#include "os_log_shims.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// Formats `fmt` against the arguments encoded in `buf`, the way Console
+/// would show the message. Writes at most `size` bytes to `out`, including a
+/// terminating NUL, and returns the length of the full message, like
+/// `snprintf`.
+///
+/// This is where deferred formatting happens: binary data (`%.*P`) becomes
+/// hex and inline strings are copied out only when a message is read.
+OS_EXPORT
+size_t loggy_os_log_render(const char *fmt, const uint8_t *buf, size_t len, char *_Nullable out, size_t size);
+
+/// Formats `value` like `%.*g` into `out`, returning the length written.
+/// For renderers that can't call `printf` directly.
+OS_EXPORT
+size_t loggy_os_log_render_double(double value, int precision, char *out, size_t size);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_log_render_h__ */
@@ -0,0 +1,1054 @@
+//
+//  os_log_segment.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_segment.h"
+#include "os_log_compress.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOGGY_OS_LOG_SEGMENT_ALIGN(x)           (((x) + 7) & ~(uint64_t)7)
+#define LOGGY_OS_LOG_SEGMENT_BLOCKS_IN_FLIGHT   8
+#define LOGGY_OS_LOG_SEGMENT_READ_AHEAD         16
+#define LOGGY_OS_LOG_SEGMENT_SCAN_CHUNK         (4 * 1024 * 1024)
+#define LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD         8
+
+// Maps the pointers a process logs with to the IDs they're stored under.
+// Pointers aren't trusted alone, since a format may be built on the fly and
+// its memory reused; the contents are compared too.
+typedef struct {
+    const void     *de_key;
+    char           *de_value;
+    uint32_t        de_len;
+    uint32_t        de_id;
+} segment_dict_entry_s;
+
+typedef struct {
+    segment_dict_entry_s *sd_slots;
+    segment_dict_entry_s **sd_ordered;
+    uint32_t        sd_mask;
+    uint32_t        sd_count;
+} segment_dict_s, *segment_dict_t;
+
+// Records are gathered into a block by the logging threads, then queued
+// for the compression thread, which writes blocks out in order.
+typedef struct segment_block_s {
+    struct segment_block_s *sb_next;
+    loggy_os_log_segment_index_s sb_index;
+    uint8_t        *sb_data;
+    size_t          sb_capacity;
+} segment_block_s, *segment_block_t;
+
+struct loggy_os_log_segment_writer_s {
+    loggy_os_log_sink_s sw_sink;
+    pthread_mutex_t sw_lock;
+    pthread_cond_t  sw_ready;
+    pthread_cond_t  sw_room;
+    pthread_t       sw_thread;
+    segment_dict_s  sw_formats;
+    segment_dict_s  sw_handles;
+    segment_block_t sw_current;
+    segment_block_t sw_queue;
+    segment_block_t *sw_queue_tail;
+    segment_block_t sw_free;
+    uint32_t        sw_blocks;
+    bool            sw_closing;
+    bool            sw_failed;
+    loggy_os_log_segment_trailer_s sw_trailer;
+    // Only used by the compression thread, then by close.
+    FILE           *sw_file;
+    uint64_t        sw_offset;
+    loggy_os_log_segment_index_s *sw_index;
+    uint32_t        sw_index_count;
+    uint32_t        sw_index_capacity;
+    uint8_t        *sw_compressed;
+    size_t          sw_compressed_capacity;
+    segment_dict_s  sw_images;
+    loggy_os_log_image_info_s sw_image;
+    uint32_t        sw_image_id;
+    loggy_os_log_clock_calibration_s *sw_calibrations;
+    uint32_t        sw_calibration_count;
+    uint32_t        sw_calibration_capacity;
+};
+
+static bool segment_dict_init(segment_dict_t dict) {
+    dict->sd_mask = 63;
+    dict->sd_count = 0;
+    dict->sd_slots = calloc(dict->sd_mask + 1, sizeof(segment_dict_entry_s));
+    dict->sd_ordered = calloc((dict->sd_mask + 1) / 2, sizeof(segment_dict_entry_s *));
+    return dict->sd_slots && dict->sd_ordered;
+}
+
+static void segment_dict_destroy(segment_dict_t dict) {
+    for (uint32_t i = 0; dict->sd_slots && i <= dict->sd_mask; i++) {
+        free(dict->sd_slots[i].de_value);
+    }
+    free(dict->sd_slots);
+    free(dict->sd_ordered);
+}
+
+static inline uint32_t segment_dict_slot(segment_dict_t dict, const void *key) {
+    return (uint32_t)(((uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ull) >> 32) & dict->sd_mask;
+}
+
+static bool segment_dict_grow(segment_dict_t dict) {
+    uint32_t mask = dict->sd_mask * 2 + 1;
+    segment_dict_entry_s *slots = calloc(mask + 1, sizeof(segment_dict_entry_s));
+    segment_dict_entry_s **ordered = calloc((mask + 1) / 2, sizeof(segment_dict_entry_s *));
+    if (!slots || !ordered) {
+        free(slots);
+        free(ordered);
+        return false;
+    }
+
+    segment_dict_s grown = { .sd_slots = slots, .sd_ordered = ordered, .sd_mask = mask, .sd_count = dict->sd_count };
+    for (uint32_t i = 0; i < dict->sd_count; i++) {
+        segment_dict_entry_s *entry = dict->sd_ordered[i];
+        uint32_t slot = segment_dict_slot(&grown, entry->de_key);
+        while (slots[slot].de_value) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = *entry;
+        ordered[entry->de_id] = &slots[slot];
+    }
+
+    free(dict->sd_slots);
+    free(dict->sd_ordered);
+    *dict = grown;
+    return true;
+}
+
+// Looks up the ID for `first` and, if given, `second` under `key`, adding
+// them if they're new. Returns false if out of memory.
+static bool segment_dict_id(segment_dict_t dict, const void *key, const char *first, const char *_Nullable second, uint32_t *id) {
+    size_t first_len = strlen(first) + 1;
+    size_t second_len = second ? strlen(second) + 1 : 0;
+
+    uint32_t slot = segment_dict_slot(dict, key);
+    for (; dict->sd_slots[slot].de_value; slot = (slot + 1) & dict->sd_mask) {
+        segment_dict_entry_s *entry = &dict->sd_slots[slot];
+        if (entry->de_key == key && entry->de_len == first_len + second_len
+            && memcmp(entry->de_value, first, first_len) == 0
+            && (!second || memcmp(entry->de_value + first_len, second, second_len) == 0)) {
+            *id = entry->de_id;
+            return true;
+        }
+    }
+
+    // Grown first, since `sd_ordered` only has room for half the slots.
+    if ((dict->sd_count + 1) * 2 > dict->sd_mask) {
+        if (!segment_dict_grow(dict)) {
+            return false;
+        }
+        for (slot = segment_dict_slot(dict, key); dict->sd_slots[slot].de_value; slot = (slot + 1) & dict->sd_mask) {}
+    }
+
+    char *value = malloc(first_len + second_len);
+    if (!value) {
+        return false;
+    }
+    memcpy(value, first, first_len);
+    if (second) {
+        memcpy(value + first_len, second, second_len);
+    }
+
+    segment_dict_entry_s *entry = &dict->sd_slots[slot];
+    *entry = (segment_dict_entry_s){ .de_key = key, .de_value = value, .de_len = (uint32_t)(first_len + second_len), .de_id = dict->sd_count };
+    dict->sd_ordered[dict->sd_count++] = entry;
+    *id = entry->de_id;
+    return true;
+}
+
+static void segment_write(loggy_os_log_segment_writer_t writer, const void *bytes, size_t len) {
+    if (len && fwrite(bytes, 1, len, writer->sw_file) != len) {
+        __atomic_store_n(&writer->sw_failed, true, __ATOMIC_RELAXED);
+    }
+    writer->sw_offset += len;
+}
+
+static void segment_pad(loggy_os_log_segment_writer_t writer) {
+    static const uint8_t zeroes[8];
+    segment_write(writer, zeroes, LOGGY_OS_LOG_SEGMENT_ALIGN(writer->sw_offset) - writer->sw_offset);
+}
+
+// Keeps each calibration taken while the segment is open, for readers to
+// convert times with.
+static void segment_calibrate(loggy_os_log_segment_writer_t writer) {
+    loggy_os_log_clock_calibration_s calibration;
+    loggy_os_log_clock_calibration(&calibration);
+
+    uint32_t count = writer->sw_calibration_count;
+    if (count && writer->sw_calibrations[count - 1].cc_monotonic == calibration.cc_monotonic) {
+        return;
+    }
+
+    if (count == writer->sw_calibration_capacity) {
+        uint32_t capacity = count ? count * 2 : 16;
+        loggy_os_log_clock_calibration_s *grown = realloc(writer->sw_calibrations, capacity * sizeof(loggy_os_log_clock_calibration_s));
+        if (!grown) {
+            return;
+        }
+        writer->sw_calibrations = grown;
+        writer->sw_calibration_capacity = capacity;
+    }
+    writer->sw_calibrations[writer->sw_calibration_count++] = calibration;
+}
+
+// Rewrites a record's return address as an image ID and linked address.
+// Records mostly come from the same image as the one before, so that one is
+// checked first.
+static void segment_locate(loggy_os_log_segment_writer_t writer, loggy_os_log_segment_record_s *record) {
+    uintptr_t pc = (uintptr_t)record->sr_pc;
+    loggy_os_log_image_info_t image = &writer->sw_image;
+    if (pc < image->ii_start || pc >= image->ii_end) {
+        if (!pc || !loggy_os_log_image_info((const void *)pc, image)
+            || !segment_dict_id(&writer->sw_images, (const void *)image->ii_start, image->ii_build_id, image->ii_path, &writer->sw_image_id)) {
+            *image = (loggy_os_log_image_info_s){ 0 };
+            record->sr_image = LOGGY_OS_LOG_SEGMENT_NO_IMAGE;
+            return;
+        }
+    }
+
+    record->sr_image = writer->sw_image_id;
+    record->sr_pc = pc - image->ii_bias;
+}
+
+// Compresses and writes out a full block. Blocks that don't shrink are
+// stored as they are.
+static void segment_write_block(loggy_os_log_segment_writer_t writer, segment_block_t block) {
+    loggy_os_log_segment_index_s *index = &block->sb_index;
+    for (uint32_t offset = 0; offset < index->si_length;) {
+        loggy_os_log_segment_record_s *record = (loggy_os_log_segment_record_s *)(block->sb_data + offset);
+        segment_locate(writer, record);
+        offset += record->sr_size;
+    }
+
+    size_t bound = LOGGY_OS_LOG_COMPRESS_BOUND(index->si_length);
+    if (bound > writer->sw_compressed_capacity) {
+        uint8_t *compressed = realloc(writer->sw_compressed, bound);
+        if (compressed) {
+            writer->sw_compressed = compressed;
+            writer->sw_compressed_capacity = bound;
+        }
+    }
+
+    size_t len = 0;
+    if (writer->sw_compressed) {
+        len = loggy_os_log_compress(block->sb_data, index->si_length, writer->sw_compressed, writer->sw_compressed_capacity);
+    }
+
+    index->si_offset = writer->sw_offset;
+    if (len && len < index->si_length) {
+        index->si_flags = LOGGY_OS_LOG_SEGMENT_BLOCK_COMPRESSED;
+        index->si_stored = (uint32_t)len;
+        segment_write(writer, writer->sw_compressed, len);
+    } else {
+        index->si_stored = index->si_length;
+        segment_write(writer, block->sb_data, index->si_length);
+    }
+    segment_pad(writer);
+
+    if (writer->sw_index_count == writer->sw_index_capacity) {
+        uint32_t capacity = writer->sw_index_capacity ? writer->sw_index_capacity * 2 : 64;
+        loggy_os_log_segment_index_s *grown = realloc(writer->sw_index, capacity * sizeof(loggy_os_log_segment_index_s));
+        if (!grown) {
+            __atomic_store_n(&writer->sw_failed, true, __ATOMIC_RELAXED);
+            return;
+        }
+        writer->sw_index = grown;
+        writer->sw_index_capacity = capacity;
+    }
+    writer->sw_index[writer->sw_index_count++] = *index;
+}
+
+static void *segment_compress_thread(void *context) {
+    loggy_os_log_segment_writer_t writer = context;
+    pthread_mutex_lock(&writer->sw_lock);
+    for (;;) {
+        while (!writer->sw_queue && !writer->sw_closing) {
+            pthread_cond_wait(&writer->sw_ready, &writer->sw_lock);
+        }
+
+        segment_block_t block = writer->sw_queue;
+        if (!block) {
+            break;
+        }
+        writer->sw_queue = block->sb_next;
+        if (!writer->sw_queue) {
+            writer->sw_queue_tail = &writer->sw_queue;
+        }
+        pthread_mutex_unlock(&writer->sw_lock);
+
+        segment_calibrate(writer);
+        segment_write_block(writer, block);
+
+        pthread_mutex_lock(&writer->sw_lock);
+        block->sb_next = writer->sw_free;
+        writer->sw_free = block;
+        pthread_cond_signal(&writer->sw_room);
+    }
+    pthread_mutex_unlock(&writer->sw_lock);
+    return NULL;
+}
+
+static void segment_sink_send(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    loggy_os_log_segment_append((loggy_os_log_segment_writer_t)sink->ls_context, record);
+}
+
+loggy_os_log_segment_writer_t loggy_os_log_segment_writer_create(const char *path) {
+    loggy_os_log_segment_writer_t writer = calloc(1, sizeof(struct loggy_os_log_segment_writer_s));
+    if (!writer) {
+        return NULL;
+    }
+
+    // Every calibration the segment keeps has to be in the same units.
+    loggy_os_log_clock_pin();
+
+    writer->sw_file = fopen(path, "wbe");
+    if (!writer->sw_file || !segment_dict_init(&writer->sw_formats) || !segment_dict_init(&writer->sw_handles)
+        || !segment_dict_init(&writer->sw_images)) {
+        goto fail;
+    }
+
+    writer->sw_sink = (loggy_os_log_sink_s){
+        .ls_send = segment_sink_send,
+        .ls_context = writer,
+        .ls_flags = LOGGY_OS_LOG_SINK_FLAG_OVERSIZE,
+    };
+    writer->sw_queue_tail = &writer->sw_queue;
+    writer->sw_trailer.st_min_time = UINT64_MAX;
+
+    loggy_os_log_segment_header_s header = {
+        .sh_magic = LOGGY_OS_LOG_SEGMENT_MAGIC,
+        .sh_version = LOGGY_OS_LOG_SEGMENT_VERSION,
+        .sh_created = loggy_os_log_timestamp(),
+    };
+    segment_write(writer, &header, sizeof(header));
+    segment_calibrate(writer);
+
+    pthread_mutex_init(&writer->sw_lock, NULL);
+    pthread_cond_init(&writer->sw_ready, NULL);
+    pthread_cond_init(&writer->sw_room, NULL);
+    if (pthread_create(&writer->sw_thread, NULL, segment_compress_thread, writer) != 0) {
+        pthread_cond_destroy(&writer->sw_room);
+        pthread_cond_destroy(&writer->sw_ready);
+        pthread_mutex_destroy(&writer->sw_lock);
+        goto fail;
+    }
+    return writer;
+
+fail:
+    if (writer->sw_file) {
+        fclose(writer->sw_file);
+    }
+    segment_dict_destroy(&writer->sw_formats);
+    segment_dict_destroy(&writer->sw_handles);
+    segment_dict_destroy(&writer->sw_images);
+    free(writer);
+    loggy_os_log_clock_unpin();
+    return NULL;
+}
+
+const loggy_os_log_sink_s *loggy_os_log_segment_writer_sink(loggy_os_log_segment_writer_t writer) {
+    return &writer->sw_sink;
+}
+
+// Hands the block being filled to the compression thread.
+static void segment_flush_block(loggy_os_log_segment_writer_t writer) {
+    segment_block_t block = writer->sw_current;
+    writer->sw_current = NULL;
+    block->sb_next = NULL;
+    *writer->sw_queue_tail = block;
+    writer->sw_queue_tail = &block->sb_next;
+    pthread_cond_signal(&writer->sw_ready);
+}
+
+// The block being filled, with room for `size` more bytes. If compression
+// has fallen too far behind, waits for it rather than grow without bound.
+static segment_block_t segment_block(loggy_os_log_segment_writer_t writer, size_t size) {
+    segment_block_t block = writer->sw_current;
+    if (!block) {
+        while (!writer->sw_free && writer->sw_blocks >= LOGGY_OS_LOG_SEGMENT_BLOCKS_IN_FLIGHT) {
+            pthread_cond_wait(&writer->sw_room, &writer->sw_lock);
+        }
+
+        if ((block = writer->sw_free)) {
+            writer->sw_free = block->sb_next;
+        } else if ((block = calloc(1, sizeof(segment_block_s)))) {
+            writer->sw_blocks += 1;
+        } else {
+            return NULL;
+        }
+
+        block->sb_index = (loggy_os_log_segment_index_s){ .si_min_time = UINT64_MAX };
+        writer->sw_current = block;
+    }
+
+    size_t needed = block->sb_index.si_length + size;
+    if (needed > block->sb_capacity) {
+        size_t capacity = needed > LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES ? needed : LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES;
+        uint8_t *data = realloc(block->sb_data, capacity);
+        if (!data) {
+            return NULL;
+        }
+        block->sb_data = data;
+        block->sb_capacity = capacity;
+    }
+    return block;
+}
+
+bool loggy_os_log_segment_append(loggy_os_log_segment_writer_t writer, const loggy_os_log_record_s *record) {
+    size_t len = loggy_os_log_record_size(record);
+    loggy_os_log_segment_record_s header = {
+        .sr_size = (uint32_t)LOGGY_OS_LOG_SEGMENT_ALIGN(sizeof(loggy_os_log_segment_record_s) + len),
+        .sr_type = record->lr_type,
+        .sr_truncated = record->lr_truncated,
+        .sr_len = (uint32_t)len,
+        .sr_time = record->lr_time,
+        .sr_activity = record->lr_activity,
+        .sr_pc = (uint64_t)(uintptr_t)record->lr_pc,
+    };
+
+    pthread_mutex_lock(&writer->sw_lock);
+
+    segment_block_t block = segment_block(writer, header.sr_size);
+    if (!block
+        || !segment_dict_id(&writer->sw_formats, record->lr_format, record->lr_format, NULL, &header.sr_format)
+        || !segment_dict_id(&writer->sw_handles, record->lr_log, record->lr_log->subsystem, record->lr_log->category, &header.sr_handle)) {
+        pthread_mutex_unlock(&writer->sw_lock);
+        return false;
+    }
+
+    loggy_os_log_segment_index_s *index = &block->sb_index;
+    uint8_t *data = block->sb_data + index->si_length;
+    memcpy(data, &header, sizeof(header));
+    loggy_os_log_record_copy(record, data + sizeof(header));
+    memset(data + sizeof(header) + len, 0, header.sr_size - sizeof(header) - len);
+    index->si_length += header.sr_size;
+
+    index->si_count += 1;
+    index->si_types |= LOGGY_OS_LOG_TYPE_BIT(record->lr_type);
+    index->si_handles |= 1ull << (header.sr_handle % 64);
+    if (record->lr_time < index->si_min_time) {
+        index->si_min_time = record->lr_time;
+    }
+    if (record->lr_time > index->si_max_time) {
+        index->si_max_time = record->lr_time;
+    }
+    writer->sw_trailer.st_records += 1;
+
+    if (index->si_length >= LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES) {
+        segment_flush_block(writer);
+    }
+
+    bool ok = !__atomic_load_n(&writer->sw_failed, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&writer->sw_lock);
+    return ok;
+}
+
+static void segment_write_dict(loggy_os_log_segment_writer_t writer, segment_dict_t dict) {
+    for (uint32_t i = 0; i < dict->sd_count; i++) {
+        segment_dict_entry_s *entry = dict->sd_ordered[i];
+        segment_write(writer, &entry->de_len, sizeof(entry->de_len));
+        segment_write(writer, entry->de_value, entry->de_len);
+        segment_pad(writer);
+    }
+}
+
+bool loggy_os_log_segment_writer_close(loggy_os_log_segment_writer_t writer) {
+    pthread_mutex_lock(&writer->sw_lock);
+    if (writer->sw_current && writer->sw_current->sb_index.si_count) {
+        segment_flush_block(writer);
+    }
+    writer->sw_closing = true;
+    pthread_cond_signal(&writer->sw_ready);
+    pthread_mutex_unlock(&writer->sw_lock);
+    pthread_join(writer->sw_thread, NULL);
+
+    loggy_os_log_segment_trailer_s *trailer = &writer->sw_trailer;
+
+    trailer->st_formats = writer->sw_offset;
+    trailer->st_format_count = writer->sw_formats.sd_count;
+    segment_write_dict(writer, &writer->sw_formats);
+
+    trailer->st_handles = writer->sw_offset;
+    trailer->st_handle_count = writer->sw_handles.sd_count;
+    segment_write_dict(writer, &writer->sw_handles);
+
+    trailer->st_images = writer->sw_offset;
+    trailer->st_image_count = writer->sw_images.sd_count;
+    segment_write_dict(writer, &writer->sw_images);
+
+    segment_calibrate(writer);
+    trailer->st_calibrations = writer->sw_offset;
+    trailer->st_calibration_count = writer->sw_calibration_count;
+    segment_write(writer, writer->sw_calibrations, writer->sw_calibration_count * sizeof(loggy_os_log_clock_calibration_s));
+
+    for (uint32_t i = 0; i < writer->sw_index_count; i++) {
+        if (writer->sw_index[i].si_min_time < trailer->st_min_time) {
+            trailer->st_min_time = writer->sw_index[i].si_min_time;
+        }
+        if (writer->sw_index[i].si_max_time > trailer->st_max_time) {
+            trailer->st_max_time = writer->sw_index[i].si_max_time;
+        }
+    }
+    if (!writer->sw_index_count) {
+        trailer->st_min_time = 0;
+    }
+
+    trailer->st_index = writer->sw_offset;
+    trailer->st_index_count = writer->sw_index_count;
+    segment_write(writer, writer->sw_index, writer->sw_index_count * sizeof(loggy_os_log_segment_index_s));
+
+    trailer->st_magic = LOGGY_OS_LOG_SEGMENT_TRAILER_MAGIC;
+    trailer->st_version = LOGGY_OS_LOG_SEGMENT_VERSION;
+    segment_write(writer, trailer, sizeof(*trailer));
+
+    bool ok = fclose(writer->sw_file) == 0 && !writer->sw_failed;
+
+    segment_block_t blocks[] = { writer->sw_current, writer->sw_free };
+    for (size_t i = 0; i < sizeof(blocks) / sizeof(blocks[0]); i++) {
+        for (segment_block_t block = blocks[i], next; block; block = next) {
+            next = block->sb_next;
+            free(block->sb_data);
+            free(block);
+        }
+    }
+
+    segment_dict_destroy(&writer->sw_formats);
+    segment_dict_destroy(&writer->sw_handles);
+    segment_dict_destroy(&writer->sw_images);
+    pthread_cond_destroy(&writer->sw_room);
+    pthread_cond_destroy(&writer->sw_ready);
+    pthread_mutex_destroy(&writer->sw_lock);
+    free(writer->sw_calibrations);
+    free(writer->sw_compressed);
+    free(writer->sw_index);
+    free(writer);
+    loggy_os_log_clock_unpin();
+    return ok;
+}
+
+// MARK: - Reading
+
+// Reads the next length-prefixed string of a table, advancing `offset`.
+// Returns `NULL` if it runs past `end` or isn't terminated.
+static const char *segment_read_string(const uint8_t *map, uint64_t *offset, uint64_t end, uint32_t *len) {
+    if (*offset + sizeof(*len) > end) {
+        return NULL;
+    }
+    memcpy(len, map + *offset, sizeof(*len));
+    uint64_t start = *offset + sizeof(*len);
+    if (*len == 0 || *len > end - start || map[start + *len - 1] != 0) {
+        return NULL;
+    }
+    *offset = LOGGY_OS_LOG_SEGMENT_ALIGN(start + *len);
+    return (const char *)map + start;
+}
+
+static bool segment_reader_load(loggy_os_log_segment_reader_t reader) {
+    const uint8_t *map = reader->sr_map;
+    size_t size = reader->sr_map_size;
+    if (size < sizeof(loggy_os_log_segment_header_s) + sizeof(loggy_os_log_segment_trailer_s)) {
+        return false;
+    }
+
+    const loggy_os_log_segment_header_s *header = (const loggy_os_log_segment_header_s *)map;
+    const loggy_os_log_segment_trailer_s *trailer = (const loggy_os_log_segment_trailer_s *)(map + size - sizeof(loggy_os_log_segment_trailer_s));
+    uint64_t end = size - sizeof(loggy_os_log_segment_trailer_s);
+    if (header->sh_magic != LOGGY_OS_LOG_SEGMENT_MAGIC || header->sh_version != LOGGY_OS_LOG_SEGMENT_VERSION
+        || trailer->st_magic != LOGGY_OS_LOG_SEGMENT_TRAILER_MAGIC || trailer->st_version != LOGGY_OS_LOG_SEGMENT_VERSION
+        || trailer->st_formats > trailer->st_handles || trailer->st_handles > trailer->st_images
+        || trailer->st_images > trailer->st_calibrations
+        || trailer->st_calibrations > trailer->st_index || trailer->st_index > end
+        || (trailer->st_index - trailer->st_calibrations) / sizeof(loggy_os_log_clock_calibration_s) < trailer->st_calibration_count
+        || (end - trailer->st_index) / sizeof(loggy_os_log_segment_index_s) < trailer->st_index_count) {
+        return false;
+    }
+    reader->sr_calibrations = (const loggy_os_log_clock_calibration_s *)(map + trailer->st_calibrations);
+    reader->sr_trailer = trailer;
+    reader->sr_index = (const loggy_os_log_segment_index_s *)(map + trailer->st_index);
+
+    reader->sr_formats = calloc(trailer->st_format_count + 1, sizeof(const char *));
+    reader->sr_handles = calloc(trailer->st_handle_count + 1, sizeof(struct loggy_os_log_s));
+    reader->sr_images = calloc(trailer->st_image_count + 1, sizeof(loggy_os_log_image_info_s));
+    if (!reader->sr_formats || !reader->sr_handles || !reader->sr_images) {
+        return false;
+    }
+
+    uint64_t offset = trailer->st_formats;
+    for (uint32_t id = 0; id < trailer->st_format_count; id++) {
+        uint32_t len;
+        if (!(reader->sr_formats[id] = segment_read_string(map, &offset, trailer->st_handles, &len))) {
+            return false;
+        }
+    }
+
+    offset = trailer->st_handles;
+    for (uint32_t id = 0; id < trailer->st_handle_count; id++) {
+        uint32_t len;
+        const char *subsystem = segment_read_string(map, &offset, trailer->st_images, &len);
+        size_t subsystem_len = subsystem ? strlen(subsystem) + 1 : 0;
+        if (!subsystem || subsystem_len >= len) {
+            return false;
+        }
+        reader->sr_handles[id].subsystem = subsystem;
+        reader->sr_handles[id].category = subsystem + subsystem_len;
+    }
+
+    offset = trailer->st_images;
+    for (uint32_t id = 0; id < trailer->st_image_count; id++) {
+        uint32_t len;
+        const char *build_id = segment_read_string(map, &offset, trailer->st_calibrations, &len);
+        size_t build_id_len = build_id ? strlen(build_id) + 1 : 0;
+        if (!build_id || build_id_len >= len) {
+            return false;
+        }
+        reader->sr_images[id].ii_build_id = build_id;
+        reader->sr_images[id].ii_path = build_id + build_id_len;
+    }
+    return true;
+}
+
+bool loggy_os_log_segment_reader_open(loggy_os_log_segment_reader_t reader, const char *path, loggy_os_activity_pool_t pool) {
+    *reader = (loggy_os_log_segment_reader_s){ .sr_pool = pool };
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    // Reads mostly run front to back, so let the kernel read ahead
+    // aggressively and drop pages behind.
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    reader->sr_map = map;
+    reader->sr_map_size = (size_t)st.st_size;
+    if (!segment_reader_load(reader)) {
+        loggy_os_log_segment_reader_close(reader);
+        return false;
+    }
+    return true;
+}
+
+void loggy_os_log_segment_reader_close(loggy_os_log_segment_reader_t reader) {
+    if (reader->sr_map) {
+        munmap((void *)reader->sr_map, reader->sr_map_size);
+    }
+    free(reader->sr_formats);
+    free(reader->sr_handles);
+    free(reader->sr_images);
+    *reader = (loggy_os_log_segment_reader_s){ 0 };
+}
+
+// Converts a stored time to monotonic nanoseconds with the last
+// calibration taken before it.
+static uint64_t segment_time(loggy_os_log_segment_reader_t reader, uint64_t time) {
+    const loggy_os_log_clock_calibration_s *calibrations = reader->sr_calibrations;
+    uint32_t count = reader->sr_trailer->st_calibration_count;
+    if (!count || !calibrations[0].cc_frequency) {
+        return time;
+    }
+
+    uint32_t low = 0, high = count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (calibrations[mid].cc_ticks <= time) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return loggy_os_log_clock_convert(&calibrations[low], time);
+}
+
+uint64_t loggy_os_log_segment_wall_time(loggy_os_log_segment_reader_t reader, uint64_t time) {
+    const loggy_os_log_clock_calibration_s *calibrations = reader->sr_calibrations;
+    uint32_t count = reader->sr_trailer->st_calibration_count;
+    if (!count) {
+        return time;
+    }
+
+    uint32_t low = 0, high = count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (calibrations[mid].cc_monotonic <= time) {
+            low = mid;
+        } else {
+            high = mid;
+        }
+    }
+    return calibrations[low].cc_realtime + time - calibrations[low].cc_monotonic;
+}
+
+// Passes `advice` for the pages holding blocks `first` through `last`.
+static void segment_advise(loggy_os_log_segment_reader_t reader, uint32_t first, uint32_t last, int advice) {
+    const loggy_os_log_segment_index_s *index = reader->sr_index;
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)(reader->sr_map + index[first].si_offset) & ~(page - 1);
+    uintptr_t end = (uintptr_t)(reader->sr_map + index[last].si_offset + index[last].si_stored);
+    if (index[first].si_offset <= index[last].si_offset && index[last].si_offset + index[last].si_stored <= reader->sr_map_size) {
+        madvise((void *)start, end - start, advice);
+    }
+}
+
+// The handle bits a block must share with the query to hold a match.
+static uint64_t segment_query_handles(loggy_os_log_segment_reader_t reader, const loggy_os_log_segment_query_s *query) {
+    if (!query->sq_subsystem) {
+        return UINT64_MAX;
+    }
+
+    uint64_t handles = 0;
+    for (uint32_t id = 0; id < reader->sr_trailer->st_handle_count; id++) {
+        if (strcmp(reader->sr_handles[id].subsystem, query->sq_subsystem) == 0) {
+            handles |= 1ull << (id % 64);
+        }
+    }
+    return handles;
+}
+
+static bool segment_block_matches(loggy_os_log_segment_reader_t reader, uint32_t i, const loggy_os_log_segment_query_s *query, uint64_t handles) {
+    const loggy_os_log_segment_trailer_s *trailer = reader->sr_trailer;
+    const loggy_os_log_segment_index_s *block = &reader->sr_index[i];
+    uint64_t end_time = query->sq_end ? query->sq_end : UINT64_MAX;
+    uint8_t types = query->sq_types ? query->sq_types : UINT8_MAX;
+    return segment_time(reader, block->si_max_time) >= query->sq_start && segment_time(reader, block->si_min_time) < end_time
+        && (block->si_types & types) && (block->si_handles & handles)
+        && block->si_offset <= trailer->st_formats && block->si_stored <= trailer->st_formats - block->si_offset;
+}
+
+bool loggy_os_log_segment_block_matches(loggy_os_log_segment_reader_t reader, uint32_t i, const loggy_os_log_segment_query_s *query) {
+    return i < reader->sr_trailer->st_index_count && segment_block_matches(reader, i, query, segment_query_handles(reader, query));
+}
+
+uint64_t loggy_os_log_segment_block_min_time(loggy_os_log_segment_reader_t reader, uint32_t i) {
+    return segment_time(reader, reader->sr_index[i].si_min_time);
+}
+
+const uint8_t *loggy_os_log_segment_block_records(loggy_os_log_segment_reader_t reader, uint32_t i, uint8_t **buf, size_t *capacity) {
+    const loggy_os_log_segment_index_s *block = &reader->sr_index[i];
+    const uint8_t *stored = reader->sr_map + block->si_offset;
+
+    if (!(block->si_flags & LOGGY_OS_LOG_SEGMENT_BLOCK_COMPRESSED)) {
+        return block->si_stored == block->si_length ? stored : NULL;
+    }
+
+    if (block->si_length > *capacity) {
+        uint8_t *grown = realloc(*buf, block->si_length);
+        if (!grown) {
+            return NULL;
+        }
+        *buf = grown;
+        *capacity = block->si_length;
+    }
+
+    return loggy_os_log_decompress(stored, block->si_stored, *buf, block->si_length) ? *buf : NULL;
+}
+
+// What `lr_image` points to for records that weren't in a known image.
+static const loggy_os_log_image_info_s segment_no_image = { .ii_path = "", .ii_build_id = "" };
+
+bool loggy_os_log_segment_record_next(loggy_os_log_segment_reader_t reader, uint32_t i, const uint8_t *records, uint64_t *offset, loggy_os_log_record_s *record) {
+    const loggy_os_log_segment_trailer_s *trailer = reader->sr_trailer;
+    uint64_t length = reader->sr_index[i].si_length;
+    if (*offset >= length || length - *offset < sizeof(loggy_os_log_segment_record_s)) {
+        return false;
+    }
+
+    const loggy_os_log_segment_record_s *entry = (const loggy_os_log_segment_record_s *)(records + *offset);
+    if (entry->sr_size < sizeof(*entry) + entry->sr_len || entry->sr_size > length - *offset
+        || entry->sr_format >= trailer->st_format_count || entry->sr_handle >= trailer->st_handle_count
+        || (entry->sr_image >= trailer->st_image_count && entry->sr_image != LOGGY_OS_LOG_SEGMENT_NO_IMAGE)) {
+        return false;
+    }
+    *offset += entry->sr_size;
+
+    *record = (loggy_os_log_record_s){
+        .lr_time = segment_time(reader, entry->sr_time),
+        .lr_activity = entry->sr_activity,
+        .lr_log = &reader->sr_handles[entry->sr_handle],
+        .lr_format = reader->sr_formats[entry->sr_format],
+        .lr_pc = (const void *)(uintptr_t)entry->sr_pc,
+        .lr_image = entry->sr_image != LOGGY_OS_LOG_SEGMENT_NO_IMAGE ? &reader->sr_images[entry->sr_image] : &segment_no_image,
+        .lr_buf = entry->sr_data,
+        .lr_len = entry->sr_len,
+        .lr_truncated = entry->sr_truncated,
+        .lr_type = entry->sr_type,
+    };
+    return true;
+}
+
+// The tasks one call has handed to a pool, so that it waits for those
+// rather than for everything else on the pool too.
+typedef struct {
+    pthread_mutex_t sg_lock;
+    pthread_cond_t  sg_done;
+    size_t          sg_pending;
+} segment_group_s, *segment_group_t;
+
+static void segment_group_init(segment_group_t group) {
+    pthread_mutex_init(&group->sg_lock, NULL);
+    pthread_cond_init(&group->sg_done, NULL);
+    group->sg_pending = 0;
+}
+
+static void segment_group_destroy(segment_group_t group) {
+    pthread_cond_destroy(&group->sg_done);
+    pthread_mutex_destroy(&group->sg_lock);
+}
+
+static void segment_group_async(segment_group_t group, loggy_os_activity_pool_t pool, void *context, void (*fn)(void *context)) {
+    pthread_mutex_lock(&group->sg_lock);
+    group->sg_pending += 1;
+    pthread_mutex_unlock(&group->sg_lock);
+    loggy_os_activity_pool_async(pool, context, fn);
+}
+
+// The last thing a task does with its context.
+static void segment_group_leave(segment_group_t group) {
+    pthread_mutex_lock(&group->sg_lock);
+    if (--group->sg_pending == 0) {
+        pthread_cond_broadcast(&group->sg_done);
+    }
+    pthread_mutex_unlock(&group->sg_lock);
+}
+
+static void segment_group_wait(segment_group_t group) {
+    pthread_mutex_lock(&group->sg_lock);
+    while (group->sg_pending) {
+        pthread_cond_wait(&group->sg_done, &group->sg_lock);
+    }
+    pthread_mutex_unlock(&group->sg_lock);
+}
+
+// A block on its way to being read.
+typedef struct {
+    loggy_os_log_segment_reader_t sd_reader;
+    segment_group_t _Nullable sd_group;
+    uint32_t        sd_block;
+    uint8_t        *_Nullable sd_buf;
+    size_t          sd_capacity;
+    const uint8_t  *_Nullable sd_records;
+} segment_decode_s, *segment_decode_t;
+
+static void segment_decode(void *context) {
+    segment_decode_t decode = context;
+    decode->sd_records = loggy_os_log_segment_block_records(decode->sd_reader, decode->sd_block, &decode->sd_buf, &decode->sd_capacity);
+    if (decode->sd_group) {
+        segment_group_leave(decode->sd_group);
+    }
+}
+
+size_t loggy_os_log_segment_read(loggy_os_log_segment_reader_t reader, const loggy_os_log_segment_query_s *query, void (*handler)(void *context, const loggy_os_log_record_s *record), void *context) {
+    static const loggy_os_log_segment_query_s everything = { 0 };
+    if (!query) {
+        query = &everything;
+    }
+
+    const loggy_os_log_segment_trailer_s *trailer = reader->sr_trailer;
+    uint64_t end_time = query->sq_end ? query->sq_end : UINT64_MAX;
+    uint8_t types = query->sq_types ? query->sq_types : UINT8_MAX;
+    uint64_t handles = segment_query_handles(reader, query);
+    if (!handles || query->sq_start > segment_time(reader, trailer->st_max_time) || end_time <= segment_time(reader, trailer->st_min_time)) {
+        return 0;
+    }
+
+    // Decompress a window of matching blocks at a time, then handle their
+    // records in order.
+    segment_decode_s window[LOGGY_OS_LOG_SEGMENT_READ_AHEAD] = {{ 0 }};
+    segment_group_s group;
+    segment_group_init(&group);
+    size_t count = 0;
+    for (uint32_t i = 0; i < trailer->st_index_count;) {
+        uint32_t last = i + LOGGY_OS_LOG_SEGMENT_READ_AHEAD * 2 < trailer->st_index_count ? i + LOGGY_OS_LOG_SEGMENT_READ_AHEAD * 2 : trailer->st_index_count - 1;
+        segment_advise(reader, i, last, MADV_WILLNEED);
+
+        size_t n = 0;
+        for (; i < trailer->st_index_count && n < LOGGY_OS_LOG_SEGMENT_READ_AHEAD; i++) {
+            if (!segment_block_matches(reader, i, query, handles)) {
+                continue;
+            }
+
+            segment_decode_t decode = &window[n++];
+            decode->sd_reader = reader;
+            decode->sd_block = i;
+            if (reader->sr_pool) {
+                decode->sd_group = &group;
+                segment_group_async(&group, reader->sr_pool, decode, segment_decode);
+            } else {
+                segment_decode(decode);
+            }
+        }
+        segment_group_wait(&group);
+
+        for (size_t k = 0; k < n; k++) {
+            loggy_os_log_record_s record;
+            uint64_t offset = 0;
+            while (window[k].sd_records && loggy_os_log_segment_record_next(reader, window[k].sd_block, window[k].sd_records, &offset, &record)) {
+                if (record.lr_time < query->sq_start || record.lr_time >= end_time
+                    || !(LOGGY_OS_LOG_TYPE_BIT(record.lr_type) & types)
+                    || (query->sq_subsystem && strcmp(record.lr_log->subsystem, query->sq_subsystem) != 0)) {
+                    continue;
+                }
+                handler(context, &record);
+                count += 1;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < LOGGY_OS_LOG_SEGMENT_READ_AHEAD; k++) {
+        free(window[k].sd_buf);
+    }
+    segment_group_destroy(&group);
+    return count;
+}
+
+// MARK: - Scanning
+
+// A run of blocks scanned by one task.
+typedef struct {
+    loggy_os_log_segment_reader_t sc_reader;
+    const loggy_os_log_segment_query_s *sc_query;
+    uint64_t        sc_handles;
+    uint32_t        sc_first;
+    uint32_t        sc_end;
+    // Where to read ahead once this chunk starts, if anywhere.
+    uint32_t        sc_ahead_first;
+    uint32_t        sc_ahead_end;
+    void (*sc_handler)(void *_Nullable context, const loggy_os_log_record_s *record);
+    void           *_Nullable sc_context;
+    size_t         *sc_count;
+    segment_group_t _Nullable sc_group;
+} segment_chunk_s, *segment_chunk_t;
+
+static void segment_scan_chunk(void *context) {
+    segment_chunk_t chunk = context;
+    loggy_os_log_segment_reader_t reader = chunk->sc_reader;
+    const loggy_os_log_segment_query_s *query = chunk->sc_query;
+    uint64_t end_time = query->sq_end ? query->sq_end : UINT64_MAX;
+    uint8_t types = query->sq_types ? query->sq_types : UINT8_MAX;
+
+    if (chunk->sc_ahead_end > chunk->sc_ahead_first) {
+        segment_advise(reader, chunk->sc_ahead_first, chunk->sc_ahead_end - 1, MADV_WILLNEED);
+    }
+
+    uint8_t *buf = NULL;
+    size_t capacity = 0, count = 0;
+    for (uint32_t i = chunk->sc_first; i < chunk->sc_end; i++) {
+        const uint8_t *records;
+        if (!segment_block_matches(reader, i, query, chunk->sc_handles) || !(records = loggy_os_log_segment_block_records(reader, i, &buf, &capacity))) {
+            continue;
+        }
+
+        loggy_os_log_record_s record;
+        uint64_t offset = 0;
+        while (loggy_os_log_segment_record_next(reader, i, records, &offset, &record)) {
+            if (record.lr_time < query->sq_start || record.lr_time >= end_time
+                || !(LOGGY_OS_LOG_TYPE_BIT(record.lr_type) & types)
+                || (query->sq_subsystem && strcmp(record.lr_log->subsystem, query->sq_subsystem) != 0)) {
+                continue;
+            }
+            chunk->sc_handler(chunk->sc_context, &record);
+            count += 1;
+        }
+    }
+    free(buf);
+
+    // Done with these pages; don't let a big file crowd out everything else.
+    segment_advise(reader, chunk->sc_first, chunk->sc_end - 1, MADV_DONTNEED);
+    __atomic_fetch_add(chunk->sc_count, count, __ATOMIC_RELAXED);
+    if (chunk->sc_group) {
+        segment_group_leave(chunk->sc_group);
+    }
+}
+
+size_t loggy_os_log_segment_scan(loggy_os_log_segment_reader_t reader, const loggy_os_log_segment_query_s *query, loggy_os_activity_pool_t pool, void (*handler)(void *context, const loggy_os_log_record_s *record), void *context) {
+    static const loggy_os_log_segment_query_s everything = { 0 };
+    if (!query) {
+        query = &everything;
+    }
+
+    const loggy_os_log_segment_trailer_s *trailer = reader->sr_trailer;
+    uint64_t handles = segment_query_handles(reader, query);
+    if (!handles || !trailer->st_index_count) {
+        return 0;
+    }
+
+    // Split at block boundaries into runs of about the same stored size.
+    uint32_t capacity = (uint32_t)(trailer->st_formats / LOGGY_OS_LOG_SEGMENT_SCAN_CHUNK) + 2;
+    segment_chunk_t chunks = calloc(capacity, sizeof(segment_chunk_s));
+    if (!chunks) {
+        return 0;
+    }
+
+    size_t count = 0;
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < trailer->st_index_count && n < capacity; n++) {
+        uint32_t first = i;
+        uint64_t stored = 0;
+        while (i < trailer->st_index_count && (stored < LOGGY_OS_LOG_SEGMENT_SCAN_CHUNK || n == capacity - 1)) {
+            stored += reader->sr_index[i++].si_stored;
+        }
+        chunks[n] = (segment_chunk_s){
+            .sc_reader = reader,
+            .sc_query = query,
+            .sc_handles = handles,
+            .sc_first = first,
+            .sc_end = i,
+            .sc_handler = handler,
+            .sc_context = context,
+            .sc_count = &count,
+        };
+    }
+
+    // Each chunk reads ahead for the one a few places after it; start the
+    // first few off here.
+    for (uint32_t k = 0; k < n; k++) {
+        if (k + LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD < n) {
+            chunks[k].sc_ahead_first = chunks[k + LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD].sc_first;
+            chunks[k].sc_ahead_end = chunks[k + LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD].sc_end;
+        }
+    }
+    segment_advise(reader, chunks[0].sc_first, chunks[n < LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD ? n - 1 : LOGGY_OS_LOG_SEGMENT_SCAN_AHEAD - 1].sc_end - 1, MADV_WILLNEED);
+
+    segment_group_s group;
+    segment_group_init(&group);
+    for (uint32_t k = 0; k < n; k++) {
+        if (pool) {
+            chunks[k].sc_group = &group;
+            segment_group_async(&group, pool, &chunks[k], segment_scan_chunk);
+        } else {
+            segment_scan_chunk(&chunks[k]);
+        }
+    }
+    segment_group_wait(&group);
+    segment_group_destroy(&group);
+
+    free(chunks);
+    return count;
+}
+
+#endif
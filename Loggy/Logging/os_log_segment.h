@@ -0,0 +1,247 @@
+//
+//  os_log_segment.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_segment_h__
+#define __loggy_os_log_segment_h__
+
+#include "os_log_sink.h"
+#include "os_log_clock.h"
+#include "os_log_image.h"
+#include "os_activity_pool.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/*
+ * A segment is a file of log messages, written front to back and sealed
+ * with a footer when closed. Everything is little-endian and 8-byte aligned.
+ *
+ *     header    loggy_os_log_segment_header_s
+ *     blocks    as many as were written, each holding a run of records
+ *               that may be compressed
+ *     formats   for each format ID in order: a uint32_t length, then the
+ *               NUL-terminated format string
+ *     handles   for each handle ID in order: a uint32_t length, then the
+ *               NUL-terminated subsystem and category
+ *     images    for each image ID in order: a uint32_t length, then the
+ *               NUL-terminated build ID in hex and path
+ *     clock     loggy_os_log_clock_calibration_s, one per calibration
+ *               taken while the segment was written
+ *     index     loggy_os_log_segment_index_s, one per block of records
+ *     trailer   loggy_os_log_segment_trailer_s, the last bytes of the file
+ *
+ * A block is `si_length` bytes of records once decompressed: each a
+ * loggy_os_log_segment_record_s followed by the encoder's buffer,
+ * unformatted. Formats, handles, and images are stored once and referred
+ * to by ID.
+ *
+ * A record's return address is stored as the image it's in and the address
+ * the image was linked at, which is what its debug info uses, so it can be
+ * symbolicated later without the process. The compression thread works
+ * that out, not the logging threads.
+ *
+ * Times are stored as `lr_time` was recorded, which may be ticks; the
+ * calibrations say how to convert them, and the reader does so, so times
+ * read back are always monotonic nanoseconds. They also map those to wall
+ * time. The writer pins the clock's units while it's open, so every
+ * calibration in a segment is in the same ones.
+ *
+ * Records are gathered into blocks of about `LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES`
+ * and compressed with `loggy_os_log_compress` on a background thread. The
+ * index gives each block's location, time span, types, and handles, so a
+ * reader can skip to the part of the file it wants and decompress only that.
+ */
+
+#define LOGGY_OS_LOG_SEGMENT_MAGIC          0x47534c4cu /* "LLSG" */
+#define LOGGY_OS_LOG_SEGMENT_TRAILER_MAGIC  0x54534c4cu /* "LLST" */
+#define LOGGY_OS_LOG_SEGMENT_VERSION        4
+#define LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES    (64 * 1024)
+/// The `sr_image` of a record whose address isn't in a known image; its
+/// `sr_pc` is the address as logged.
+#define LOGGY_OS_LOG_SEGMENT_NO_IMAGE       UINT32_MAX
+
+typedef struct {
+    uint32_t        sh_magic;
+    uint32_t        sh_version;
+    uint64_t        sh_created;
+} loggy_os_log_segment_header_s;
+
+typedef struct {
+    uint32_t        sr_size;
+    os_log_type_t   sr_type;
+    uint8_t         sr_reserved;
+    uint16_t        sr_truncated;
+    uint32_t        sr_len;
+    uint32_t        sr_handle;
+    uint32_t        sr_format;
+    uint32_t        sr_image;
+    uint64_t        sr_time;
+    uint64_t        sr_activity;
+    uint64_t        sr_pc;
+    uint8_t         sr_data[];
+} loggy_os_log_segment_record_s;
+
+OS_ENUM(loggy_os_log_segment_block_flags, uint8_t,
+    LOGGY_OS_LOG_SEGMENT_BLOCK_COMPRESSED = 0x01,
+);
+
+typedef struct {
+    uint64_t        si_offset;
+    uint64_t        si_min_time;
+    uint64_t        si_max_time;
+    /// Handles in the block, as bits `1 << (id % 64)`.
+    uint64_t        si_handles;
+    uint32_t        si_count;
+    /// Types in the block, as `LOGGY_OS_LOG_TYPE_BIT`s.
+    uint8_t         si_types;
+    loggy_os_log_segment_block_flags_t si_flags;
+    uint8_t         si_reserved[2];
+    /// Bytes the block takes in the file.
+    uint32_t        si_stored;
+    /// Bytes of records in the block.
+    uint32_t        si_length;
+} loggy_os_log_segment_index_s;
+
+typedef struct {
+    uint64_t        st_formats;
+    uint64_t        st_handles;
+    uint64_t        st_images;
+    uint64_t        st_calibrations;
+    uint64_t        st_index;
+    uint64_t        st_records;
+    uint64_t        st_min_time;
+    uint64_t        st_max_time;
+    uint32_t        st_format_count;
+    uint32_t        st_handle_count;
+    uint32_t        st_index_count;
+    uint32_t        st_calibration_count;
+    uint32_t        st_image_count;
+    uint32_t        st_reserved;
+    uint32_t        st_magic;
+    uint32_t        st_version;
+} loggy_os_log_segment_trailer_s;
+
+// MARK: - Writing
+
+typedef struct loggy_os_log_segment_writer_s *loggy_os_log_segment_writer_t;
+
+/// Creates or replaces the segment at `path`. Returns `NULL` on failure.
+OS_EXPORT
+loggy_os_log_segment_writer_t _Nullable loggy_os_log_segment_writer_create(const char *path);
+
+/// A sink that appends to the segment; install it with
+/// `loggy_os_log_set_sink`. It must be uninstalled before closing.
+OS_EXPORT
+const loggy_os_log_sink_s *loggy_os_log_segment_writer_sink(loggy_os_log_segment_writer_t writer);
+
+/// Appends `record`. Safe to call from any thread; appends are serialized.
+/// Only copies the record into the current block; if compression falls
+/// behind by several blocks, waits for it. Returns false if a write failed.
+OS_EXPORT
+bool loggy_os_log_segment_append(loggy_os_log_segment_writer_t writer, const loggy_os_log_record_s *record);
+
+/// Writes the footer, closes the file, and frees the writer. Returns false
+/// if any write failed, in which case the segment is unreadable.
+OS_EXPORT
+bool loggy_os_log_segment_writer_close(loggy_os_log_segment_writer_t writer);
+
+// MARK: - Reading
+
+typedef struct {
+    const uint8_t  *_Nullable sr_map;
+    size_t          sr_map_size;
+    loggy_os_activity_pool_t _Nullable sr_pool;
+    const loggy_os_log_segment_trailer_s *_Nullable sr_trailer;
+    const loggy_os_log_segment_index_s *_Nullable sr_index;
+    const char    *_Nonnull *_Nullable sr_formats;
+    struct loggy_os_log_s *_Nullable sr_handles;
+    loggy_os_log_image_info_s *_Nullable sr_images;
+    const loggy_os_log_clock_calibration_s *_Nullable sr_calibrations;
+} loggy_os_log_segment_reader_s, *loggy_os_log_segment_reader_t;
+
+/// Which records to read. Zeroed fields match everything.
+typedef struct {
+    /// Records at or after this time, in `lr_time` nanoseconds.
+    uint64_t        sq_start;
+    /// Records before this time.
+    uint64_t        sq_end;
+    /// A mask of `LOGGY_OS_LOG_TYPE_BIT`s.
+    uint8_t         sq_types;
+    const char     *_Nullable sq_subsystem;
+} loggy_os_log_segment_query_s;
+
+/// Maps the sealed segment at `path`. Returns false if it can't be read or
+/// isn't a segment.
+///
+/// Blocks are decompressed on `pool` if given, several at a time ahead of
+/// the records being handled. The pool must outlive the reader. Reading
+/// waits for its own blocks only, but don't read from one of the pool's
+/// workers: the blocks could be stuck behind the worker that's waiting.
+OS_EXPORT
+bool loggy_os_log_segment_reader_open(loggy_os_log_segment_reader_t reader, const char *path, loggy_os_activity_pool_t _Nullable pool);
+
+OS_EXPORT
+void loggy_os_log_segment_reader_close(loggy_os_log_segment_reader_t reader);
+
+/// Passes each record matching `query` to `handler` in the order written,
+/// skipping blocks the index rules out. The record's pointers are only
+/// valid during the call, except `lr_image`, which points to the
+/// `loggy_os_log_image_info_s` of the image `lr_pc` is in for as long as the
+/// reader is open. `lr_pc` is an address as that image was linked, suitable
+/// for `loggy_os_log_symbolicate`. If the writer couldn't find the image,
+/// the info's path is empty and `lr_pc` is the address as logged. Returns
+/// the number of records handled.
+OS_EXPORT
+size_t loggy_os_log_segment_read(loggy_os_log_segment_reader_t reader, const loggy_os_log_segment_query_s *_Nullable query, void (*handler)(void *_Nullable context, const loggy_os_log_record_s *record), void *_Nullable context);
+
+/// Like `loggy_os_log_segment_read`, but for pulling large segments as fast
+/// as the disk allows: the segment is split at block boundaries into chunks
+/// of a few megabytes, which are decoded and filtered on `pool` with the
+/// kernel reading ahead of them.
+///
+/// `handler` is called from the pool's workers, concurrently across chunks
+/// and in order within one, so records don't arrive in order overall. Waits
+/// until every chunk is done, and for nothing else on the pool. Don't call
+/// it from one of `pool`'s workers, whose chunks could be stuck behind the
+/// wait. Returns the number of records handled.
+OS_EXPORT
+size_t loggy_os_log_segment_scan(loggy_os_log_segment_reader_t reader, const loggy_os_log_segment_query_s *_Nullable query, loggy_os_activity_pool_t _Nullable pool, void (*handler)(void *_Nullable context, const loggy_os_log_record_s *record), void *_Nullable context);
+
+/// The wall time, in `CLOCK_REALTIME` nanoseconds, of a record's time, as
+/// the segment's writer would have seen it.
+OS_EXPORT
+uint64_t loggy_os_log_segment_wall_time(loggy_os_log_segment_reader_t reader, uint64_t time);
+
+// MARK: - Blocks
+
+// For readers that schedule the work themselves, like the query engine.
+
+/// Whether the index allows block `i` to hold records matching `query`.
+OS_EXPORT
+bool loggy_os_log_segment_block_matches(loggy_os_log_segment_reader_t reader, uint32_t i, const loggy_os_log_segment_query_s *query);
+
+/// The earliest time of any record in block `i`, in `lr_time` nanoseconds.
+OS_EXPORT
+uint64_t loggy_os_log_segment_block_min_time(loggy_os_log_segment_reader_t reader, uint32_t i);
+
+/// The records of block `i`, decompressed into `*buf` if need be. `*buf`
+/// holds `*capacity` bytes and is grown as needed; free it when done.
+/// Returns `NULL` if the block is corrupt.
+OS_EXPORT
+const uint8_t *_Nullable loggy_os_log_segment_block_records(loggy_os_log_segment_reader_t reader, uint32_t i, uint8_t *_Nullable *_Nonnull buf, size_t *capacity);
+
+/// Reads the record at `*offset` in the `records` of block `i` and advances
+/// past it. Returns false at the end of the block, or if it's corrupt.
+OS_EXPORT
+bool loggy_os_log_segment_record_next(loggy_os_log_segment_reader_t reader, uint32_t i, const uint8_t *records, uint64_t *offset, loggy_os_log_record_s *record);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_segment_h__ */
@@ -11,40 +11,92 @@
 //===----------------------------------------------------------------------===//
 
 #include "os_log_shims.h"
+#include "os_log_format.h"
+#include "os_activity_shims.h"
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
-OS_ENUM(os_log_fmt_hdr_flags, uint8_t,
-    OSLF_HDR_FLAG_HAS_PRIVATE    = 0x01,
-    OSLF_HDR_FLAG_HAS_NON_SCALAR = 0x02,
-);
-
-typedef struct os_log_fmt_hdr_s {
-    os_log_fmt_hdr_flags_t hdr_flags;
-    uint8_t hdr_cmd_cnt;
-} os_log_fmt_hdr_s, *os_log_fmt_hdr_t;
-
-OS_ENUM(os_log_fmt_cmd_flags, uint8_t,
-    OSLF_CMD_FLAG_PRIVATE = 0x1,
-    OSLF_CMD_FLAG_PUBLIC = 0x2
-);
-
-OS_ENUM(os_log_fmt_cmd_type, uint8_t,
-    OSLF_CMD_TYPE_SCALAR      = 0,
-    OSLF_CMD_TYPE_COUNT       = 1,
-    OSLF_CMD_TYPE_STRING      = 2,
-    OSLF_CMD_TYPE_DATA        = 3,
-    OSLF_CMD_TYPE_OBJECT      = 4,
-    OSLF_CMD_TYPE_WIDE_STRING = 5,
-    OSLF_CMD_TYPE_ERRNO       = 6,
-);
-
-typedef struct {
-    os_log_fmt_cmd_flags_t cmd_flags : 4;
-    os_log_fmt_cmd_type_t cmd_type : 4;
-    uint8_t cmd_size;
-} os_log_fmt_cmd_s, *os_log_fmt_cmd_t;
+// MARK: - Chunk pool
 
-static inline void encode(loggy_os_log_encoder_t ob, os_log_fmt_cmd_type_t type, const void *data, size_t size) {
+static pthread_key_t chunk_pool_key;
+static pthread_once_t chunk_pool_once = PTHREAD_ONCE_INIT;
+static uint64_t encoder_truncations;
+
+static void chunk_pool_destroy(void *value) {
+    loggy_os_log_chunk_t chunk = value;
+    while (chunk) {
+        loggy_os_log_chunk_t next = chunk->oc_next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void chunk_pool_init(void) {
+    pthread_key_create(&chunk_pool_key, chunk_pool_destroy);
+}
+
+static loggy_os_log_chunk_t _Nullable chunk_pool_get(void) {
+    pthread_once(&chunk_pool_once, chunk_pool_init);
+    loggy_os_log_chunk_t chunk = pthread_getspecific(chunk_pool_key);
+    if (chunk) {
+        pthread_setspecific(chunk_pool_key, chunk->oc_next);
+    } else {
+        chunk = malloc(sizeof(loggy_os_log_chunk_s));
+        if (!chunk) {
+            return NULL;
+        }
+    }
+
+    chunk->oc_next = NULL;
+    chunk->oc_len = 0;
+    return chunk;
+}
+
+static void chunk_pool_put(loggy_os_log_chunk_t first, loggy_os_log_chunk_t last) {
+    // Only reachable after `chunk_pool_get`, so the key exists.
+    last->oc_next = pthread_getspecific(chunk_pool_key);
+    pthread_setspecific(chunk_pool_key, first);
+}
+
+// MARK: - Encoding
+
+static uint8_t *_Nullable spill(loggy_os_log_encoder_t ob, size_t size) {
+    if (!(ob->ob_flags & LOGGY_OS_LOG_ENCODER_FLAG_GROWABLE)) {
+        return NULL;
+    }
+
+    loggy_os_log_chunk_t chunk = ob->ob_tail;
+    if (!chunk || sizeof(chunk->oc_b) - chunk->oc_len < size) {
+        if (ob->ob_chunk_cnt == LOGGY_OS_LOG_ENCODER_MAX_CHUNKS || !(chunk = chunk_pool_get())) {
+            return NULL;
+        }
+
+        if (ob->ob_tail) {
+            ob->ob_tail->oc_next = chunk;
+        } else {
+            ob->ob_chunks = chunk;
+        }
+        ob->ob_tail = chunk;
+        ob->ob_chunk_cnt += 1;
+    }
+
+    uint8_t *ptr = chunk->oc_b + chunk->oc_len;
+    chunk->oc_len += size;
+    return ptr;
+}
+
+// Counts `count` arguments dropped or cut short, in the message and overall.
+static inline void encode_truncated(loggy_os_log_encoder_t ob, uint16_t count) {
+    ob->ob_truncated += count;
+    __atomic_fetch_add(&encoder_truncations, count, __ATOMIC_RELAXED);
+}
+
+// Claims `total` bytes for `count` commands that must stay together, inline
+// or in the same chunk. Returns where they go, or NULL (and counts them) if
+// there is no room.
+static inline uint8_t *_Nullable encode_claim(loggy_os_log_encoder_t ob, uint8_t count, size_t total) {
     os_log_fmt_hdr_t hdr = (os_log_fmt_hdr_t)ob->ob_b;
     if (ob->ob_len == 0) {
         bzero(ob->ob_b, sizeof(os_log_fmt_hdr_s));
@@ -52,49 +104,273 @@ static inline void encode(loggy_os_log_encoder_t ob, os_log_fmt_cmd_type_t type,
     }
 
     uint32_t avail = LOGGY_OS_LOG_ENCODER_BUF_SIZE - ob->ob_len;
+    uint8_t *ptr;
 
-    if (hdr->hdr_cmd_cnt > LOGGY_OS_LOG_ENCODER_MAX_COMMANDS || avail < sizeof(os_log_fmt_cmd_s) + size) {
-        return;
+    if (hdr->hdr_cmd_cnt > UINT8_MAX - count) {
+        ptr = NULL;
+    } else if (!ob->ob_chunks && hdr->hdr_cmd_cnt + count <= LOGGY_OS_LOG_ENCODER_MAX_COMMANDS && avail >= total) {
+        ptr = ob->ob_b + ob->ob_len;
+        ob->ob_len += total;
+    } else {
+        // Once spilling starts, everything after goes to the chunks so the
+        // commands stay in order.
+        ptr = spill(ob, total);
     }
 
+    if (!ptr) {
+        encode_truncated(ob, count);
+        return NULL;
+    }
+
+    hdr->hdr_cmd_cnt += count;
+    return ptr;
+}
+
+// Writes a command's descriptor at `ptr`. Returns where its data goes.
+static inline uint8_t *encode_command(loggy_os_log_encoder_t ob, uint8_t *ptr, os_log_fmt_cmd_flags_t flags, os_log_fmt_cmd_type_t type, size_t size) {
     os_log_fmt_cmd_s cmd = {
-        .cmd_flags = 0,
+        .cmd_flags = flags,
         .cmd_type = type,
         .cmd_size = size
     };
 
-    memcpy(ob->ob_b + ob->ob_len, &cmd, sizeof(os_log_fmt_cmd_s));
-    ob->ob_len += sizeof(os_log_fmt_cmd_s);
+    memcpy(ptr, &cmd, sizeof(os_log_fmt_cmd_s));
+
+    if (type != OSLF_CMD_TYPE_SCALAR && type != OSLF_CMD_TYPE_COUNT) {
+        ((os_log_fmt_hdr_t)ob->ob_b)->hdr_flags |= OSLF_HDR_FLAG_HAS_NON_SCALAR;
+    }
+
+    return ptr + sizeof(os_log_fmt_cmd_s);
+}
+
+// Claims room for one command of `size` bytes, writing its descriptor.
+// Returns where the data goes, or NULL (and counts it) if there is no room.
+static inline uint8_t *_Nullable encode_reserve(loggy_os_log_encoder_t ob, os_log_fmt_cmd_flags_t flags, os_log_fmt_cmd_type_t type, size_t size) {
+    uint8_t *ptr = encode_claim(ob, 1, sizeof(os_log_fmt_cmd_s) + size);
+    return ptr ? encode_command(ob, ptr, flags, type, size) : NULL;
+}
+
+static inline void encode(loggy_os_log_encoder_t ob, os_log_fmt_cmd_type_t type, const void *data, size_t size) {
+    uint8_t *ptr = encode_reserve(ob, 0, type, size);
+    if (ptr) {
+        memcpy(ptr, data, size);
+    }
+}
+
+void loggy_os_log_encoder_set_growable(loggy_os_log_encoder_t encoder) {
+    encoder->ob_flags |= LOGGY_OS_LOG_ENCODER_FLAG_GROWABLE;
+}
+
+size_t loggy_os_log_encoder_size(loggy_os_log_encoder_t encoder) {
+    loggy_os_log_encoder_flush(encoder);
+    size_t size = encoder->ob_len;
+    for (loggy_os_log_chunk_t chunk = encoder->ob_chunks; chunk; chunk = chunk->oc_next) {
+        size += chunk->oc_len;
+    }
+    return size;
+}
+
+void loggy_os_log_encoder_copy(loggy_os_log_encoder_t encoder, uint8_t *buf) {
+    loggy_os_log_encoder_flush(encoder);
+    memcpy(buf, encoder->ob_b, encoder->ob_len);
+    buf += encoder->ob_len;
+    for (loggy_os_log_chunk_t chunk = encoder->ob_chunks; chunk; chunk = chunk->oc_next) {
+        memcpy(buf, chunk->oc_b, chunk->oc_len);
+        buf += chunk->oc_len;
+    }
+}
+
+void loggy_os_log_encoder_reset(loggy_os_log_encoder_t encoder) {
+    if (encoder->ob_chunks) {
+        chunk_pool_put(encoder->ob_chunks, encoder->ob_tail);
+    }
+
+    encoder->ob_len = 0;
+    encoder->ob_pending_cnt = 0;
+    encoder->ob_truncated = 0;
+    encoder->ob_flags &= LOGGY_OS_LOG_ENCODER_FLAG_GROWABLE;
+    encoder->ob_chunk_cnt = 0;
+    encoder->ob_chunks = NULL;
+    encoder->ob_tail = NULL;
+}
+
+uint64_t loggy_os_log_encoder_truncations(void) {
+    return __atomic_load_n(&encoder_truncations, __ATOMIC_RELAXED);
+}
+
+// Charges the arguments a message lost to the log it's sent to.
+static inline void encoder_count_truncations(loggy_os_log_encoder_t encoder, os_log_t h) {
+    if (encoder->ob_truncated) {
+        _loggy_os_log_truncations_add(h, encoder->ob_truncated);
+    }
+}
+
+void loggy_os_log_encoder_add_batch(loggy_os_log_encoder_t ob, const loggy_os_log_arg_type_t *types, const uint64_t *values, size_t count) {
+    if (count == 0) {
+        return;
+    }
 
-    memcpy(ob->ob_b + ob->ob_len, data, size);
-    ob->ob_len += size;
+    os_log_fmt_hdr_t hdr = (os_log_fmt_hdr_t)ob->ob_b;
+    if (ob->ob_len == 0) {
+        bzero(ob->ob_b, sizeof(os_log_fmt_hdr_s));
+        ob->ob_len = sizeof(os_log_fmt_hdr_s);
+    }
 
-    if (type == OSLF_CMD_TYPE_OBJECT) {
-        hdr->hdr_flags |= OSLF_HDR_FLAG_HAS_NON_SCALAR;
+    size_t total = count * sizeof(os_log_fmt_cmd_s);
+    for (size_t i = 0; i < count; i++) {
+        total += types[i] & 0x0f;
     }
 
-    hdr->hdr_cmd_cnt += 1;
+    if (ob->ob_chunks || hdr->hdr_cmd_cnt + count > LOGGY_OS_LOG_ENCODER_MAX_COMMANDS || LOGGY_OS_LOG_ENCODER_BUF_SIZE - ob->ob_len < total) {
+        // Too big for the inline buffer; go one by one so that the rest
+        // spills or is counted as truncated.
+        for (size_t i = 0; i < count; i++) {
+            uint32_t narrow = (uint32_t)values[i];
+            size_t size = types[i] & 0x0f;
+            encode(ob, types[i] >> 4, size == sizeof(uint32_t) ? (const void *)&narrow : &values[i], size);
+        }
+        return;
+    }
+
+    uint8_t *ptr = ob->ob_b + ob->ob_len;
+    for (size_t i = 0; i < count; i++) {
+        os_log_fmt_cmd_s cmd = {
+            .cmd_flags = 0,
+            .cmd_type = types[i] >> 4,
+            .cmd_size = types[i] & 0x0f
+        };
+
+        memcpy(ptr, &cmd, sizeof(os_log_fmt_cmd_s));
+        ptr += sizeof(os_log_fmt_cmd_s);
+
+        if (cmd.cmd_size == sizeof(uint32_t)) {
+            uint32_t value = (uint32_t)values[i];
+            memcpy(ptr, &value, sizeof(uint32_t));
+        } else {
+            memcpy(ptr, &values[i], sizeof(uint64_t));
+        }
+        ptr += cmd.cmd_size;
+
+        if (cmd.cmd_type == OSLF_CMD_TYPE_OBJECT) {
+            hdr->hdr_flags |= OSLF_HDR_FLAG_HAS_NON_SCALAR;
+        }
+    }
+
+    ob->ob_len += (uint32_t)total;
+    hdr->hdr_cmd_cnt += (uint8_t)count;
 }
 
-void loggy_os_log_encoder_add_int32(loggy_os_log_encoder_t encoder, int32_t value) {
-    encode(encoder, OSLF_CMD_TYPE_SCALAR, &value, sizeof(int32_t));
+void loggy_os_log_encoder_flush(loggy_os_log_encoder_t encoder) {
+    uint8_t count = encoder->ob_pending_cnt;
+    encoder->ob_pending_cnt = 0;
+    loggy_os_log_encoder_add_batch(encoder, encoder->ob_pending_types, encoder->ob_pending, count);
 }
 
-void loggy_os_log_encoder_add_int64(loggy_os_log_encoder_t encoder, int64_t value) {
-    encode(encoder, OSLF_CMD_TYPE_SCALAR, &value, sizeof(int64_t));
+static size_t encoder_string_limit = LOGGY_OS_LOG_ENCODER_MAX_STRING;
+
+size_t loggy_os_log_encoder_get_string_limit(void) {
+    return __atomic_load_n(&encoder_string_limit, __ATOMIC_RELAXED);
 }
 
-void loggy_os_log_encoder_add_int(loggy_os_log_encoder_t encoder, size_t value) {
-    encode(encoder, OSLF_CMD_TYPE_SCALAR, &value, sizeof(size_t));
+void loggy_os_log_encoder_set_string_limit(size_t limit) {
+    if (limit > LOGGY_OS_LOG_ENCODER_MAX_STRING) {
+        limit = LOGGY_OS_LOG_ENCODER_MAX_STRING;
+    }
+    __atomic_store_n(&encoder_string_limit, limit, __ATOMIC_RELAXED);
 }
 
-void loggy_os_log_encoder_add_double(loggy_os_log_encoder_t encoder, double value, int precision) {
-    encode(encoder, OSLF_CMD_TYPE_SCALAR, &precision, sizeof(int));
-    encode(encoder, OSLF_CMD_TYPE_SCALAR, &value, sizeof(double));
+uint8_t *loggy_os_log_encoder_add_string(loggy_os_log_encoder_t encoder, size_t length) {
+    loggy_os_log_encoder_flush(encoder);
+
+    if (length > LOGGY_OS_LOG_ENCODER_MAX_STRING) {
+        length = LOGGY_OS_LOG_ENCODER_MAX_STRING;
+    }
+
+    uint8_t *ptr = encode_reserve(encoder, OSLF_CMD_FLAG_LOGGY_INLINE, OSLF_CMD_TYPE_STRING, length + 1);
+    if (ptr) {
+        ptr[length] = 0;
+        encoder->ob_flags |= LOGGY_OS_LOG_ENCODER_FLAG_HAS_INLINE_ARGS;
+    }
+    return ptr;
 }
 
-void loggy_os_log_encoder_add_object(loggy_os_log_encoder_t encoder, const void *value) {
-    encode(encoder, OSLF_CMD_TYPE_OBJECT, &value, sizeof(void *));
+void loggy_os_log_encoder_add_data(loggy_os_log_encoder_t encoder, const void *bytes, size_t length) {
+    loggy_os_log_encoder_flush(encoder);
+
+    // Splitting the bytes across commands would add arguments the format
+    // doesn't have, so the rest are cut and counted like a dropped argument.
+    if (length > LOGGY_OS_LOG_ENCODER_MAX_DATA) {
+        length = LOGGY_OS_LOG_ENCODER_MAX_DATA;
+        encode_truncated(encoder, 1);
+    }
+
+    // The count and the bytes are claimed together, so a message never ends
+    // up with one inline and the other spilled or dropped.
+    int32_t count = (int32_t)length;
+    uint8_t *ptr = encode_claim(encoder, 2, sizeof(os_log_fmt_cmd_s) * 2 + sizeof(int32_t) + length);
+    if (!ptr) {
+        return;
+    }
+
+    ptr = encode_command(encoder, ptr, 0, OSLF_CMD_TYPE_COUNT, sizeof(int32_t));
+    memcpy(ptr, &count, sizeof(int32_t));
+    ptr = encode_command(encoder, ptr + sizeof(int32_t), OSLF_CMD_FLAG_LOGGY_INLINE, OSLF_CMD_TYPE_DATA, length);
+    if (length) {
+        memcpy(ptr, bytes, length);
+    }
+    encoder->ob_flags |= LOGGY_OS_LOG_ENCODER_FLAG_HAS_INLINE_ARGS;
+}
+
+#if LOGGY_HAS_OS_LOG
+
+// Walks the commands in `len` bytes of `buf`, copying them to `dst` (if any)
+// with inline strings and data replaced by pointers to their bytes, as
+// `os_log` expects. Returns the number of bytes written.
+static size_t export_commands(const uint8_t *buf, size_t len, uint8_t *_Nullable dst) {
+    size_t written = 0;
+    for (size_t offset = 0; offset + sizeof(os_log_fmt_cmd_s) <= len;) {
+        const uint8_t *start = buf + offset;
+        const uint8_t *data = start + sizeof(os_log_fmt_cmd_s);
+        os_log_fmt_cmd_s cmd;
+        memcpy(&cmd, start, sizeof(os_log_fmt_cmd_s));
+        offset += sizeof(os_log_fmt_cmd_s) + cmd.cmd_size;
+
+        if (cmd.cmd_flags & OSLF_CMD_FLAG_LOGGY_INLINE) {
+            cmd.cmd_flags &= ~OSLF_CMD_FLAG_LOGGY_INLINE;
+            cmd.cmd_size = sizeof(data);
+            if (dst) {
+                memcpy(dst + written, &cmd, sizeof(os_log_fmt_cmd_s));
+                memcpy(dst + written + sizeof(os_log_fmt_cmd_s), &data, sizeof(data));
+            }
+        } else if (dst) {
+            memcpy(dst + written, start, sizeof(os_log_fmt_cmd_s) + cmd.cmd_size);
+        }
+
+        written += sizeof(os_log_fmt_cmd_s) + cmd.cmd_size;
+    }
+    return written;
+}
+
+// Like `loggy_os_log_encoder_size`/`loggy_os_log_encoder_copy`, but in the
+// form `os_log` consumes. The encoder must outlive the use of the result.
+static size_t encoder_export(loggy_os_log_encoder_t ob, uint8_t *_Nullable dst) {
+    if (!(ob->ob_flags & LOGGY_OS_LOG_ENCODER_FLAG_HAS_INLINE_ARGS)) {
+        if (dst) {
+            loggy_os_log_encoder_copy(ob, dst);
+        }
+        return loggy_os_log_encoder_size(ob);
+    }
+
+    size_t written = sizeof(os_log_fmt_hdr_s);
+    if (dst) {
+        memcpy(dst, ob->ob_b, sizeof(os_log_fmt_hdr_s));
+    }
+
+    written += export_commands(ob->ob_b + sizeof(os_log_fmt_hdr_s), ob->ob_len - sizeof(os_log_fmt_hdr_s), dst ? dst + written : NULL);
+    for (loggy_os_log_chunk_t chunk = ob->ob_chunks; chunk; chunk = chunk->oc_next) {
+        written += export_commands(chunk->oc_b, chunk->oc_len, dst ? dst + written : NULL);
+    }
+    return written;
 }
 
 #define OS_LOG_PACK_AVAILABILITY API_AVAILABLE(macosx(10.12.4), ios(10.3), tvos(10.2), watchos(3.2))
@@ -119,18 +395,50 @@ OS_LOG_PACK_AVAILABILITY
 extern void os_log_pack_send(os_log_pack_t pack, os_log_t log, os_log_type_t type);
 
 void loggy_os_log_send(loggy_os_log_encoder_t encoder, const char *fmt, os_log_t h, os_log_type_t type, const void *ra, const void *dso) {
+    loggy_os_log_encoder_flush(encoder);
+    encoder_count_truncations(encoder, h);
+    size_t len = encoder_export(encoder, NULL);
     if (__builtin_available(macOS 10.12.4, iOS 10.3, tvOS 10.2, watchOS 3.2, *)) {
-        size_t sz = _os_log_pack_size(encoder->ob_len);
+        size_t sz = _os_log_pack_size(len);
         uint8_t buf[sz];
         uint8_t *ptr = _os_log_pack_fill((os_log_pack_t)buf, sz, 0, dso, fmt);
         ((os_log_pack_t)buf)->olp_pc = ra;
-        memcpy(ptr, encoder->ob_b, encoder->ob_len);
+        encoder_export(encoder, ptr);
         os_log_pack_send((os_log_pack_t)buf, h, type);
+    } else if (encoder->ob_chunks || (encoder->ob_flags & LOGGY_OS_LOG_ENCODER_FLAG_HAS_INLINE_ARGS)) {
+        uint8_t buf[len];
+        encoder_export(encoder, buf);
+        _os_log_impl((void *)dso, h, type, fmt, buf, (uint32_t)len);
     } else {
         _os_log_impl((void *)dso, h, type, fmt, encoder->ob_b, encoder->ob_len);
     }
+    loggy_os_log_encoder_reset(encoder);
 }
 
+#else
+
+void loggy_os_log_send(loggy_os_log_encoder_t encoder, const char *fmt, os_log_t h, os_log_type_t type, const void *ra, const void *dso) {
+    loggy_os_log_encoder_flush(encoder);
+    encoder_count_truncations(encoder, h);
+    loggy_os_log_record_s record = {
+        .lr_time = loggy_os_log_timestamp(),
+        .lr_activity = loggy_os_activity_current_id(),
+        .lr_log = h,
+        .lr_format = fmt,
+        .lr_pc = ra,
+        .lr_dso = dso,
+        .lr_buf = encoder->ob_b,
+        .lr_len = encoder->ob_len,
+        .lr_chunks = encoder->ob_chunks,
+        .lr_truncated = encoder->ob_truncated,
+        .lr_type = type,
+    };
+    loggy_os_log_sink_send(&record);
+    loggy_os_log_encoder_reset(encoder);
+}
+
+#endif
+
 #if LOGGY_HAS_OS_SIGNPOST
 
 LOGGY_OS_SIGNPOST_AVAILABILITY
@@ -140,12 +448,15 @@ LOGGY_OS_SIGNPOST_AVAILABILITY
 extern void _os_signpost_pack_send(os_log_pack_t pack, os_log_t h, os_signpost_type_t spty);
 
 void loggy_os_signpost_send(loggy_os_log_encoder_t encoder, const char *fmt, os_log_t h, os_signpost_type_t spty, const uint8_t *spnm, os_signpost_id_t spid, const void *ra, const void *dso) {
-    size_t sz = _os_log_pack_size(encoder->ob_len);
+    loggy_os_log_encoder_flush(encoder);
+    encoder_count_truncations(encoder, h);
+    size_t sz = _os_log_pack_size(encoder_export(encoder, NULL));
     uint8_t buf[sz];
     uint8_t *ptr = _os_signpost_pack_fill((os_log_pack_t)buf, sz, 0, dso, fmt, (const char *)spnm, spid);
     ((os_log_pack_t)buf)->olp_pc = ra;
-    memcpy(ptr, encoder->ob_b, encoder->ob_len);
+    encoder_export(encoder, ptr);
     _os_signpost_pack_send((os_log_pack_t)buf, h, spty);
+    loggy_os_log_encoder_reset(encoder);
 }
 
 #endif
@@ -13,7 +13,13 @@
 #ifndef __loggy_os_log_shims_h__
 #define __loggy_os_log_shims_h__
 
+#if __has_include(<os/log.h>)
+#define LOGGY_HAS_OS_LOG 1
 #include <os/log.h>
+#else
+#define LOGGY_HAS_OS_LOG 0
+#include "os_log_portable.h"
+#endif
 
 #if __has_include(<os/signpost.h>)
 #define LOGGY_HAS_OS_SIGNPOST 1
@@ -27,9 +33,48 @@ OS_ASSUME_NONNULL_BEGIN
 #define LOGGY_OS_LOG_ENCODER_MAX_COMMANDS   48
 #define LOGGY_OS_LOG_ENCODER_BUF_SIZE       (2 + (2 + 16) * LOGGY_OS_LOG_ENCODER_MAX_COMMANDS)
 
+#define LOGGY_OS_LOG_ENCODER_CHUNK_SIZE     4096
+#define LOGGY_OS_LOG_ENCODER_MAX_CHUNKS     8
+#define LOGGY_OS_LOG_ENCODER_MAX_STRING     (UINT8_MAX - 1)
+#define LOGGY_OS_LOG_ENCODER_MAX_DATA       UINT8_MAX
+#define LOGGY_OS_LOG_ENCODER_MAX_PENDING    32
+
+/// Overflow storage for a growable encoder. Commands are never split across
+/// chunks; `oc_b` continues the command stream where the previous chunk (or
+/// the encoder's inline buffer) left off.
+typedef struct loggy_os_log_chunk_s {
+    struct loggy_os_log_chunk_s *_Nullable oc_next;
+    uint32_t oc_len;
+    uint8_t oc_b[LOGGY_OS_LOG_ENCODER_CHUNK_SIZE - sizeof(void *) - sizeof(uint32_t) * 2];
+} loggy_os_log_chunk_s, *loggy_os_log_chunk_t;
+
+OS_ENUM(loggy_os_log_encoder_flags, uint8_t,
+    LOGGY_OS_LOG_ENCODER_FLAG_GROWABLE = 0x01,
+    LOGGY_OS_LOG_ENCODER_FLAG_HAS_INLINE_ARGS = 0x02,
+);
+
+/// How to encode one argument of a batch: the command type in the high
+/// nibble, the size in bytes in the low one.
+OS_ENUM(loggy_os_log_arg_type, uint8_t,
+    LOGGY_OS_LOG_ARG_SCALAR32 = 0x04,
+    LOGGY_OS_LOG_ARG_SCALAR64 = 0x08,
+    LOGGY_OS_LOG_ARG_COUNT32  = 0x14,
+    LOGGY_OS_LOG_ARG_OBJECT   = 0x40 | sizeof(void *),
+);
+
+#define LOGGY_OS_LOG_ARG_WORD (sizeof(size_t) == 8 ? LOGGY_OS_LOG_ARG_SCALAR64 : LOGGY_OS_LOG_ARG_SCALAR32)
+
 typedef struct {
     uint8_t ob_b[LOGGY_OS_LOG_ENCODER_BUF_SIZE];
     uint32_t ob_len;
+    uint16_t ob_truncated;
+    loggy_os_log_encoder_flags_t ob_flags;
+    uint8_t ob_chunk_cnt;
+    loggy_os_log_chunk_t _Nullable ob_chunks;
+    loggy_os_log_chunk_t _Nullable ob_tail;
+    uint8_t ob_pending_cnt;
+    loggy_os_log_arg_type_t ob_pending_types[LOGGY_OS_LOG_ENCODER_MAX_PENDING];
+    uint64_t ob_pending[LOGGY_OS_LOG_ENCODER_MAX_PENDING];
 } loggy_os_log_encoder_s OS_SWIFT_NAME(LogStatementEncoder), *loggy_os_log_encoder_t;
 
 OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(getter:LogStatementEncoder.currentReturnAddress())
@@ -37,24 +82,228 @@ void *loggy_os_log_return_address(void) {
     return __builtin_return_address(1);
 }
 
-OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
-void loggy_os_log_encoder_add_int32(loggy_os_log_encoder_t encoder, int32_t value);
+// MARK: - Enabled types
+
+/// The bit for `type` in a mask of enabled types.
+#define LOGGY_OS_LOG_TYPE_BIT(type) (1u << (((type) & 0x3) | (((type) >> 2) & 0x4)))
+
+/// Bumped whenever the logging configuration may have changed; cached masks
+/// from an earlier generation are recomputed.
+OS_EXPORT uint64_t _loggy_os_log_generation;
+
+#if LOGGY_HAS_OS_LOG
+// Twice as many slots as the intern table holds handles, so probes are short.
+#define LOGGY_OS_LOG_ENABLED_CACHE_SIZE 8192
+
+#if __has_feature(objc_arc)
+#define LOGGY_OS_LOG_HANDLE_KEY(h) ((__bridge const void *)(h))
+#else
+#define LOGGY_OS_LOG_HANDLE_KEY(h) ((const void *)(h))
+#endif
+
+// Handles can't carry extra state on Darwin, so masks live in a side table
+// keyed by the handle's address, open-addressed and never emptied. Only
+// handles that are never freed are added: interned ones and the default.
+// Any other handle's address could be reused by one for another subsystem,
+// which would inherit its mask, so those ask `os_log_type_enabled` every
+// time.
+typedef struct {
+    const void *_Nullable ec_log;
+    uint64_t ec_state;
+    uint64_t ec_truncated;
+} _loggy_os_log_enabled_cache_s;
+
+OS_EXPORT _loggy_os_log_enabled_cache_s _loggy_os_log_enabled_cache[LOGGY_OS_LOG_ENABLED_CACHE_SIZE];
+
+/// Gives `h`, which must never be freed, a slot in the side table.
+OS_EXPORT
+void _loggy_os_log_enabled_cache_add(os_log_t h);
+#endif
+
+OS_EXPORT
+bool _loggy_os_log_enabled_refresh(os_log_t h, os_log_type_t type);
+
+/// Like `os_log_type_enabled`, but answered from a mask cached per handle, so
+/// the usual case is a relaxed load and a bit test.
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.isEnabled(_:type:))
+bool loggy_os_log_type_enabled(os_log_t h, os_log_type_t type) {
+#if LOGGY_HAS_OS_LOG
+    const void *key = LOGGY_OS_LOG_HANDLE_KEY(h);
+    size_t slot = (size_t)(((uint64_t)(uintptr_t)key * 0x9e3779b97f4a7c15ull) >> 51);
+    _loggy_os_log_enabled_cache_s *entry;
+    for (;;) {
+        entry = &_loggy_os_log_enabled_cache[slot];
+        const void *owner = __atomic_load_n(&entry->ec_log, __ATOMIC_RELAXED);
+        if (owner == key) {
+            break;
+        }
+        if (!owner) {
+            return _loggy_os_log_enabled_refresh(h, type);
+        }
+        slot = (slot + 1) & (LOGGY_OS_LOG_ENABLED_CACHE_SIZE - 1);
+    }
+    uint64_t state = __atomic_load_n(&entry->ec_state, __ATOMIC_RELAXED);
+#else
+    uint64_t state = __atomic_load_n(&h->enabled, __ATOMIC_RELAXED);
+#endif
+    if ((state >> 8) != __atomic_load_n(&_loggy_os_log_generation, __ATOMIC_RELAXED)) {
+        return _loggy_os_log_enabled_refresh(h, type);
+    }
+    return (state & LOGGY_OS_LOG_TYPE_BIT(type)) != 0;
+}
+
+/// Invalidates every cached mask.
+OS_EXPORT
+void loggy_os_log_config_changed(void);
+
+// MARK: - Handles
+
+/// Returns the shared handle for `subsystem` and `category`, creating it the
+/// first time. Interned handles live as long as the process; lookups of
+/// existing ones don't lock or allocate. There's room for 4096 of them;
+/// past that, or if one can't be created, this returns `OS_LOG_DEFAULT`.
+OS_EXPORT
+os_log_t loggy_os_log_intern(const char *subsystem, const char *category);
+
+/// Encodes `count` arguments in one pass. `values` holds the bits of each
+/// argument, zero-extended, and `types` says how to encode it. Room is
+/// checked once for the whole batch.
+OS_SWIFT_NAME(LogStatementEncoder.append(self:types:values:count:))
+void loggy_os_log_encoder_add_batch(loggy_os_log_encoder_t encoder, const loggy_os_log_arg_type_t *types, const uint64_t *values, size_t count);
+
+/// Encodes any arguments queued by the scalar `append` functions. Everything
+/// that reads or sends the encoder does this first.
+OS_SWIFT_NAME(LogStatementEncoder.flush(self:))
+void loggy_os_log_encoder_flush(loggy_os_log_encoder_t encoder);
+
+/// Queues an argument to be encoded along with its neighbors by
+/// `loggy_os_log_encoder_add_batch`.
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.push(self:_:as:))
+void loggy_os_log_encoder_push(loggy_os_log_encoder_t encoder, uint64_t value, loggy_os_log_arg_type_t type) {
+    if (encoder->ob_pending_cnt == LOGGY_OS_LOG_ENCODER_MAX_PENDING) {
+        loggy_os_log_encoder_flush(encoder);
+    }
+    encoder->ob_pending_types[encoder->ob_pending_cnt] = type;
+    encoder->ob_pending[encoder->ob_pending_cnt] = value;
+    encoder->ob_pending_cnt += 1;
+}
+
+/// Lets the encoder continue into chunks borrowed from a per-thread pool once
+/// its inline buffer fills, rather than dropping arguments. Messages that fit
+/// inline never touch the pool. Chunks are returned when the encoder is sent.
+OS_SWIFT_NAME(LogStatementEncoder.makeGrowable(self:))
+void loggy_os_log_encoder_set_growable(loggy_os_log_encoder_t encoder);
+
+/// The encoded size, including any chunks.
+OS_SWIFT_NAME(LogStatementEncoder.size(self:))
+size_t loggy_os_log_encoder_size(loggy_os_log_encoder_t encoder);
+
+/// Copies the encoded payload, including any chunks, into `buf`, which must
+/// hold `loggy_os_log_encoder_size(encoder)` bytes.
+OS_SWIFT_NAME(LogStatementEncoder.copyBytes(self:to:))
+void loggy_os_log_encoder_copy(loggy_os_log_encoder_t encoder, uint8_t *buf);
+
+/// Returns any chunks to the pool and empties the encoder.
+OS_SWIFT_NAME(LogStatementEncoder.reset(self:))
+void loggy_os_log_encoder_reset(loggy_os_log_encoder_t encoder);
 
-OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
-void loggy_os_log_encoder_add_int64(loggy_os_log_encoder_t encoder, int64_t value);
+/// The number of arguments dropped or cut short for lack of space across all
+/// messages.
+OS_SWIFT_NAME(getter:LogStatementEncoder.totalTruncations())
+uint64_t loggy_os_log_encoder_truncations(void);
 
-OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
-void loggy_os_log_encoder_add_int(loggy_os_log_encoder_t encoder, size_t value);
+/// The number of arguments dropped or cut short across messages sent
+/// to `h`. On Darwin, only interned handles and the default keep a count;
+/// for others, this is always zero.
+OS_SWIFT_NAME(LogStatementEncoder.truncations(in:))
+uint64_t loggy_os_log_truncations(os_log_t h);
 
-OS_SWIFT_NAME(LogStatementEncoder.append(self:_:precision:))
-void loggy_os_log_encoder_add_double(loggy_os_log_encoder_t encoder, double value, int precision);
+OS_EXPORT
+void _loggy_os_log_truncations_add(os_log_t h, uint64_t count);
 
-OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
-void loggy_os_log_encoder_add_object(loggy_os_log_encoder_t encoder, const void *value);
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
+void loggy_os_log_encoder_add_int32(loggy_os_log_encoder_t encoder, int32_t value) {
+    loggy_os_log_encoder_push(encoder, (uint32_t)value, LOGGY_OS_LOG_ARG_SCALAR32);
+}
+
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
+void loggy_os_log_encoder_add_int64(loggy_os_log_encoder_t encoder, int64_t value) {
+    loggy_os_log_encoder_push(encoder, (uint64_t)value, LOGGY_OS_LOG_ARG_SCALAR64);
+}
+
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
+void loggy_os_log_encoder_add_int(loggy_os_log_encoder_t encoder, size_t value) {
+    loggy_os_log_encoder_push(encoder, value, LOGGY_OS_LOG_ARG_WORD);
+}
+
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.append(self:_:precision:))
+void loggy_os_log_encoder_add_double(loggy_os_log_encoder_t encoder, double value, int precision) {
+    uint64_t bits;
+    __builtin_memcpy(&bits, &value, sizeof(double));
+    loggy_os_log_encoder_push(encoder, (uint32_t)precision, LOGGY_OS_LOG_ARG_SCALAR32);
+    loggy_os_log_encoder_push(encoder, bits, LOGGY_OS_LOG_ARG_SCALAR64);
+}
+
+/// The longest string argument, in UTF-8 bytes, copied into a message.
+/// Longer strings are cut short. At most `LOGGY_OS_LOG_ENCODER_MAX_STRING`.
+OS_SWIFT_NAME(getter:LogStatementEncoder.maximumStringLength())
+size_t loggy_os_log_encoder_get_string_limit(void);
+
+OS_SWIFT_NAME(setter:LogStatementEncoder.maximumStringLength(_:))
+void loggy_os_log_encoder_set_string_limit(size_t limit);
+
+/// Reserves room for a `%s` argument of `length` bytes stored inline in the
+/// message, and returns where to write them. The byte after them is already
+/// a NUL terminator. Returns `NULL` if the message is out of room.
+OS_REFINED_FOR_SWIFT
+uint8_t *_Nullable loggy_os_log_encoder_add_string(loggy_os_log_encoder_t encoder, size_t length);
+
+/// Appends a `%.*P` argument: its length, then up to
+/// `LOGGY_OS_LOG_ENCODER_MAX_DATA` bytes copied into the message. The bytes
+/// are rendered as hex only when the message is read. Bytes past the limit
+/// are cut, and the argument counts as truncated.
+OS_SWIFT_NAME(LogStatementEncoder.append(self:bytes:count:))
+void loggy_os_log_encoder_add_data(loggy_os_log_encoder_t encoder, const void *_Nullable bytes, size_t length);
+
+OS_ALWAYS_INLINE OS_INLINE OS_SWIFT_NAME(LogStatementEncoder.append(self:_:))
+void loggy_os_log_encoder_add_object(loggy_os_log_encoder_t encoder, const void *value) {
+    loggy_os_log_encoder_push(encoder, (uintptr_t)value, LOGGY_OS_LOG_ARG_OBJECT);
+}
+
+/// Returns the format string interned for the call site at `ra` producing
+/// messages of the given `shape`, or `NULL` if there isn't one yet.
+OS_SWIFT_NAME(LogStatementEncoder.cachedFormat(callSite:shape:))
+const char *_Nullable loggy_os_log_format_lookup(const void *ra, uint64_t shape);
+
+/// Interns a copy of `fmt` for the call site at `ra`. The copy lives as long
+/// as the process. Returns `NULL` if the cache has no room for it.
+OS_SWIFT_NAME(LogStatementEncoder.cacheFormat(_:callSite:shape:))
+const char *_Nullable loggy_os_log_format_intern(const void *ra, uint64_t shape, const char *fmt);
+
+/// Limits each call site to bursts of `burst` messages, refilled at `rate`
+/// messages per second. A rate of 0, the default, turns limiting off.
+OS_SWIFT_NAME(LogStatementEncoder.limitRate(_:burst:))
+void loggy_os_log_rate_limit(uint32_t rate, uint32_t burst);
+
+/// Takes a token for the call site at `ra`. Returns false if the message
+/// should be suppressed.
+///
+/// Messages suppressed since the call site last sent one are summarized in
+/// a "Suppressed %llu messages" record to `h` at `type`, sent just before
+/// the next admitted message, or by a background thread once the site's
+/// bucket has refilled if no message comes first.
+OS_SWIFT_NAME(LogStatementEncoder.admit(callSite:log:type:containingBinary:))
+bool loggy_os_log_rate_admit(const void *ra, os_log_t h, os_log_type_t type, const void *dso);
 
 OS_SWIFT_NAME(LogStatementEncoder.__send(self:format:to:at:fromAddress:containingBinary:)) OS_REFINED_FOR_SWIFT
 void loggy_os_log_send(loggy_os_log_encoder_t encoder, const char *fmt, os_log_t h, os_log_type_t type, const void *ra, const void *dso);
 
+/// Makes a signpost ID unique within the process, never null or invalid.
+/// Each thread takes IDs from a block of its own, so this is usually a
+/// thread-local increment.
+OS_EXPORT
+uint64_t loggy_os_signpost_id_make(void);
+
 #if LOGGY_HAS_OS_SIGNPOST
 
 #define LOGGY_OS_SIGNPOST_AVAILABILITY API_AVAILABLE(macosx(10.14), ios(12.0), tvos(12.0), watchos(5.0))
@@ -67,4 +316,8 @@ void loggy_os_signpost_send(loggy_os_log_encoder_t encoder, const char *fmt, os_
 
 OS_ASSUME_NONNULL_END
 
+#if !LOGGY_HAS_OS_LOG
+#include "os_log_sink.h"
+#endif
+
 #endif /* __loggy_os_log_shims_h__ */
@@ -0,0 +1,331 @@
+//
+//  os_log_sink.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_sink.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <stdlib.h>
+#include <string.h>
+
+static const loggy_os_log_sink_s *loggy_os_log_current_sink;
+
+void loggy_os_log_set_sink(const loggy_os_log_sink_s *sink) {
+    __atomic_store_n(&loggy_os_log_current_sink, sink, __ATOMIC_RELEASE);
+}
+
+size_t loggy_os_log_record_size(const loggy_os_log_record_s *record) {
+    size_t size = record->lr_len;
+    for (const loggy_os_log_chunk_s *chunk = record->lr_chunks; chunk; chunk = chunk->oc_next) {
+        size += chunk->oc_len;
+    }
+    return size;
+}
+
+void loggy_os_log_record_copy(const loggy_os_log_record_s *record, uint8_t *buf) {
+    memcpy(buf, record->lr_buf, record->lr_len);
+    buf += record->lr_len;
+    for (const loggy_os_log_chunk_s *chunk = record->lr_chunks; chunk; chunk = chunk->oc_next) {
+        memcpy(buf, chunk->oc_b, chunk->oc_len);
+        buf += chunk->oc_len;
+    }
+}
+
+// Commands are a flags/type byte and a size byte followed by the data.
+static uint8_t count_commands(const uint8_t *buf, uint32_t len) {
+    uint8_t count = 0;
+    for (uint32_t offset = 0; offset + 2 <= len; offset += 2 + buf[offset + 1]) {
+        count += 1;
+    }
+    return count;
+}
+
+// Presents an oversize message to a sink that only takes the inline part.
+static void send_truncated(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    uint8_t spilled = 0;
+    for (const loggy_os_log_chunk_s *chunk = record->lr_chunks; chunk; chunk = chunk->oc_next) {
+        spilled += count_commands(chunk->oc_b, chunk->oc_len);
+    }
+
+    uint8_t buf[LOGGY_OS_LOG_ENCODER_BUF_SIZE];
+    memcpy(buf, record->lr_buf, record->lr_len);
+    buf[1] -= spilled;
+
+    loggy_os_log_record_s copy = *record;
+    copy.lr_buf = buf;
+    copy.lr_chunks = NULL;
+    copy.lr_truncated += spilled;
+    sink->ls_send(sink, &copy);
+}
+
+void loggy_os_log_sink_send(const loggy_os_log_record_s *record) {
+    const loggy_os_log_sink_s *sink = __atomic_load_n(&loggy_os_log_current_sink, __ATOMIC_ACQUIRE);
+    if (!sink) {
+        return;
+    }
+
+    if (record->lr_chunks && !(sink->ls_flags & LOGGY_OS_LOG_SINK_FLAG_OVERSIZE)) {
+        send_truncated(sink, record);
+    } else {
+        sink->ls_send(sink, record);
+    }
+}
+
+// MARK: - Ring
+
+#define LOGGY_OS_LOG_RING_MIN_SIZE 4096
+#define LOGGY_OS_LOG_RING_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+#define LOGGY_OS_LOG_RING_MAX_FRAGMENTS (1 + LOGGY_OS_LOG_ENCODER_MAX_CHUNKS)
+
+static void ring_sink_send(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    loggy_os_log_ring_append((loggy_os_log_ring_t)sink->ls_context, record);
+}
+
+bool loggy_os_log_ring_init(loggy_os_log_ring_t ring, void *storage, size_t size) {
+    if (size < LOGGY_OS_LOG_RING_MIN_SIZE || (size & (size - 1)) != 0) {
+        return false;
+    }
+
+    memset(storage, 0, size);
+    *ring = (loggy_os_log_ring_s){
+        .lrb_sink = {
+            .ls_send = ring_sink_send,
+            .ls_context = ring,
+            .ls_flags = LOGGY_OS_LOG_SINK_FLAG_OVERSIZE,
+        },
+        .lrb_storage = storage,
+        .lrb_mask = size - 1,
+    };
+    return true;
+}
+
+static inline loggy_os_log_entry_t ring_entry(loggy_os_log_ring_t ring, uint64_t position) {
+    return (loggy_os_log_entry_t)(ring->lrb_storage + (position & ring->lrb_mask));
+}
+
+// Claims contiguous space for `count` entries of `sizes`, in order, at
+// `positions`. An entry that would straddle the end of the storage is moved
+// past it, and the space it skips is claimed too and marked as padding.
+static bool ring_reserve(loggy_os_log_ring_t ring, const uint64_t *sizes, size_t count, uint64_t *positions) {
+    uint64_t capacity = ring->lrb_mask + 1;
+    uint64_t head = __atomic_load_n(&ring->lrb_head, __ATOMIC_RELAXED);
+    uint64_t total = 0, end;
+    for (size_t i = 0; i < count; i++) {
+        total += sizes[i];
+    }
+
+    for (;;) {
+        uint64_t tail = __atomic_load_n(&ring->lrb_tail, __ATOMIC_ACQUIRE);
+        end = head;
+        for (size_t i = 0; i < count; i++) {
+            uint64_t room = capacity - (end & ring->lrb_mask);
+            end += room < sizes[i] ? room : 0;
+            positions[i] = end;
+            end += sizes[i];
+        }
+
+        if (end - tail <= capacity) {
+            if (ring->lrb_single_writer) {
+                __atomic_store_n(&ring->lrb_head, end, __ATOMIC_RELAXED);
+                break;
+            }
+            if (__atomic_compare_exchange_n(&ring->lrb_head, &head, end, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+
+        // Padding can keep a message that would fit in the empty ring from
+        // fitting where the head is now, however much is drained. Pad out
+        // to the start of the storage so that a retry fits.
+        uint64_t skip = capacity - (head & ring->lrb_mask);
+        if (head != tail || skip == capacity || total > capacity) {
+            return false;
+        }
+        if (__atomic_compare_exchange_n(&ring->lrb_head, &head, head + skip, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            loggy_os_log_entry_t pad = ring_entry(ring, head);
+            pad->le_flags = LOGGY_OS_LOG_ENTRY_FLAG_PADDING;
+            __atomic_store_n(&pad->le_size, (uint32_t)skip, __ATOMIC_RELEASE);
+            head += skip;
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t padding = positions[i] - head;
+        if (padding) {
+            loggy_os_log_entry_t pad = ring_entry(ring, head);
+            pad->le_flags = LOGGY_OS_LOG_ENTRY_FLAG_PADDING;
+            __atomic_store_n(&pad->le_size, (uint32_t)padding, __ATOMIC_RELEASE);
+        }
+        head = positions[i] + sizes[i];
+    }
+    return true;
+}
+
+size_t loggy_os_log_ring_entry_size(const loggy_os_log_record_s *record) {
+    size_t size = LOGGY_OS_LOG_RING_ALIGN(sizeof(loggy_os_log_entry_s) + record->lr_len);
+    for (const loggy_os_log_chunk_s *chunk = record->lr_chunks; chunk; chunk = chunk->oc_next) {
+        size += LOGGY_OS_LOG_RING_ALIGN(sizeof(loggy_os_log_entry_s) + chunk->oc_len);
+    }
+    return size;
+}
+
+bool loggy_os_log_ring_try_append(loggy_os_log_ring_t ring, const loggy_os_log_record_s *record) {
+    // The head holds the inline part of the payload, and each chunk goes in
+    // an entry of its own rather than being gathered into one large one.
+    const loggy_os_log_chunk_s *chunks[LOGGY_OS_LOG_RING_MAX_FRAGMENTS] = { NULL };
+    uint64_t sizes[LOGGY_OS_LOG_RING_MAX_FRAGMENTS], positions[LOGGY_OS_LOG_RING_MAX_FRAGMENTS];
+    size_t count = 1;
+    uint64_t total = sizes[0] = LOGGY_OS_LOG_RING_ALIGN(sizeof(loggy_os_log_entry_s) + record->lr_len);
+    for (const loggy_os_log_chunk_s *chunk = record->lr_chunks; chunk; chunk = chunk->oc_next, count++) {
+        if (count == LOGGY_OS_LOG_RING_MAX_FRAGMENTS) {
+            return false;
+        }
+        chunks[count] = chunk;
+        total += sizes[count] = LOGGY_OS_LOG_RING_ALIGN(sizeof(loggy_os_log_entry_s) + chunk->oc_len);
+    }
+
+    if (total > ring->lrb_mask + 1 || !ring_reserve(ring, sizes, count, positions)) {
+        return false;
+    }
+
+    uint32_t sequence = count > 1 ? __atomic_add_fetch(&ring->lrb_sequence, 1, __ATOMIC_RELAXED) : 0;
+
+    // Continuations are published before the head, so a reader that sees
+    // the head sees the whole message. Their other fields stay zero.
+    for (size_t i = count - 1; i > 0; i--) {
+        loggy_os_log_entry_t entry = ring_entry(ring, positions[i]);
+        entry->le_type = record->lr_type;
+        entry->le_flags = LOGGY_OS_LOG_ENTRY_FLAG_CONTINUATION | (i + 1 < count ? LOGGY_OS_LOG_ENTRY_FLAG_CONTINUED : 0);
+        entry->le_len = chunks[i]->oc_len;
+        entry->le_sequence = sequence;
+        memcpy(entry->le_data, chunks[i]->oc_b, chunks[i]->oc_len);
+        __atomic_store_n(&entry->le_size, (uint32_t)sizes[i], __ATOMIC_RELEASE);
+    }
+
+    loggy_os_log_entry_t entry = ring_entry(ring, positions[0]);
+    entry->le_type = record->lr_type;
+    entry->le_flags = count > 1 ? LOGGY_OS_LOG_ENTRY_FLAG_CONTINUED : 0;
+    entry->le_len = record->lr_len;
+    entry->le_truncated = record->lr_truncated;
+    entry->le_sequence = sequence;
+    entry->le_time = record->lr_time;
+    entry->le_activity = record->lr_activity;
+    entry->le_log = record->lr_log;
+    entry->le_format = record->lr_format;
+    entry->le_pc = record->lr_pc;
+    entry->le_dso = record->lr_dso;
+    memcpy(entry->le_data, record->lr_buf, record->lr_len);
+
+    // Publishing the size is what makes the entry visible to the reader.
+    __atomic_store_n(&entry->le_size, (uint32_t)sizes[0], __ATOMIC_RELEASE);
+    return true;
+}
+
+bool loggy_os_log_ring_append(loggy_os_log_ring_t ring, const loggy_os_log_record_s *record) {
+    if (!loggy_os_log_ring_try_append(ring, record)) {
+        __atomic_fetch_add(&ring->lrb_dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+// Gathers the oversize message whose head is at `position` into one entry
+// for `handler`. Its continuations were published before the head, so
+// they're all there. Returns where the message ends, and false in
+// `handled` if it couldn't be put back together.
+static uint64_t ring_reassemble(loggy_os_log_ring_t ring, uint64_t position, void (*handler)(void *context, const loggy_os_log_entry_s *entry), void *context, bool *handled) {
+    const loggy_os_log_entry_s *head = ring_entry(ring, position);
+    uint64_t end = position + head->le_size;
+    size_t len = head->le_len;
+    bool complete = false;
+
+    for (uint64_t cursor = end; !complete && cursor - position <= ring->lrb_mask;) {
+        const loggy_os_log_entry_s *entry = ring_entry(ring, cursor);
+        if (!entry->le_size) {
+            break;
+        }
+        cursor += entry->le_size;
+        if (entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_PADDING) {
+            continue;
+        }
+        if (!(entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_CONTINUATION) || entry->le_sequence != head->le_sequence) {
+            break;
+        }
+        len += entry->le_len;
+        end = cursor;
+        complete = !(entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_CONTINUED);
+    }
+
+    loggy_os_log_entry_t message = complete ? malloc(sizeof(loggy_os_log_entry_s) + len) : NULL;
+    if (!message) {
+        *handled = false;
+        return end;
+    }
+
+    memcpy(message, head, sizeof(loggy_os_log_entry_s));
+    message->le_flags = 0;
+    message->le_len = (uint32_t)len;
+    size_t offset = 0;
+    for (uint64_t cursor = position; cursor < end;) {
+        const loggy_os_log_entry_s *entry = ring_entry(ring, cursor);
+        if (!(entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_PADDING)) {
+            memcpy(message->le_data + offset, entry->le_data, entry->le_len);
+            offset += entry->le_len;
+        }
+        cursor += entry->le_size;
+    }
+    message->le_size = (uint32_t)LOGGY_OS_LOG_RING_ALIGN(sizeof(loggy_os_log_entry_s) + len);
+
+    handler(context, message);
+    free(message);
+    *handled = true;
+    return end;
+}
+
+size_t loggy_os_log_ring_drain(loggy_os_log_ring_t ring, void (*handler)(void *context, const loggy_os_log_entry_s *entry), void *context) {
+    uint64_t tail = __atomic_load_n(&ring->lrb_tail, __ATOMIC_RELAXED);
+    size_t count = 0;
+
+    for (;;) {
+        loggy_os_log_entry_t entry = ring_entry(ring, tail);
+        uint32_t size = __atomic_load_n(&entry->le_size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            break;
+        }
+
+        uint64_t end = tail + size;
+        if (entry->le_flags & LOGGY_OS_LOG_ENTRY_FLAG_CONTINUED) {
+            bool handled;
+            end = ring_reassemble(ring, tail, handler, context, &handled);
+            if (handled) {
+                count += 1;
+            } else {
+                __atomic_fetch_add(&ring->lrb_dropped, 1, __ATOMIC_RELAXED);
+            }
+        } else if (!(entry->le_flags & (LOGGY_OS_LOG_ENTRY_FLAG_PADDING | LOGGY_OS_LOG_ENTRY_FLAG_CONTINUATION))) {
+            handler(context, entry);
+            count += 1;
+        }
+
+        // Writers rely on unclaimed space reading as zero.
+        while (tail < end) {
+            entry = ring_entry(ring, tail);
+            tail += entry->le_size;
+            memset(entry, 0, entry->le_size);
+        }
+        __atomic_store_n(&ring->lrb_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return count;
+}
+
+uint64_t loggy_os_log_ring_dropped(loggy_os_log_ring_t ring) {
+    return __atomic_load_n(&ring->lrb_dropped, __ATOMIC_RELAXED);
+}
+
+#endif
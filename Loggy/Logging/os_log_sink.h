@@ -0,0 +1,168 @@
+//
+//  os_log_sink.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_sink_h__
+#define __loggy_os_log_sink_h__
+
+#include "os_log_shims.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// A finished log message, as handed to a sink. Formatting is deferred: the
+/// buffer holds the encoded arguments, and `lr_format` is the format string
+/// they belong to. Everything is borrowed for the duration of the call.
+///
+/// Messages that outgrew the encoder's inline buffer continue in
+/// `lr_chunks`. Sinks that don't set `LOGGY_OS_LOG_SINK_FLAG_OVERSIZE` never
+/// see chunks; the arguments in them are counted in `lr_truncated` instead.
+///
+/// `lr_dso` is the `#dsohandle` of the image that logged the message. A
+/// record read back from a segment has none; `lr_image` describes its
+/// image instead, and `lr_pc` is an address as that image was linked.
+typedef struct {
+    uint64_t        lr_time;
+    uint64_t        lr_activity;
+    os_log_t        lr_log;
+    const char     *lr_format;
+    const void     *lr_pc;
+    const void     *_Nullable lr_dso;
+    const struct loggy_os_log_image_info_s *_Nullable lr_image;
+    const uint8_t  *lr_buf;
+    const loggy_os_log_chunk_s *_Nullable lr_chunks;
+    uint32_t        lr_len;
+    uint16_t        lr_truncated;
+    os_log_type_t   lr_type;
+} loggy_os_log_record_s, *loggy_os_log_record_t;
+
+/// The size of the record's payload, including any chunks.
+OS_EXPORT
+size_t loggy_os_log_record_size(const loggy_os_log_record_s *record);
+
+/// Copies the record's payload, including any chunks, into `buf`.
+OS_EXPORT
+void loggy_os_log_record_copy(const loggy_os_log_record_s *record, uint8_t *buf);
+
+OS_ENUM(loggy_os_log_sink_flags, uint32_t,
+    LOGGY_OS_LOG_SINK_FLAG_OVERSIZE = 0x01,
+);
+
+/// A destination for log messages on platforms without `os_log`.
+///
+/// `ls_send` may be called concurrently from any thread; it must copy
+/// whatever it needs out of the record before returning.
+typedef struct loggy_os_log_sink_s {
+    void (*ls_send)(const struct loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record);
+    void *_Nullable ls_context;
+    loggy_os_log_sink_flags_t ls_flags;
+} loggy_os_log_sink_s, *loggy_os_log_sink_t;
+
+/// Installs `sink` as the destination for `loggy_os_log_send`. The sink must
+/// outlive its installation. Passing `NULL` discards messages.
+OS_EXPORT
+void loggy_os_log_set_sink(const loggy_os_log_sink_s *_Nullable sink);
+
+/// Hands `record` to the installed sink.
+OS_EXPORT
+void loggy_os_log_sink_send(const loggy_os_log_record_s *record);
+
+/// The time stored in `lr_time`: monotonic nanoseconds, or ticks once
+/// `loggy_os_log_clock_use_ticks` succeeds.
+OS_EXPORT
+uint64_t loggy_os_log_timestamp(void);
+
+// MARK: - Ring
+
+OS_ENUM(loggy_os_log_entry_flags, uint8_t,
+    LOGGY_OS_LOG_ENTRY_FLAG_PADDING = 0x01,
+    /// More of the message follows in continuation entries.
+    LOGGY_OS_LOG_ENTRY_FLAG_CONTINUED = 0x02,
+    /// The entry holds only payload, continuing the one before.
+    LOGGY_OS_LOG_ENTRY_FLAG_CONTINUATION = 0x04,
+);
+
+/// The layout of a message inside a ring. Entries are 8-byte aligned and
+/// never straddle the end of the storage.
+///
+/// An oversize message is a head entry with the inline part of the payload,
+/// then a continuation entry per chunk, all with the same `le_sequence`.
+typedef struct {
+    uint32_t        le_size;
+    os_log_type_t   le_type;
+    loggy_os_log_entry_flags_t le_flags;
+    uint16_t        le_truncated;
+    uint32_t        le_len;
+    uint32_t        le_sequence;
+    uint64_t        le_time;
+    uint64_t        le_activity;
+    os_log_t        le_log;
+    const char     *le_format;
+    const void     *le_pc;
+    const void     *_Nullable le_dso;
+    uint8_t         le_data[];
+} loggy_os_log_entry_s, *loggy_os_log_entry_t;
+
+/// A preallocated binary ring of log entries.
+///
+/// Any number of threads may append; one thread at a time may drain. When
+/// the ring is full, new messages are dropped and counted rather than
+/// overwriting unread ones.
+///
+/// Oversize messages go in as several entries no bigger than a chunk, so
+/// they need no more contiguous room than small ones. Their space is
+/// claimed all at once, so a message is either appended whole or dropped,
+/// and the drain reassembles it before handing it on.
+///
+/// Set `lrb_single_writer` after init if only one thread will ever append;
+/// the ring then claims space with a plain store instead of a CAS.
+typedef struct {
+    loggy_os_log_sink_s lrb_sink;
+    uint8_t            *lrb_storage;
+    uint64_t            lrb_mask;
+    uint64_t            lrb_head;
+    uint64_t            lrb_tail;
+    uint64_t            lrb_dropped;
+    uint32_t            lrb_sequence;
+    bool                lrb_single_writer;
+} loggy_os_log_ring_s, *loggy_os_log_ring_t;
+
+/// Prepares `ring` to use `storage`, which must be `size` bytes, a power of
+/// two of at least 4KiB. Returns false if the size is unsuitable.
+///
+/// Install the ring with `loggy_os_log_set_sink(&ring->lrb_sink)`.
+OS_EXPORT
+bool loggy_os_log_ring_init(loggy_os_log_ring_t ring, void *storage, size_t size);
+
+/// The bytes `record` takes up in a ring, including any continuations.
+OS_EXPORT
+size_t loggy_os_log_ring_entry_size(const loggy_os_log_record_s *record);
+
+/// Appends a copy of `record`. Returns false if the message was dropped.
+OS_EXPORT
+bool loggy_os_log_ring_append(loggy_os_log_ring_t ring, const loggy_os_log_record_s *record);
+
+/// Like `loggy_os_log_ring_append`, but a full ring isn't counted as a drop,
+/// for callers that will retry.
+OS_EXPORT
+bool loggy_os_log_ring_try_append(loggy_os_log_ring_t ring, const loggy_os_log_record_s *record);
+
+/// Passes every committed message to `handler` in order, then releases its
+/// space. Oversize messages are reassembled into a single entry first.
+/// Returns the number of messages handled.
+OS_EXPORT
+size_t loggy_os_log_ring_drain(loggy_os_log_ring_t ring, void (*handler)(void *_Nullable context, const loggy_os_log_entry_s *entry), void *_Nullable context);
+
+/// The number of messages dropped because the ring was full.
+OS_EXPORT
+uint64_t loggy_os_log_ring_dropped(loggy_os_log_ring_t ring);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_sink_h__ */
@@ -0,0 +1,897 @@
+//
+//  os_log_symbolicate.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_symbolicate.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+#include <elf.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOGGY_OS_LOG_SYMBOLICATE_END_SEQUENCE   UINT32_MAX
+#define LOGGY_OS_LOG_SYMBOLICATE_NO_FILE        (UINT32_MAX - 1)
+
+// A mapped ELF file with the sections symbolication needs.
+typedef struct {
+    const uint8_t  *ef_map;
+    size_t          ef_size;
+    const Elf64_Shdr *ef_sections;
+    uint32_t        ef_section_count;
+    const char     *ef_names;
+    uint64_t        ef_names_size;
+} elf_file_s, *elf_file_t;
+
+// A row of a line table. Rows are sorted by address; each applies until
+// the next, and an end-of-sequence row covers the gap after a sequence.
+typedef struct {
+    uint64_t        dr_address;
+    uint32_t        dr_file;
+    uint32_t        dr_line;
+} debug_row_s;
+
+typedef struct {
+    uint64_t        df_address;
+    uint64_t        df_size;
+    const char     *df_name;
+} debug_function_s;
+
+typedef struct {
+    const char     *df_directory;
+    const char     *df_name;
+    char           *_Nullable df_path;
+} debug_file_s;
+
+typedef struct {
+    uint64_t        dc_address;
+    loggy_os_log_symbol_s dc_symbol;
+    bool            dc_used;
+} debug_cache_entry_s;
+
+// Everything known about one build of an image. Kept for the life of the
+// symbolicator, even if nothing was found, so it's only looked for once.
+typedef struct debug_image_s {
+    struct debug_image_s *di_next;
+    char           *di_key;
+    elf_file_s      di_files[2];
+    uint32_t        di_file_count;
+    debug_row_s    *di_rows;
+    size_t          di_row_count;
+    debug_function_s *di_functions;
+    size_t          di_function_count;
+    debug_file_s   *di_sources;
+    uint32_t        di_source_count;
+    uint32_t        di_source_capacity;
+    debug_cache_entry_s *di_cache;
+    uint32_t        di_cache_mask;
+    uint32_t        di_cache_count;
+} debug_image_s, *debug_image_t;
+
+struct loggy_os_log_symbolicator_s {
+    pthread_mutex_t ls_lock;
+    debug_image_t   ls_images;
+};
+
+// MARK: - ELF
+
+static bool elf_open(elf_file_t file, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Elf64_Ehdr)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        return false;
+    }
+
+    *file = (elf_file_s){ .ef_map = map, .ef_size = (size_t)st.st_size };
+
+    const Elf64_Ehdr *ehdr = map;
+    if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB
+        || ehdr->e_shentsize != sizeof(Elf64_Shdr) || ehdr->e_shoff > file->ef_size
+        || (file->ef_size - ehdr->e_shoff) / sizeof(Elf64_Shdr) < ehdr->e_shnum || ehdr->e_shstrndx >= ehdr->e_shnum) {
+        munmap(map, file->ef_size);
+        return false;
+    }
+
+    file->ef_sections = (const Elf64_Shdr *)(file->ef_map + ehdr->e_shoff);
+    file->ef_section_count = ehdr->e_shnum;
+
+    const Elf64_Shdr *names = &file->ef_sections[ehdr->e_shstrndx];
+    if (names->sh_offset > file->ef_size || names->sh_size > file->ef_size - names->sh_offset) {
+        munmap(map, file->ef_size);
+        return false;
+    }
+    file->ef_names = (const char *)file->ef_map + names->sh_offset;
+    file->ef_names_size = names->sh_size;
+    return true;
+}
+
+static void elf_close(elf_file_t file) {
+    if (file->ef_map) {
+        munmap((void *)file->ef_map, file->ef_size);
+    }
+    *file = (elf_file_s){ 0 };
+}
+
+// The contents of section `i`, or `NULL` if it has none in the file or
+// they're compressed.
+static const uint8_t *_Nullable elf_section_data(elf_file_t file, uint32_t i, uint64_t *size) {
+    const Elf64_Shdr *section = &file->ef_sections[i];
+    if (section->sh_type == SHT_NOBITS || (section->sh_flags & SHF_COMPRESSED)
+        || section->sh_offset > file->ef_size || section->sh_size > file->ef_size - section->sh_offset) {
+        return NULL;
+    }
+    *size = section->sh_size;
+    return file->ef_map + section->sh_offset;
+}
+
+static const uint8_t *_Nullable elf_section(elf_file_t file, const char *name, uint64_t *size) {
+    for (uint32_t i = 0; i < file->ef_section_count; i++) {
+        uint32_t offset = file->ef_sections[i].sh_name;
+        if (offset < file->ef_names_size && strncmp(file->ef_names + offset, name, file->ef_names_size - offset) == 0) {
+            return elf_section_data(file, i, size);
+        }
+    }
+    return NULL;
+}
+
+// Whether the file's GNU build ID, in hex, is `build_id`.
+static bool elf_build_id_matches(elf_file_t file, const char *build_id) {
+    static const char digits[] = "0123456789abcdef";
+    for (uint32_t i = 0; i < file->ef_section_count; i++) {
+        uint64_t size;
+        const uint8_t *note = file->ef_sections[i].sh_type == SHT_NOTE ? elf_section_data(file, i, &size) : NULL;
+        if (!note) {
+            continue;
+        }
+
+        uint64_t align = file->ef_sections[i].sh_addralign == 8 ? 8 : 4;
+        const uint8_t *end = note + size;
+        while ((size_t)(end - note) >= sizeof(Elf64_Nhdr)) {
+            const Elf64_Nhdr *nhdr = (const Elf64_Nhdr *)note;
+            const uint8_t *name = note + sizeof(Elf64_Nhdr);
+            uint64_t name_size = (nhdr->n_namesz + align - 1) & ~(align - 1);
+            uint64_t desc_size = (nhdr->n_descsz + align - 1) & ~(align - 1);
+            if (name_size > (size_t)(end - name) || desc_size > (size_t)(end - name) - name_size) {
+                break;
+            }
+
+            const uint8_t *desc = name + name_size;
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 && memcmp(name, "GNU", 4) == 0) {
+                if (strlen(build_id) != nhdr->n_descsz * 2) {
+                    return false;
+                }
+                for (uint32_t j = 0; j < nhdr->n_descsz; j++) {
+                    if (build_id[j * 2] != digits[desc[j] >> 4] || build_id[j * 2 + 1] != digits[desc[j] & 0xf]) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+            note = desc + desc_size;
+        }
+    }
+    return false;
+}
+
+// MARK: - Functions
+
+static int debug_function_compare(const void *lhs, const void *rhs) {
+    uint64_t a = ((const debug_function_s *)lhs)->df_address, b = ((const debug_function_s *)rhs)->df_address;
+    return a < b ? -1 : a > b;
+}
+
+// Reads the functions from `.symtab`, or `.dynsym` if the file was stripped.
+static bool debug_load_functions(debug_image_t image, elf_file_t file) {
+    const char *tables[][2] = { { ".symtab", ".strtab" }, { ".dynsym", ".dynstr" } };
+    for (size_t t = 0; t < sizeof(tables) / sizeof(tables[0]); t++) {
+        uint64_t symbols_size, names_size;
+        const uint8_t *symbols = elf_section(file, tables[t][0], &symbols_size);
+        const char *names = (const char *)elf_section(file, tables[t][1], &names_size);
+        if (!symbols || !names) {
+            continue;
+        }
+
+        size_t count = symbols_size / sizeof(Elf64_Sym);
+        debug_function_s *functions = malloc(count * sizeof(debug_function_s) + 1);
+        if (!functions) {
+            return false;
+        }
+
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            const Elf64_Sym *symbol = (const Elf64_Sym *)symbols + i;
+            if (ELF64_ST_TYPE(symbol->st_info) != STT_FUNC || symbol->st_shndx == SHN_UNDEF || !symbol->st_value
+                || symbol->st_name >= names_size || !memchr(names + symbol->st_name, 0, names_size - symbol->st_name)) {
+                continue;
+            }
+            functions[n++] = (debug_function_s){ .df_address = symbol->st_value, .df_size = symbol->st_size, .df_name = names + symbol->st_name };
+        }
+
+        if (!n) {
+            free(functions);
+            continue;
+        }
+
+        qsort(functions, n, sizeof(debug_function_s), debug_function_compare);
+        image->di_functions = functions;
+        image->di_function_count = n;
+        return true;
+    }
+    return false;
+}
+
+// MARK: - DWARF
+
+typedef struct {
+    const uint8_t  *dc_p;
+    const uint8_t  *dc_end;
+    bool            dc_bad;
+} dwarf_cursor_s, *dwarf_cursor_t;
+
+// Reads `size` bytes as a little-endian integer.
+static uint64_t dwarf_read(dwarf_cursor_t c, size_t size) {
+    if ((size_t)(c->dc_end - c->dc_p) < size) {
+        c->dc_bad = true;
+        c->dc_p = c->dc_end;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (size_t i = 0; i < size && i < 8; i++) {
+        value |= (uint64_t)c->dc_p[i] << (i * 8);
+    }
+    c->dc_p += size;
+    return value;
+}
+
+static uint64_t dwarf_uleb(dwarf_cursor_t c) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; c->dc_p < c->dc_end; shift += 7) {
+        uint8_t byte = *c->dc_p++;
+        if (shift < 64) {
+            value |= (uint64_t)(byte & 0x7f) << shift;
+        }
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    c->dc_bad = true;
+    return 0;
+}
+
+static int64_t dwarf_sleb(dwarf_cursor_t c) {
+    int64_t value = 0;
+    unsigned shift = 0;
+    while (c->dc_p < c->dc_end) {
+        uint8_t byte = *c->dc_p++;
+        if (shift < 64) {
+            value |= (int64_t)((uint64_t)(byte & 0x7f) << shift);
+        }
+        shift += 7;
+        if (!(byte & 0x80)) {
+            if (shift < 64 && (byte & 0x40)) {
+                value |= -((int64_t)1 << shift);
+            }
+            return value;
+        }
+    }
+    c->dc_bad = true;
+    return 0;
+}
+
+static const char *_Nullable dwarf_string(dwarf_cursor_t c) {
+    const char *str = (const char *)c->dc_p;
+    const uint8_t *nul = memchr(c->dc_p, 0, (size_t)(c->dc_end - c->dc_p));
+    if (!nul) {
+        c->dc_bad = true;
+        c->dc_p = c->dc_end;
+        return NULL;
+    }
+    c->dc_p = nul + 1;
+    return str;
+}
+
+// The string sections that DWARF 5 file tables refer into.
+typedef struct {
+    const char     *_Nullable ds_str;
+    uint64_t        ds_str_size;
+    const char     *_Nullable ds_line_str;
+    uint64_t        ds_line_str_size;
+} dwarf_strings_s;
+
+static const char *_Nullable dwarf_strp(const char *_Nullable section, uint64_t size, uint64_t offset) {
+    if (!section || offset >= size || !memchr(section + offset, 0, size - offset)) {
+        return NULL;
+    }
+    return section + offset;
+}
+
+// Reads an attribute of a DWARF 5 directory or file entry, keeping it if
+// it's a string or a number. Returns false for forms that can't appear.
+static bool dwarf_form(dwarf_cursor_t c, uint64_t form, bool is64, const dwarf_strings_s *strings, const char **str, uint64_t *num) {
+    *str = NULL;
+    *num = 0;
+    switch (form) {
+    case 0x08: /* DW_FORM_string */
+        *str = dwarf_string(c);
+        break;
+    case 0x0e: /* DW_FORM_strp */
+        *str = dwarf_strp(strings->ds_str, strings->ds_str_size, dwarf_read(c, is64 ? 8 : 4));
+        break;
+    case 0x1f: /* DW_FORM_line_strp */
+        *str = dwarf_strp(strings->ds_line_str, strings->ds_line_str_size, dwarf_read(c, is64 ? 8 : 4));
+        break;
+    case 0x0b: /* DW_FORM_data1 */
+        *num = dwarf_read(c, 1);
+        break;
+    case 0x05: /* DW_FORM_data2 */
+        *num = dwarf_read(c, 2);
+        break;
+    case 0x06: /* DW_FORM_data4 */
+        *num = dwarf_read(c, 4);
+        break;
+    case 0x07: /* DW_FORM_data8 */
+        *num = dwarf_read(c, 8);
+        break;
+    case 0x1e: /* DW_FORM_data16 */
+        dwarf_read(c, 16);
+        break;
+    case 0x0f: /* DW_FORM_udata */
+        *num = dwarf_uleb(c);
+        break;
+    case 0x09: /* DW_FORM_block */
+        dwarf_read(c, (size_t)dwarf_uleb(c));
+        break;
+    default:
+        return false;
+    }
+    return !c->dc_bad;
+}
+
+static bool debug_add_source(debug_image_t image, const char *_Nullable directory, const char *name, uint32_t *id) {
+    if (image->di_source_count == image->di_source_capacity) {
+        uint32_t capacity = image->di_source_capacity ? image->di_source_capacity * 2 : 64;
+        debug_file_s *grown = realloc(image->di_sources, capacity * sizeof(debug_file_s));
+        if (!grown) {
+            return false;
+        }
+        image->di_sources = grown;
+        image->di_source_capacity = capacity;
+    }
+
+    *id = image->di_source_count;
+    image->di_sources[image->di_source_count++] = (debug_file_s){ .df_directory = directory, .df_name = name };
+    return true;
+}
+
+static bool debug_add_row(debug_image_t image, size_t *capacity, uint64_t address, uint32_t file, uint32_t line) {
+    if (image->di_row_count == *capacity) {
+        size_t grown_capacity = *capacity ? *capacity * 2 : 4096;
+        debug_row_s *grown = realloc(image->di_rows, grown_capacity * sizeof(debug_row_s));
+        if (!grown) {
+            return false;
+        }
+        image->di_rows = grown;
+        *capacity = grown_capacity;
+    }
+    image->di_rows[image->di_row_count++] = (debug_row_s){ .dr_address = address, .dr_file = file, .dr_line = line };
+    return true;
+}
+
+// Reads the directory and file tables of a DWARF 5 line program header,
+// turning each file into a source ID.
+static bool dwarf_read_v5_files(debug_image_t image, dwarf_cursor_t c, bool is64, const dwarf_strings_s *strings, uint32_t **files, uint64_t *file_count) {
+    const char **directories = NULL;
+    uint64_t directory_count = 0;
+    bool ok = false;
+
+    for (int table = 0; table < 2; table++) {
+        uint8_t format_count = (uint8_t)dwarf_read(c, 1);
+        uint64_t formats[2 * 255];
+        for (uint8_t i = 0; i < format_count; i++) {
+            formats[i * 2] = dwarf_uleb(c);
+            formats[i * 2 + 1] = dwarf_uleb(c);
+        }
+
+        uint64_t count = dwarf_uleb(c);
+        if (c->dc_bad || count > (uint64_t)(c->dc_end - c->dc_p)) {
+            goto done;
+        }
+
+        if (table == 0) {
+            directories = calloc(count + 1, sizeof(const char *));
+            directory_count = count;
+        } else {
+            *files = calloc(count + 1, sizeof(uint32_t));
+            *file_count = count;
+        }
+        if (table == 0 ? !directories : !*files) {
+            goto done;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            const char *path = NULL;
+            uint64_t directory = 0;
+            for (uint8_t j = 0; j < format_count; j++) {
+                const char *str;
+                uint64_t num;
+                if (!dwarf_form(c, formats[j * 2 + 1], is64, strings, &str, &num)) {
+                    goto done;
+                }
+                if (formats[j * 2] == 1 /* DW_LNCT_path */) {
+                    path = str;
+                } else if (formats[j * 2] == 2 /* DW_LNCT_directory_index */) {
+                    directory = num;
+                }
+            }
+
+            if (table == 0) {
+                directories[i] = path;
+            } else if (!path) {
+                (*files)[i] = LOGGY_OS_LOG_SYMBOLICATE_NO_FILE;
+            } else if (!debug_add_source(image, directory < directory_count ? directories[directory] : NULL, path, &(*files)[i])) {
+                goto done;
+            }
+        }
+    }
+    ok = true;
+
+done:
+    free(directories);
+    return ok;
+}
+
+// Reads the directory and file tables of an earlier line program header.
+// File numbers start at 1; 0 is left unknown.
+static bool dwarf_read_files(debug_image_t image, dwarf_cursor_t c, uint32_t **files, uint64_t *file_count) {
+    const char **directories = NULL;
+    uint64_t directory_count = 0, directory_capacity = 0;
+    uint64_t capacity = 0;
+    bool ok = false;
+
+    *file_count = 1;
+    for (;;) {
+        const char *directory = dwarf_string(c);
+        if (!directory || !directory[0]) {
+            break;
+        }
+        if (directory_count + 1 >= directory_capacity) {
+            directory_capacity = directory_capacity ? directory_capacity * 2 : 16;
+            const char **grown = realloc(directories, directory_capacity * sizeof(const char *));
+            if (!grown) {
+                goto done;
+            }
+            directories = grown;
+        }
+        directories[++directory_count] = directory;
+    }
+
+    for (;;) {
+        const char *name = dwarf_string(c);
+        if (!name || !name[0]) {
+            break;
+        }
+        uint64_t directory = dwarf_uleb(c);
+        dwarf_uleb(c);
+        dwarf_uleb(c);
+
+        if (*file_count >= capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            uint32_t *grown = realloc(*files, capacity * sizeof(uint32_t));
+            if (!grown) {
+                goto done;
+            }
+            *files = grown;
+            (*files)[0] = LOGGY_OS_LOG_SYMBOLICATE_NO_FILE;
+        }
+        const char *path = directory && directory <= directory_count ? directories[directory] : NULL;
+        if (!debug_add_source(image, path, name, &(*files)[(*file_count)++])) {
+            goto done;
+        }
+    }
+    ok = !c->dc_bad;
+
+done:
+    free(directories);
+    return ok;
+}
+
+static inline uint32_t dwarf_file(const uint32_t *_Nullable files, uint64_t file_count, uint64_t file) {
+    return files && file < file_count ? files[file] : LOGGY_OS_LOG_SYMBOLICATE_NO_FILE;
+}
+
+// Runs one unit's line program, adding its rows. Sequences at address zero
+// or an all-ones address are for code the linker discarded, and dropped.
+static void dwarf_run_program(debug_image_t image, dwarf_cursor_t c, size_t *capacity, uint8_t address_size,
+                              uint8_t min_length, int8_t line_base, uint8_t line_range, uint8_t opcode_base, const uint8_t *lengths,
+                              const uint32_t *_Nullable files, uint64_t file_count) {
+    uint64_t address = 0, file = 1, line = 1;
+    size_t sequence = image->di_row_count;
+
+    while (c->dc_p < c->dc_end && !c->dc_bad) {
+        uint8_t opcode = (uint8_t)dwarf_read(c, 1);
+        if (opcode >= opcode_base) {
+            uint8_t adjusted = opcode - opcode_base;
+            address += (uint64_t)(adjusted / line_range) * min_length;
+            line += (uint64_t)(int64_t)(line_base + adjusted % line_range);
+            debug_add_row(image, capacity, address, dwarf_file(files, file_count, file), (uint32_t)line);
+            continue;
+        }
+
+        switch (opcode) {
+        case 0: {
+            uint64_t len = dwarf_uleb(c);
+            if (!len || len > (uint64_t)(c->dc_end - c->dc_p)) {
+                return;
+            }
+            const uint8_t *next = c->dc_p + len;
+            uint8_t extended = (uint8_t)dwarf_read(c, 1);
+            if (extended == 1 /* DW_LNE_end_sequence */) {
+                uint64_t start = sequence < image->di_row_count ? image->di_rows[sequence].dr_address : address;
+                uint64_t tombstone = address_size == 4 ? UINT32_MAX : UINT64_MAX;
+                if (!start || start >= tombstone - 1) {
+                    image->di_row_count = sequence;
+                } else {
+                    debug_add_row(image, capacity, address, LOGGY_OS_LOG_SYMBOLICATE_END_SEQUENCE, 0);
+                }
+                sequence = image->di_row_count;
+                address = 0;
+                file = 1;
+                line = 1;
+            } else if (extended == 2 /* DW_LNE_set_address */) {
+                address = dwarf_read(c, (size_t)(len - 1));
+            }
+            c->dc_p = next;
+            break;
+        }
+        case 1: /* DW_LNS_copy */
+            debug_add_row(image, capacity, address, dwarf_file(files, file_count, file), (uint32_t)line);
+            break;
+        case 2: /* DW_LNS_advance_pc */
+            address += dwarf_uleb(c) * min_length;
+            break;
+        case 3: /* DW_LNS_advance_line */
+            line += (uint64_t)dwarf_sleb(c);
+            break;
+        case 4: /* DW_LNS_set_file */
+            file = dwarf_uleb(c);
+            break;
+        case 8: /* DW_LNS_const_add_pc */
+            address += (uint64_t)((255 - opcode_base) / line_range) * min_length;
+            break;
+        case 9: /* DW_LNS_fixed_advance_pc */
+            address += dwarf_read(c, 2);
+            break;
+        default:
+            for (uint8_t i = 0; i < lengths[opcode - 1]; i++) {
+                dwarf_uleb(c);
+            }
+            break;
+        }
+    }
+
+    // A sequence without an end is incomplete; don't let it cover anything.
+    image->di_row_count = sequence;
+}
+
+static int debug_row_compare(const void *lhs, const void *rhs) {
+    const debug_row_s *a = lhs, *b = rhs;
+    if (a->dr_address != b->dr_address) {
+        return a->dr_address < b->dr_address ? -1 : 1;
+    }
+    // Where one sequence ends and the next begins, the beginning wins.
+    bool a_end = a->dr_file == LOGGY_OS_LOG_SYMBOLICATE_END_SEQUENCE, b_end = b->dr_file == LOGGY_OS_LOG_SYMBOLICATE_END_SEQUENCE;
+    return b_end - a_end;
+}
+
+// Decodes every line program in `.debug_line` into one table of rows.
+static bool debug_load_lines(debug_image_t image, elf_file_t file) {
+    uint64_t size;
+    const uint8_t *section = elf_section(file, ".debug_line", &size);
+    if (!section) {
+        return false;
+    }
+
+    dwarf_strings_s strings = { 0 };
+    strings.ds_str = (const char *)elf_section(file, ".debug_str", &strings.ds_str_size);
+    strings.ds_line_str = (const char *)elf_section(file, ".debug_line_str", &strings.ds_line_str_size);
+
+    size_t capacity = 0;
+    dwarf_cursor_s c = { .dc_p = section, .dc_end = section + size };
+    while (c.dc_p < c.dc_end) {
+        bool is64 = false;
+        uint64_t unit_length = dwarf_read(&c, 4);
+        if (unit_length == 0xffffffff) {
+            is64 = true;
+            unit_length = dwarf_read(&c, 8);
+        }
+        if (c.dc_bad || unit_length > (uint64_t)(c.dc_end - c.dc_p)) {
+            break;
+        }
+
+        dwarf_cursor_s unit = { .dc_p = c.dc_p, .dc_end = c.dc_p + unit_length };
+        c.dc_p = unit.dc_end;
+
+        uint16_t version = (uint16_t)dwarf_read(&unit, 2);
+        if (version < 2 || version > 5) {
+            continue;
+        }
+
+        uint8_t address_size = 8;
+        if (version >= 5) {
+            address_size = (uint8_t)dwarf_read(&unit, 1);
+            dwarf_read(&unit, 1);
+        }
+
+        uint64_t header_length = dwarf_read(&unit, is64 ? 8 : 4);
+        if (unit.dc_bad || header_length > (uint64_t)(unit.dc_end - unit.dc_p)) {
+            continue;
+        }
+        dwarf_cursor_s program = { .dc_p = unit.dc_p + header_length, .dc_end = unit.dc_end };
+
+        uint8_t min_length = (uint8_t)dwarf_read(&unit, 1);
+        if (version >= 4) {
+            dwarf_read(&unit, 1);
+        }
+        dwarf_read(&unit, 1);
+        int8_t line_base = (int8_t)dwarf_read(&unit, 1);
+        uint8_t line_range = (uint8_t)dwarf_read(&unit, 1);
+        uint8_t opcode_base = (uint8_t)dwarf_read(&unit, 1);
+        const uint8_t *lengths = unit.dc_p;
+        if (unit.dc_bad || !line_range || !opcode_base) {
+            continue;
+        }
+        dwarf_read(&unit, opcode_base - 1);
+
+        uint32_t *files = NULL;
+        uint64_t file_count = 0;
+        bool ok = version >= 5 ? dwarf_read_v5_files(image, &unit, is64, &strings, &files, &file_count) : dwarf_read_files(image, &unit, &files, &file_count);
+        if (ok) {
+            dwarf_run_program(image, &program, &capacity, address_size, min_length, line_base, line_range, opcode_base, lengths, files, file_count);
+        }
+        free(files);
+    }
+
+    if (!image->di_row_count) {
+        return false;
+    }
+    qsort(image->di_rows, image->di_row_count, sizeof(debug_row_s), debug_row_compare);
+    return true;
+}
+
+// MARK: - Images
+
+static void debug_image_destroy(debug_image_t image) {
+    for (uint32_t i = 0; i < image->di_file_count; i++) {
+        elf_close(&image->di_files[i]);
+    }
+    for (uint32_t i = 0; i < image->di_source_count; i++) {
+        free(image->di_sources[i].df_path);
+    }
+    free(image->di_key);
+    free(image->di_rows);
+    free(image->di_functions);
+    free(image->di_sources);
+    free(image->di_cache);
+    free(image);
+}
+
+// Looks for the image's debug info at its path, then where distributions
+// install separate debug files. Lines and functions may come from
+// different files, if the binary was stripped of one but not the other.
+static debug_image_t _Nullable debug_image_create(const loggy_os_log_image_info_s *info) {
+    debug_image_t image = calloc(1, sizeof(debug_image_s));
+    if (!image || !(image->di_key = strdup(info->ii_build_id[0] ? info->ii_build_id : info->ii_path))) {
+        free(image);
+        return NULL;
+    }
+
+    char candidates[3][4096];
+    size_t candidate_count = 0;
+    if (info->ii_path[0]) {
+        snprintf(candidates[candidate_count++], sizeof(candidates[0]), "%s", info->ii_path);
+    }
+    if (strlen(info->ii_build_id) > 2) {
+        snprintf(candidates[candidate_count++], sizeof(candidates[0]), "/usr/lib/debug/.build-id/%.2s/%s.debug", info->ii_build_id, info->ii_build_id + 2);
+    }
+    if (info->ii_path[0] == '/') {
+        snprintf(candidates[candidate_count++], sizeof(candidates[0]), "/usr/lib/debug%s.debug", info->ii_path);
+    }
+
+    for (size_t i = 0; i < candidate_count && (!image->di_rows || !image->di_functions); i++) {
+        elf_file_s file;
+        if (!elf_open(&file, candidates[i])) {
+            continue;
+        }
+
+        bool used = false;
+        if (!info->ii_build_id[0] || elf_build_id_matches(&file, info->ii_build_id)) {
+            if (!image->di_rows) {
+                used |= debug_load_lines(image, &file);
+            }
+            if (!image->di_functions) {
+                used |= debug_load_functions(image, &file);
+            }
+        }
+
+        if (used) {
+            image->di_files[image->di_file_count++] = file;
+        } else {
+            elf_close(&file);
+        }
+    }
+    return image;
+}
+
+static const char *_Nullable debug_source_path(debug_image_t image, uint32_t id) {
+    if (id >= image->di_source_count) {
+        return NULL;
+    }
+
+    debug_file_s *source = &image->di_sources[id];
+    if (!source->df_path && source->df_name[0] != '/' && source->df_directory && source->df_directory[0]) {
+        size_t directory_len = strlen(source->df_directory), name_len = strlen(source->df_name);
+        if ((source->df_path = malloc(directory_len + name_len + 2))) {
+            memcpy(source->df_path, source->df_directory, directory_len);
+            source->df_path[directory_len] = '/';
+            memcpy(source->df_path + directory_len + 1, source->df_name, name_len + 1);
+        }
+    }
+    return source->df_path ? source->df_path : source->df_name;
+}
+
+static void debug_image_resolve(debug_image_t image, uint64_t address, loggy_os_log_symbol_t symbol) {
+    *symbol = (loggy_os_log_symbol_s){ 0 };
+
+    size_t lo = 0, hi = image->di_row_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (image->di_rows[mid].dr_address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo && image->di_rows[lo - 1].dr_file != LOGGY_OS_LOG_SYMBOLICATE_END_SEQUENCE) {
+        symbol->ls_file = debug_source_path(image, image->di_rows[lo - 1].dr_file);
+        symbol->ls_line = image->di_rows[lo - 1].dr_line;
+    }
+
+    lo = 0;
+    hi = image->di_function_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (image->di_functions[mid].df_address <= address) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo) {
+        const debug_function_s *function = &image->di_functions[lo - 1];
+        if (!function->df_size || address - function->df_address < function->df_size) {
+            symbol->ls_function = function->df_name;
+        }
+    }
+}
+
+static inline uint32_t debug_cache_slot(debug_image_t image, uint64_t address) {
+    return (uint32_t)((address * 0x9e3779b97f4a7c15ull) >> 32) & image->di_cache_mask;
+}
+
+static bool debug_cache_grow(debug_image_t image) {
+    uint32_t mask = image->di_cache_mask ? image->di_cache_mask * 2 + 1 : 255;
+    debug_cache_entry_s *cache = calloc(mask + 1, sizeof(debug_cache_entry_s));
+    if (!cache) {
+        return false;
+    }
+
+    debug_cache_entry_s *old = image->di_cache;
+    uint32_t old_size = image->di_cache ? image->di_cache_mask + 1 : 0;
+    image->di_cache = cache;
+    image->di_cache_mask = mask;
+    for (uint32_t i = 0; i < old_size; i++) {
+        if (old[i].dc_used) {
+            uint32_t slot = debug_cache_slot(image, old[i].dc_address);
+            while (cache[slot].dc_used) {
+                slot = (slot + 1) & mask;
+            }
+            cache[slot] = old[i];
+        }
+    }
+    free(old);
+    return true;
+}
+
+// Resolves `address` through the image's cache, filling it on a miss.
+static bool debug_image_lookup(debug_image_t image, uint64_t address, loggy_os_log_symbol_t symbol) {
+    if ((image->di_cache_count + 1) * 2 > image->di_cache_mask + 1 && !debug_cache_grow(image)) {
+        debug_image_resolve(image, address, symbol);
+        return symbol->ls_line != 0;
+    }
+
+    uint32_t slot = debug_cache_slot(image, address);
+    for (; image->di_cache[slot].dc_used; slot = (slot + 1) & image->di_cache_mask) {
+        if (image->di_cache[slot].dc_address == address) {
+            *symbol = image->di_cache[slot].dc_symbol;
+            return symbol->ls_line != 0;
+        }
+    }
+
+    debug_image_resolve(image, address, symbol);
+    image->di_cache[slot] = (debug_cache_entry_s){ .dc_address = address, .dc_symbol = *symbol, .dc_used = true };
+    image->di_cache_count += 1;
+    return symbol->ls_line != 0;
+}
+
+// MARK: - Symbolicator
+
+loggy_os_log_symbolicator_t loggy_os_log_symbolicator_create(void) {
+    loggy_os_log_symbolicator_t symbolicator = calloc(1, sizeof(struct loggy_os_log_symbolicator_s));
+    if (!symbolicator) {
+        return NULL;
+    }
+    pthread_mutex_init(&symbolicator->ls_lock, NULL);
+    return symbolicator;
+}
+
+void loggy_os_log_symbolicator_destroy(loggy_os_log_symbolicator_t symbolicator) {
+    for (debug_image_t image = symbolicator->ls_images, next; image; image = next) {
+        next = image->di_next;
+        debug_image_destroy(image);
+    }
+    pthread_mutex_destroy(&symbolicator->ls_lock);
+    free(symbolicator);
+}
+
+size_t loggy_os_log_symbolicate(loggy_os_log_symbolicator_t symbolicator, const loggy_os_log_image_info_s *info, const uint64_t *addresses, size_t count, loggy_os_log_symbol_s *symbols) {
+    if (!info->ii_path[0] && !info->ii_build_id[0]) {
+        memset(symbols, 0, count * sizeof(loggy_os_log_symbol_s));
+        return 0;
+    }
+
+    pthread_mutex_lock(&symbolicator->ls_lock);
+
+    const char *key = info->ii_build_id[0] ? info->ii_build_id : info->ii_path;
+    debug_image_t image = symbolicator->ls_images;
+    while (image && strcmp(image->di_key, key) != 0) {
+        image = image->di_next;
+    }
+    if (!image && (image = debug_image_create(info))) {
+        image->di_next = symbolicator->ls_images;
+        symbolicator->ls_images = image;
+    }
+
+    size_t resolved = 0;
+    for (size_t i = 0; i < count; i++) {
+        // A return address is just past the call; look up the call itself.
+        if (image && addresses[i] && debug_image_lookup(image, addresses[i] - 1, &symbols[i])) {
+            resolved += 1;
+        } else if (!image || !addresses[i]) {
+            symbols[i] = (loggy_os_log_symbol_s){ 0 };
+        }
+    }
+
+    pthread_mutex_unlock(&symbolicator->ls_lock);
+    return resolved;
+}
+
+#endif
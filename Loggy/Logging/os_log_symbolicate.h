@@ -0,0 +1,54 @@
+//
+//  os_log_symbolicate.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_log_symbolicate_h__
+#define __loggy_os_log_symbolicate_h__
+
+#include "os_log_image.h"
+
+#if !LOGGY_HAS_OS_LOG
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// Where an address is in the source. Fields the debug info doesn't cover
+/// are `NULL` or zero.
+typedef struct {
+    const char     *_Nullable ls_function;
+    const char     *_Nullable ls_file;
+    uint32_t        ls_line;
+} loggy_os_log_symbol_s, *loggy_os_log_symbol_t;
+
+/// Turns return addresses into functions, files, and lines after the fact,
+/// from the ELF symbol table and DWARF line tables of the images they're in.
+///
+/// An image's debug info is looked for at its path, then under
+/// `/usr/lib/debug`, and only used if its build ID matches. It's loaded
+/// once per build ID, the first time an address in it is asked about, and
+/// every address's result is kept, so symbolicating many records costs one
+/// lookup per call site. Compressed debug sections aren't supported.
+typedef struct loggy_os_log_symbolicator_s *loggy_os_log_symbolicator_t;
+
+OS_EXPORT
+loggy_os_log_symbolicator_t _Nullable loggy_os_log_symbolicator_create(void);
+
+/// Frees the symbolicator and every string it has returned.
+OS_EXPORT
+void loggy_os_log_symbolicator_destroy(loggy_os_log_symbolicator_t symbolicator);
+
+/// Resolves `count` return addresses in `image`, as it was linked, into
+/// `symbols`. Records read from a segment have these in `lr_pc`, with the
+/// image in `lr_image`. Safe to call from any number of threads.
+///
+/// Returns the number of addresses resolved to a line.
+OS_EXPORT
+size_t loggy_os_log_symbolicate(loggy_os_log_symbolicator_t symbolicator, const loggy_os_log_image_info_s *image, const uint64_t *addresses, size_t count, loggy_os_log_symbol_s *symbols);
+
+OS_ASSUME_NONNULL_END
+
+#endif
+
+#endif /* __loggy_os_log_symbolicate_h__ */
@@ -0,0 +1,34 @@
+//
+//  os_signpost_id.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_log_shims.h"
+
+#define LOGGY_OS_SIGNPOST_ID_BLOCK  1024
+
+// Far from 0 (null), ~0 (invalid), and the small pointer values used by
+// IDs made from objects.
+#define LOGGY_OS_SIGNPOST_ID_BASE   (0x4c4f4747ull << 32)
+
+static uint64_t signpost_id_next_block;
+static __thread uint64_t signpost_id_next;
+static __thread uint64_t signpost_id_end;
+
+OS_NOINLINE
+static uint64_t signpost_id_refill(void) {
+    uint64_t block = __atomic_fetch_add(&signpost_id_next_block, 1, __ATOMIC_RELAXED);
+    uint64_t start = LOGGY_OS_SIGNPOST_ID_BASE + block * LOGGY_OS_SIGNPOST_ID_BLOCK;
+    signpost_id_next = start + 1;
+    signpost_id_end = start + LOGGY_OS_SIGNPOST_ID_BLOCK;
+    return start;
+}
+
+uint64_t loggy_os_signpost_id_make(void) {
+    if (signpost_id_next == signpost_id_end) {
+        return signpost_id_refill();
+    }
+    return signpost_id_next++;
+}
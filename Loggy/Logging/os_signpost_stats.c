@@ -0,0 +1,339 @@
+//
+//  os_signpost_stats.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#include "os_signpost_stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Histograms are log-linear, like HDR histograms: values under 16 have a
+// bucket each, and every power of two above that is split into 16 buckets.
+#define LOGGY_OS_SIGNPOST_STATS_SUB_BITS    4
+#define LOGGY_OS_SIGNPOST_STATS_SUB_COUNT   (1 << LOGGY_OS_SIGNPOST_STATS_SUB_BITS)
+#define LOGGY_OS_SIGNPOST_STATS_MAX_EXP     47
+#define LOGGY_OS_SIGNPOST_STATS_BUCKETS     ((LOGGY_OS_SIGNPOST_STATS_MAX_EXP - LOGGY_OS_SIGNPOST_STATS_SUB_BITS + 2) * LOGGY_OS_SIGNPOST_STATS_SUB_COUNT)
+
+#define LOGGY_OS_SIGNPOST_STATS_NAMES       64
+#define LOGGY_OS_SIGNPOST_STATS_PENDING     4096
+#define LOGGY_OS_SIGNPOST_STATS_PROBE       32
+
+typedef struct {
+    const char *sh_name;
+    uint64_t sh_counts[LOGGY_OS_SIGNPOST_STATS_BUCKETS];
+} stats_histogram_s, *stats_histogram_t;
+
+// Only the owning thread writes a shard; snapshots read it concurrently.
+// Shards of exited threads are adopted by new ones rather than freed, so
+// their counts are never lost.
+typedef struct stats_shard_s {
+    struct stats_shard_s *ss_next;
+    bool ss_retired;
+    uint32_t ss_count;
+    stats_histogram_s ss_histograms[LOGGY_OS_SIGNPOST_STATS_NAMES];
+} stats_shard_s, *stats_shard_t;
+
+// A begin waiting for its end. `ps_key` is 0 when empty, 1 when the begin
+// has been matched, and 2 while being written.
+typedef struct {
+    uint64_t ps_key;
+    const void *ps_log;
+    const char *ps_name;
+    uint64_t ps_spid;
+    uint64_t ps_time;
+} stats_pending_s, *stats_pending_t;
+
+#define LOGGY_OS_SIGNPOST_STATS_EMPTY   0
+#define LOGGY_OS_SIGNPOST_STATS_DONE    1
+#define LOGGY_OS_SIGNPOST_STATS_BUSY    2
+
+static bool stats_enabled;
+static uint64_t stats_evictions;
+static stats_shard_t stats_shards;
+static stats_pending_s stats_pending[LOGGY_OS_SIGNPOST_STATS_PENDING];
+static pthread_key_t stats_shard_key;
+static pthread_once_t stats_shard_once = PTHREAD_ONCE_INIT;
+
+void loggy_os_signpost_stats_enable(bool enabled) {
+    __atomic_store_n(&stats_enabled, enabled, __ATOMIC_RELAXED);
+}
+
+static uint64_t stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static size_t stats_bucket(uint64_t value) {
+    if (value < LOGGY_OS_SIGNPOST_STATS_SUB_COUNT) {
+        return (size_t)value;
+    }
+
+    unsigned exp = 63 - (unsigned)__builtin_clzll(value);
+    if (exp > LOGGY_OS_SIGNPOST_STATS_MAX_EXP) {
+        return LOGGY_OS_SIGNPOST_STATS_BUCKETS - 1;
+    }
+
+    size_t sub = (size_t)(value >> (exp - LOGGY_OS_SIGNPOST_STATS_SUB_BITS)) & (LOGGY_OS_SIGNPOST_STATS_SUB_COUNT - 1);
+    return (exp - LOGGY_OS_SIGNPOST_STATS_SUB_BITS + 1) * LOGGY_OS_SIGNPOST_STATS_SUB_COUNT + sub;
+}
+
+// The largest value that lands in `bucket`.
+static uint64_t stats_bucket_value(size_t bucket) {
+    if (bucket < LOGGY_OS_SIGNPOST_STATS_SUB_COUNT) {
+        return bucket;
+    }
+
+    unsigned exp = (unsigned)(bucket / LOGGY_OS_SIGNPOST_STATS_SUB_COUNT) + LOGGY_OS_SIGNPOST_STATS_SUB_BITS - 1;
+    uint64_t sub = bucket % LOGGY_OS_SIGNPOST_STATS_SUB_COUNT;
+    uint64_t step = 1ull << (exp - LOGGY_OS_SIGNPOST_STATS_SUB_BITS);
+    return (1ull << exp) + (sub + 1) * step - 1;
+}
+
+// MARK: - Shards
+
+static void stats_shard_retire(void *value) {
+    stats_shard_t shard = value;
+    __atomic_store_n(&shard->ss_retired, true, __ATOMIC_RELEASE);
+}
+
+static void stats_shard_init(void) {
+    pthread_key_create(&stats_shard_key, stats_shard_retire);
+}
+
+static stats_shard_t _Nullable stats_shard_get(void) {
+    pthread_once(&stats_shard_once, stats_shard_init);
+    stats_shard_t shard = pthread_getspecific(stats_shard_key);
+    if (shard) {
+        return shard;
+    }
+
+    for (shard = __atomic_load_n(&stats_shards, __ATOMIC_ACQUIRE); shard; shard = shard->ss_next) {
+        bool retired = true;
+        if (__atomic_compare_exchange_n(&shard->ss_retired, &retired, false, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (!shard) {
+        if (!(shard = calloc(1, sizeof(stats_shard_s)))) {
+            return NULL;
+        }
+
+        shard->ss_next = __atomic_load_n(&stats_shards, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&stats_shards, &shard->ss_next, shard, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {}
+    }
+
+    pthread_setspecific(stats_shard_key, shard);
+    return shard;
+}
+
+static void stats_shard_add(stats_shard_t shard, const char *name, uint64_t value) {
+    stats_histogram_t histogram = NULL;
+    uint32_t count = shard->ss_count;
+    for (uint32_t i = 0; i < count; i++) {
+        if (shard->ss_histograms[i].sh_name == name) {
+            histogram = &shard->ss_histograms[i];
+            break;
+        }
+    }
+
+    if (!histogram) {
+        if (count == LOGGY_OS_SIGNPOST_STATS_NAMES) {
+            return;
+        }
+        histogram = &shard->ss_histograms[count];
+        histogram->sh_name = name;
+        __atomic_store_n(&shard->ss_count, count + 1, __ATOMIC_RELEASE);
+    }
+
+    uint64_t *counter = &histogram->sh_counts[stats_bucket(value)];
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+}
+
+// MARK: - Matching
+
+static uint64_t stats_key(const void *log, const char *name, uint64_t spid) {
+    uint64_t key = ((uint64_t)(uintptr_t)log * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)(uintptr_t)name * 0xc2b2ae3d27d4eb4full) ^ (spid * 0x165667b19e3779f9ull);
+    // Never collides with the slot states.
+    return key | (1ull << 63);
+}
+
+static bool stats_claim(stats_pending_t pending, uint64_t state, const void *log, const char *name, uint64_t spid, uint64_t key, uint64_t now) {
+    if (!__atomic_compare_exchange_n(&pending->ps_key, &state, LOGGY_OS_SIGNPOST_STATS_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+
+    pending->ps_log = log;
+    pending->ps_name = name;
+    pending->ps_spid = spid;
+    __atomic_store_n(&pending->ps_time, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&pending->ps_key, key, __ATOMIC_RELEASE);
+    return true;
+}
+
+// Begins whose end never comes would otherwise fill the table for good, so
+// when none of the slots it probes is free, a begin takes over the oldest
+// one. That's where abandoned intervals end up, and a young one is only
+// lost if every slot nearby is busy.
+static void stats_begin(const void *log, const char *name, uint64_t spid, uint64_t key, uint64_t now) {
+    size_t slot = (size_t)(key >> 20);
+    stats_pending_t oldest = NULL;
+    uint64_t oldest_state = 0, oldest_time = UINT64_MAX;
+
+    for (size_t i = 0; i < LOGGY_OS_SIGNPOST_STATS_PROBE; i++) {
+        stats_pending_t pending = &stats_pending[(slot + i) & (LOGGY_OS_SIGNPOST_STATS_PENDING - 1)];
+        uint64_t state = __atomic_load_n(&pending->ps_key, __ATOMIC_ACQUIRE);
+        if (state == LOGGY_OS_SIGNPOST_STATS_BUSY) {
+            continue;
+        }
+
+        if (state == LOGGY_OS_SIGNPOST_STATS_EMPTY || state == LOGGY_OS_SIGNPOST_STATS_DONE) {
+            if (stats_claim(pending, state, log, name, spid, key, now)) {
+                return;
+            }
+            continue;
+        }
+
+        uint64_t time = __atomic_load_n(&pending->ps_time, __ATOMIC_RELAXED);
+        if (time < oldest_time) {
+            oldest = pending;
+            oldest_state = state;
+            oldest_time = time;
+        }
+    }
+
+    if (oldest && stats_claim(oldest, oldest_state, log, name, spid, key, now)) {
+        __atomic_fetch_add(&stats_evictions, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static bool stats_end(const void *log, const char *name, uint64_t spid, uint64_t key, uint64_t *begin) {
+    size_t slot = (size_t)(key >> 20);
+    for (size_t i = 0; i < LOGGY_OS_SIGNPOST_STATS_PROBE; i++) {
+        stats_pending_t pending = &stats_pending[(slot + i) & (LOGGY_OS_SIGNPOST_STATS_PENDING - 1)];
+        uint64_t state = __atomic_load_n(&pending->ps_key, __ATOMIC_ACQUIRE);
+        if (state == LOGGY_OS_SIGNPOST_STATS_EMPTY) {
+            return false;
+        }
+
+        if (state != key || pending->ps_log != log || pending->ps_name != name || pending->ps_spid != spid) {
+            continue;
+        }
+
+        // Claim it, in case another thread is ending the same interval.
+        if (__atomic_compare_exchange_n(&pending->ps_key, &state, LOGGY_OS_SIGNPOST_STATS_BUSY, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            *begin = pending->ps_time;
+            __atomic_store_n(&pending->ps_key, LOGGY_OS_SIGNPOST_STATS_DONE, __ATOMIC_RELEASE);
+            return true;
+        }
+    }
+    return false;
+}
+
+void loggy_os_signpost_stats_record(os_log_t h, const char *name, uint64_t spid, loggy_os_signpost_phase_t phase) {
+    if (!__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED) || phase == LOGGY_OS_SIGNPOST_PHASE_EVENT) {
+        return;
+    }
+
+    const void *log = (const void *)h;
+    uint64_t now = stats_now();
+    uint64_t key = stats_key(log, name, spid);
+
+    if (phase == LOGGY_OS_SIGNPOST_PHASE_BEGIN) {
+        stats_begin(log, name, spid, key, now);
+        return;
+    }
+
+    uint64_t begin;
+    stats_shard_t shard;
+    if (stats_end(log, name, spid, key, &begin) && (shard = stats_shard_get())) {
+        stats_shard_add(shard, name, now > begin ? now - begin : 0);
+    }
+}
+
+uint64_t loggy_os_signpost_stats_evictions(void) {
+    return __atomic_load_n(&stats_evictions, __ATOMIC_RELAXED);
+}
+
+// MARK: - Snapshots
+
+static uint64_t stats_percentile(const uint64_t *counts, uint64_t total, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (double)total);
+    if (rank >= total) {
+        rank = total - 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LOGGY_OS_SIGNPOST_STATS_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank) {
+            return stats_bucket_value(i);
+        }
+    }
+    return 0;
+}
+
+size_t loggy_os_signpost_stats_snapshot(loggy_os_signpost_summary_s *out, size_t capacity) {
+    stats_histogram_t merged = NULL;
+    size_t names = 0, allocated = 0;
+
+    for (stats_shard_t shard = __atomic_load_n(&stats_shards, __ATOMIC_ACQUIRE); shard; shard = shard->ss_next) {
+        uint32_t count = __atomic_load_n(&shard->ss_count, __ATOMIC_ACQUIRE);
+        for (uint32_t i = 0; i < count; i++) {
+            const stats_histogram_s *histogram = &shard->ss_histograms[i];
+
+            size_t j = 0;
+            while (j < names && merged[j].sh_name != histogram->sh_name) {
+                j++;
+            }
+
+            if (j == names) {
+                if (names == allocated) {
+                    size_t grown = allocated ? allocated * 2 : 8;
+                    stats_histogram_t larger = realloc(merged, grown * sizeof(stats_histogram_s));
+                    if (!larger) {
+                        continue;
+                    }
+                    merged = larger;
+                    allocated = grown;
+                }
+                memset(&merged[j], 0, sizeof(stats_histogram_s));
+                merged[j].sh_name = histogram->sh_name;
+                names += 1;
+            }
+
+            for (size_t b = 0; b < LOGGY_OS_SIGNPOST_STATS_BUCKETS; b++) {
+                merged[j].sh_counts[b] += __atomic_load_n(&histogram->sh_counts[b], __ATOMIC_RELAXED);
+            }
+        }
+    }
+
+    for (size_t j = 0; j < names && j < capacity; j++) {
+        const uint64_t *counts = merged[j].sh_counts;
+        loggy_os_signpost_summary_s summary = { .ss_name = merged[j].sh_name };
+        for (size_t b = 0; b < LOGGY_OS_SIGNPOST_STATS_BUCKETS; b++) {
+            if (counts[b] && !summary.ss_count) {
+                summary.ss_min = b ? stats_bucket_value(b - 1) + 1 : 0;
+            }
+            if (counts[b]) {
+                summary.ss_max = stats_bucket_value(b);
+            }
+            summary.ss_count += counts[b];
+        }
+
+        if (summary.ss_count) {
+            summary.ss_p50 = stats_percentile(counts, summary.ss_count, 0.50);
+            summary.ss_p99 = stats_percentile(counts, summary.ss_count, 0.99);
+            summary.ss_p999 = stats_percentile(counts, summary.ss_count, 0.999);
+        }
+        out[j] = summary;
+    }
+
+    free(merged);
+    return names;
+}
@@ -0,0 +1,62 @@
+//
+//  os_signpost_stats.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+#ifndef __loggy_os_signpost_stats_h__
+#define __loggy_os_signpost_stats_h__
+
+#include "os_log_shims.h"
+
+OS_ASSUME_NONNULL_BEGIN
+
+/// Matches `os_signpost_type_t`, which isn't available everywhere.
+OS_ENUM(loggy_os_signpost_phase, uint8_t,
+    LOGGY_OS_SIGNPOST_PHASE_EVENT = 0x00,
+    LOGGY_OS_SIGNPOST_PHASE_BEGIN = 0x01,
+    LOGGY_OS_SIGNPOST_PHASE_END   = 0x02,
+);
+
+/// Starts or stops aggregating signpost intervals in process. Off by default.
+OS_EXPORT
+void loggy_os_signpost_stats_enable(bool enabled);
+
+/// Notes a signpost. A `BEGIN` is matched with the next `END` for the same
+/// `h`, `name`, and `spid`, from any thread, and the time between them is
+/// recorded for `name`. `name` must be a string that lives as long as the
+/// process, like a `StaticString`; intervals are grouped by its address.
+///
+/// Recording goes into a histogram owned by the calling thread, so threads
+/// never contend on it.
+OS_EXPORT
+void loggy_os_signpost_stats_record(os_log_t h, const char *name, uint64_t spid, loggy_os_signpost_phase_t phase);
+
+/// The number of begins dropped before their end came, to make room for
+/// newer ones. A begin whose end never comes is eventually dropped this way,
+/// since the oldest pending begin is the first to go.
+OS_EXPORT
+uint64_t loggy_os_signpost_stats_evictions(void);
+
+/// Latency percentiles for one signpost name, in nanoseconds. Percentiles
+/// are accurate to within about 6%.
+typedef struct {
+    const char     *ss_name;
+    uint64_t        ss_count;
+    uint64_t        ss_min;
+    uint64_t        ss_p50;
+    uint64_t        ss_p99;
+    uint64_t        ss_p999;
+    uint64_t        ss_max;
+} loggy_os_signpost_summary_s;
+
+/// Merges every thread's histograms and writes a summary per name to `out`,
+/// up to `capacity` of them. Returns the number of names, which may be more
+/// than `capacity`.
+OS_EXPORT
+size_t loggy_os_signpost_stats_snapshot(loggy_os_signpost_summary_s *_Nullable out, size_t capacity);
+
+OS_ASSUME_NONNULL_END
+
+#endif /* __loggy_os_signpost_stats_h__ */
@@ -7,3 +7,6 @@
 
 #include <Loggy/os_activity_shims.h>
 #include <Loggy/os_log_shims.h>
+#include <Loggy/os_log_render.h>
+#include <Loggy/os_log_image.h>
+#include <Loggy/os_signpost_stats.h>
@@ -0,0 +1,378 @@
+//
+//  bench-compress.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures segment compression on a synthetic corpus. Each message is a
+ * `LogStatement` built from the variants in `LogStatement.Variant`, with
+ * its arguments encoded and its format built the way
+ * OSLog+LogStatement.swift does it, and with values that change from
+ * message to message the way real ones do. They're written through a
+ * segment writer, whose blocks are then decompressed and compressed again
+ * on their own to time the codec. Reports the compression ratio, the codec
+ * in MB/s of uncompressed data, and how fast the segment is written and
+ * read back. Build it from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-compress.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-compress
+ *
+ * The default is 1M messages, written to a temporary file that's removed
+ * afterward.
+ */
+
+#include "os_log_compress.h"
+#include "os_log_segment.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// The cases of `LogStatement.Variant`, less `.interpolation`, which is
+// what a statement is a list of.
+OS_ENUM(bench_variant, uint8_t,
+    BENCH_LITERAL,
+    BENCH_BOOL,
+    BENCH_INT8,
+    BENCH_UINT8,
+    BENCH_INT16,
+    BENCH_UINT16,
+    BENCH_INT32,
+    BENCH_UINT32,
+    BENCH_INT64,
+    BENCH_UINT64,
+    BENCH_INT,
+    BENCH_UINT,
+    BENCH_FLOAT,
+    BENCH_DOUBLE,
+    BENCH_STRING,
+    BENCH_DATA,
+    BENCH_BYTES,
+    BENCH_OBJECT,
+);
+
+typedef struct {
+    bench_variant_t bs_variant;
+    const char     *bs_literal;
+} bench_segment_s;
+
+#define BENCH_SEGMENTS 10
+
+typedef struct {
+    const char     *bt_category;
+    os_log_type_t   bt_type;
+    bench_segment_s bt_segments[BENCH_SEGMENTS];
+} bench_statement_s;
+
+#define L(text) { BENCH_LITERAL, text }
+#define V(variant) { variant, NULL }
+
+// The example app's statements, then the sort an app's networking,
+// storage, and UI code logs.
+static const bench_statement_s statements[] = {
+    { "ViewController.UI", OS_LOG_TYPE_DEBUG, { L("This will only show in Xcode! Hello, "), V(BENCH_STRING), L("!") } },
+    { "ViewController.UI", OS_LOG_TYPE_DEFAULT, { L("Next, a scalar: "), V(BENCH_DOUBLE) } },
+    { "ViewController.UI", OS_LOG_TYPE_DEFAULT, { L("Now, more complex: ("), V(BENCH_DOUBLE), L(", "), V(BENCH_DOUBLE), L(", "), V(BENCH_DOUBLE), L(", "), V(BENCH_DOUBLE), L(")") } },
+    { "ViewController.Processing", OS_LOG_TYPE_DEFAULT, { L("Doing some work...") } },
+    { "ViewController.Processing", OS_LOG_TYPE_ERROR, { L("Things are going bad down here, cap'n!") } },
+    { "Network", OS_LOG_TYPE_DEFAULT, { L("Request "), V(BENCH_STRING), L(" finished with "), V(BENCH_INT), L(" in "), V(BENCH_DOUBLE), L(" ms") } },
+    { "Network", OS_LOG_TYPE_INFO, { L("Received "), V(BENCH_UINT64), L(" bytes for task "), V(BENCH_UINT32), L(", cached: "), V(BENCH_BOOL) } },
+    { "Network", OS_LOG_TYPE_DEBUG, { L("Response body: "), V(BENCH_DATA) } },
+    { "Storage", OS_LOG_TYPE_INFO, { L("Loaded "), V(BENCH_INT), L(" rows from "), V(BENCH_STRING), L(" in "), V(BENCH_FLOAT), L(" s") } },
+    { "Storage", OS_LOG_TYPE_DEBUG, { L("Page "), V(BENCH_UINT16), L(" of "), V(BENCH_UINT16), L(" checksum "), V(BENCH_BYTES) } },
+    { "Storage", OS_LOG_TYPE_FAULT, { L("Migration "), V(BENCH_INT16), L(" failed with status "), V(BENCH_INT32) } },
+    { "UI", OS_LOG_TYPE_DEFAULT, { L("User "), V(BENCH_STRING), L(" tapped "), V(BENCH_STRING) } },
+    { "UI", OS_LOG_TYPE_DEBUG, { L("Presented "), V(BENCH_OBJECT), L(" at depth "), V(BENCH_INT8), L(", flags "), V(BENCH_UINT8) } },
+    { "UI", OS_LOG_TYPE_INFO, { L("Frame took "), V(BENCH_INT64), L(" ns, "), V(BENCH_UINT), L(" views") } },
+};
+
+#define BENCH_STATEMENTS (sizeof(statements) / sizeof(statements[0]))
+
+// Built once each, as a call site's format is.
+static char *formats[BENCH_STATEMENTS];
+
+static const char *const paths[] = { "/api/v1/users", "/api/v1/orders", "/api/v1/orders/search", "/static/app.js", "/health" };
+static const char *const users[] = { "alice", "bob", "carol", "dave" };
+static const char *const controls[] = { "Save", "Cancel", "Compose", "Settings", "Back" };
+static const char *const tables[] = { "messages", "contacts", "attachments" };
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Builds a statement's format the way `LogStatement.Variant.appendFormat`
+// does.
+static char *bench_format(const bench_statement_s *statement) {
+    char format[512] = "";
+    for (size_t i = 0; i < BENCH_SEGMENTS; i++) {
+        const bench_segment_s *segment = &statement->bt_segments[i];
+        if (segment->bs_variant == BENCH_LITERAL && !segment->bs_literal) {
+            continue;
+        }
+        static const char *const specifiers[] = {
+            [BENCH_BOOL] = "%{bool}d", [BENCH_INT8] = "%hhd", [BENCH_UINT8] = "%hhu",
+            [BENCH_INT16] = "%hd", [BENCH_UINT16] = "%hu", [BENCH_INT32] = "%d", [BENCH_UINT32] = "%u",
+            [BENCH_INT64] = "%lld", [BENCH_UINT64] = "%llu", [BENCH_INT] = "%zd", [BENCH_UINT] = "%zu",
+            [BENCH_FLOAT] = "%.*g", [BENCH_DOUBLE] = "%.*g", [BENCH_STRING] = "%s",
+            [BENCH_DATA] = "%.*P", [BENCH_BYTES] = "%.*P", [BENCH_OBJECT] = "%@",
+        };
+        strcat(format, segment->bs_variant == BENCH_LITERAL ? segment->bs_literal : specifiers[segment->bs_variant]);
+    }
+    return strdup(format);
+}
+
+static void bench_add_string(loggy_os_log_encoder_t encoder, const char *string) {
+    size_t length = strlen(string);
+    uint8_t *buffer = loggy_os_log_encoder_add_string(encoder, length);
+    if (buffer) {
+        memcpy(buffer, string, length);
+    }
+}
+
+// Encodes a statement's arguments the way `LogStatementEncoder.append`
+// does, with values derived from the message's index `n`.
+static void bench_encode(const bench_statement_s *statement, uint64_t n, loggy_os_log_encoder_t encoder) {
+    size_t strings = 0;
+    for (size_t i = 0; i < BENCH_SEGMENTS; i++) {
+        const bench_segment_s *segment = &statement->bt_segments[i];
+        uint8_t digest[16];
+        switch (segment->bs_variant) {
+        case BENCH_LITERAL:
+            break;
+        case BENCH_BOOL:
+            loggy_os_log_encoder_add_int32(encoder, n % 3 == 0);
+            break;
+        case BENCH_INT8:
+            loggy_os_log_encoder_add_int32(encoder, (int8_t)(n % 6));
+            break;
+        case BENCH_UINT8:
+            loggy_os_log_encoder_add_int32(encoder, (uint8_t)(1 << (n % 4)));
+            break;
+        case BENCH_INT16:
+            loggy_os_log_encoder_add_int32(encoder, (int16_t)(40 + n % 3));
+            break;
+        case BENCH_UINT16:
+            loggy_os_log_encoder_add_int32(encoder, (uint16_t)(n % 200));
+            break;
+        case BENCH_INT32:
+            loggy_os_log_encoder_add_int32(encoder, -(int32_t)(n % 7));
+            break;
+        case BENCH_UINT32:
+            loggy_os_log_encoder_add_int32(encoder, (int32_t)(uint32_t)(n / 3));
+            break;
+        case BENCH_INT64:
+            loggy_os_log_encoder_add_int64(encoder, (int64_t)(8000000 + n * 7919 % 9000000));
+            break;
+        case BENCH_UINT64:
+            loggy_os_log_encoder_add_int64(encoder, (int64_t)(n * 2654435761u % 1048576));
+            break;
+        case BENCH_INT:
+            loggy_os_log_encoder_add_int(encoder, n % 5 ? 200 : 404);
+            break;
+        case BENCH_UINT:
+            loggy_os_log_encoder_add_int(encoder, 20 + n % 40);
+            break;
+        case BENCH_FLOAT:
+            loggy_os_log_encoder_add_double(encoder, (float)(n % 1000) / 997.0f, FLT_DIG);
+            break;
+        case BENCH_DOUBLE:
+            loggy_os_log_encoder_add_double(encoder, (double)(n % 100000) / 7.0, DBL_DIG);
+            break;
+        case BENCH_STRING:
+            switch (strings++) {
+            case 0:
+                bench_add_string(encoder, statement == &statements[0] ? "Xcode" : statement->bt_category[0] == 'S' ? tables[n % 3] : statement->bt_category[0] == 'U' ? users[n % 4] : paths[n * 7 % 5]);
+                break;
+            default:
+                bench_add_string(encoder, controls[n % 5]);
+                break;
+            }
+            break;
+        case BENCH_DATA:
+        case BENCH_BYTES:
+            for (size_t j = 0; j < sizeof(digest); j++) {
+                digest[j] = (uint8_t)((n + j) * 2654435761u >> 13);
+            }
+            loggy_os_log_encoder_add_data(encoder, digest, segment->bs_variant == BENCH_DATA ? sizeof(digest) : 8);
+            break;
+        case BENCH_OBJECT:
+            loggy_os_log_encoder_add_object(encoder, (const void *)(uintptr_t)(0x600000c00000 + (n % 64) * 0x40));
+            break;
+        }
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench-compress [-n messages]\n");
+    exit(2);
+}
+
+static size_t handled;
+
+static void count(void *context, const loggy_os_log_record_s *record) {
+    (void)context;
+    (void)record;
+    handled += 1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t messages = 1000000;
+    int ch;
+    while ((ch = getopt(argc, argv, "n:")) != -1) {
+        switch (ch) {
+        case 'n':
+            messages = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!messages) {
+        usage();
+    }
+
+    char path[] = "/tmp/bench-compress.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+
+    os_log_t logs[BENCH_STATEMENTS];
+    for (size_t i = 0; i < BENCH_STATEMENTS; i++) {
+        formats[i] = bench_format(&statements[i]);
+        logs[i] = loggy_os_log_intern("com.example.bench", statements[i].bt_category);
+    }
+
+    // Write the corpus. Statements come in bursts, as a screen's worth of
+    // work logs several in a row.
+    loggy_os_log_segment_writer_t writer = loggy_os_log_segment_writer_create(path);
+    if (!writer) {
+        unlink(path);
+        return 1;
+    }
+
+    uint64_t start = now();
+    for (size_t n = 0; n < messages; n++) {
+        size_t which = (n / 4 * 2654435761u >> 7) % BENCH_STATEMENTS;
+        if (n % 4 == 3) {
+            which = (which + 5) % BENCH_STATEMENTS;
+        }
+        const bench_statement_s *statement = &statements[which];
+
+        loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+        bench_encode(statement, n, &encoder);
+        loggy_os_log_encoder_flush(&encoder);
+
+        loggy_os_log_record_s record = {
+            .lr_time = loggy_os_log_timestamp(),
+            .lr_log = logs[which],
+            .lr_format = formats[which],
+            .lr_pc = (const uint8_t *)(void *)bench_encode + which * 64,
+            .lr_dso = (void *)bench_encode,
+            .lr_buf = encoder.ob_b,
+            .lr_len = encoder.ob_len,
+            .lr_type = statement->bt_type,
+        };
+        loggy_os_log_segment_append(writer, &record);
+    }
+    bool closed = loggy_os_log_segment_writer_close(writer);
+    uint64_t write_time = now() - start;
+
+    loggy_os_log_segment_reader_s reader;
+    if (!closed || !loggy_os_log_segment_reader_open(&reader, path, NULL)) {
+        unlink(path);
+        return 1;
+    }
+
+    // Take the blocks back out of the file, then time the codec on them.
+    uint32_t blocks = reader.sr_trailer->st_index_count;
+    uint64_t raw = 0, stored = 0;
+    for (uint32_t i = 0; i < blocks; i++) {
+        raw += reader.sr_index[i].si_length;
+        stored += reader.sr_index[i].si_stored;
+    }
+
+    uint8_t *plain = malloc(raw);
+    uint8_t *packed = malloc(LOGGY_OS_LOG_COMPRESS_BOUND(LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES * 2));
+    uint64_t *offsets = calloc(blocks + 1, sizeof(uint64_t));
+    if (!plain || !packed || !offsets) {
+        return 1;
+    }
+
+    // Fault the output in first, so only decompressing is timed.
+    memset(plain, 0, raw);
+
+    bool ok = true;
+    start = now();
+    for (uint32_t i = 0; i < blocks; i++) {
+        const loggy_os_log_segment_index_s *block = &reader.sr_index[i];
+        const uint8_t *data = reader.sr_map + block->si_offset;
+        offsets[i + 1] = offsets[i] + block->si_length;
+        if (!(block->si_flags & LOGGY_OS_LOG_SEGMENT_BLOCK_COMPRESSED)) {
+            memcpy(plain + offsets[i], data, block->si_length);
+        } else if (!loggy_os_log_decompress(data, block->si_stored, plain + offsets[i], block->si_length)) {
+            ok = false;
+        }
+    }
+    uint64_t decompress_time = now() - start;
+
+    uint64_t recompressed = 0;
+    start = now();
+    for (uint32_t i = 0; i < blocks; i++) {
+        size_t length = offsets[i + 1] - offsets[i];
+        size_t len = loggy_os_log_compress(plain + offsets[i], length, packed, LOGGY_OS_LOG_COMPRESS_BOUND(LOGGY_OS_LOG_SEGMENT_BLOCK_BYTES * 2));
+        recompressed += len;
+        ok = ok && len;
+    }
+    uint64_t compress_time = now() - start;
+
+    double read_times[2];
+    for (size_t i = 0; i < 2; i++) {
+        loggy_os_activity_pool_t pool = i ? loggy_os_activity_pool_create(4) : NULL;
+        loggy_os_log_segment_reader_s pass;
+        if (!loggy_os_log_segment_reader_open(&pass, path, pool)) {
+            return 1;
+        }
+        handled = 0;
+        start = now();
+        loggy_os_log_segment_read(&pass, NULL, count, NULL);
+        read_times[i] = (double)(now() - start);
+        ok = ok && handled == messages;
+        loggy_os_log_segment_reader_close(&pass);
+        if (pool) {
+            loggy_os_activity_pool_destroy(pool);
+        }
+    }
+
+    struct stat st;
+    stat(path, &st);
+    printf("%zu messages of %zu statements, %.1f MB of records in %u blocks\n", messages, BENCH_STATEMENTS, raw / 1e6, blocks);
+    printf("blocks %.1f MB compressed, ratio %.2f; file %.1f MB, ratio %.2f\n",
+           stored / 1e6, (double)raw / (double)stored, st.st_size / 1e6, (double)raw / (double)st.st_size);
+    printf("compress %6.0f MB/s, decompress %6.0f MB/s\n",
+           raw / (compress_time / 1e3), raw / (decompress_time / 1e3));
+    printf("write %6.0f MB/s, read %6.0f MB/s inline, %6.0f MB/s on a pool of 4\n",
+           raw / (write_time / 1e3), raw / (read_times[0] / 1e3), raw / (read_times[1] / 1e3));
+    if (recompressed != stored) {
+        printf("blocks compressed to %llu bytes on their own, %llu in the file\n", (unsigned long long)recompressed, (unsigned long long)stored);
+    }
+
+    loggy_os_log_segment_reader_close(&reader);
+    unlink(path);
+    free(plain);
+    free(packed);
+    free(offsets);
+    for (size_t i = 0; i < BENCH_STATEMENTS; i++) {
+        free(formats[i]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+//
+//  bench-enabled.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures the cost of checking a disabled type, the whole of the disabled
+ * path. "uncached" recomputes the handle's mask on every check, the way
+ * asking os_log each time used to cost; "cached" is the generation-tagged
+ * mask that `loggy_os_log_type_enabled` answers from. Counts are in
+ * time-stamp counter ticks, which run at the CPU's nominal clock, when the
+ * counter is usable. Build it from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-enabled.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-enabled
+ */
+
+#include "os_log_shims.h"
+#include "os_log_clock.h"
+#include <stdio.h>
+
+#define BENCH_CHECKS 10000000
+
+static size_t enabled;
+
+static uint64_t run(os_log_t log, bool cached) {
+    uint64_t start = loggy_os_log_timestamp();
+    for (long i = 0; i < BENCH_CHECKS; i++) {
+        bool result = cached ? loggy_os_log_type_enabled(log, OS_LOG_TYPE_DEBUG) : _loggy_os_log_enabled_refresh(log, OS_LOG_TYPE_DEBUG);
+        // Keep the check from being hoisted out of the loop.
+        __asm__ __volatile__("" : : "r"(result) : "memory");
+        enabled += result;
+    }
+    return loggy_os_log_timestamp() - start;
+}
+
+int main(void) {
+    bool ticks = loggy_os_log_clock_use_ticks();
+    loggy_os_log_clock_calibration_s calibration;
+    loggy_os_log_clock_calibration(&calibration);
+
+    // A handful of rules for other subsystems, as an app with a few
+    // frameworks might have, and one for this one that leaves debug off.
+    static const char *const others[] = { "com.example.network", "com.example.storage", "com.example.ui", "com.example.sync" };
+    for (size_t i = 0; i < sizeof(others) / sizeof(others[0]); i++) {
+        loggy_os_log_configure(others[i], NULL, 0xff);
+    }
+    loggy_os_log_configure("com.example.bench", NULL, (uint8_t)~LOGGY_OS_LOG_TYPE_BIT(OS_LOG_TYPE_DEBUG));
+
+    os_log_t log = loggy_os_log_intern("com.example.bench", "enabled");
+    static const bool modes[] = { false, true };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        uint64_t elapsed = run(log, modes[i]);
+        double nanoseconds = ticks ? (double)elapsed * 1e9 / (double)calibration.cc_frequency : (double)elapsed;
+        if (ticks) {
+            printf("%-8s %6.1f ticks/check, %5.1f ns/check\n", modes[i] ? "cached" : "uncached",
+                   (double)elapsed / BENCH_CHECKS, nanoseconds / BENCH_CHECKS);
+        } else {
+            printf("%-8s %5.1f ns/check\n", modes[i] ? "cached" : "uncached", nanoseconds / BENCH_CHECKS);
+        }
+    }
+    return enabled ? 1 : 0;
+}
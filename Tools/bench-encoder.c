@@ -0,0 +1,63 @@
+//
+//  bench-encoder.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures the per-argument cost of encoding 8- and 32-argument messages,
+ * without sending them. "one call each" encodes every argument with its own
+ * call into the encoder, the way each append used to; "batched" queues them
+ * with the inline append functions and encodes them in one pass. Build it
+ * from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-encoder.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-encoder
+ */
+
+#include "os_log_shims.h"
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_MESSAGES 2000000
+
+static uint8_t sink[4096];
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static double run(int arguments, bool batched) {
+    static const loggy_os_log_arg_type_t type = LOGGY_OS_LOG_ARG_SCALAR64;
+    uint64_t start = now();
+    for (long i = 0; i < BENCH_MESSAGES; i++) {
+        loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+        if (batched) {
+            for (int j = 0; j < arguments; j++) {
+                loggy_os_log_encoder_add_int64(&encoder, i + j);
+            }
+            loggy_os_log_encoder_flush(&encoder);
+        } else {
+            for (int j = 0; j < arguments; j++) {
+                uint64_t value = (uint64_t)(i + j);
+                loggy_os_log_encoder_add_batch(&encoder, &type, &value, 1);
+            }
+        }
+        // Keep the encoding from being optimized away.
+        sink[i & (sizeof(sink) - 1)] = encoder.ob_b[(size_t)i % encoder.ob_len];
+    }
+    return (double)(now() - start) / BENCH_MESSAGES / arguments;
+}
+
+int main(void) {
+    static const int arguments[] = { 8, 32 };
+    for (size_t i = 0; i < sizeof(arguments) / sizeof(arguments[0]); i++) {
+        printf("%2d arguments: one call each %5.2f ns/argument, batched %5.2f ns/argument\n",
+               arguments[i], run(arguments[i], false), run(arguments[i], true));
+    }
+    return 0;
+}
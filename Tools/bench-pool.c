@@ -0,0 +1,116 @@
+//
+//  bench-pool.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures what carrying activities through the work-stealing pool costs,
+ * at 1, 2, 4, and 8 workers. Each round submits root tasks from outside
+ * the pool, and each root fans out into leaves from its worker, which the
+ * other workers steal. "no activity" submits the roots with none current,
+ * so tasks capture and restore nothing; "activity" submits each under an
+ * activity of its own, which every leaf must find current. Leaves do a few
+ * dozen nanoseconds of arithmetic, so the pool's overhead shows. Times are
+ * wall clock per task, including the roots. Exits nonzero if a leaf ran
+ * under the wrong activity. Build it from the repository root on Linux
+ * with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-pool.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-pool
+ */
+
+#include "os_activity_pool.h"
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_ROUNDS    40
+#define BENCH_ROOTS     64
+#define BENCH_LEAVES    1024
+#define BENCH_WORK      64
+#define BENCH_TASKS     ((size_t)BENCH_ROUNDS * BENCH_ROOTS * (BENCH_LEAVES + 1))
+
+typedef struct {
+    loggy_os_activity_pool_t br_pool;
+    os_activity_id_t br_activity;
+} bench_root_s, *bench_root_t;
+
+static bench_root_s roots[BENCH_ROOTS];
+static size_t wrong_activity;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_leaf(void *context) {
+    bench_root_t root = context;
+    if (os_activity_get_identifier(OS_ACTIVITY_CURRENT, NULL) != root->br_activity) {
+        __atomic_fetch_add(&wrong_activity, 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t x = (uint64_t)(uintptr_t)context;
+    for (int i = 0; i < BENCH_WORK; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+    }
+    __asm__ volatile("" : : "r"(x));
+}
+
+static void bench_root(void *context) {
+    bench_root_t root = context;
+    for (size_t i = 0; i < BENCH_LEAVES; i++) {
+        loggy_os_activity_pool_async(root->br_pool, root, bench_leaf);
+    }
+}
+
+static double run(loggy_os_activity_pool_t pool, bool activities) {
+    uint64_t start = now();
+    for (size_t round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < BENCH_ROOTS; i++) {
+            bench_root_t root = &roots[i];
+            root->br_pool = pool;
+            if (!activities) {
+                root->br_activity = 0;
+                loggy_os_activity_pool_async(pool, root, bench_root);
+                continue;
+            }
+
+            struct os_activity_scope_state_s state;
+            os_activity_t activity = _os_activity_create(NULL, "root", OS_ACTIVITY_CURRENT, OS_ACTIVITY_FLAG_DEFAULT);
+            os_activity_scope_enter(activity, &state);
+            root->br_activity = activity->ac_id;
+            loggy_os_activity_pool_async(pool, root, bench_root);
+            os_activity_scope_leave(&state);
+            loggy_os_activity_release(activity);
+        }
+        loggy_os_activity_pool_wait(pool);
+    }
+    return (double)(now() - start) / BENCH_TASKS;
+}
+
+int main(void) {
+    static const size_t widths[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+        loggy_os_activity_pool_t pool = loggy_os_activity_pool_create(widths[i]);
+        if (!pool) {
+            return 1;
+        }
+
+        // Once untimed, so the workers' deques and stacks are warm.
+        (void)run(pool, true);
+        double without = run(pool, false);
+        double with = run(pool, true);
+        printf("%zu workers: no activity %6.1f ns/task, activity %6.1f ns/task\n", widths[i], without, with);
+        loggy_os_activity_pool_destroy(pool);
+    }
+
+    if (wrong_activity) {
+        printf("%zu tasks ran under the wrong activity\n", wrong_activity);
+    }
+    return wrong_activity ? 1 : 0;
+}
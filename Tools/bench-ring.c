@@ -0,0 +1,73 @@
+//
+//  bench-ring.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures the cost of sending a message through the portable sink into a
+ * binary ring, for messages of 0, 4, and 16 arguments. The ring is drained
+ * every 1024 messages, so the time includes the reader's share. Build it
+ * from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-ring.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-ring
+ */
+
+#include "os_log_shims.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BENCH_MESSAGES 2000000
+
+static uint64_t storage[(1 << 24) / sizeof(uint64_t)];
+static loggy_os_log_ring_s ring;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void discard(void *context, const loggy_os_log_entry_s *entry) {
+    (void)context;
+    (void)entry;
+}
+
+static double run(int arguments) {
+    uint64_t start = now();
+    for (long i = 0; i < BENCH_MESSAGES; i++) {
+        loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+        for (int j = 0; j < arguments; j++) {
+            loggy_os_log_encoder_add_int64(&encoder, i + j);
+        }
+        loggy_os_log_send(&encoder, "message", OS_LOG_DEFAULT, OS_LOG_TYPE_DEFAULT, (void *)run, NULL);
+        if ((i & 1023) == 0) {
+            loggy_os_log_ring_drain(&ring, discard, NULL);
+        }
+    }
+    uint64_t elapsed = now() - start;
+    loggy_os_log_ring_drain(&ring, discard, NULL);
+    return (double)elapsed / BENCH_MESSAGES;
+}
+
+int main(void) {
+    if (!loggy_os_log_ring_init(&ring, storage, sizeof(storage))) {
+        return 1;
+    }
+    loggy_os_log_set_sink(&ring.lrb_sink);
+
+    static const int arguments[] = { 0, 4, 16 };
+    for (size_t i = 0; i < sizeof(arguments) / sizeof(arguments[0]); i++) {
+        printf("%2d arguments: %6.1f ns/message\n", arguments[i], run(arguments[i]));
+    }
+
+    uint64_t dropped = loggy_os_log_ring_dropped(&ring);
+    if (dropped) {
+        printf("dropped %llu messages\n", (unsigned long long)dropped);
+    }
+    return 0;
+}
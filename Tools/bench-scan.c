@@ -0,0 +1,212 @@
+//
+//  bench-scan.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures how fast `loggy_os_log_segment_scan` pulls a large segment, in
+ * GB/s of the file on disk. It writes a synthetic segment of request logs
+ * from a few handles, with paths and numbers that vary the way real ones
+ * do, until the file reaches the size asked for. Then it flushes the file
+ * and drops it from the page cache, and scans it once cold, from the
+ * disk, and once warm. `loggy_os_log_segment_read`, decoding in order on
+ * one thread, is timed warm for comparison. Build it from the repository
+ * root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-scan.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-scan
+ *
+ * The default is a 10 GB file, scanned with a worker per core, written to
+ * a temporary file that's removed afterward. With -o, the file is kept,
+ * and if it's already a segment it's scanned as is.
+ */
+
+#include "os_log_segment.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_STAT_INTERVAL 100000
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t file_size(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+// Writes records until the file holds `size` bytes. The compression thread
+// writes blocks out behind the appends, so the size is only checked now
+// and then; the file comes out a little over.
+static bool generate(const char *path, uint64_t size) {
+    loggy_os_log_segment_writer_t writer = loggy_os_log_segment_writer_create(path);
+    if (!writer) {
+        return false;
+    }
+
+    os_log_t logs[] = {
+        loggy_os_log_intern("com.example.app", "network"),
+        loggy_os_log_intern("com.example.app", "ui"),
+        loggy_os_log_intern("com.example.db", "query"),
+    };
+    static const char *const formats[] = {
+        "Request %s finished with %d in %.*g ms, id %lld",
+        "Presented %s after %d frames, %.*g ms late, generation %lld",
+        "Query %s returned %d rows in %.*g ms, plan %lld",
+    };
+
+    uint64_t x = 88172645463325252ull, records = 0;
+    uint64_t start = now();
+    for (; records % BENCH_STAT_INTERVAL || file_size(path) < size; records++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+
+        size_t which = records % 3;
+        char name[24];
+        int length = snprintf(name, sizeof(name), "/u/%llx", (unsigned long long)(x & 0xffffffffff));
+
+        loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+        uint8_t *buffer = loggy_os_log_encoder_add_string(&encoder, (size_t)length);
+        if (buffer) {
+            memcpy(buffer, name, (size_t)length);
+        }
+        loggy_os_log_encoder_add_int32(&encoder, (int32_t)(x >> 40) % 1000);
+        loggy_os_log_encoder_add_double(&encoder, (double)(x >> 20 & 0xfffff) / 1e3, 6);
+        loggy_os_log_encoder_add_int64(&encoder, (int64_t)records);
+        loggy_os_log_encoder_flush(&encoder);
+
+        loggy_os_log_record_s record = {
+            .lr_time = loggy_os_log_timestamp(),
+            .lr_activity = x >> 50,
+            .lr_log = logs[which],
+            .lr_format = formats[which],
+            .lr_pc = (const uint8_t *)(void *)generate + which * 16,
+            .lr_dso = (void *)generate,
+            .lr_buf = encoder.ob_b,
+            .lr_len = encoder.ob_len,
+            .lr_type = records % 100 ? OS_LOG_TYPE_INFO : OS_LOG_TYPE_ERROR,
+        };
+        if (!loggy_os_log_segment_append(writer, &record)) {
+            loggy_os_log_segment_writer_close(writer);
+            return false;
+        }
+    }
+
+    if (!loggy_os_log_segment_writer_close(writer)) {
+        return false;
+    }
+    double elapsed = (double)(now() - start) / 1e9;
+    printf("wrote %llu records, %.2f GB, in %.1fs\n", (unsigned long long)records, file_size(path) / 1e9, elapsed);
+    return true;
+}
+
+// Writes the file's dirty pages out and drops it from the page cache, so
+// the next scan reads from the disk.
+static bool evict(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = fdatasync(fd) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+// Records are already decoded by the time they get here, which is what's
+// being measured.
+static void discard(void *context, const loggy_os_log_record_s *record) {
+    (void)context;
+    (void)record;
+}
+
+static bool measure(const char *path, const char *name, loggy_os_activity_pool_t pool, bool ordered) {
+    loggy_os_log_segment_reader_s reader;
+    uint64_t start = now();
+    if (!loggy_os_log_segment_reader_open(&reader, path, NULL)) {
+        return false;
+    }
+    size_t records = ordered ? loggy_os_log_segment_read(&reader, NULL, discard, NULL) : loggy_os_log_segment_scan(&reader, NULL, pool, discard, NULL);
+    double elapsed = (double)(now() - start) / 1e9;
+
+    printf("%-14s %llu records in %6.2fs, %5.2f GB/s\n", name, (unsigned long long)records, elapsed, reader.sr_map_size / 1e9 / elapsed);
+    bool ok = records == reader.sr_trailer->st_records;
+    loggy_os_log_segment_reader_close(&reader);
+    return ok;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: bench-scan [-s gigabytes] [-t threads] [-o path]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    double gigabytes = 10;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *keep = NULL;
+    int ch;
+    while ((ch = getopt(argc, argv, "s:t:o:")) != -1) {
+        switch (ch) {
+        case 's':
+            gigabytes = strtod(optarg, NULL);
+            break;
+        case 't':
+            threads = strtol(optarg, NULL, 10);
+            break;
+        case 'o':
+            keep = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    if (gigabytes <= 0 || threads < 1) {
+        usage();
+    }
+
+    char temporary[] = "/tmp/bench-scan.XXXXXX";
+    const char *path = keep;
+    if (!path) {
+        int fd = mkstemp(temporary);
+        if (fd < 0) {
+            return 1;
+        }
+        close(fd);
+        path = temporary;
+    }
+
+    loggy_os_log_segment_reader_s existing;
+    if (keep && loggy_os_log_segment_reader_open(&existing, path, NULL)) {
+        printf("scanning %s as is, %.2f GB\n", path, existing.sr_map_size / 1e9);
+        loggy_os_log_segment_reader_close(&existing);
+    } else if (!generate(path, (uint64_t)(gigabytes * 1e9))) {
+        fprintf(stderr, "bench-scan: couldn't write %s\n", path);
+        unlink(path);
+        return 1;
+    }
+
+    printf("scanning with %ld worker%s\n", threads, threads == 1 ? "" : "s");
+    loggy_os_activity_pool_t pool = loggy_os_activity_pool_create((size_t)threads);
+    bool ok = evict(path) && measure(path, "scan, cold", pool, false);
+    ok = ok && measure(path, "scan, warm", pool, false);
+    ok = ok && measure(path, "read in order", NULL, true);
+    if (pool) {
+        loggy_os_activity_pool_destroy(pool);
+    }
+
+    if (!keep) {
+        unlink(path);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,96 @@
+//
+//  bench-signpost-id.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Measures making signpost IDs at 1, 8, and 32 threads. "shared counter"
+ * takes every ID from one atomic counter, for comparison; "per-thread
+ * blocks" is `loggy_os_signpost_id_make`. Times are wall clock over every
+ * ID made by every thread, so with more threads than cores they include
+ * contention but not parallelism. Build it from the repository root on
+ * Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/bench-signpost-id.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o bench-signpost-id
+ */
+
+#include "os_log_shims.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_IDS 10000000
+
+static uint64_t shared_counter;
+static pthread_barrier_t barrier;
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void *shared_main(void *context) {
+    uint64_t sum = 0;
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < BENCH_IDS; i++) {
+        sum += __atomic_fetch_add(&shared_counter, 1, __ATOMIC_RELAXED);
+    }
+    *(uint64_t *)context = sum;
+    return NULL;
+}
+
+// Also checks that this thread's IDs only ever go up, which with blocks
+// handed out in order means no two threads share one.
+static void *blocks_main(void *context) {
+    uint64_t sum = 0, last = 0;
+    pthread_barrier_wait(&barrier);
+    for (long i = 0; i < BENCH_IDS; i++) {
+        uint64_t id = loggy_os_signpost_id_make();
+        if (id <= last) {
+            *(uint64_t *)context = 0;
+            return NULL;
+        }
+        last = id;
+        sum += id;
+    }
+    *(uint64_t *)context = sum;
+    return NULL;
+}
+
+static double run(size_t threads, void *(*body)(void *), bool *ok) {
+    pthread_t workers[threads];
+    uint64_t sums[threads];
+    pthread_barrier_init(&barrier, NULL, (unsigned)threads + 1);
+    for (size_t i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, body, &sums[i]);
+    }
+
+    pthread_barrier_wait(&barrier);
+    uint64_t start = now();
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+        *ok = *ok && sums[i] != 0;
+    }
+    uint64_t elapsed = now() - start;
+    pthread_barrier_destroy(&barrier);
+    return (double)elapsed / ((double)threads * BENCH_IDS);
+}
+
+int main(void) {
+    static const size_t threads[] = { 1, 8, 32 };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+        double shared = run(threads[i], shared_main, &ok);
+        double blocks = run(threads[i], blocks_main, &ok);
+        printf("%2zu threads: shared counter %5.2f ns/ID, per-thread blocks %5.2f ns/ID\n", threads[i], shared, blocks);
+    }
+    if (!ok) {
+        printf("IDs went backward\n");
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+//
+//  Bridging.h
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+// Stands in for the framework's umbrella header when the benchmarks are
+// compiled into the same module as Loggy's Swift sources.
+
+#include "os_activity_shims.h"
+#include "os_log_shims.h"
+#include "os_log_render.h"
+#include "os_log_image.h"
+#include "os_signpost_stats.h"
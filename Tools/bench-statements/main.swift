@@ -0,0 +1,206 @@
+//
+//  main.swift
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+// Benchmarks for the Swift side of Loggy. They're compiled into the same
+// module as the framework's sources, so they can compare the current code
+// paths against the ones they replaced. Build and run them from the
+// repository root on macOS with:
+//
+//     clang -c -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+//         Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c
+//     xcrun swiftc -O -module-name Loggy \
+//         -import-objc-header Tools/bench-statements/Bridging.h \
+//         -Xcc -ILoggy/Logging -Xcc -I"Loggy/Activity Tracing" \
+//         Loggy/Logging/*.swift "Loggy/Activity Tracing"/*.swift \
+//         Tools/bench-statements/main.swift os_*.o -o bench-statements
+//     ./bench-statements
+
+import Foundation
+import CoreGraphics
+
+/// Runs `body` `iterations` times, returning the average nanoseconds per run.
+func measure(_ iterations: Int, _ body: () -> Void) -> Double {
+    let start = DispatchTime.now().uptimeNanoseconds
+    for _ in 0 ..< iterations {
+        body()
+    }
+    let end = DispatchTime.now().uptimeNanoseconds
+    return Double(end - start) / Double(iterations)
+}
+
+func report(_ name: String, _ nanoseconds: Double) {
+    let label = name.padding(toLength: 40, withPad: " ", startingAt: 0)
+    print("\(label) \(String(format: "%8.1f", nanoseconds)) ns")
+}
+
+// MARK: - String arguments
+
+// A `.string` used to be bridged to an autoreleased `NSString`, and only its
+// pointer was encoded. Now its UTF-8 is copied into the message.
+
+func benchmarkStrings() {
+    let iterations = 1_000_000
+    for length in [8, 64, 200] {
+        let value = String(repeating: "a", count: length)
+
+        let boxed = measure(iterations / 1000) {
+            autoreleasepool {
+                for _ in 0 ..< 1000 {
+                    var encoder = LogStatementEncoder()
+                    let object = Unmanaged.passRetained(value as NSString).autorelease()
+                    encoder.append(object.toOpaque())
+                    encoder.flush()
+                    encoder.reset()
+                }
+            }
+        } / 1000
+
+        let inline = measure(iterations) {
+            var encoder = LogStatementEncoder()
+            encoder.append(value)
+            encoder.reset()
+        }
+
+        report("string of \(length) bytes, NSString", boxed)
+        report("string of \(length) bytes, inline", inline)
+    }
+}
+
+// MARK: - Descriptions
+
+// `LogStatement.description` used to build a printf format, box every
+// argument as `CVarArg`, and go through `String(format:)`. This is that
+// path, kept here to compare against.
+
+private extension UnsafeRawBufferPointer {
+
+    var hexDescription: String {
+        let digits = Array("0123456789abcdef".utf8)
+        var hex = [UInt8]()
+        hex.reserveCapacity(count * 2)
+        for byte in self {
+            hex.append(digits[Int(byte >> 4)])
+            hex.append(digits[Int(byte & 0xf)])
+        }
+        return String(decoding: hex, as: UTF8.self)
+    }
+
+}
+
+private extension LogStatement.Variant {
+
+    func write(formatTo format: inout String, argumentsTo arguments: inout [CVarArg]) {
+        switch self {
+        case .literal(let value):
+            format.append(value.replacingOccurrences(of: "%", with: "%%"))
+        case .bool(false):
+            format.append("%@")
+            arguments.append("false")
+        case .bool(true):
+            format.append("%@")
+            arguments.append("true")
+        case .int8(let value):
+            format.append("%hhd")
+            arguments.append(value)
+        case .uint8(let value):
+            format.append("%hhu")
+            arguments.append(value)
+        case .int16(let value):
+            format.append("%hd")
+            arguments.append(value)
+        case .uint16(let value):
+            format.append("%hu")
+            arguments.append(value)
+        case .int32(let value):
+            format.append("%d")
+            arguments.append(value)
+        case .uint32(let value):
+            format.append("%u")
+            arguments.append(value)
+        case .int64(let value):
+            format.append("%lld")
+            arguments.append(value)
+        case .uint64(let value):
+            format.append("%llu")
+            arguments.append(value)
+        case .int(let value):
+            format.append("%zd")
+            arguments.append(value)
+        case .uint(let value):
+            format.append("%zu")
+            arguments.append(value)
+        case .float(let value):
+            format.append("%.*g")
+            arguments.append(FLT_DIG)
+            arguments.append(value)
+        case .double(let value):
+            format.append("%.*g")
+            arguments.append(DBL_DIG)
+            arguments.append(value)
+        case .string(let string):
+            format.append("%@")
+            arguments.append(string)
+        case .data(let data):
+            format.append("%@")
+            arguments.append(data.withUnsafeBytes { (bytes: UnsafePointer<UInt8>) in
+                UnsafeRawBufferPointer(start: bytes, count: data.count).hexDescription
+            })
+        case .bytes(let buffer):
+            format.append("%@")
+            arguments.append(buffer.hexDescription)
+        case .object(let object):
+            format.append("%@")
+            arguments.append(OpaquePointer(object.toOpaque()))
+        case .interpolation:
+            forEachSegment { (other) in
+                other.write(formatTo: &format, argumentsTo: &arguments)
+            }
+        }
+    }
+
+}
+
+private extension LogStatement {
+
+    var formattedDescription: String {
+        var format = ""
+        var arguments = [CVarArg]()
+        variant.write(formatTo: &format, argumentsTo: &arguments)
+        return String(format: format, arguments: arguments)
+    }
+
+}
+
+func benchmarkDescriptions() {
+    // The statements the sample app logs, in `ViewController`.
+    let text = "Xcode"
+    let rect = CGRect(x: 1.5, y: 2, width: 3, height: 4)
+    let statements: [(String, LogStatement)] = [
+        ("string", "This will only show in Xcode! Hello, \(text)!"),
+        ("scalar", "Next, a scalar: \(rect.minX)"),
+        ("CGRect", "Now, more complex: \(rect)"),
+        ("literal", "Things are going bad down here, cap'n!"),
+    ]
+
+    let iterations = 200_000
+    for (name, statement) in statements {
+        precondition(statement.description == statement.formattedDescription, "renderers disagree on \(name)")
+
+        let formatted = measure(iterations) {
+            _ = statement.formattedDescription
+        }
+        let rendered = measure(iterations) {
+            _ = statement.description
+        }
+
+        report("description of \(name), String(format:)", formatted)
+        report("description of \(name), rendered", rendered)
+    }
+}
+
+benchmarkStrings()
+benchmarkDescriptions()
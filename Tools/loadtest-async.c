@@ -0,0 +1,152 @@
+//
+//  loadtest-async.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Load test for asynchronous delivery. Each of several threads sends
+ * messages at a fixed rate through loggy_os_log_send, timing every call,
+ * while the drain thread delivers them to a sink that counts them. Reports
+ * the producer latency percentiles, and fails if the p99 is 100ns or more
+ * or if any message is lost or dropped. Build it from the repository root
+ * on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/loadtest-async.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o loadtest-async
+ *
+ * The defaults are 8 threads sending 1M messages/s each, for 1M messages
+ * per thread. It needs a core per sending thread, plus one for the drain,
+ * to say anything about latency; with fewer, the time a sender spends
+ * preempted lands in its samples.
+ */
+
+#include "os_log_async.h"
+#include "os_log_clock.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LOADTEST_TARGET_P99 100
+
+static size_t threads = 8;
+static uint64_t rate = 1000000;
+static size_t messages = 1000000;
+
+static uint64_t delivered;
+static uint64_t *latencies;
+static pthread_barrier_t barrier;
+
+static void count(const loggy_os_log_sink_s *sink, const loggy_os_log_record_s *record) {
+    (void)sink;
+    (void)record;
+    __atomic_fetch_add(&delivered, 1, __ATOMIC_RELAXED);
+}
+
+static const loggy_os_log_sink_s counter = {
+    .ls_send = count,
+};
+
+static int compare(const void *lhs, const void *rhs) {
+    uint64_t a = *(const uint64_t *)lhs, b = *(const uint64_t *)rhs;
+    return a < b ? -1 : a > b;
+}
+
+// Paced by spinning, so the sender's caches stay as warm as they would be
+// in a thread that's busy logging. Timed with `loggy_os_log_timestamp`, so
+// in ticks if the counter is usable; converted to nanoseconds afterward.
+static void *sender_main(void *context) {
+    uint64_t *samples = latencies + (uintptr_t)context * messages;
+    os_log_t log = loggy_os_log_intern("com.example.loadtest", "sender");
+
+    loggy_os_log_clock_calibration_s calibration;
+    loggy_os_log_clock_calibration(&calibration);
+    uint64_t period = (calibration.cc_frequency ? calibration.cc_frequency : 1000000000) / rate;
+
+    pthread_barrier_wait(&barrier);
+    uint64_t next = loggy_os_log_timestamp();
+    for (size_t i = 0; i < messages; i++) {
+        while (loggy_os_log_timestamp() < next) {}
+        next += period;
+
+        loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+        loggy_os_log_encoder_add_int64(&encoder, (int64_t)i);
+        loggy_os_log_encoder_add_int32(&encoder, (int32_t)(uintptr_t)context);
+
+        uint64_t start = loggy_os_log_timestamp();
+        loggy_os_log_send(&encoder, "message %lld from %d", log, OS_LOG_TYPE_DEFAULT, (void *)sender_main, NULL);
+        samples[i] = loggy_os_log_timestamp() - start;
+    }
+    return NULL;
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: loadtest-async [-t threads] [-r messages/s per thread] [-n messages per thread]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    int ch;
+    while ((ch = getopt(argc, argv, "t:r:n:")) != -1) {
+        switch (ch) {
+        case 't':
+            threads = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            rate = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            messages = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (!threads || !rate || !messages) {
+        usage();
+    }
+
+    bool ticks = loggy_os_log_clock_use_ticks();
+    loggy_os_log_async_config_s config = {
+        .la_ring_size = 1 << 20,
+        .la_interval = 100000,
+    };
+    if (!(latencies = calloc(threads * messages, sizeof(uint64_t))) || !loggy_os_log_async_start(&counter, &config)) {
+        return 1;
+    }
+
+    pthread_barrier_init(&barrier, NULL, (unsigned)threads);
+    pthread_t *senders = calloc(threads, sizeof(pthread_t));
+    uint64_t start = loggy_os_log_clock_nanoseconds(loggy_os_log_timestamp());
+    for (uintptr_t i = 0; i < threads; i++) {
+        pthread_create(&senders[i], NULL, sender_main, (void *)i);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(senders[i], NULL);
+    }
+    uint64_t elapsed = loggy_os_log_clock_nanoseconds(loggy_os_log_timestamp()) - start;
+    loggy_os_log_async_stop();
+
+    size_t total = threads * messages;
+    qsort(latencies, total, sizeof(uint64_t), compare);
+
+    loggy_os_log_clock_calibration_s calibration;
+    loggy_os_log_clock_calibration(&calibration);
+    double scale = calibration.cc_frequency ? 1e9 / (double)calibration.cc_frequency : 1;
+    double p50 = latencies[total / 2] * scale;
+    double p99 = latencies[total / 100 * 99] * scale;
+    double p999 = latencies[total / 1000 * 999] * scale;
+    double max = latencies[total - 1] * scale;
+
+    uint64_t dropped = loggy_os_log_async_dropped(OS_LOG_TYPE_DEFAULT);
+    printf("%zu threads, %zu messages in %.2fs (%.2fM/s), timed in %s\n",
+           threads, total, elapsed / 1e9, total / (elapsed / 1e3), ticks ? "ticks" : "nanoseconds");
+    printf("send latency: p50 %.0fns, p99 %.0fns, p99.9 %.0fns, max %.0fns\n", p50, p99, p999, max);
+    printf("delivered %llu, dropped %llu\n", (unsigned long long)delivered, (unsigned long long)dropped);
+
+    return p99 < LOADTEST_TARGET_P99 && delivered == total && !dropped ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+//
+//  loggy-read.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Prints the messages in Loggy log segments, merged in time order and
+ * optionally filtered by a predicate, with where each was logged from if
+ * asked. Build it from the repository
+ * root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/loggy-read.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o loggy-read
+ */
+
+#include "os_log_query.h"
+#include "os_log_render.h"
+#include "os_log_symbolicate.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const char *type_name(os_log_type_t type) {
+    switch (type) {
+    case OS_LOG_TYPE_INFO: return "Info";
+    case OS_LOG_TYPE_DEBUG: return "Debug";
+    case OS_LOG_TYPE_ERROR: return "Error";
+    case OS_LOG_TYPE_FAULT: return "Fault";
+    default: return "Default";
+    }
+}
+
+static void print_record(void *context, const loggy_os_log_record_s *record) {
+    loggy_os_log_symbolicator_t symbolicator = context;
+
+    char stack[1024];
+    char *message = stack;
+    size_t len = loggy_os_log_render(record->lr_format, record->lr_buf, record->lr_len, stack, sizeof(stack));
+    if (len >= sizeof(stack) && (message = malloc(len + 1))) {
+        loggy_os_log_render(record->lr_format, record->lr_buf, record->lr_len, message, len + 1);
+    } else if (!message) {
+        message = stack;
+    }
+
+    printf("%" PRIu64 ".%09" PRIu64 " %-7s %#" PRIx64 " [%s:%s] %s%s\n",
+           record->lr_time / 1000000000, record->lr_time % 1000000000,
+           type_name(record->lr_type), record->lr_activity,
+           record->lr_log->subsystem, record->lr_log->category, message,
+           record->lr_truncated ? " <truncated>" : "");
+
+    loggy_os_log_symbol_s symbol;
+    uint64_t pc = (uint64_t)(uintptr_t)record->lr_pc;
+    if (!symbolicator || !record->lr_image) {
+        // Nothing to show where it came from.
+    } else if (loggy_os_log_symbolicate(symbolicator, record->lr_image, &pc, 1, &symbol)) {
+        printf("    at %s (%s:%" PRIu32 ")\n", symbol.ls_function ? symbol.ls_function : "?", symbol.ls_file, symbol.ls_line);
+    } else {
+        const loggy_os_log_image_info_s *image = record->lr_image;
+        printf("    at %s (%s+%#" PRIx64 ")\n", symbol.ls_function ? symbol.ls_function : "?", image->ii_path[0] ? image->ii_path : "?", pc);
+    }
+
+    if (message != stack) {
+        free(message);
+    }
+}
+
+static void usage(void) {
+    fprintf(stderr, "usage: loggy-read [-s] [-p predicate] segment...\n"
+                    "  -p  only show messages matching the predicate,\n"
+                    "      e.g. 'type == error && subsystem == \"com.example.app\" && int[0] > 500'\n"
+                    "  -s  show the function, file, and line each message came from\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    loggy_os_log_predicate_t predicate = NULL;
+    loggy_os_log_symbolicator_t symbolicator = NULL;
+    char error[256];
+    int ch;
+    while ((ch = getopt(argc, argv, "p:s")) != -1) {
+        switch (ch) {
+        case 'p':
+            if (predicate) {
+                usage();
+            }
+            if (!(predicate = loggy_os_log_predicate_create(optarg, error, sizeof(error)))) {
+                fprintf(stderr, "loggy-read: bad predicate: %s\n", error);
+                return 2;
+            }
+            break;
+        case 's':
+            if (!symbolicator && !(symbolicator = loggy_os_log_symbolicator_create())) {
+                return 1;
+            }
+            break;
+        default:
+            usage();
+        }
+    }
+
+    if (optind == argc) {
+        usage();
+    }
+
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        loggy_os_log_segment_reader_s reader;
+        if (!loggy_os_log_segment_reader_open(&reader, argv[i], NULL)) {
+            fprintf(stderr, "loggy-read: %s: not a readable segment\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        loggy_os_log_segment_reader_close(&reader);
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    loggy_os_activity_pool_t pool = cpus > 1 ? loggy_os_activity_pool_create((size_t)cpus) : NULL;
+
+    loggy_os_log_query((const char *const *)argv + optind, (size_t)(argc - optind), predicate, pool, print_record, symbolicator);
+
+    if (pool) {
+        loggy_os_activity_pool_destroy(pool);
+    }
+    if (predicate) {
+        loggy_os_log_predicate_destroy(predicate);
+    }
+    if (symbolicator) {
+        loggy_os_log_symbolicator_destroy(symbolicator);
+    }
+    return status;
+}
@@ -0,0 +1,130 @@
+//
+//  stress-clock.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Checks the sequence lock around the clock's latest calibration. It's
+ * compiled together with os_log_clock.c so it can publish calibrations
+ * whose fields are all derived from one counter; one thread publishes them
+ * as fast as it can while the others read them, and any read that mixes
+ * two calibrations shows up as fields that disagree. Then it switches to
+ * ticks, if the counter is usable, and has every thread calibrate with no
+ * interval between recalibrations, checking that times convert to within a
+ * few microseconds of clock reads taken around them. Exits nonzero on any
+ * mismatch. Build it from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         -DLOGGY_OS_LOG_CLOCK_CALIBRATION_INTERVAL=0 \
+ *         Tools/stress-clock.c -lpthread -o stress-clock
+ *
+ * It's also worth running with -fsanitize=thread.
+ */
+
+#include "os_log_clock.c"
+#include <stdio.h>
+
+#define STRESS_READERS  4
+#define STRESS_PUBLISH  2000000
+#define STRESS_CALIBRATE 200000
+// How far a converted time may be outside the clock reads around it.
+#define STRESS_SLACK    20000
+
+#if LOGGY_OS_LOG_CLOCK_HAS_TSC
+
+static bool publishing;
+static size_t torn;
+static size_t reads;
+static size_t drifted;
+static pthread_barrier_t barrier;
+
+static void *publisher_main(void *context) {
+    (void)context;
+    pthread_barrier_wait(&barrier);
+    for (uint64_t n = 1; n <= STRESS_PUBLISH; n++) {
+        loggy_os_log_clock_calibration_s calibration = {
+            .cc_ticks = n,
+            .cc_monotonic = n * 3,
+            .cc_realtime = n * 5,
+            .cc_frequency = n * 7,
+        };
+        clock_publish(&calibration);
+    }
+    __atomic_store_n(&publishing, false, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void *reader_main(void *context) {
+    (void)context;
+    size_t local_reads = 0, local_torn = 0;
+    pthread_barrier_wait(&barrier);
+    while (__atomic_load_n(&publishing, __ATOMIC_ACQUIRE)) {
+        loggy_os_log_clock_calibration_s calibration;
+        clock_latest_read(&calibration);
+        uint64_t n = calibration.cc_ticks;
+        if (calibration.cc_monotonic != n * 3 || calibration.cc_realtime != n * 5 || calibration.cc_frequency != n * 7) {
+            local_torn += 1;
+        }
+        local_reads += 1;
+    }
+    __atomic_fetch_add(&reads, local_reads, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&torn, local_torn, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void *calibrator_main(void *context) {
+    (void)context;
+    size_t local_drifted = 0;
+    pthread_barrier_wait(&barrier);
+    for (size_t i = 0; i < STRESS_CALIBRATE; i++) {
+        loggy_os_log_clock_calibration_s calibration;
+        loggy_os_log_clock_calibration(&calibration);
+        uint64_t before = clock_read(CLOCK_MONOTONIC);
+        uint64_t converted = loggy_os_log_clock_convert(&calibration, loggy_os_log_timestamp());
+        uint64_t after = clock_read(CLOCK_MONOTONIC);
+        if (converted + STRESS_SLACK < before || converted > after + STRESS_SLACK) {
+            local_drifted += 1;
+        }
+    }
+    __atomic_fetch_add(&drifted, local_drifted, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void run(void *(*first)(void *), void *(*rest)(void *)) {
+    pthread_t threads[STRESS_READERS + 1];
+    pthread_barrier_init(&barrier, NULL, STRESS_READERS + 1);
+    pthread_create(&threads[0], NULL, first, NULL);
+    for (size_t i = 1; i <= STRESS_READERS; i++) {
+        pthread_create(&threads[i], NULL, rest, NULL);
+    }
+    for (size_t i = 0; i <= STRESS_READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+}
+
+int main(void) {
+    publishing = true;
+    run(publisher_main, reader_main);
+    printf("%d calibrations published, %zu read, %zu torn\n", STRESS_PUBLISH, reads, torn);
+
+    if (!loggy_os_log_clock_use_ticks()) {
+        printf("tick counter unusable, skipping calibration\n");
+        return torn ? 1 : 0;
+    }
+    run(calibrator_main, calibrator_main);
+    printf("%d calibrations on each of %d threads, %zu conversions off by more than %dns\n",
+           STRESS_CALIBRATE, STRESS_READERS + 1, drifted, STRESS_SLACK);
+    return torn || drifted ? 1 : 0;
+}
+
+#else
+
+int main(void) {
+    printf("no tick counter on this architecture\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,192 @@
+//
+//  stress-compress.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Round-trips inputs through `loggy_os_log_compress` and
+ * `loggy_os_log_decompress`: random bytes, long runs, text repeating at
+ * near and far distances, and mixes of them, at every length up to a few
+ * hundred bytes and at random lengths up to four blocks, with each input
+ * placed at the end of its allocation so that reading past it faults under
+ * a sanitizer. Every input must come back exactly, compressed into no more
+ * than the bound. Decompressing it truncated or at the wrong size must
+ * fail, and decompressing it with bytes flipped must stay inside its
+ * buffers. Exits nonzero on any mismatch. Build it from the repository
+ * root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/stress-compress.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o stress-compress
+ *
+ * It's also worth running with -fsanitize=address.
+ */
+
+#include "os_log_compress.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_SHORT    512
+#define STRESS_RANDOM   2000
+#define STRESS_MAX      (256 * 1024)
+
+OS_ENUM(stress_kind, uint8_t,
+    STRESS_KIND_RANDOM,
+    STRESS_KIND_RUNS,
+    STRESS_KIND_NEAR,
+    STRESS_KIND_FAR,
+    STRESS_KIND_MIXED,
+    STRESS_KIND_COUNT,
+);
+
+static const char *const kind_names[] = { "random", "runs", "near repeats", "far repeats", "mixed" };
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15;
+
+// xorshift64*, so runs are repeatable.
+static uint64_t rng(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static void fill(uint8_t *buf, size_t len, stress_kind_t kind) {
+    static const char words[] = "Request /api/v1/users finished with 200 in 12.345 ms; cache hit ratio 0.93 ";
+    for (size_t i = 0; i < len;) {
+        stress_kind_t part = kind == STRESS_KIND_MIXED ? (stress_kind_t)(rng() % STRESS_KIND_MIXED) : kind;
+        size_t span = kind == STRESS_KIND_MIXED ? 1 + rng() % 300 : len;
+        if (span > len - i) {
+            span = len - i;
+        }
+
+        switch (part) {
+        case STRESS_KIND_RANDOM:
+            for (size_t j = 0; j < span; j++) {
+                buf[i + j] = (uint8_t)rng();
+            }
+            break;
+        case STRESS_KIND_RUNS:
+            for (size_t j = 0; j < span;) {
+                uint8_t byte = (uint8_t)(rng() % 4);
+                for (size_t run = 1 + rng() % 600; run && j < span; run--) {
+                    buf[i + j++] = byte;
+                }
+            }
+            break;
+        case STRESS_KIND_NEAR:
+            for (size_t j = 0; j < span; j++) {
+                buf[i + j] = (uint8_t)words[(i + j) % (sizeof(words) - 1)];
+                if (rng() % 64 == 0) {
+                    buf[i + j] = (uint8_t)rng();
+                }
+            }
+            break;
+        case STRESS_KIND_FAR:
+            // Copies from just inside and just beyond the farthest offset
+            // a match can refer to.
+            for (size_t j = 0; j < span; j++) {
+                size_t at = i + j;
+                buf[at] = at >= 65535 && rng() % 8 ? buf[at - 65535 + rng() % 2] : (uint8_t)rng();
+            }
+            break;
+        default:
+            break;
+        }
+        i += span;
+    }
+}
+
+// Compresses and decompresses `len` bytes, then decompresses damaged copies
+// of the result. `src` and the outputs each end at the end of their
+// allocations.
+static bool round_trip(const uint8_t *src, size_t len, size_t *stored) {
+    size_t bound = LOGGY_OS_LOG_COMPRESS_BOUND(len);
+    uint8_t *compressed = malloc(bound);
+    uint8_t *output = malloc(len + 1);
+    if (!compressed || !output) {
+        abort();
+    }
+
+    bool ok = true;
+    size_t clen = loggy_os_log_compress(src, len, compressed, bound);
+    if (!clen || clen > bound) {
+        ok = false;
+    } else {
+        memmove(compressed + bound - clen, compressed, clen);
+        const uint8_t *tail = compressed + bound - clen;
+        uint8_t *out = output + 1;
+        if (!loggy_os_log_decompress(tail, clen, out, len) || memcmp(out, src, len) != 0) {
+            ok = false;
+        }
+
+        // The wrong size and a truncated input must be refused. Damaged
+        // input may decode to anything, as long as it stays in bounds.
+        if (len && loggy_os_log_decompress(tail, clen, output + 2, len - 1)) {
+            ok = false;
+        }
+        if (clen > 1 && loggy_os_log_decompress(tail, clen - 1, out, len)) {
+            ok = false;
+        }
+        for (size_t i = 0; i < 8; i++) {
+            uint8_t *damaged = compressed + bound - clen;
+            size_t at = rng() % clen;
+            uint8_t saved = damaged[at];
+            damaged[at] ^= (uint8_t)(1 + rng() % 255);
+            (void)loggy_os_log_decompress(damaged, clen, out, len);
+            damaged[at] = saved;
+        }
+    }
+
+    *stored = clen;
+    free(compressed);
+    free(output);
+    return ok;
+}
+
+// Copies `len` bytes of `buf` to the end of a fresh allocation and
+// round-trips them there.
+static bool check(const uint8_t *buf, size_t len, size_t *raw, size_t *stored) {
+    uint8_t *src = malloc(len ? len : 1);
+    if (!src) {
+        abort();
+    }
+    memcpy(src + (len ? 0 : 1), buf, len);
+    size_t clen;
+    bool ok = round_trip(src + (len ? 0 : 1), len, &clen);
+    free(src);
+    *raw += len;
+    *stored += clen;
+    return ok;
+}
+
+int main(void) {
+    uint8_t *buf = malloc(STRESS_MAX);
+    if (!buf) {
+        return 1;
+    }
+
+    size_t failures = 0;
+    for (stress_kind_t kind = 0; kind < STRESS_KIND_COUNT; kind++) {
+        size_t raw = 0, stored = 0, kind_failures = 0;
+        for (size_t len = 0; len <= STRESS_SHORT; len++) {
+            fill(buf, len, kind);
+            kind_failures += !check(buf, len, &raw, &stored);
+        }
+        for (size_t i = 0; i < STRESS_RANDOM; i++) {
+            size_t len = rng() % (STRESS_MAX + 1);
+            fill(buf, len, kind);
+            kind_failures += !check(buf, len, &raw, &stored);
+        }
+
+        printf("%-13s %5d inputs, %6.1f MB to %6.1f MB, %zu failed\n", kind_names[kind],
+               STRESS_SHORT + 1 + STRESS_RANDOM, raw / 1e6, stored / 1e6, kind_failures);
+        failures += kind_failures;
+    }
+
+    free(buf);
+    return failures ? 1 : 0;
+}
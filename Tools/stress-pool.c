@@ -0,0 +1,125 @@
+//
+//  stress-pool.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Checks the activity pool's work-stealing deques under load. Each round
+ * starts a pool and submits trees of tasks from the outside, each under an
+ * activity nested in another; every task submits two children from its
+ * worker until the tree is deep enough, so work is pushed and popped at
+ * the bottom of the deques while idle workers steal from the top. Every
+ * task must run exactly once, with the activity it was submitted under and
+ * that activity's parent current. Exits nonzero on any mismatch. Build it
+ * from the repository root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/stress-pool.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o stress-pool
+ *
+ * It's also worth running with -fsanitize=thread.
+ */
+
+#include "os_activity_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STRESS_ROUNDS   8
+#define STRESS_WIDTH    4
+#define STRESS_ROOTS    32
+#define STRESS_DEPTH    10
+#define STRESS_TASKS    (STRESS_ROOTS * ((1 << (STRESS_DEPTH + 1)) - 1))
+
+typedef struct {
+    loggy_os_activity_pool_t st_pool;
+    uint32_t st_index;
+    uint32_t st_depth;
+    os_activity_id_t st_activity;
+    os_activity_id_t st_parent;
+} stress_task_s, *stress_task_t;
+
+static uint32_t ran[STRESS_TASKS];
+static uint32_t next_index;
+static size_t wrong_activity;
+
+static void stress_submit(loggy_os_activity_pool_t pool, uint32_t depth, os_activity_id_t activity, os_activity_id_t parent);
+
+static void stress_run(void *context) {
+    stress_task_t task = context;
+    os_activity_id_t parent;
+    os_activity_id_t activity = os_activity_get_identifier(OS_ACTIVITY_CURRENT, &parent);
+    if (activity != task->st_activity || parent != task->st_parent) {
+        __atomic_fetch_add(&wrong_activity, 1, __ATOMIC_RELAXED);
+    }
+
+    __atomic_fetch_add(&ran[task->st_index], 1, __ATOMIC_RELAXED);
+    if (task->st_depth) {
+        stress_submit(task->st_pool, task->st_depth - 1, activity, parent);
+        stress_submit(task->st_pool, task->st_depth - 1, activity, parent);
+    }
+    free(task);
+}
+
+static void stress_submit(loggy_os_activity_pool_t pool, uint32_t depth, os_activity_id_t activity, os_activity_id_t parent) {
+    stress_task_t task = malloc(sizeof(stress_task_s));
+    if (!task) {
+        abort();
+    }
+
+    *task = (stress_task_s){
+        .st_pool = pool,
+        .st_index = __atomic_fetch_add(&next_index, 1, __ATOMIC_RELAXED),
+        .st_depth = depth,
+        .st_activity = activity,
+        .st_parent = parent,
+    };
+    loggy_os_activity_pool_async(pool, task, stress_run);
+}
+
+int main(void) {
+    size_t failures = 0;
+    for (size_t round = 0; round < STRESS_ROUNDS; round++) {
+        loggy_os_activity_pool_t pool = loggy_os_activity_pool_create(STRESS_WIDTH);
+        if (!pool) {
+            return 1;
+        }
+
+        next_index = 0;
+        for (size_t i = 0; i < STRESS_TASKS; i++) {
+            ran[i] = 0;
+        }
+
+        for (size_t i = 0; i < STRESS_ROOTS; i++) {
+            struct os_activity_scope_state_s outer_state, inner_state;
+            os_activity_t outer = _os_activity_create(NULL, "outer", OS_ACTIVITY_CURRENT, OS_ACTIVITY_FLAG_DEFAULT);
+            os_activity_scope_enter(outer, &outer_state);
+            os_activity_t inner = _os_activity_create(NULL, "inner", OS_ACTIVITY_CURRENT, OS_ACTIVITY_FLAG_DEFAULT);
+            os_activity_scope_enter(inner, &inner_state);
+
+            stress_submit(pool, STRESS_DEPTH, inner->ac_id, outer->ac_id);
+
+            os_activity_scope_leave(&inner_state);
+            os_activity_scope_leave(&outer_state);
+            loggy_os_activity_release(inner);
+            loggy_os_activity_release(outer);
+        }
+
+        loggy_os_activity_pool_destroy(pool);
+
+        size_t missing = 0, repeated = 0;
+        for (size_t i = 0; i < STRESS_TASKS; i++) {
+            missing += ran[i] == 0;
+            repeated += ran[i] > 1;
+        }
+        if (next_index != STRESS_TASKS || missing || repeated) {
+            printf("round %zu: submitted %u of %d, %zu never ran, %zu ran twice\n", round, next_index, STRESS_TASKS, missing, repeated);
+            failures += 1;
+        }
+    }
+
+    printf("%d rounds of %d tasks on %d workers, %zu failed, %zu ran under the wrong activity\n",
+           STRESS_ROUNDS, STRESS_TASKS, STRESS_WIDTH, failures, wrong_activity);
+    return failures || wrong_activity ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+//
+//  stress-ring.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Checks the binary ring under contention: several writers append messages
+ * into a small ring while one thread drains it, and every message must come
+ * out exactly once, intact, and in order per writer. One in five messages is
+ * oversize, with one to three chunks, so continuations and wrapping are
+ * exercised too. Exits nonzero on any mismatch. Build it from the repository
+ * root on Linux with:
+ *
+ *     cc -std=gnu11 -O2 -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/stress-ring.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o stress-ring
+ *
+ * It's also worth running with -fsanitize=thread.
+ */
+
+#include "os_log_sink.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define STRESS_WRITERS      3
+#define STRESS_MESSAGES     100000
+#define STRESS_MAX_CHUNKS   3
+#define STRESS_MAX_SIZE     (LOGGY_OS_LOG_ENCODER_BUF_SIZE + STRESS_MAX_CHUNKS * sizeof(((loggy_os_log_chunk_s *)0)->oc_b))
+
+static uint64_t storage[16384 / sizeof(uint64_t)];
+static loggy_os_log_ring_s ring;
+static bool done;
+
+static uint32_t next_index[STRESS_WRITERS];
+static size_t received, oversize, failures;
+
+static void fill(uint8_t *buf, size_t len, uint32_t key) {
+    for (size_t i = 0; i < len; i++) {
+        buf[i] = (uint8_t)(key * 31 + i * 7);
+    }
+}
+
+// Each message carries its writer and index in `le_activity`, and its total
+// size in `le_pc`, so the drain can tell what it should have gotten.
+static void check(void *context, const loggy_os_log_entry_s *entry) {
+    (void)context;
+    static uint8_t expected[STRESS_MAX_SIZE];
+
+    uint32_t key = (uint32_t)entry->le_activity;
+    uint32_t writer = key >> 24, index = key & 0xffffff;
+    received += 1;
+    if (writer >= STRESS_WRITERS || index != next_index[writer]) {
+        failures += 1;
+        return;
+    }
+    next_index[writer] = index + 1;
+
+    if (entry->le_len != (uint32_t)(uintptr_t)entry->le_pc) {
+        failures += 1;
+        return;
+    }
+    fill(expected, entry->le_len, key);
+    if (memcmp(expected, entry->le_data, entry->le_len) != 0) {
+        failures += 1;
+    }
+    if (entry->le_len > LOGGY_OS_LOG_ENCODER_BUF_SIZE) {
+        oversize += 1;
+    }
+}
+
+static void *writer_main(void *context) {
+    uint32_t writer = (uint32_t)(uintptr_t)context;
+    static __thread loggy_os_log_chunk_s chunks[STRESS_MAX_CHUNKS];
+    static __thread uint8_t message[STRESS_MAX_SIZE];
+
+    for (uint32_t i = 0; i < STRESS_MESSAGES; i++) {
+        uint32_t key = writer << 24 | i;
+        size_t count = i % 5 == 0 ? 1 + i % STRESS_MAX_CHUNKS : 0;
+        size_t inline_len = 100 + i % (LOGGY_OS_LOG_ENCODER_BUF_SIZE - 100);
+        size_t total = inline_len;
+        for (size_t c = 0; c < count; c++) {
+            chunks[c].oc_len = (uint32_t)(1000 + (i * 13 + c * 7) % 3000);
+            total += chunks[c].oc_len;
+        }
+
+        fill(message, total, key);
+        size_t offset = inline_len;
+        for (size_t c = 0; c < count; c++) {
+            memcpy(chunks[c].oc_b, message + offset, chunks[c].oc_len);
+            offset += chunks[c].oc_len;
+            chunks[c].oc_next = c + 1 < count ? &chunks[c + 1] : NULL;
+        }
+
+        loggy_os_log_record_s record = {
+            .lr_activity = key,
+            .lr_pc = (const void *)(uintptr_t)total,
+            .lr_buf = message,
+            .lr_len = (uint32_t)inline_len,
+            .lr_chunks = count ? chunks : NULL,
+        };
+        while (!loggy_os_log_ring_try_append(&ring, &record)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static void *drain_main(void *context) {
+    (void)context;
+    while (!__atomic_load_n(&done, __ATOMIC_ACQUIRE)) {
+        if (!loggy_os_log_ring_drain(&ring, check, NULL)) {
+            sched_yield();
+        }
+    }
+    loggy_os_log_ring_drain(&ring, check, NULL);
+    return NULL;
+}
+
+int main(void) {
+    if (!loggy_os_log_ring_init(&ring, storage, sizeof(storage))) {
+        return 1;
+    }
+
+    pthread_t drain, writers[STRESS_WRITERS];
+    pthread_create(&drain, NULL, drain_main, NULL);
+    for (uintptr_t i = 0; i < STRESS_WRITERS; i++) {
+        pthread_create(&writers[i], NULL, writer_main, (void *)i);
+    }
+    for (size_t i = 0; i < STRESS_WRITERS; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    __atomic_store_n(&done, true, __ATOMIC_RELEASE);
+    pthread_join(drain, NULL);
+
+    size_t sent = (size_t)STRESS_WRITERS * STRESS_MESSAGES;
+    printf("sent %zu, received %zu (%zu oversize), %zu bad, %llu dropped\n",
+           sent, received, oversize, failures, (unsigned long long)loggy_os_log_ring_dropped(&ring));
+    return received == sent && failures == 0 ? 0 : 1;
+}
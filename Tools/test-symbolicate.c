@@ -0,0 +1,197 @@
+//
+//  test-symbolicate.c
+//  Loggy
+//
+//  Copyright © 2018 Big Nerd Ranch. Licensed under MIT.
+//
+
+/*
+ * Checks `loggy_os_log_symbolicate` against addr2line. Messages are logged
+ * from call sites in several functions of this program into a segment,
+ * which is read back; each record's address is symbolicated from the image
+ * in `lr_image`, and the same address is given to addr2line, which must
+ * agree on the function, file, and line. Exits nonzero on any mismatch.
+ * Build it from the repository root on Linux, with debug info, with:
+ *
+ *     cc -std=gnu11 -O2 -g -ILoggy/Logging -I"Loggy/Activity Tracing" \
+ *         Tools/test-symbolicate.c Loggy/Logging/os_*.c "Loggy/Activity Tracing"/os_*.c \
+ *         -lpthread -ldl -o test-symbolicate
+ *
+ * addr2line, from binutils, has to be on the path.
+ */
+
+#include "os_log_segment.h"
+#include "os_log_symbolicate.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_SITES 64
+// How many distinct call sites there must be. The compiler's tail calls and
+// unrolling change how many there are, but never make it fewer than this.
+#define TEST_MIN_SITES 6
+
+static loggy_os_log_segment_writer_t writer;
+static os_log_t log_handle;
+
+// Stands in for the logging functions, which record their return address.
+__attribute__((noinline))
+static void test_log(int value) {
+    loggy_os_log_encoder_s encoder = { .ob_len = 0 };
+    loggy_os_log_encoder_add_int32(&encoder, value);
+    loggy_os_log_encoder_flush(&encoder);
+
+    loggy_os_log_record_s record = {
+        .lr_time = loggy_os_log_timestamp(),
+        .lr_log = log_handle,
+        .lr_format = "value %d",
+        .lr_pc = __builtin_extract_return_addr(__builtin_return_address(0)),
+        .lr_dso = (const void *)test_log,
+        .lr_buf = encoder.ob_b,
+        .lr_len = encoder.ob_len,
+        .lr_type = OS_LOG_TYPE_DEFAULT,
+    };
+    loggy_os_log_segment_append(writer, &record);
+}
+
+__attribute__((noinline))
+static void test_request(int status) {
+    test_log(status);
+    if (status >= 400) {
+        test_log(-status);
+    }
+}
+
+__attribute__((noinline))
+static void test_loop(int count) {
+    for (int i = 0; i < count; i++) {
+        test_log(i);
+    }
+}
+
+__attribute__((noinline))
+static int test_nested(int depth) {
+    if (depth == 0) {
+        test_log(0);
+        return 0;
+    }
+    int result = test_nested(depth - 1) + 1;
+    test_log(result);
+    return result;
+}
+
+// A call site's return address, as the image was linked.
+typedef struct {
+    uint64_t        ts_address;
+    const loggy_os_log_image_info_s *ts_image;
+} test_site_s;
+
+static test_site_s sites[TEST_SITES];
+static size_t site_count;
+static size_t without_image;
+
+static void collect(void *context, const loggy_os_log_record_s *record) {
+    (void)context;
+    if (!record->lr_image || !record->lr_image->ii_path || !record->lr_image->ii_path[0] || record->lr_dso) {
+        without_image += 1;
+        return;
+    }
+
+    uint64_t address = (uint64_t)(uintptr_t)record->lr_pc;
+    for (size_t i = 0; i < site_count; i++) {
+        if (sites[i].ts_address == address) {
+            return;
+        }
+    }
+    if (site_count < TEST_SITES) {
+        sites[site_count++] = (test_site_s){ .ts_address = address, .ts_image = record->lr_image };
+    }
+}
+
+// Function names come from the symbol table, where a function the compiler
+// cloned has a suffix like `.constprop.0`; addr2line names it as written.
+static bool same_function(const char *symbol, const char *function) {
+    size_t length = strlen(function);
+    return strncmp(symbol, function, length) == 0 && (symbol[length] == 0 || symbol[length] == '.');
+}
+
+static const char *base_name(const char *path) {
+    const char *slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+int main(void) {
+    char path[] = "/tmp/test-symbolicate.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return 1;
+    }
+    close(fd);
+
+    log_handle = loggy_os_log_intern("com.example.test", "symbolicate");
+    if (!(writer = loggy_os_log_segment_writer_create(path))) {
+        return 1;
+    }
+    test_request(200);
+    test_request(404);
+    test_loop(3);
+    test_nested(3);
+    test_log(1);
+    loggy_os_log_segment_writer_close(writer);
+
+    loggy_os_log_segment_reader_s reader;
+    if (!loggy_os_log_segment_reader_open(&reader, path, NULL)) {
+        unlink(path);
+        return 1;
+    }
+    loggy_os_log_segment_read(&reader, NULL, collect, NULL);
+
+    loggy_os_log_symbolicator_t symbolicator = loggy_os_log_symbolicator_create();
+    if (!symbolicator) {
+        return 1;
+    }
+
+    // The symbolicator looks up the call before a return address, so ask
+    // addr2line about the same one.
+    size_t failures = 0;
+    for (size_t i = 0; i < site_count; i++) {
+        loggy_os_log_symbol_s symbol;
+        bool resolved = loggy_os_log_symbolicate(symbolicator, sites[i].ts_image, &sites[i].ts_address, 1, &symbol) == 1;
+
+        char command[4096], function[512] = "", location[4096] = "";
+        snprintf(command, sizeof(command), "addr2line -f -e '%s' %#" PRIx64, sites[i].ts_image->ii_path, sites[i].ts_address - 1);
+        FILE *pipe = popen(command, "r");
+        if (!pipe || !fgets(function, sizeof(function), pipe) || !fgets(location, sizeof(location), pipe)) {
+            fprintf(stderr, "test-symbolicate: couldn't run addr2line\n");
+            return 1;
+        }
+        pclose(pipe);
+        function[strcspn(function, "\n")] = 0;
+
+        // "file:line", perhaps followed by " (discriminator n)".
+        location[strcspn(location, " \n")] = 0;
+        char *colon = strrchr(location, ':');
+        uint32_t line = colon ? (uint32_t)strtoul(colon + 1, NULL, 10) : 0;
+        if (colon) {
+            *colon = 0;
+        }
+
+        bool agree = resolved && symbol.ls_function && same_function(symbol.ls_function, function)
+            && symbol.ls_file && strcmp(base_name(symbol.ls_file), base_name(location)) == 0 && symbol.ls_line == line;
+        printf("%#8" PRIx64 "  %-22s %s:%-4" PRIu32 "%s", sites[i].ts_address,
+               resolved && symbol.ls_function ? symbol.ls_function : "?", resolved && symbol.ls_file ? base_name(symbol.ls_file) : "?",
+               resolved ? symbol.ls_line : 0, agree ? "\n" : "");
+        if (!agree) {
+            printf("  addr2line says %s %s:%" PRIu32 "\n", function, base_name(location), line);
+            failures += 1;
+        }
+    }
+
+    printf("%zu call sites, %zu disagree with addr2line, %zu records without an image\n", site_count, failures, without_image);
+    loggy_os_log_symbolicator_destroy(symbolicator);
+    loggy_os_log_segment_reader_close(&reader);
+    unlink(path);
+    return failures || without_image || site_count < TEST_MIN_SITES ? 1 : 0;
+}